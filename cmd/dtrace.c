@@ -1608,6 +1608,14 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * A program from the program cache can only be enabled, and does not
+	 * share its variables with other programs: only use the cache if we
+	 * are enabling a single program.
+	 */
+	if (g_mode == DMODE_EXEC && g_exec && g_cmdc == 1)
+		g_cflags |= DTRACE_C_CACHE;
+
 	/*
 	 * In our fourth pass we finish g_cmdv[] by calling dc_func to convert
 	 * each string or file specification into a compiled program structure.
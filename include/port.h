@@ -8,6 +8,8 @@
 #ifndef _PORT_H
 #define _PORT_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <mutex.h>
 #include <sys/types.h>
@@ -28,6 +30,11 @@ int mutex_init(mutex_t *m, int flags1, void *ptr);
 
 unsigned long linux_version_code(void);
 
+void *cachefile_map(const char *path, size_t hdrsize, uint32_t magic,
+    uint32_t version, size_t *sizep);
+int cachefile_write(const char *dir, const char *path,
+    int (*func)(FILE *, void *), void *arg);
+
 #ifndef HAVE_ELF_GETSHDRSTRNDX
 #define elf_getshdrstrndx elf_getshstrndx
 #define elf_getshdrnum elf_getshnum
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <dt_impl.h>
+#include <dt_module.h>
 #include <dtrace.h>
 #include <assert.h>
 #include <alloca.h>
@@ -17,21 +18,32 @@
 #include <libproc.h>
 #include <port.h>
 
-#define	DTRACE_AHASHSIZE	32779		/* big 'ol prime */
+#define	DTRACE_AHASHSIZE	4096		/* initial size; power of 2 */
+#define	DTRACE_AHASHLOAD(s)	((s) - ((s) >> 2))	/* 75% load factor */
+
+#define	DT_AHASH_MUL		0x9e3779b97f4a7c15ULL
+#define	DT_AHASH_NDX(h, v)	((v) & ((h)->dtah_size - 1))
+#define	DT_ASTRIPES		64		/* parallel snap locks */
+
+#define	DT_ASLABSIZE		(1024 * 1024)	/* default arena slab size */
+#define	DT_ASLABALIGN(s)	(((s) + sizeof (uint64_t) - 1) & \
+				    ~(sizeof (uint64_t) - 1))
 
 /*
- * Because qsort(3C) does not allow an argument to be passed to a comparison
- * function, the variables that affect comparison must regrettably be global;
- * they are protected by a global static lock, dt_qsort_lock.
+ * The options that affect comparison ("aggsortrev", "aggsortkey" and
+ * "aggsortkeypos") are passed to the comparison functions as the argument
+ * of qsort_r(3), so that any number of handles can sort at the same time.
  */
-static pthread_mutex_t dt_qsort_lock = PTHREAD_MUTEX_INITIALIZER;
+typedef struct dt_aggsort {
+	int dtags_rev;			/* reverse the sense of comparison */
+	int dtags_key;			/* sort on keys rather than values */
+	int dtags_keypos;		/* key to sort on first */
+} dt_aggsort_t;
 
-static int dt_revsort;
-static int dt_keysort;
-static int dt_keypos;
+typedef int dt_aggcmp_f(const void *, const void *, void *);
 
-#define	DT_LESSTHAN	(dt_revsort == 0 ? -1 : 1)
-#define	DT_GREATERTHAN	(dt_revsort == 0 ? 1 : -1)
+#define	DT_LESSTHAN(s)		((s)->dtags_rev == 0 ? -1 : 1)
+#define	DT_GREATERTHAN(s)	((s)->dtags_rev == 0 ? 1 : -1)
 
 static void
 dt_aggregate_count(int64_t *existing, int64_t *new, size_t size)
@@ -43,16 +55,16 @@ dt_aggregate_count(int64_t *existing, int64_t *new, size_t size)
 }
 
 static int
-dt_aggregate_countcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_countcmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	int64_t lvar = *lhs;
 	int64_t rvar = *rhs;
 
 	if (lvar < rvar)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lvar > rvar)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
@@ -74,31 +86,31 @@ dt_aggregate_max(int64_t *existing, int64_t *new, size_t size)
 }
 
 static int
-dt_aggregate_averagecmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_averagecmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	int64_t lavg = lhs[0] ? (lhs[1] / lhs[0]) : 0;
 	int64_t ravg = rhs[0] ? (rhs[1] / rhs[0]) : 0;
 
 	if (lavg < ravg)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lavg > ravg)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
 
 static int
-dt_aggregate_stddevcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_stddevcmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	uint64_t lsd = dt_stddev((uint64_t *)lhs, 1);
 	uint64_t rsd = dt_stddev((uint64_t *)rhs, 1);
 
 	if (lsd < rsd)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lsd > rsd)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
@@ -156,17 +168,17 @@ dt_aggregate_lquantizedzero(int64_t *lquanta)
 }
 
 static int
-dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	long double lsum = dt_aggregate_lquantizedsum(lhs);
 	long double rsum = dt_aggregate_lquantizedsum(rhs);
 	int64_t lzero, rzero;
 
 	if (lsum < rsum)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lsum > rsum)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	/*
 	 * If they're both equal, then we will compare based on the weights at
@@ -178,10 +190,10 @@ dt_aggregate_lquantizedcmp(int64_t *lhs, int64_t *rhs)
 	rzero = dt_aggregate_lquantizedzero(rhs);
 
 	if (lzero < rzero)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lzero > rzero)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
@@ -274,17 +286,17 @@ dt_aggregate_llquantizedzero(int64_t *llquanta)
  * Other behavior is also reasonable.
  */
 static int
-dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	long double lsum = dt_aggregate_llquantizedsum(lhs);
 	long double rsum = dt_aggregate_llquantizedsum(rhs);
 	int64_t lzero, rzero;
 
 	if (lsum < rsum)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lsum > rsum)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	/*
 	 * If they're both equal, then we will compare based on the weights at
@@ -296,16 +308,16 @@ dt_aggregate_llquantizedcmp(int64_t *lhs, int64_t *rhs)
 	rzero = dt_aggregate_llquantizedzero(rhs);
 
 	if (lzero < rzero)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lzero > rzero)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
 
 static int
-dt_aggregate_quantizedcmp(int64_t *lhs, int64_t *rhs)
+dt_aggregate_quantizedcmp(int64_t *lhs, int64_t *rhs, const dt_aggsort_t *sp)
 {
 	int nbuckets = DTRACE_QUANTIZE_NBUCKETS, i;
 	long double ltotal = 0, rtotal = 0;
@@ -324,10 +336,10 @@ dt_aggregate_quantizedcmp(int64_t *lhs, int64_t *rhs)
 	}
 
 	if (ltotal < rtotal)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (ltotal > rtotal)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	/*
 	 * If they're both equal, then we will compare based on the weights at
@@ -335,10 +347,10 @@ dt_aggregate_quantizedcmp(int64_t *lhs, int64_t *rhs)
 	 * tie and will be resolved based on the key comparison.
 	 */
 	if (lzero < rzero)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lzero > rzero)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
@@ -414,34 +426,17 @@ dt_aggregate_mod(dtrace_hdl_t *dtp, uint64_t *addr)
 		return;
 	}
 
-	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
-	    dmp = dt_list_next(dmp)) {
-		/*
-		 * Check text and data ranges for match.  If there is a range
-		 * that covers the given address, normalize it.
-		 */
-		if (dmp->dm_text_addrs != NULL &&
-		    bsearch(addr, dmp->dm_text_addrs, dmp->dm_text_addrs_size,
-			    sizeof (struct dtrace_addr_range),
-			    dtrace_addr_range_cmp) != NULL) {
-
-			*addr = dmp->dm_text_addrs[0].dar_va;
-			return;
-		}
-
-		if (dmp->dm_data_addrs != NULL &&
-		    bsearch(addr, dmp->dm_data_addrs, dmp->dm_data_addrs_size,
-			    sizeof (struct dtrace_addr_range),
-			    dtrace_addr_range_cmp) != NULL) {
-
-			if (dmp->dm_text_addrs != NULL)
-				*addr = dmp->dm_text_addrs[0].dar_va;
-			else
-				*addr = dmp->dm_data_addrs[0].dar_va;
+	/*
+	 * If a module's text or data ranges cover the given address, normalize
+	 * it to the start of the module's text (or data, if it has no text).
+	 */
+	if ((dmp = dt_module_lookup_by_addr(dtp, *addr)) == NULL)
+		return;
 
-			return;
-		}
-	}
+	if (dmp->dm_text_addrs != NULL)
+		*addr = dmp->dm_text_addrs[0].dar_va;
+	else
+		*addr = dmp->dm_data_addrs[0].dar_va;
 }
 
 static dtrace_aggvarid_t
@@ -466,24 +461,320 @@ dt_aggregate_aggvarid(dt_ahashent_t *ent)
 }
 
 
+
+/*
+ * Aggregation entries, their inline key and value data and their per-CPU
+ * value blocks are carved out of large slabs owned by the dt_aggregate_t.
+ * A block removed from the hash (by trunc() or a DTRACE_AGGWALK_REMOVE walk)
+ * is not returned to its slab but kept on a free list for its size, and is
+ * handed out again to the next allocation of that size; aggregations keep
+ * the same few sizes, so an arena that sees repeated removals stops growing.
+ * The whole arena is released at once when the hash is found empty and when
+ * the aggregate is destroyed.
+ */
+static void *
+dt_aggregate_alloc(dtrace_hdl_t *dtp, size_t size)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_aslab_t *slab = agp->dtat_slabs;
+	dt_afree_t *fp;
+	void *p;
+
+	size = DT_ASLABALIGN(size);
+
+	for (fp = agp->dtat_free; fp != NULL; fp = fp->dtaf_next) {
+		if (fp->dtaf_size != size || fp->dtaf_blocks == NULL)
+			continue;
+
+		p = fp->dtaf_blocks;
+		fp->dtaf_blocks = *(void **)p;
+		return (p);
+	}
+
+	if (slab == NULL || slab->dtas_size - slab->dtas_used < size) {
+		size_t ssize = DT_ASLABSIZE;
+
+		if (size > ssize - sizeof (dt_aslab_t))
+			ssize = size + sizeof (dt_aslab_t);
+
+		if ((slab = malloc(ssize)) == NULL) {
+			(void) dt_set_errno(dtp, EDT_NOMEM);
+			return (NULL);
+		}
+
+		slab->dtas_next = agp->dtat_slabs;
+		slab->dtas_size = ssize;
+		slab->dtas_used = sizeof (dt_aslab_t);
+		agp->dtat_slabs = slab;
+	}
+
+	p = (char *)slab + slab->dtas_used;
+	slab->dtas_used += size;
+
+	return (p);
+}
+
+/*
+ * Put a block that is no longer referenced on the free list for its size.
+ * The list heads are themselves allocated from the arena, once per size.
+ */
+static void
+dt_aggregate_free(dtrace_hdl_t *dtp, void *p, size_t size)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_afree_t *fp;
+
+	size = DT_ASLABALIGN(size);
+
+	for (fp = agp->dtat_free; fp != NULL; fp = fp->dtaf_next) {
+		if (fp->dtaf_size == size)
+			break;
+	}
+
+	if (fp == NULL) {
+		/*
+		 * If no head can be allocated the block is simply not reused;
+		 * it is still released with the rest of the arena.
+		 */
+		if ((fp = dt_aggregate_alloc(dtp, sizeof (dt_afree_t))) == NULL)
+			return;
+
+		fp->dtaf_size = size;
+		fp->dtaf_blocks = NULL;
+		fp->dtaf_next = agp->dtat_free;
+		agp->dtat_free = fp;
+	}
+
+	*(void **)p = fp->dtaf_blocks;
+	fp->dtaf_blocks = p;
+}
+
+static void
+dt_aggregate_release(dt_aggregate_t *agp)
+{
+	dt_aslab_t *slab, *next;
+
+	for (slab = agp->dtat_slabs; slab != NULL; slab = next) {
+		next = slab->dtas_next;
+		free(slab);
+	}
+
+	agp->dtat_slabs = NULL;
+	agp->dtat_free = NULL;
+}
+
+/*
+ * Mix the key bytes at addr into hashval a word at a time.  Every bit of the
+ * key affects every bit of the result, so keys that differ only in the order
+ * of their bytes (e.g. stacks, or strings with the same characters) do not
+ * collide the way they would under a simple sum.
+ */
+static uint64_t
+dt_aggregate_hashbytes(uint64_t hashval, const char *addr, size_t size)
+{
+	uint64_t word;
+
+	for (; size >= sizeof (uint64_t); size -= sizeof (uint64_t)) {
+		memcpy(&word, addr, sizeof (uint64_t));
+		addr += sizeof (uint64_t);
+
+		hashval = (hashval ^ word) * DT_AHASH_MUL;
+		hashval ^= hashval >> 29;
+	}
+
+	if (size != 0) {
+		word = 0;
+		memcpy(&word, addr, size);
+
+		hashval = (hashval ^ word ^ ((uint64_t)size << 56)) * DT_AHASH_MUL;
+		hashval ^= hashval >> 29;
+	}
+
+	return (hashval);
+}
+
+static uint64_t
+dt_aggregate_hashfinal(uint64_t hashval)
+{
+	hashval ^= hashval >> 33;
+	hashval *= 0xff51afd7ed558ccdULL;
+	hashval ^= hashval >> 33;
+	hashval *= 0xc4ceb9fe1a85ec53ULL;
+	hashval ^= hashval >> 33;
+
+	return (hashval);
+}
+
+/*
+ * Double the size of the hash table, rethreading every entry onto its new
+ * chain.  The list of all entries is left untouched, so walkers that rely on
+ * its order see no difference.
+ */
 static int
-dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
+dt_aggregate_hashgrow(dtrace_hdl_t *dtp, dt_ahash_t *hash)
+{
+	size_t nsize = hash->dtah_size << 1;
+	dt_ahashent_t **nhash, *h;
+	size_t ndx;
+
+	if ((nhash = calloc(nsize, sizeof (dt_ahashent_t *))) == NULL)
+		return (dt_set_errno(dtp, EDT_NOMEM));
+
+	free(hash->dtah_hash);
+	hash->dtah_hash = nhash;
+	hash->dtah_size = nsize;
+
+	for (h = hash->dtah_all; h != NULL; h = h->dtahe_nextall) {
+		ndx = DT_AHASH_NDX(hash, h->dtahe_hashval);
+
+		h->dtahe_prev = NULL;
+		h->dtahe_next = nhash[ndx];
+
+		if (nhash[ndx] != NULL)
+			nhash[ndx]->dtahe_prev = h;
+
+		nhash[ndx] = h;
+	}
+
+	return (0);
+}
+
+static int
+dt_aggregate_keymatch(dtrace_aggdesc_t *agg, caddr_t addr, caddr_t data)
 {
-	dtrace_epid_t id;
-	uint64_t hashval;
-	size_t offs, roffs, size, ndx;
-	int i, j, rval;
-	caddr_t addr, data;
 	dtrace_recdesc_t *rec;
-	dt_aggregate_t *agp = &dtp->dt_aggregate;
-	dtrace_aggdesc_t *agg;
-	dt_ahash_t *hash = &agp->dtat_hash;
+	int j;
+
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		rec = &agg->dtagd_rec[j];
+
+		if (memcmp(&addr[rec->dtrd_offset], &data[rec->dtrd_offset],
+		    rec->dtrd_size) != 0)
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Each CPU remembers, for every record position in its last snapshot, the
+ * buffer offset of the record and the hash entry it was merged into.  Hot
+ * keys tend to land at the same place in successive snapshots; when they
+ * do, the key is simply compared against the remembered entry, skipping the
+ * hash computation and chain walk.  Any removal from the hash invalidates
+ * the whole cache.
+ */
+static dt_ahashent_t *
+dt_aggregate_cacheget(dt_acache_t *cache, size_t nrec, size_t offs,
+    dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dt_acent_t *ace;
 	dt_ahashent_t *h;
-	dtrace_bufdesc_t b = agp->dtat_buf, *buf = &b;
-	dtrace_aggdata_t *aggdata;
-	int flags = agp->dtat_flags;
 
+	if (cache == NULL || nrec >= cache->dtac_nents)
+		return (NULL);
+
+	ace = &cache->dtac_ents[nrec];
+	h = ace->dtace_ent;
+
+	if (ace->dtace_offs != offs || h->dtahe_data.dtada_desc != agg)
+		return (NULL);
+
+	if (!dt_aggregate_keymatch(agg, addr, h->dtahe_data.dtada_data))
+		return (NULL);
+
+	return (h);
+}
+
+/*
+ * Returns 0 or an error number: this may run on a snapshot thread, which must
+ * not set the handle's errno outside of dtap_lock.
+ */
+static int
+dt_aggregate_cacheset(dt_acache_t *cache, size_t nrec, size_t offs,
+    dt_ahashent_t *h)
+{
+	if (nrec >= cache->dtac_size) {
+		size_t nsize = cache->dtac_size ? cache->dtac_size << 1 : 1024;
+		dt_acent_t *ents;
+
+		ents = realloc(cache->dtac_ents, nsize * sizeof (dt_acent_t));
+
+		if (ents == NULL)
+			return (EDT_NOMEM);
+
+		cache->dtac_ents = ents;
+		cache->dtac_size = nsize;
+	}
+
+	cache->dtac_ents[nrec].dtace_offs = offs;
+	cache->dtac_ents[nrec].dtace_ent = h;
+
+	if (nrec >= cache->dtac_nents)
+		cache->dtac_nents = nrec + 1;
+
+	return (0);
+}
+
+/*
+ * State shared by the threads of a parallel aggregation snapshot.  Each
+ * worker fetches and merges whole CPU buffers.  Lookups and updates of
+ * existing entries are serialized only by the stripe lock covering their
+ * hash chain; the stripe is chosen from the hash value alone, so that it
+ * does not change when the table grows.  Everything that touches handle-wide
+ * state (fetching new aggregation descriptions, key normalization, the
+ * arena, the list of all entries) is done under dtap_lock, which a worker
+ * thus only takes for a key it has not seen, for a key that needs to be
+ * resolved to a symbol, and for the first record of every aggregation.
+ * Growing the table takes dtap_lock and then every stripe, in order.
+ *
+ * The handle's errno is only ever set under dtap_lock: the functions below
+ * return error numbers, and the first one a worker sees is kept in dtap_err.
+ */
+typedef struct dt_apool {
+	dtrace_hdl_t *dtap_hdl;			/* DTrace handle */
+	pthread_mutex_t dtap_lock;		/* protects handle state */
+	pthread_mutex_t dtap_stripes[DT_ASTRIPES]; /* hash chain locks */
+	int dtap_next;				/* next dtat_cpus index */
+	int dtap_err;				/* first error, or 0 */
+	uint64_t *dtap_drops;			/* drops, by dtat_cpus index */
+	uint64_t dtap_skipped;			/* records merged from cache */
+	uint64_t dtap_hashed;			/* records looked up in hash */
+} dt_apool_t;
+
+/*
+ * A thread's view of a snapshot: the pool it belongs to (NULL if the
+ * snapshot is not parallel), and its own copy of the aggregation
+ * descriptions it has used, indexed by aggregation ID.
+ */
+typedef struct dt_aworker {
+	dt_apool_t *dtaw_pool;			/* pool, or NULL */
+	dtrace_aggdesc_t **dtaw_aggs;		/* descriptions, by ID */
+	dtrace_aggid_t dtaw_naggs;		/* size of dtaw_aggs */
+} dt_aworker_t;
+
+#define	DT_APOOL_LOCK(p, l)	do { \
+	if ((p) != NULL) \
+		(void) pthread_mutex_lock(l); \
+} while (0)
+
+#define	DT_APOOL_UNLOCK(p, l)	do { \
+	if ((p) != NULL) \
+		(void) pthread_mutex_unlock(l); \
+} while (0)
+
+#define	DT_APOOL_STRIPE(p, v)	\
+	(&(p)->dtap_stripes[(v) & (DT_ASTRIPES - 1)])
+
+/*
+ * Returns 0 or an error number.
+ */
+static int
+dt_aggregate_fetch(dtrace_hdl_t *dtp, processorid_t cpu,
+    dtrace_bufdesc_t *buf)
+{
 	buf->dtbd_cpu = cpu;
+	buf->dtbd_size = dtp->dt_aggregate.dtat_buf.dtbd_size;
 
 	if (dt_ioctl(dtp, DTRACEIOC_AGGSNAP, buf) == -1) {
 		if (errno == ENOENT) {
@@ -492,31 +783,349 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
 			 * CPU was unconfigured.  This is okay; we'll just
 			 * do nothing but return success.
 			 */
+			buf->dtbd_size = 0;
+			buf->dtbd_drops = 0;
 			return (0);
 		}
 
-		return (dt_set_errno(dtp, errno));
+		return (errno);
 	}
 
-	if (buf->dtbd_drops != 0) {
-		if (dt_handle_cpudrop(dtp, cpu,
-		    DTRACEDROP_AGGREGATION, buf->dtbd_drops) == -1)
-			return (-1);
+	return (0);
+}
+
+static void
+dt_aggregate_apply(dt_ahashent_t *h, processorid_t cpu, caddr_t addr)
+{
+	dtrace_aggdata_t *aggdata = &h->dtahe_data;
+	dtrace_aggdesc_t *agg = aggdata->dtada_desc;
+	dtrace_recdesc_t *rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+	caddr_t data = aggdata->dtada_data;
+	size_t roffs = rec->dtrd_offset;
+
+	/* LINTED - alignment */
+	h->dtahe_aggregate((int64_t *)&data[roffs],
+	    /* LINTED - alignment */
+	    (int64_t *)&addr[roffs], rec->dtrd_size);
+
+	/*
+	 * If we're keeping per CPU data, apply the aggregating action there
+	 * as well.
+	 */
+	if (aggdata->dtada_percpu != NULL) {
+		data = aggdata->dtada_percpu[cpu];
+
+		/* LINTED - alignment */
+		h->dtahe_aggregate((int64_t *)data,
+		    /* LINTED - alignment */
+		    (int64_t *)&addr[roffs], rec->dtrd_size);
 	}
+}
 
-	if (buf->dtbd_size == 0)
+static dt_ahashent_t *
+dt_aggregate_lookup(dt_ahash_t *hash, size_t ndx, uint64_t hashval,
+    dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dt_ahashent_t *h;
+
+	for (h = hash->dtah_hash[ndx]; h != NULL; h = h->dtahe_next) {
+		if (h->dtahe_hashval != hashval)
+			continue;
+
+		if (h->dtahe_size != agg->dtagd_size)
+			continue;
+
+		if (dt_aggregate_keymatch(agg, addr, h->dtahe_data.dtada_data))
+			return (h);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Create a hash entry for the record at addr and link it onto chain ndx and
+ * onto the list of all entries.
+ */
+static dt_ahashent_t *
+dt_aggregate_insert(dtrace_hdl_t *dtp, processorid_t cpu, size_t ndx,
+    uint64_t hashval, dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_ahash_t *hash = &agp->dtat_hash;
+	dtrace_recdesc_t *rec;
+	dtrace_aggdata_t *aggdata;
+	dt_ahashent_t *h;
+	size_t size = agg->dtagd_size, psize = 0;
+	size_t esize = sizeof (dt_ahashent_t) + size;
+	int j;
+
+	/*
+	 * The key and value data are stored inline, directly after the entry
+	 * itself, so that a lookup touches one allocation; both come from the
+	 * aggregate's arena.
+	 */
+	if ((h = dt_aggregate_alloc(dtp, esize)) == NULL)
+		return (NULL);
+	memset(h, 0, sizeof (dt_ahashent_t));
+	aggdata = &h->dtahe_data;
+	aggdata->dtada_data = (caddr_t)(h + 1);
+
+	memcpy(aggdata->dtada_data, addr, size);
+	aggdata->dtada_size = size;
+	aggdata->dtada_desc = agg;
+	aggdata->dtada_handle = dtp;
+	(void) dt_epid_lookup(dtp, agg->dtagd_epid,
+	    &aggdata->dtada_edesc, &aggdata->dtada_pdesc);
+	aggdata->dtada_normal = 1;
+
+	h->dtahe_hashval = hashval;
+	h->dtahe_size = size;
+	(void) dt_aggregate_aggvarid(h);
+
+	rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+
+	if (agp->dtat_flags & DTRACE_A_PERCPU) {
+		int max_cpus = agp->dtat_maxcpu;
+		size_t vsize = DT_ASLABALIGN(rec->dtrd_size);
+		caddr_t *percpu, vals;
+
+		/*
+		 * The pointer array and the values for every CPU are
+		 * allocated as a single block.
+		 */
+		psize = max_cpus * (sizeof (caddr_t) + vsize);
+		if ((percpu = dt_aggregate_alloc(dtp, psize)) == NULL) {
+			dt_aggregate_free(dtp, h, esize);
+			return (NULL);
+		}
+
+		vals = (caddr_t)&percpu[max_cpus];
+		memset(vals, 0, max_cpus * vsize);
+
+		for (j = 0; j < max_cpus; j++)
+			percpu[j] = vals + j * vsize;
+
+		memcpy(percpu[cpu], &addr[rec->dtrd_offset], rec->dtrd_size);
+
+		aggdata->dtada_percpu = percpu;
+	}
+
+	switch (rec->dtrd_action) {
+	case DTRACEAGG_MIN:
+		h->dtahe_aggregate = dt_aggregate_min;
+		break;
+
+	case DTRACEAGG_MAX:
+		h->dtahe_aggregate = dt_aggregate_max;
+		break;
+
+	case DTRACEAGG_LQUANTIZE:
+		h->dtahe_aggregate = dt_aggregate_lquantize;
+		break;
+
+	case DTRACEAGG_LLQUANTIZE:
+		h->dtahe_aggregate = dt_aggregate_llquantize;
+		break;
+
+	case DTRACEAGG_COUNT:
+	case DTRACEAGG_SUM:
+	case DTRACEAGG_AVG:
+	case DTRACEAGG_STDDEV:
+	case DTRACEAGG_QUANTIZE:
+		h->dtahe_aggregate = dt_aggregate_count;
+		break;
+
+	default:
+		if (aggdata->dtada_percpu != NULL)
+			dt_aggregate_free(dtp, aggdata->dtada_percpu, psize);
+		dt_aggregate_free(dtp, h, esize);
+		(void) dt_set_errno(dtp, EDT_BADAGG);
+		return (NULL);
+	}
+
+	if (hash->dtah_hash[ndx] != NULL)
+		hash->dtah_hash[ndx]->dtahe_prev = h;
+
+	h->dtahe_next = hash->dtah_hash[ndx];
+	hash->dtah_hash[ndx] = h;
+
+	if (hash->dtah_all != NULL)
+		hash->dtah_all->dtahe_prevall = h;
+
+	h->dtahe_nextall = hash->dtah_all;
+	hash->dtah_all = h;
+	hash->dtah_nelems++;
+
+	return (h);
+}
+
+/*
+ * Find the description of aggregation id.  Descriptions are never freed
+ * while tracing, so a worker can remember them without holding any lock.
+ * Returns 0 or an error number.
+ */
+static int
+dt_aggregate_snap_agg(dtrace_hdl_t *dtp, dt_aworker_t *wp, dtrace_aggid_t id,
+    dtrace_aggdesc_t **aggp)
+{
+	dt_apool_t *pool = wp->dtaw_pool;
+	dtrace_aggdesc_t **aggs;
+	dtrace_aggid_t naggs;
+	int err = 0;
+
+	if (id < wp->dtaw_naggs && wp->dtaw_aggs[id] != NULL) {
+		*aggp = wp->dtaw_aggs[id];
 		return (0);
+	}
 
-	if (hash->dtah_hash == NULL) {
-		size_t size;
+	DT_APOOL_LOCK(pool, &pool->dtap_lock);
+	if (dt_aggid_lookup(dtp, id, aggp) != 0)
+		err = dtp->dt_errno;
+	DT_APOOL_UNLOCK(pool, &pool->dtap_lock);
 
-		hash->dtah_size = DTRACE_AHASHSIZE;
-		size = hash->dtah_size * sizeof (dt_ahashent_t *);
+	if (err != 0)
+		return (err);
 
-		if ((hash->dtah_hash = malloc(size)) == NULL)
-			return (dt_set_errno(dtp, EDT_NOMEM));
+	if (id >= wp->dtaw_naggs) {
+		naggs = wp->dtaw_naggs ? wp->dtaw_naggs : 16;
+
+		while (naggs <= id)
+			naggs <<= 1;
+
+		aggs = realloc(wp->dtaw_aggs, naggs * sizeof (*aggs));
+
+		/*
+		 * Not being able to remember the description only costs a
+		 * lookup under the lock the next time around.
+		 */
+		if (aggs == NULL)
+			return (0);
+
+		memset(&aggs[wp->dtaw_naggs], 0,
+		    (naggs - wp->dtaw_naggs) * sizeof (*aggs));
+		wp->dtaw_aggs = aggs;
+		wp->dtaw_naggs = naggs;
+	}
+
+	wp->dtaw_aggs[id] = *aggp;
+
+	return (0);
+}
+
+/*
+ * Resolve the addresses in the key of the record at addr to the symbols or
+ * modules they are aggregated by.  This consults the handle's symbol tables,
+ * so it is done under dtap_lock, and only for aggregations that need it.
+ */
+static void
+dt_aggregate_snap_normalize(dtrace_hdl_t *dtp, dt_apool_t *pool,
+    dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dtrace_recdesc_t *rec;
+	size_t roffs;
+	int j, locked = 0;
+
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		rec = &agg->dtagd_rec[j];
+		roffs = rec->dtrd_offset;
+
+		switch (rec->dtrd_action) {
+		case DTRACEACT_USYM:
+		case DTRACEACT_UMOD:
+		case DTRACEACT_SYM:
+		case DTRACEACT_MOD:
+			break;
+
+		default:
+			continue;
+		}
+
+		if (!locked) {
+			DT_APOOL_LOCK(pool, &pool->dtap_lock);
+			locked = 1;
+		}
+
+		switch (rec->dtrd_action) {
+		case DTRACEACT_USYM:
+			/* LINTED - alignment */
+			dt_aggregate_usym(dtp, (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_UMOD:
+			/* LINTED - alignment */
+			dt_aggregate_umod(dtp, (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_SYM:
+			/* LINTED - alignment */
+			dt_aggregate_sym(dtp, (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_MOD:
+			/* LINTED - alignment */
+			dt_aggregate_mod(dtp, (uint64_t *)&addr[roffs]);
+			break;
+		}
+	}
+
+	if (locked)
+		DT_APOOL_UNLOCK(pool, &pool->dtap_lock);
+}
+
+/*
+ * Grow the hash if it has reached its load factor.  In a parallel snapshot,
+ * the caller holds dtap_lock and no stripe lock; every stripe is taken so
+ * that no other thread is walking a chain while the chains are rethreaded.
+ */
+static int
+dt_aggregate_snap_grow(dtrace_hdl_t *dtp, dt_apool_t *pool)
+{
+	dt_ahash_t *hash = &dtp->dt_aggregate.dtat_hash;
+	int i, rval;
+
+	if (hash->dtah_nelems < DTRACE_AHASHLOAD(hash->dtah_size))
+		return (0);
+
+	for (i = 0; pool != NULL && i < DT_ASTRIPES; i++)
+		(void) pthread_mutex_lock(&pool->dtap_stripes[i]);
 
-		memset(hash->dtah_hash, 0, size);
+	rval = dt_aggregate_hashgrow(dtp, hash);
+
+	for (i = 0; pool != NULL && i < DT_ASTRIPES; i++)
+		(void) pthread_mutex_unlock(&pool->dtap_stripes[i]);
+
+	return (rval);
+}
+
+/*
+ * Merge the records of one CPU's aggregation buffer into the hash.  If the
+ * worker has a pool, other threads are merging other CPUs at the same time.
+ * Returns 0 or an error number.
+ */
+static int
+dt_aggregate_snap_buf(dtrace_hdl_t *dtp, processorid_t cpu,
+    dtrace_bufdesc_t *buf, dt_aworker_t *wp)
+{
+	dt_apool_t *pool = wp->dtaw_pool;
+	dtrace_epid_t id;
+	uint64_t hashval, skipped = 0, hashed = 0;
+	size_t offs, size, ndx, nrec = 0;
+	int j, err;
+	caddr_t addr;
+	dtrace_recdesc_t *rec;
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_aggdesc_t *agg;
+	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_ahashent_t *h;
+	dt_acache_t *cache = NULL;
+
+	if (agp->dtat_cache != NULL) {
+		cache = &agp->dtat_cache[cpu];
+
+		if (cache->dtac_gen != hash->dtah_gen) {
+			cache->dtac_nents = 0;
+			cache->dtac_gen = hash->dtah_gen;
+		}
 	}
 
 	for (offs = 0; offs < buf->dtbd_size; ) {
@@ -535,204 +1144,245 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
 			continue;
 		}
 
-		if ((rval = dt_aggid_lookup(dtp, id, &agg)) != 0)
-			return (rval);
+		if ((err = dt_aggregate_snap_agg(dtp, wp, id, &agg)) != 0)
+			return (err);
 
 		addr = buf->dtbd_data + offs;
 		size = agg->dtagd_size;
-		hashval = 0;
+
+		dt_aggregate_snap_normalize(dtp, pool, agg, addr);
+
+		if ((h = dt_aggregate_cacheget(cache, nrec, offs,
+		    agg, addr)) != NULL) {
+			skipped++;
+
+			DT_APOOL_LOCK(pool,
+			    DT_APOOL_STRIPE(pool, h->dtahe_hashval));
+			dt_aggregate_apply(h, cpu, addr);
+			DT_APOOL_UNLOCK(pool,
+			    DT_APOOL_STRIPE(pool, h->dtahe_hashval));
+			goto bufnext;
+		}
+
+		hashed++;
+		hashval = size;
 
 		for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
 			rec = &agg->dtagd_rec[j];
-			roffs = rec->dtrd_offset;
+			hashval = dt_aggregate_hashbytes(hashval,
+			    &addr[rec->dtrd_offset], rec->dtrd_size);
+		}
 
-			switch (rec->dtrd_action) {
-			case DTRACEACT_USYM:
-				dt_aggregate_usym(dtp,
-				    /* LINTED - alignment */
-				    (uint64_t *)&addr[roffs]);
-				break;
+		hashval = dt_aggregate_hashfinal(hashval);
 
-			case DTRACEACT_UMOD:
-				dt_aggregate_umod(dtp,
-				    /* LINTED - alignment */
-				    (uint64_t *)&addr[roffs]);
-				break;
+		DT_APOOL_LOCK(pool, DT_APOOL_STRIPE(pool, hashval));
+		ndx = DT_AHASH_NDX(hash, hashval);
 
-			case DTRACEACT_SYM:
-				/* LINTED - alignment */
-				dt_aggregate_sym(dtp, (uint64_t *)&addr[roffs]);
-				break;
+		if ((h = dt_aggregate_lookup(hash, ndx, hashval,
+		    agg, addr)) != NULL) {
+			dt_aggregate_apply(h, cpu, addr);
+			DT_APOOL_UNLOCK(pool, DT_APOOL_STRIPE(pool, hashval));
+			goto bufnext;
+		}
 
-			case DTRACEACT_MOD:
-				/* LINTED - alignment */
-				dt_aggregate_mod(dtp, (uint64_t *)&addr[roffs]);
-				break;
+		/*
+		 * If we're here, we couldn't find an entry for this record.
+		 * In a parallel snapshot, we must drop the stripe lock to
+		 * take the handle lock, and in the meantime another thread
+		 * may have grown the table or inserted the same key; look
+		 * again once we hold both.
+		 */
+		DT_APOOL_UNLOCK(pool, DT_APOOL_STRIPE(pool, hashval));
+		DT_APOOL_LOCK(pool, &pool->dtap_lock);
 
-			default:
-				break;
-			}
+		if (dt_aggregate_snap_grow(dtp, pool) == -1) {
+			err = dtp->dt_errno;
+			DT_APOOL_UNLOCK(pool, &pool->dtap_lock);
+			return (err);
+		}
+
+		DT_APOOL_LOCK(pool, DT_APOOL_STRIPE(pool, hashval));
+		ndx = DT_AHASH_NDX(hash, hashval);
 
-			for (i = 0; i < rec->dtrd_size; i++)
-				hashval += addr[roffs + i];
+		if (pool != NULL && (h = dt_aggregate_lookup(hash, ndx,
+		    hashval, agg, addr)) != NULL) {
+			dt_aggregate_apply(h, cpu, addr);
+		} else if ((h = dt_aggregate_insert(dtp, cpu, ndx, hashval,
+		    agg, addr)) == NULL) {
+			err = dtp->dt_errno;
 		}
 
-		ndx = hashval % hash->dtah_size;
+		DT_APOOL_UNLOCK(pool, DT_APOOL_STRIPE(pool, hashval));
+		DT_APOOL_UNLOCK(pool, &pool->dtap_lock);
 
-		for (h = hash->dtah_hash[ndx]; h != NULL; h = h->dtahe_next) {
-			if (h->dtahe_hashval != hashval)
-				continue;
+		if (h == NULL)
+			return (err);
+bufnext:
+		if (cache != NULL &&
+		    (err = dt_aggregate_cacheset(cache, nrec, offs, h)) != 0)
+			return (err);
 
-			if (h->dtahe_size != size)
-				continue;
+		nrec++;
+		offs += size;
+	}
 
-			aggdata = &h->dtahe_data;
-			data = aggdata->dtada_data;
+	if (pool != NULL) {
+		(void) pthread_mutex_lock(&pool->dtap_lock);
+		pool->dtap_skipped += skipped;
+		pool->dtap_hashed += hashed;
+		(void) pthread_mutex_unlock(&pool->dtap_lock);
+	} else {
+		agp->dtat_skipped += skipped;
+		agp->dtat_hashed += hashed;
+	}
 
-			for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
-				rec = &agg->dtagd_rec[j];
-				roffs = rec->dtrd_offset;
+	return (0);
+}
 
-				for (i = 0; i < rec->dtrd_size; i++)
-					if (addr[roffs + i] != data[roffs + i])
-						goto hashnext;
-			}
+static int
+dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_bufdesc_t b = agp->dtat_buf, *buf = &b;
+	dt_aworker_t w;
+	int err;
 
-			/*
-			 * We found it.  Now we need to apply the aggregating
-			 * action on the data here.
-			 */
-			rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
-			roffs = rec->dtrd_offset;
-			/* LINTED - alignment */
-			h->dtahe_aggregate((int64_t *)&data[roffs],
-			    /* LINTED - alignment */
-			    (int64_t *)&addr[roffs], rec->dtrd_size);
+	if ((err = dt_aggregate_fetch(dtp, cpu, buf)) != 0)
+		return (dt_set_errno(dtp, err));
 
-			/*
-			 * If we're keeping per CPU data, apply the aggregating
-			 * action there as well.
-			 */
-			if (aggdata->dtada_percpu != NULL) {
-				data = aggdata->dtada_percpu[cpu];
+	if (buf->dtbd_drops != 0) {
+		if (dt_handle_cpudrop(dtp, cpu,
+		    DTRACEDROP_AGGREGATION, buf->dtbd_drops) == -1)
+			return (-1);
+	}
 
-				/* LINTED - alignment */
-				h->dtahe_aggregate((int64_t *)data,
-				    /* LINTED - alignment */
-				    (int64_t *)&addr[roffs], rec->dtrd_size);
-			}
+	if (buf->dtbd_size == 0)
+		return (0);
 
-			goto bufnext;
-hashnext:
-			continue;
-		}
+	memset(&w, 0, sizeof (w));
+	err = dt_aggregate_snap_buf(dtp, cpu, buf, &w);
+	free(w.dtaw_aggs);
 
-		/*
-		 * If we're here, we couldn't find an entry for this record.
-		 */
-		if ((h = malloc(sizeof (dt_ahashent_t))) == NULL)
-			return (dt_set_errno(dtp, EDT_NOMEM));
-		memset(h, 0, sizeof (dt_ahashent_t));
-		aggdata = &h->dtahe_data;
+	if (err != 0)
+		return (dt_set_errno(dtp, err));
 
-		if ((aggdata->dtada_data = malloc(size)) == NULL) {
-			free(h);
-			return (dt_set_errno(dtp, EDT_NOMEM));
+	return (0);
+}
+
+static void *
+dt_aggregate_snap_worker(void *arg)
+{
+	dt_apool_t *pool = arg;
+	dtrace_hdl_t *dtp = pool->dtap_hdl;
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_bufdesc_t b = agp->dtat_buf, *buf = &b;
+	dt_aworker_t w;
+	processorid_t cpu;
+	int i, err = 0;
+
+	memset(&w, 0, sizeof (w));
+	w.dtaw_pool = pool;
+
+	if ((buf->dtbd_data = malloc(agp->dtat_buf.dtbd_size)) == NULL)
+		err = EDT_NOMEM;
+
+	while (err == 0) {
+		(void) pthread_mutex_lock(&pool->dtap_lock);
+
+		if (pool->dtap_err != 0 || pool->dtap_next >= agp->dtat_ncpus) {
+			(void) pthread_mutex_unlock(&pool->dtap_lock);
+			break;
 		}
 
-		memcpy(aggdata->dtada_data, addr, size);
-		aggdata->dtada_size = size;
-		aggdata->dtada_desc = agg;
-		aggdata->dtada_handle = dtp;
-		(void) dt_epid_lookup(dtp, agg->dtagd_epid,
-		    &aggdata->dtada_edesc, &aggdata->dtada_pdesc);
-		aggdata->dtada_normal = 1;
+		i = pool->dtap_next++;
+		(void) pthread_mutex_unlock(&pool->dtap_lock);
 
-		h->dtahe_hashval = hashval;
-		h->dtahe_size = size;
-		(void) dt_aggregate_aggvarid(h);
+		cpu = agp->dtat_cpus[i];
 
-		rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+		if ((err = dt_aggregate_fetch(dtp, cpu, buf)) != 0)
+			break;
 
-		if (flags & DTRACE_A_PERCPU) {
-			int max_cpus = agp->dtat_maxcpu;
-			caddr_t *percpu = malloc(max_cpus * sizeof (caddr_t));
+		pool->dtap_drops[i] = buf->dtbd_drops;
+		err = dt_aggregate_snap_buf(dtp, cpu, buf, &w);
+	}
 
-			if (percpu == NULL) {
-				free(aggdata->dtada_data);
-				free(h);
-				return (dt_set_errno(dtp, EDT_NOMEM));
-			}
+	if (err != 0) {
+		(void) pthread_mutex_lock(&pool->dtap_lock);
+		if (pool->dtap_err == 0)
+			pool->dtap_err = err;
+		(void) pthread_mutex_unlock(&pool->dtap_lock);
+	}
 
-			for (j = 0; j < max_cpus; j++) {
-				percpu[j] = malloc(rec->dtrd_size);
+	free(w.dtaw_aggs);
+	free(buf->dtbd_data);
+	return (NULL);
+}
 
-				if (percpu[j] == NULL) {
-					while (--j >= 0)
-						free(percpu[j]);
+/*
+ * Snapshot and merge the aggregation buffers of all CPUs using nthreads
+ * threads.  Drops are reported, in CPU order, once all threads are done.
+ */
+static int
+dt_aggregate_snap_parallel(dtrace_hdl_t *dtp, int nthreads)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_apool_t pool;
+	pthread_t *threads;
+	int i, n, rval = 0;
 
-					free(aggdata->dtada_data);
-					free(h);
-					return (dt_set_errno(dtp, EDT_NOMEM));
-				}
+	memset(&pool, 0, sizeof (pool));
+	pool.dtap_hdl = dtp;
+	(void) pthread_mutex_init(&pool.dtap_lock, NULL);
 
-				if (j == cpu) {
-					memcpy(percpu[j],
-					    &addr[rec->dtrd_offset],
-					    rec->dtrd_size);
-				} else {
-					memset(percpu[j], 0, rec->dtrd_size);
-				}
-			}
+	for (i = 0; i < DT_ASTRIPES; i++)
+		(void) pthread_mutex_init(&pool.dtap_stripes[i], NULL);
 
-			aggdata->dtada_percpu = percpu;
-		}
+	pool.dtap_drops = dt_zalloc(dtp, agp->dtat_ncpus * sizeof (uint64_t));
+	threads = dt_alloc(dtp, nthreads * sizeof (pthread_t));
 
-		switch (rec->dtrd_action) {
-		case DTRACEAGG_MIN:
-			h->dtahe_aggregate = dt_aggregate_min;
-			break;
+	if (pool.dtap_drops == NULL || threads == NULL) {
+		rval = -1;
+		goto out;
+	}
 
-		case DTRACEAGG_MAX:
-			h->dtahe_aggregate = dt_aggregate_max;
+	for (n = 0; n < nthreads; n++) {
+		if (pthread_create(&threads[n], NULL,
+		    dt_aggregate_snap_worker, &pool) != 0)
 			break;
+	}
 
-		case DTRACEAGG_LQUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_lquantize;
-			break;
+	/*
+	 * If we could not start any thread at all, do the work ourselves.
+	 */
+	if (n == 0)
+		(void) dt_aggregate_snap_worker(&pool);
 
-		case DTRACEAGG_LLQUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_llquantize;
-			break;
+	for (i = 0; i < n; i++)
+		(void) pthread_join(threads[i], NULL);
 
-		case DTRACEAGG_COUNT:
-		case DTRACEAGG_SUM:
-		case DTRACEAGG_AVG:
-		case DTRACEAGG_STDDEV:
-		case DTRACEAGG_QUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_count;
-			break;
+	for (i = 0; i < agp->dtat_ncpus && rval == 0; i++) {
+		if (pool.dtap_drops[i] != 0 &&
+		    dt_handle_cpudrop(dtp, agp->dtat_cpus[i],
+		    DTRACEDROP_AGGREGATION, pool.dtap_drops[i]) == -1)
+			rval = -1;
+	}
 
-		default:
-			return (dt_set_errno(dtp, EDT_BADAGG));
-		}
+	if (rval == 0 && pool.dtap_err != 0)
+		rval = dt_set_errno(dtp, pool.dtap_err);
 
-		if (hash->dtah_hash[ndx] != NULL)
-			hash->dtah_hash[ndx]->dtahe_prev = h;
+	agp->dtat_skipped += pool.dtap_skipped;
+	agp->dtat_hashed += pool.dtap_hashed;
 
-		h->dtahe_next = hash->dtah_hash[ndx];
-		hash->dtah_hash[ndx] = h;
+out:
+	dt_free(dtp, threads);
+	dt_free(dtp, pool.dtap_drops);
 
-		if (hash->dtah_all != NULL)
-			hash->dtah_all->dtahe_prevall = h;
+	for (i = 0; i < DT_ASTRIPES; i++)
+		(void) pthread_mutex_destroy(&pool.dtap_stripes[i]);
 
-		h->dtahe_nextall = hash->dtah_all;
-		hash->dtah_all = h;
-bufnext:
-		offs += agg->dtagd_size;
-	}
+	(void) pthread_mutex_destroy(&pool.dtap_lock);
 
-	return (0);
+	return (rval);
 }
 
 int
@@ -740,8 +1390,10 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 {
 	int i, rval;
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_ahash_t *hash = &agp->dtat_hash;
 	hrtime_t now = gethrtime();
 	dtrace_optval_t interval = dtp->dt_options[DTRACEOPT_AGGRATE];
+	int nthreads = dtp->dt_aggthreads;
 
 	if (dtp->dt_lastagg != 0) {
 		if (now - dtp->dt_lastagg < interval)
@@ -758,34 +1410,69 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 	if (agp->dtat_buf.dtbd_size == 0)
 		return (0);
 
-	for (i = 0; i < agp->dtat_ncpus; i++) {
-		if ((rval = dt_aggregate_snap_cpu(dtp, agp->dtat_cpus[i])) != 0)
+	if (hash->dtah_hash == NULL) {
+		hash->dtah_hash = calloc(DTRACE_AHASHSIZE,
+		    sizeof (dt_ahashent_t *));
+
+		if (hash->dtah_hash == NULL)
+			return (dt_set_errno(dtp, EDT_NOMEM));
+
+		hash->dtah_size = DTRACE_AHASHSIZE;
+		hash->dtah_nelems = 0;
+	} else if (hash->dtah_all == NULL && agp->dtat_slabs != NULL) {
+		/*
+		 * Every entry has been removed since the last snapshot;
+		 * nothing refers to the arena any more, so give it back.
+		 */
+		dt_aggregate_release(agp);
+	}
+
+	agp->dtat_skipped = agp->dtat_hashed = 0;
+
+	if (nthreads > agp->dtat_ncpus)
+		nthreads = agp->dtat_ncpus;
+
+	if (nthreads > 1 && dtp->dt_vector == NULL) {
+		if ((rval = dt_aggregate_snap_parallel(dtp, nthreads)) != 0)
 			return (rval);
+	} else {
+		for (i = 0; i < agp->dtat_ncpus; i++) {
+			rval = dt_aggregate_snap_cpu(dtp, agp->dtat_cpus[i]);
+
+			if (rval != 0)
+				return (rval);
+		}
 	}
 
+	if (agp->dtat_flags & DTRACE_A_SNAPSTATS)
+		return (dt_handle_aggsnap(dtp, agp->dtat_skipped,
+		    agp->dtat_hashed));
+
 	return (0);
 }
 
 static int
-dt_aggregate_hashcmp(const void *lhs, const void *rhs)
+dt_aggregate_hashcmp(const void *lhs, const void *rhs, void *arg)
 {
+	const dt_aggsort_t *sp = arg;
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
 	dtrace_aggdesc_t *lagg = lh->dtahe_data.dtada_desc;
 	dtrace_aggdesc_t *ragg = rh->dtahe_data.dtada_desc;
 
 	if (lagg->dtagd_nrecs < ragg->dtagd_nrecs)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lagg->dtagd_nrecs > ragg->dtagd_nrecs)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
 
 static int
-dt_aggregate_varcmp(const void *lhs, const void *rhs)
+dt_aggregate_varcmp(const void *lhs, const void *rhs, void *arg)
 {
+	const dt_aggsort_t *sp = arg;
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
 	dtrace_aggvarid_t lid, rid;
@@ -794,17 +1481,18 @@ dt_aggregate_varcmp(const void *lhs, const void *rhs)
 	rid = dt_aggregate_aggvarid(rh);
 
 	if (lid < rid)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lid > rid)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	return (0);
 }
 
 static int
-dt_aggregate_keycmp(const void *lhs, const void *rhs)
+dt_aggregate_keycmp(const void *lhs, const void *rhs, void *arg)
 {
+	const dt_aggsort_t *sp = arg;
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
 	dtrace_aggdesc_t *lagg = lh->dtahe_data.dtada_desc;
@@ -813,13 +1501,13 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 	char *ldata, *rdata;
 	int rval, i, j, keypos, nrecs;
 
-	if ((rval = dt_aggregate_hashcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_hashcmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
 	nrecs = lagg->dtagd_nrecs - 1;
 	assert(nrecs == ragg->dtagd_nrecs - 1);
 
-	keypos = dt_keypos + 1 >= nrecs ? 0 : dt_keypos;
+	keypos = sp->dtags_keypos + 1 >= nrecs ? 0 : sp->dtags_keypos;
 
 	for (i = 1; i < nrecs; i++) {
 		uint64_t lval, rval;
@@ -835,10 +1523,10 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 		rdata = rh->dtahe_data.dtada_data + rrec->dtrd_offset;
 
 		if (lrec->dtrd_size < rrec->dtrd_size)
-			return (DT_LESSTHAN);
+			return (DT_LESSTHAN(sp));
 
 		if (lrec->dtrd_size > rrec->dtrd_size)
-			return (DT_GREATERTHAN);
+			return (DT_GREATERTHAN(sp));
 
 		switch (lrec->dtrd_size) {
 		case sizeof (uint64_t):
@@ -879,10 +1567,10 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 					rval = ((uint64_t *)rdata)[j];
 
 					if (lval < rval)
-						return (DT_LESSTHAN);
+						return (DT_LESSTHAN(sp));
 
 					if (lval > rval)
-						return (DT_GREATERTHAN);
+						return (DT_GREATERTHAN(sp));
 				}
 
 				break;
@@ -893,10 +1581,10 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 					rval = ((uint8_t *)rdata)[j];
 
 					if (lval < rval)
-						return (DT_LESSTHAN);
+						return (DT_LESSTHAN(sp));
 
 					if (lval > rval)
-						return (DT_GREATERTHAN);
+						return (DT_GREATERTHAN(sp));
 				}
 			}
 
@@ -904,18 +1592,19 @@ dt_aggregate_keycmp(const void *lhs, const void *rhs)
 		}
 
 		if (lval < rval)
-			return (DT_LESSTHAN);
+			return (DT_LESSTHAN(sp));
 
 		if (lval > rval)
-			return (DT_GREATERTHAN);
+			return (DT_GREATERTHAN(sp));
 	}
 
 	return (0);
 }
 
 static int
-dt_aggregate_valcmp(const void *lhs, const void *rhs)
+dt_aggregate_valcmp(const void *lhs, const void *rhs, void *arg)
 {
+	const dt_aggsort_t *sp = arg;
 	dt_ahashent_t *lh = *((dt_ahashent_t **)lhs);
 	dt_ahashent_t *rh = *((dt_ahashent_t **)rhs);
 	dtrace_aggdesc_t *lagg = lh->dtahe_data.dtada_desc;
@@ -926,14 +1615,14 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 	int64_t *laddr, *raddr;
 	int rval, i;
 
-	if ((rval = dt_aggregate_hashcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_hashcmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
 	if (lagg->dtagd_nrecs > ragg->dtagd_nrecs)
-		return (DT_GREATERTHAN);
+		return (DT_GREATERTHAN(sp));
 
 	if (lagg->dtagd_nrecs < ragg->dtagd_nrecs)
-		return (DT_LESSTHAN);
+		return (DT_LESSTHAN(sp));
 
 	if (lagg->dtagd_nrecs <= 0)
 	    return 0;
@@ -943,16 +1632,16 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 		rrec = &ragg->dtagd_rec[i];
 
 		if (lrec->dtrd_offset < rrec->dtrd_offset)
-			return (DT_LESSTHAN);
+			return (DT_LESSTHAN(sp));
 
 		if (lrec->dtrd_offset > rrec->dtrd_offset)
-			return (DT_GREATERTHAN);
+			return (DT_GREATERTHAN(sp));
 
 		if (lrec->dtrd_action < rrec->dtrd_action)
-			return (DT_LESSTHAN);
+			return (DT_LESSTHAN(sp));
 
 		if (lrec->dtrd_action > rrec->dtrd_action)
-			return (DT_GREATERTHAN);
+			return (DT_GREATERTHAN(sp));
 	}
 
 	laddr = (int64_t *)(uintptr_t)(ldata + lrec->dtrd_offset);
@@ -960,30 +1649,30 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 
 	switch (lrec->dtrd_action) {
 	case DTRACEAGG_AVG:
-		rval = dt_aggregate_averagecmp(laddr, raddr);
+		rval = dt_aggregate_averagecmp(laddr, raddr, sp);
 		break;
 
 	case DTRACEAGG_STDDEV:
-		rval = dt_aggregate_stddevcmp(laddr, raddr);
+		rval = dt_aggregate_stddevcmp(laddr, raddr, sp);
 		break;
 
 	case DTRACEAGG_QUANTIZE:
-		rval = dt_aggregate_quantizedcmp(laddr, raddr);
+		rval = dt_aggregate_quantizedcmp(laddr, raddr, sp);
 		break;
 
 	case DTRACEAGG_LQUANTIZE:
-		rval = dt_aggregate_lquantizedcmp(laddr, raddr);
+		rval = dt_aggregate_lquantizedcmp(laddr, raddr, sp);
 		break;
 
 	case DTRACEAGG_LLQUANTIZE:
-		rval = dt_aggregate_llquantizedcmp(laddr, raddr);
+		rval = dt_aggregate_llquantizedcmp(laddr, raddr, sp);
 		break;
 
 	case DTRACEAGG_COUNT:
 	case DTRACEAGG_SUM:
 	case DTRACEAGG_MIN:
 	case DTRACEAGG_MAX:
-		rval = dt_aggregate_countcmp(laddr, raddr);
+		rval = dt_aggregate_countcmp(laddr, raddr, sp);
 		break;
 
 	default:
@@ -994,11 +1683,11 @@ dt_aggregate_valcmp(const void *lhs, const void *rhs)
 }
 
 static int
-dt_aggregate_valkeycmp(const void *lhs, const void *rhs)
+dt_aggregate_valkeycmp(const void *lhs, const void *rhs, void *arg)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_valcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_valcmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
 	/*
@@ -1006,85 +1695,92 @@ dt_aggregate_valkeycmp(const void *lhs, const void *rhs)
 	 * equal.  We already know that the key layout is the same for the two
 	 * elements; we must now compare the keys themselves as a tie-breaker.
 	 */
-	return (dt_aggregate_keycmp(lhs, rhs));
+	return (dt_aggregate_keycmp(lhs, rhs, arg));
 }
 
 static int
-dt_aggregate_keyvarcmp(const void *lhs, const void *rhs)
+dt_aggregate_keyvarcmp(const void *lhs, const void *rhs, void *arg)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_keycmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_keycmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
-	return (dt_aggregate_varcmp(lhs, rhs));
+	return (dt_aggregate_varcmp(lhs, rhs, arg));
 }
 
 static int
-dt_aggregate_varkeycmp(const void *lhs, const void *rhs)
+dt_aggregate_varkeycmp(const void *lhs, const void *rhs, void *arg)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_varcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_varcmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
-	return (dt_aggregate_keycmp(lhs, rhs));
+	return (dt_aggregate_keycmp(lhs, rhs, arg));
 }
 
 static int
-dt_aggregate_valvarcmp(const void *lhs, const void *rhs)
+dt_aggregate_valvarcmp(const void *lhs, const void *rhs, void *arg)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_valkeycmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_valkeycmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
-	return (dt_aggregate_varcmp(lhs, rhs));
+	return (dt_aggregate_varcmp(lhs, rhs, arg));
 }
 
 static int
-dt_aggregate_varvalcmp(const void *lhs, const void *rhs)
+dt_aggregate_varvalcmp(const void *lhs, const void *rhs, void *arg)
 {
 	int rval;
 
-	if ((rval = dt_aggregate_varcmp(lhs, rhs)) != 0)
+	if ((rval = dt_aggregate_varcmp(lhs, rhs, arg)) != 0)
 		return (rval);
 
-	return (dt_aggregate_valkeycmp(lhs, rhs));
+	return (dt_aggregate_valkeycmp(lhs, rhs, arg));
 }
 
 static int
-dt_aggregate_keyvarrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_keyvarrevcmp(const void *lhs, const void *rhs, void *arg)
 {
-	return (dt_aggregate_keyvarcmp(rhs, lhs));
+	return (dt_aggregate_keyvarcmp(rhs, lhs, arg));
 }
 
 static int
-dt_aggregate_varkeyrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_varkeyrevcmp(const void *lhs, const void *rhs, void *arg)
 {
-	return (dt_aggregate_varkeycmp(rhs, lhs));
+	return (dt_aggregate_varkeycmp(rhs, lhs, arg));
 }
 
 static int
-dt_aggregate_valvarrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_valvarrevcmp(const void *lhs, const void *rhs, void *arg)
 {
-	return (dt_aggregate_valvarcmp(rhs, lhs));
+	return (dt_aggregate_valvarcmp(rhs, lhs, arg));
 }
 
 static int
-dt_aggregate_varvalrevcmp(const void *lhs, const void *rhs)
+dt_aggregate_varvalrevcmp(const void *lhs, const void *rhs, void *arg)
 {
-	return (dt_aggregate_varvalcmp(rhs, lhs));
+	return (dt_aggregate_varvalcmp(rhs, lhs, arg));
 }
 
 static int
-dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
+dt_aggregate_valkeyrevcmp(const void *lhs, const void *rhs, void *arg)
 {
+	return (dt_aggregate_valkeycmp(rhs, lhs, arg));
+}
+
+static int
+dt_aggregate_bundlecmp(const void *lhs, const void *rhs, void *arg)
+{
+	const dt_aggsort_t *sp = arg;
 	dt_ahashent_t **lh = *((dt_ahashent_t ***)lhs);
 	dt_ahashent_t **rh = *((dt_ahashent_t ***)rhs);
 	int i, rval;
 
-	if (dt_keysort) {
+	if (sp->dtags_key) {
 		/*
 		 * If we're sorting on keys, we need to scan until we find the
 		 * last entry -- that's the representative key.  (The order of
@@ -1098,7 +1794,7 @@ dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
 		assert(i != 0);
 		assert(rh[i + 1] == NULL);
 
-		if ((rval = dt_aggregate_keycmp(&lh[i], &rh[i])) != 0)
+		if ((rval = dt_aggregate_keycmp(&lh[i], &rh[i], arg)) != 0)
 			return (rval);
 	}
 
@@ -1112,14 +1808,16 @@ dt_aggregate_bundlecmp(const void *lhs, const void *rhs)
 			 * key comparison from the representative key as the
 			 * tie-breaker.
 			 */
-			if (dt_keysort)
+			if (sp->dtags_key)
 				return (0);
 
 			assert(i != 0);
 			assert(rh[i + 1] == NULL);
-			return (dt_aggregate_keycmp(&lh[i], &rh[i]));
+			return (dt_aggregate_keycmp(&lh[i], &rh[i], arg));
 		} else {
-			if ((rval = dt_aggregate_valcmp(&lh[i], &rh[i])) != 0)
+			rval = dt_aggregate_valcmp(&lh[i], &rh[i], arg);
+
+			if (rval != 0)
 				return (rval);
 		}
 	}
@@ -1144,6 +1842,11 @@ dt_aggregate_go(dtrace_hdl_t *dtp)
 	if (agp->dtat_cpus == NULL)
 		return (dt_set_errno(dtp, EDT_NOMEM));
 
+	agp->dtat_cache = calloc(agp->dtat_maxcpu, sizeof (dt_acache_t));
+
+	if (agp->dtat_cache == NULL)
+		return (dt_set_errno(dtp, EDT_NOMEM));
+
 	/*
 	 * Use the aggregation buffer size as reloaded from the kernel.
 	 */
@@ -1243,9 +1946,6 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 		return (0);
 
 	case DTRACE_AGGWALK_REMOVE: {
-		dtrace_aggdata_t *aggdata = &h->dtahe_data;
-		int i, max_cpus = agp->dtat_maxcpu;
-
 		/*
 		 * First, remove this hash entry from its hash chain.
 		 */
@@ -1253,7 +1953,7 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 			h->dtahe_prev->dtahe_next = h->dtahe_next;
 		} else {
 			dt_ahash_t *hash = &agp->dtat_hash;
-			size_t ndx = h->dtahe_hashval % hash->dtah_size;
+			size_t ndx = DT_AHASH_NDX(hash, h->dtahe_hashval);
 
 			assert(hash->dtah_hash[ndx] == h);
 			hash->dtah_hash[ndx] = h->dtahe_next;
@@ -1277,18 +1977,27 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 		if (h->dtahe_nextall != NULL)
 			h->dtahe_nextall->dtahe_prevall = h->dtahe_prevall;
 
+		agp->dtat_hash.dtah_nelems--;
+		agp->dtat_hash.dtah_gen++;
+
 		/*
-		 * We're unlinked.  We can safely destroy the data.
+		 * We're unlinked.  Bumping dtah_gen above has invalidated any
+		 * per-CPU cache entry that still points at us, so the entry
+		 * and its per-CPU values can be handed out again.
 		 */
-		if (aggdata->dtada_percpu != NULL) {
-			for (i = 0; i < max_cpus; i++)
-				free(aggdata->dtada_percpu[i]);
-			free(aggdata->dtada_percpu);
-		}
+		data = &h->dtahe_data;
+
+		if (data->dtada_percpu != NULL) {
+			aggdesc = data->dtada_desc;
+			rec = &aggdesc->dtagd_rec[aggdesc->dtagd_nrecs - 1];
 
-		free(aggdata->dtada_data);
-		free(h);
+			dt_aggregate_free(dtp, data->dtada_percpu,
+			    agp->dtat_maxcpu * (sizeof (caddr_t) +
+			    DT_ASLABALIGN(rec->dtrd_size)));
+		}
 
+		dt_aggregate_free(dtp, h,
+		    sizeof (dt_ahashent_t) + h->dtahe_size);
 		return (0);
 	}
 
@@ -1299,35 +2008,33 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 	return (0);
 }
 
-void
+static void
 dt_aggregate_qsort(dtrace_hdl_t *dtp, void *base, size_t nel, size_t width,
-    int (*compar)(const void *, const void *))
+    dt_aggcmp_f *compar)
 {
-	int rev = dt_revsort, key = dt_keysort, keypos = dt_keypos;
 	dtrace_optval_t keyposopt = dtp->dt_options[DTRACEOPT_AGGSORTKEYPOS];
+	dt_aggsort_t sort;
 
-	dt_revsort = (dtp->dt_options[DTRACEOPT_AGGSORTREV] != DTRACEOPT_UNSET);
-	dt_keysort = (dtp->dt_options[DTRACEOPT_AGGSORTKEY] != DTRACEOPT_UNSET);
+	sort.dtags_rev =
+	    (dtp->dt_options[DTRACEOPT_AGGSORTREV] != DTRACEOPT_UNSET);
+	sort.dtags_key =
+	    (dtp->dt_options[DTRACEOPT_AGGSORTKEY] != DTRACEOPT_UNSET);
 
 	if (keyposopt != DTRACEOPT_UNSET && keyposopt <= INT_MAX) {
-		dt_keypos = (int)keyposopt;
+		sort.dtags_keypos = (int)keyposopt;
 	} else {
-		dt_keypos = 0;
+		sort.dtags_keypos = 0;
 	}
 
 	if (compar == NULL) {
-		if (!dt_keysort) {
+		if (!sort.dtags_key) {
 			compar = dt_aggregate_varvalcmp;
 		} else {
 			compar = dt_aggregate_varkeycmp;
 		}
 	}
 
-	qsort(base, nel, width, compar);
-
-	dt_revsort = rev;
-	dt_keysort = key;
-	dt_keypos = keypos;
+	qsort_r(base, nel, width, compar, &sort);
 }
 
 int
@@ -1353,12 +2060,12 @@ dtrace_aggregate_walk(dtrace_hdl_t *dtp, dtrace_aggregate_f *func, void *arg)
 
 static int
 dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
-    dtrace_aggregate_f *func, void *arg,
-    int (*sfunc)(const void *, const void *))
+    dtrace_aggregate_f *func, void *arg, dt_aggcmp_f *sfunc)
 {
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	dt_ahashent_t *h, **sorted;
 	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_aggsort_t sort = { 0 };
 	size_t i, nentries = 0;
 
 	for (h = hash->dtah_all; h != NULL; h = h->dtahe_nextall)
@@ -1372,8 +2079,6 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
 	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall)
 		sorted[i++] = h;
 
-	(void) pthread_mutex_lock(&dt_qsort_lock);
-
 	if (sfunc == NULL) {
 		dt_aggregate_qsort(dtp, sorted, nentries,
 		    sizeof (dt_ahashent_t *), NULL);
@@ -1383,11 +2088,10 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
 		 * we'll use that -- ignoring the values of the "aggsortrev",
 		 * "aggsortkey" and "aggsortkeypos" options.
 		 */
-		qsort(sorted, nentries, sizeof (dt_ahashent_t *), sfunc);
+		qsort_r(sorted, nentries, sizeof (dt_ahashent_t *), sfunc,
+		    &sort);
 	}
 
-	(void) pthread_mutex_unlock(&dt_qsort_lock);
-
 	for (i = 0; i < nentries; i++) {
 		h = sorted[i];
 
@@ -1401,6 +2105,113 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
 	return (0);
 }
 
+static void
+dt_aggregate_siftdown(dt_ahashent_t **heap, size_t n, size_t i,
+    dt_aggcmp_f *sfunc, void *sarg)
+{
+	dt_ahashent_t *tmp;
+	size_t l, r, max;
+
+	for (;;) {
+		l = 2 * i + 1;
+		r = l + 1;
+		max = i;
+
+		if (l < n && sfunc(&heap[l], &heap[max], sarg) > 0)
+			max = l;
+		if (r < n && sfunc(&heap[r], &heap[max], sarg) > 0)
+			max = r;
+		if (max == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[max];
+		heap[max] = tmp;
+		i = max;
+	}
+}
+
+/*
+ * Partition the n entries so that the first k are the k that sort first
+ * under sfunc, in no particular order, and the rest follow.  The first k
+ * entries are kept as a heap with the greatest on top; each remaining entry
+ * that sorts before the top is swapped with it.  This costs O(n log k)
+ * rather than the O(n log n) of sorting everything.
+ */
+static void
+dt_aggregate_select(dt_ahashent_t **ents, size_t n, size_t k,
+    dt_aggcmp_f *sfunc, void *sarg)
+{
+	dt_ahashent_t *tmp;
+	size_t i;
+
+	if (k == 0 || k >= n)
+		return;
+
+	for (i = k / 2; i-- > 0; )
+		dt_aggregate_siftdown(ents, k, i, sfunc, sarg);
+
+	for (i = k; i < n; i++) {
+		if (sfunc(&ents[i], &ents[0], sarg) >= 0)
+			continue;
+
+		tmp = ents[0];
+		ents[0] = ents[i];
+		ents[i] = tmp;
+		dt_aggregate_siftdown(ents, k, 0, sfunc, sarg);
+	}
+}
+
+/*
+ * Implement trunc():  keep the "keep" entries of the aggregation variable
+ * varid with the greatest values (or the smallest, if rev is set) and
+ * remove all others.  Only the entries of varid are considered, and none
+ * of them need to be sorted.
+ */
+int
+dt_aggregate_trunc(dtrace_hdl_t *dtp, dtrace_aggvarid_t varid,
+    uint64_t keep, int rev)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_ahashent_t *h, **ents;
+	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_aggsort_t sort = { 0 };
+	size_t i, nentries = 0;
+	int rval = 0;
+
+	for (h = hash->dtah_all; h != NULL; h = h->dtahe_nextall) {
+		if (h->dtahe_data.dtada_desc->dtagd_nrecs != 0 &&
+		    dt_aggregate_aggvarid(h) == varid)
+			nentries++;
+	}
+
+	if (nentries <= keep)
+		return (0);
+
+	if ((ents = dt_alloc(dtp, nentries * sizeof (dt_ahashent_t *))) == NULL)
+		return (-1);
+
+	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall) {
+		if (h->dtahe_data.dtada_desc->dtagd_nrecs != 0 &&
+		    dt_aggregate_aggvarid(h) == varid)
+			ents[i++] = h;
+	}
+
+	dt_aggregate_select(ents, nentries, keep, rev ?
+	    dt_aggregate_valkeycmp : dt_aggregate_valkeyrevcmp, &sort);
+
+	for (i = keep; i < nentries; i++) {
+		if (dt_aggwalk_rval(dtp, ents[i],
+		    DTRACE_AGGWALK_REMOVE) == -1) {
+			rval = -1;
+			break;
+		}
+	}
+
+	dt_free(dtp, ents);
+	return (rval);
+}
+
 int
 dtrace_aggregate_walk_sorted(dtrace_hdl_t *dtp,
     dtrace_aggregate_f *func, void *arg)
@@ -1486,6 +2297,7 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 	int rval = -1, *map, *remap = NULL;
 	int i, j;
 	dtrace_optval_t sortpos = dtp->dt_options[DTRACEOPT_AGGSORTPOS];
+	dt_aggsort_t sort = { 0 };
 
 	/*
 	 * If the sorting position is greater than the number of aggregation
@@ -1777,14 +2589,10 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 
 	/*
 	 * We've loaded our array; now we need to sort by value to allow us
-	 * to create bundles of like value.  We're going to acquire the
-	 * dt_qsort_lock here, and hold it across all of our subsequent
-	 * comparison and sorting.
+	 * to create bundles of like value.
 	 */
-	(void) pthread_mutex_lock(&dt_qsort_lock);
-
-	qsort(sorted, nentries, sizeof (dt_ahashent_t *),
-	    dt_aggregate_keyvarcmp);
+	qsort_r(sorted, nentries, sizeof (dt_ahashent_t *),
+	    dt_aggregate_keyvarcmp, &sort);
 
 	/*
 	 * Now we need to go through and create bundles.  Because the number
@@ -1799,7 +2607,7 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 
 	for (i = 1, start = 0; i <= nentries; i++) {
 		if (i < nentries &&
-		    dt_aggregate_keycmp(&sorted[i], &sorted[i - 1]) == 0)
+		    dt_aggregate_keycmp(&sorted[i], &sorted[i - 1], &sort) == 0)
 			continue;
 
 		/*
@@ -1809,10 +2617,8 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 		assert(i - start <= naggvars);
 		bundlesize = (naggvars + 2) * sizeof (dt_ahashent_t *);
 
-		if ((nbundle = dt_zalloc(dtp, bundlesize)) == NULL) {
-			(void) pthread_mutex_unlock(&dt_qsort_lock);
+		if ((nbundle = dt_zalloc(dtp, bundlesize)) == NULL)
 			goto out;
-		}
 
 		for (j = start; j < i; j++) {
 			dtrace_aggvarid_t id = dt_aggregate_aggvarid(sorted[j]);
@@ -1860,8 +2666,6 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 	dt_aggregate_qsort(dtp, bundle, nbundles, sizeof (dt_ahashent_t **),
 	    dt_aggregate_bundlecmp);
 
-	(void) pthread_mutex_unlock(&dt_qsort_lock);
-
 	/*
 	 * We're done!  Now we just need to go back over the sorted bundles,
 	 * calling the function.
@@ -1965,35 +2769,28 @@ dt_aggregate_destroy(dtrace_hdl_t *dtp)
 {
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	dt_ahash_t *hash = &agp->dtat_hash;
-	dt_ahashent_t *h, *next;
-	dtrace_aggdata_t *aggdata;
-	int i, max_cpus = agp->dtat_maxcpu;
+	int i;
 
 	if (hash->dtah_hash == NULL) {
 		assert(hash->dtah_all == NULL);
 	} else {
 		free(hash->dtah_hash);
 
-		for (h = hash->dtah_all; h != NULL; h = next) {
-			next = h->dtahe_nextall;
-
-			aggdata = &h->dtahe_data;
-
-			if (aggdata->dtada_percpu != NULL) {
-				for (i = 0; i < max_cpus; i++)
-					free(aggdata->dtada_percpu[i]);
-				free(aggdata->dtada_percpu);
-			}
-
-			free(aggdata->dtada_data);
-			free(h);
-		}
-
 		hash->dtah_hash = NULL;
 		hash->dtah_all = NULL;
 		hash->dtah_size = 0;
+		hash->dtah_nelems = 0;
+	}
+
+	if (agp->dtat_cache != NULL) {
+		for (i = 0; i < agp->dtat_maxcpu; i++)
+			free(agp->dtat_cache[i].dtac_ents);
+
+		free(agp->dtat_cache);
+		agp->dtat_cache = NULL;
 	}
 
+	dt_aggregate_release(agp);
 	free(agp->dtat_buf.dtbd_data);
 	free(agp->dtat_cpus);
 }
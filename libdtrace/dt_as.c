@@ -52,6 +52,150 @@ dt_irlist_label(dt_irlist_t *dlp)
 	return (dlp->dl_label++);
 }
 
+/*
+ * Describe which fields of an instruction name registers it reads or writes,
+ * using the DT_IRREG_* flags.  Returns -1 for an unknown opcode.
+ */
+int
+dt_irnode_regs(const dt_irnode_t *dip)
+{
+	int regs = 0;
+
+	switch (DIF_INSTR_OP(dip->di_instr)) {
+	case DIF_OP_OR:
+	case DIF_OP_XOR:
+	case DIF_OP_AND:
+	case DIF_OP_SLL:
+	case DIF_OP_SRL:
+	case DIF_OP_SRA:
+	case DIF_OP_SUB:
+	case DIF_OP_ADD:
+	case DIF_OP_MUL:
+		regs |= DT_IRREG_PURE;
+		/*FALLTHRU*/
+	case DIF_OP_SDIV:
+	case DIF_OP_UDIV:
+	case DIF_OP_SREM:
+	case DIF_OP_UREM:
+		regs |= DT_IRREG_R1 | DT_IRREG_R2 | DT_IRREG_DEF;
+		break;
+	case DIF_OP_NOT:
+	case DIF_OP_MOV:
+		regs |= DT_IRREG_PURE | DT_IRREG_R1 | DT_IRREG_DEF;
+		break;
+	case DIF_OP_CMP:
+		regs |= DT_IRREG_PURE;
+		/*FALLTHRU*/
+	case DIF_OP_SCMP:
+		regs |= DT_IRREG_R1 | DT_IRREG_R2 | DT_IRREG_DEFCC;
+		break;
+	case DIF_OP_TST:
+		regs |= DT_IRREG_PURE | DT_IRREG_R1 | DT_IRREG_DEFCC;
+		break;
+	case DIF_OP_BA:
+		break;
+	case DIF_OP_BE:
+	case DIF_OP_BNE:
+	case DIF_OP_BG:
+	case DIF_OP_BGU:
+	case DIF_OP_BGE:
+	case DIF_OP_BGEU:
+	case DIF_OP_BL:
+	case DIF_OP_BLU:
+	case DIF_OP_BLE:
+	case DIF_OP_BLEU:
+		regs |= DT_IRREG_USECC;
+		break;
+	case DIF_OP_LDSB:
+	case DIF_OP_LDSH:
+	case DIF_OP_LDSW:
+	case DIF_OP_LDUB:
+	case DIF_OP_LDUH:
+	case DIF_OP_LDUW:
+	case DIF_OP_LDX:
+	case DIF_OP_ULDSB:
+	case DIF_OP_ULDSH:
+	case DIF_OP_ULDSW:
+	case DIF_OP_ULDUB:
+	case DIF_OP_ULDUH:
+	case DIF_OP_ULDUW:
+	case DIF_OP_ULDX:
+	case DIF_OP_RLDSB:
+	case DIF_OP_RLDSH:
+	case DIF_OP_RLDSW:
+	case DIF_OP_RLDUB:
+	case DIF_OP_RLDUH:
+	case DIF_OP_RLDUW:
+	case DIF_OP_RLDX:
+	case DIF_OP_ALLOCS:
+		regs |= DT_IRREG_R1 | DT_IRREG_DEF;
+		break;
+	case DIF_OP_RET:
+	case DIF_OP_STGS:
+	case DIF_OP_STTS:
+	case DIF_OP_STLS:
+	case DIF_OP_STGAA:
+	case DIF_OP_STTAA:
+		regs |= DT_IRREG_RD;
+		break;
+	case DIF_OP_NOP:
+		regs |= DT_IRREG_PURE;
+		break;
+	case DIF_OP_SETX:
+		if (dip->di_extern == NULL)
+			regs |= DT_IRREG_PURE;
+		regs |= DT_IRREG_DEF;
+		break;
+	case DIF_OP_SETS:
+		regs |= DT_IRREG_PURE | DT_IRREG_DEF;
+		break;
+	case DIF_OP_LDGA:
+	case DIF_OP_LDTA:
+		regs |= DT_IRREG_R2 | DT_IRREG_DEF;
+		break;
+	case DIF_OP_LDGS:
+	case DIF_OP_LDTS:
+	case DIF_OP_LDLS:
+		/*
+		 * Built-in variables may fault or change from one load to
+		 * the next: only user variables are plain loads.
+		 */
+		if (DIF_INSTR_VAR(dip->di_instr) >= DIF_VAR_OTHER_UBASE)
+			regs |= DT_IRREG_PURE;
+		regs |= DT_IRREG_DEF;
+		break;
+	case DIF_OP_CALL:
+	case DIF_OP_LDGAA:
+	case DIF_OP_LDTAA:
+		regs |= DT_IRREG_DEF;
+		break;
+	case DIF_OP_PUSHTR:
+	case DIF_OP_PUSHTV:
+		regs |= DT_IRREG_R2 | DT_IRREG_RD;
+		break;
+	case DIF_OP_POPTS:
+	case DIF_OP_FLUSHTS:
+		break;
+	case DIF_OP_COPYS:
+		regs |= DT_IRREG_R1 | DT_IRREG_R2 | DT_IRREG_RD;
+		break;
+	case DIF_OP_STB:
+	case DIF_OP_STH:
+	case DIF_OP_STW:
+	case DIF_OP_STX:
+		regs |= DT_IRREG_R1 | DT_IRREG_RD;
+		break;
+	case DIF_OP_XLATE:
+	case DIF_OP_XLARG:
+		regs |= DT_IRREG_RD | DT_IRREG_DEF;
+		break;
+	default:
+		return (-1);
+	}
+
+	return (regs);
+}
+
 /*ARGSUSED*/
 static int
 dt_countvar(dt_idhash_t *dhp, dt_ident_t *idp, void *data)
@@ -24,6 +24,14 @@ typedef struct dt_irnode {
 
 #define	DT_LBL_NONE	0		/* no label on this instruction */
 
+#define	DT_IRREG_R1	0x01	/* register read through r1 field */
+#define	DT_IRREG_R2	0x02	/* register read through r2 field */
+#define	DT_IRREG_RD	0x04	/* register read through rd field */
+#define	DT_IRREG_DEF	0x08	/* register written through rd field */
+#define	DT_IRREG_USECC	0x10	/* condition codes read */
+#define	DT_IRREG_DEFCC	0x20	/* condition codes written */
+#define	DT_IRREG_PURE	0x40	/* deletable if results are unused */
+
 typedef struct dt_irlist {
 	dt_irnode_t *dl_list;		/* pointer to first node in list */
 	dt_irnode_t *dl_last;		/* pointer to last node in list */
@@ -35,6 +43,7 @@ extern void dt_irlist_create(dt_irlist_t *);
 extern void dt_irlist_destroy(dt_irlist_t *);
 extern void dt_irlist_append(dt_irlist_t *, dt_irnode_t *);
 extern uint_t dt_irlist_label(dt_irlist_t *);
+extern int dt_irnode_regs(const dt_irnode_t *);
 
 #ifdef	__cplusplus
 }
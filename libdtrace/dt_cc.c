@@ -87,6 +87,8 @@
 #include <dt_ident.h>
 #include <dt_string.h>
 #include <dt_impl.h>
+#include <dt_progcache.h>
+#include <dt_libimage.h>
 
 int yylineno;
 
@@ -883,6 +885,39 @@ dt_action_ftruncate(dtrace_hdl_t *dtp, dt_node_t *dnp, dtrace_stmtdesc_t *sdp)
 	ap->dtad_arg = DT_ACT_FTRUNCATE;
 }
 
+/*
+ * With -xtemporal, every clause records the time at which it fired, so that
+ * dtrace_consume() can merge the records of all CPUs in time order.  The
+ * timestamp is recorded by a library action, which is skipped when the
+ * records are printed.
+ */
+static void
+dt_action_timestamp(dtrace_hdl_t *dtp, dtrace_stmtdesc_t *sdp)
+{
+	dtrace_actdesc_t *ap = dt_stmt_action(dtp, sdp);
+	dtrace_difo_t *dp = dt_zalloc(dtp, sizeof (dtrace_difo_t));
+
+	if (dp == NULL)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
+
+	dp->dtdo_buf = dt_alloc(dtp, sizeof (dif_instr_t) * 2);
+
+	if (dp->dtdo_buf == NULL) {
+		dt_difo_free(dtp, dp);
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
+	}
+
+	/* ldgs	DIF_VAR_TIMESTAMP, %r1 */
+	dp->dtdo_buf[0] = DIF_INSTR_LDV(DIF_OP_LDGS, DIF_VAR_TIMESTAMP, 1);
+	dp->dtdo_buf[1] = DIF_INSTR_RET(1);	/* ret	%r1 */
+	dp->dtdo_len = 2;
+	dp->dtdo_rtype = dt_int_rtype;
+
+	ap->dtad_difo = dp;
+	ap->dtad_kind = DTRACEACT_LIBACT;
+	ap->dtad_arg = DT_ACT_TIMESTAMP;
+}
+
 /*ARGSUSED*/
 static void
 dt_action_stop(dtrace_hdl_t *dtp, dt_node_t *dnp, dtrace_stmtdesc_t *sdp)
@@ -1638,6 +1673,41 @@ dt_compile_one_clause(dtrace_hdl_t *dtp, dt_node_t *cnp, dt_node_t *pnp)
 		dt_stmt_append(sdp, dnp);
 	}
 
+	/*
+	 * Data may not be recorded after a commit(): the committed records
+	 * carry the timestamps of the clauses that speculated them.  A clause
+	 * that only aggregates, or only evaluates D expressions without
+	 * recording them (such as the one added by dt_cse()), records no data
+	 * to put in order, and gets no timestamp either.
+	 */
+	if (dtp->dt_temporal) {
+		dtrace_actdesc_t *ap;
+		int rec = edp->dted_action == NULL;
+
+		for (ap = edp->dted_action; ap != NULL; ap = ap->dtad_next) {
+			if (ap->dtad_kind == DTRACEACT_COMMIT)
+				break;
+
+			if (DTRACEACT_ISAGG(ap->dtad_kind))
+				continue;
+
+			if (ap->dtad_kind == DTRACEACT_DIFEXPR &&
+			    ap->dtad_difo->dtdo_rtype.dtdt_kind ==
+			    DIF_TYPE_CTF &&
+			    ap->dtad_difo->dtdo_rtype.dtdt_size == 0)
+				continue;
+
+			rec = 1;
+		}
+
+		if (ap == NULL && rec) {
+			sdp = dt_stmt_create(dtp, edp, cnp->dn_ctxattr,
+			    _dtrace_defattr);
+			dt_action_timestamp(dtp, sdp);
+			dt_stmt_append(sdp, cnp);
+		}
+	}
+
 	assert(yypcb->pcb_ecbdesc == edp);
 	dt_ecbdesc_release(dtp, edp);
 	dt_endcontext(dtp);
@@ -1686,8 +1756,12 @@ dt_setcontext(dtrace_hdl_t *dtp, dtrace_probedesc_t *pdp)
 	 * (2) The provider exists and has DTRACE_PRIV_PROC privilege.
 	 *
 	 * On an error, dt_pid_create_probes() will set the error message
-	 * and tag -- we just have to longjmp() out of here.
+	 * and tag -- we just have to longjmp() out of here.  Programs that
+	 * may depend on such probes are not kept in the program cache.
 	 */
+	if (isdigit(pdp->dtpd_provider[strlen(pdp->dtpd_provider) - 1]))
+		yypcb->pcb_nocache = 1;
+
 	if (isdigit(pdp->dtpd_provider[strlen(pdp->dtpd_provider) - 1]) &&
 	    ((pvp = dt_provider_lookup(dtp, pdp->dtpd_provider)) == NULL ||
 	    pvp->pv_desc.dtvd_priv.dtpp_flags & DTRACE_PRIV_PROC) &&
@@ -2187,7 +2261,7 @@ dt_lib_depend_sort(dtrace_hdl_t *dtp)
 	return (0);
 }
 
-static void
+void
 dt_lib_depend_free(dtrace_hdl_t *dtp)
 {
 	dt_lib_depend_t *dld, *dlda;
@@ -2227,9 +2301,10 @@ dt_lib_depend_free(dtrace_hdl_t *dtp)
  * compile a library and the error is something other than #pragma D depends_on.
  * Dependency errors are silently ignored to permit a library directory to
  * contain libraries which may not be accessible depending on our privileges.
+ * Each library compiled is added to the library image 'dli'.
  */
 static int
-dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
+dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path, dt_libimage_t *dli)
 {
 	struct dirent *dp;
 	const char *p;
@@ -2240,6 +2315,8 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 	FILE *fp;
 	void *rv;
 	dt_lib_depend_t *dld;
+	char *src;
+	size_t len;
 
 	if ((dirp = opendir(path)) == NULL) {
 		dt_dprintf("skipping lib dir %s: %s\n", path, strerror(errno));
@@ -2293,7 +2370,8 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 	for (dld = dt_list_next(&dtp->dt_lib_dep_sorted); dld != NULL;
 	    dld = dt_list_next(dld)) {
 
-		if ((fp = fopen(dld->dtld_library, "r")) == NULL) {
+		if ((fp = dt_libimage_open(dld->dtld_library, &src,
+		    &len)) == NULL) {
 			dt_dprintf("skipping library %s: %s\n",
 			    dld->dtld_library, strerror(errno));
 			continue;
@@ -2305,16 +2383,20 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 		dtp->dt_filetag = NULL;
 
 		if (pgp == NULL && (dtp->dt_errno != EDT_COMPILER ||
-		    dtp->dt_errtag != dt_errtag(D_PRAGMA_DEPEND)))
+		    dtp->dt_errtag != dt_errtag(D_PRAGMA_DEPEND))) {
+			free(src);
 			goto err;
+		}
 
 		if (pgp == NULL) {
 			dt_dprintf("skipping library %s: %s\n",
 			    dld->dtld_library,
 			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+			free(src);
 		} else {
 			dld->dtld_loaded = B_TRUE;
 			dt_program_destroy(dtp, pgp);
+			dt_libimage_add(dtp, dli, dld->dtld_library, src, len);
 		}
 	}
 
@@ -2381,25 +2463,37 @@ dt_find_kernpath(dtrace_hdl_t *dtp, const char *path)
  * contain inlines and translators that will be cached by the compiler.  We
  * defer this activity until the first compile to permit libdtrace clients to
  * add their own library directories and so that we can properly report errors.
+ * If there is a current library image, the libraries are compiled from it
+ * instead of being looked for; otherwise, a new image is stored.
  */
 static int
 dt_load_libs(dtrace_hdl_t *dtp)
 {
 	dt_dirpath_t *dirp;
+	dt_libimage_t dli;
 
 	if (dtp->dt_cflags & DTRACE_C_NOLIBS)
 		return (0); /* libraries already processed */
 
 	dtp->dt_cflags |= DTRACE_C_NOLIBS;
 
+	switch (dt_libimage_load(dtp, &dli)) {
+	case 0:
+		return (0);
+	case -1:
+		dtp->dt_cflags &= ~DTRACE_C_NOLIBS;
+		return (-1); /* errno is set for us */
+	}
+
 	for (dirp = dt_list_next(&dtp->dt_lib_path);
 	    dirp != NULL; dirp = dt_list_next(dirp)) {
 		char *kdir_path;
 
 		/* Load libs from per-kernel path if available. */
 		if ((kdir_path = dt_find_kernpath(dtp, dirp->dir_path)) != NULL) {
-			if (dt_load_libs_dir(dtp, kdir_path) != 0) {
+			if (dt_load_libs_dir(dtp, kdir_path, &dli) != 0) {
 				dtp->dt_cflags &= ~DTRACE_C_NOLIBS;
+				dt_libimage_fini(dtp, &dli);
 				free(kdir_path);
 				return (-1);
 			}
@@ -2407,12 +2501,15 @@ dt_load_libs(dtrace_hdl_t *dtp)
 		}
 
 		/* Load libs from original path in the list. */
-		if (dt_load_libs_dir(dtp, dirp->dir_path) != 0) {
+		if (dt_load_libs_dir(dtp, dirp->dir_path, &dli) != 0) {
 			dtp->dt_cflags &= ~DTRACE_C_NOLIBS;
+			dt_libimage_fini(dtp, &dli);
 			return (-1); /* errno is set for us */
 		}
 	}
 
+	dt_libimage_store(dtp, &dli);
+	dt_libimage_fini(dtp, &dli);
 	return (0);
 }
 
@@ -2423,6 +2520,7 @@ dt_compile(dtrace_hdl_t *dtp, int context, dtrace_probespec_t pspec, void *arg,
 	dt_node_t *dnp;
 	dt_decl_t *ddp;
 	dt_pcb_t pcb;
+	dt_progcache_t dpc;
 	void *rv = NULL;
 	int err;
 
@@ -2431,17 +2529,34 @@ dt_compile(dtrace_hdl_t *dtp, int context, dtrace_probespec_t pspec, void *arg,
 		return (NULL);
 	}
 
-	if (dt_list_next(&dtp->dt_lib_path) != NULL && dt_load_libs(dtp) != 0)
+	if (fp && (cflags & DTRACE_C_CPP) && (fp = dt_preproc(dtp, fp)) == NULL)
+		return (NULL); /* errno is set for us */
+
+	/*
+	 * A program found in the program cache needs neither the libraries
+	 * nor the compiler.  Its key covers the preprocessed source.
+	 */
+	memset(&dpc, 0, sizeof (dt_progcache_t));
+	if (context == DT_CTX_DPROG && (rv = dt_progcache_lookup(dtp, &dpc,
+	    pspec, cflags, argc, argv, fp, s)) != NULL) {
+		if (fp && (cflags & DTRACE_C_CPP))
+			(void) fclose(fp); /* close dt_preproc() file */
+		return (rv);
+	}
+
+	if (dt_list_next(&dtp->dt_lib_path) != NULL && dt_load_libs(dtp) != 0) {
+		if (fp && (cflags & DTRACE_C_CPP))
+			(void) fclose(fp); /* close dt_preproc() file */
+		dt_progcache_fini(&dpc);
 		return (NULL); /* errno is set for us */
+	}
 
 	(void) ctf_discard(dtp->dt_cdefs->dm_ctfp);
 	(void) ctf_discard(dtp->dt_ddefs->dm_ctfp);
 
 	(void) dt_idhash_iter(dtp->dt_globals, dt_idreset, NULL);
 	(void) dt_idhash_iter(dtp->dt_tls, dt_idreset, NULL);
-
-	if (fp && (cflags & DTRACE_C_CPP) && (fp = dt_preproc(dtp, fp)) == NULL)
-		return (NULL); /* errno is set for us */
+	(void) dt_idhash_iter(dtp->dt_macros, dt_idreset, NULL);
 
 	dt_pcb_push(dtp, &pcb);
 
@@ -2522,6 +2637,11 @@ dt_compile(dtrace_hdl_t *dtp, int context, dtrace_probespec_t pspec, void *arg,
 		if ((yypcb->pcb_prog = dt_program_create(dtp)) == NULL)
 			longjmp(yypcb->pcb_jmpbuf, dtrace_errno(dtp));
 
+		if (yypcb->pcb_cflags & DTRACE_C_CSE) {
+			dt_cse(yypcb);
+			dnp = yypcb->pcb_root->dn_list;
+		}
+
 		for (; dnp != NULL; dnp = dnp->dn_list) {
 			switch (dnp->dn_kind) {
 			case DT_NODE_CLAUSE:
@@ -2532,6 +2652,7 @@ dt_compile(dtrace_hdl_t *dtp, int context, dtrace_probespec_t pspec, void *arg,
 					dt_compile_xlator(dnp);
 				break;
 			case DT_NODE_PROVIDER:
+				yypcb->pcb_nocache = 1;
 				(void) dt_node_cook(dnp, DT_IDFLG_REF);
 				break;
 			}
@@ -2580,6 +2701,10 @@ out:
 	if (yypcb->pcb_fileptr && (cflags & DTRACE_C_CPP))
 		(void) fclose(yypcb->pcb_fileptr); /* close dt_preproc() file */
 
+	if (err == 0 && context == DT_CTX_DPROG)
+		dt_progcache_store(dtp, &dpc, yypcb, rv);
+
+	dt_progcache_fini(&dpc);
 	dt_pcb_pop(dtp, err);
 	(void) dt_set_errno(dtp, err);
 	return (err ? NULL : rv);
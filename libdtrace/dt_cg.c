@@ -1882,7 +1882,7 @@ dt_cg(dt_pcb_t *pcb, dt_node_t *dnp)
 	dt_xlator_t *dxp = NULL;
 
 	if (pcb->pcb_regs == NULL && (pcb->pcb_regs =
-	    dt_regset_create(pcb->pcb_hdl->dt_conf.dtc_difintregs)) == NULL)
+	    dt_regset_create(DT_REGSET_VREGS)) == NULL)
 		longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
 
 	dt_regset_reset(pcb->pcb_regs);
@@ -1913,7 +1913,8 @@ dt_cg(dt_pcb_t *pcb, dt_node_t *dnp)
 
 	/*
 	 * If we're generating code for a translator body, assign the input
-	 * parameter to the first available register (i.e. caller passes %r1).
+	 * parameter to the first available register (i.e. caller passes %r1):
+	 * dt_regset_assign() keeps registers live on entry where they are.
 	 */
 	if (dnp->dn_kind == DT_NODE_MEMBER) {
 		dxp = dnp->dn_membxlator;
@@ -1933,4 +1934,9 @@ dt_cg(dt_pcb_t *pcb, dt_node_t *dnp)
 		dxp->dx_ident->di_id = 0;
 		dxp->dx_ident->di_flags &= ~DT_IDFLG_CGREG;
 	}
+
+	dt_regset_assign(pcb);
+
+	if (!(pcb->pcb_cflags & DTRACE_C_NOOPT))
+		dt_difopt(pcb);
 }
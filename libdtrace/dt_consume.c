@@ -20,6 +20,15 @@
 
 #define	DT_MASK_LO 0x00000000FFFFFFFFULL
 
+#define	DT_WAKEFILL	50	/* wakeup fill threshold (percent) */
+#define	DT_WAKEFILL_MIN	(NANOSEC / 1000) /* shortest predicted wakeup */
+#define	DT_WAKEFILL_FIRST (NANOSEC / 100) /* first look after going */
+
+#define	DT_AUTOSWITCH_HIWAT	50	/* speed up above (percent) */
+#define	DT_AUTOSWITCH_LOWAT	10	/* back off below (percent) */
+#define	DT_AUTOSWITCH_MIN	(NANOSEC / MILLISEC) /* fastest rate */
+#define	DT_AUTOSWITCH_MAX	NANOSEC	/* slowest switchrate */
+
 /*
  * We declare this here because (1) we need it and (2) we want to avoid a
  * dependency on libm in libdtrace.
@@ -1034,8 +1043,6 @@ int
 dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
     caddr_t addr, int depth, int size)
 {
-	dtrace_syminfo_t dts;
-	GElf_Sym sym;
 	int i, indent;
 	char c[PATH_MAX * 2];
 	uint64_t pc;
@@ -1075,29 +1082,7 @@ dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		if (dt_printf(dtp, fp, "%*s", indent, "") < 0)
 			return (-1);
 
-		if (dtrace_lookup_by_addr(dtp, pc, &sym, &dts) == 0) {
-			if (pc > sym.st_value) {
-				(void) snprintf(c, sizeof (c), "%s`%s+0x%llx",
-				    dts.dts_object, dts.dts_name,
-				    (long long unsigned) pc - sym.st_value);
-			} else {
-				(void) snprintf(c, sizeof (c), "%s`%s",
-				    dts.dts_object, dts.dts_name);
-			}
-		} else {
-			/*
-			 * We'll repeat the lookup, but this time we'll specify
-			 * a NULL GElf_Sym -- indicating that we're only
-			 * interested in the containing module.
-			 */
-			if (dtrace_lookup_by_addr(dtp, pc, NULL, &dts) == 0) {
-				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dts.dts_object, (long long unsigned) pc);
-			} else {
-				(void) snprintf(c, sizeof (c), "0x%llx",
-				    (long long unsigned) pc);
-			}
-		}
+		(void) dtrace_addr2str(dtp, pc, c, sizeof (c));
 
 		if (dt_printf(dtp, fp, format, c) < 0)
 			return (-1);
@@ -1121,8 +1106,9 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	const char *str = strsize ? strbase : NULL;
 	int err = 0;
 
-	char name[PATH_MAX], objname[PATH_MAX], c[PATH_MAX * 2];
-	GElf_Sym sym;
+	char c[PATH_MAX * 2];
+	prsymaddr_t *psa = NULL;
+	char **syms = NULL;
 	int i, indent;
 	pid_t pid = -1, tgid;
 
@@ -1151,6 +1137,29 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
 		    DTRACE_PROC_SHORTLIVED);
 
+	/*
+	 * Resolve all the frames up front, in one trip through libproc,
+	 * rather than going back to the process for every frame.
+	 */
+	if (pid >= 0) {
+		uint32_t n;
+
+		psa = dt_zalloc(dtp, depth * sizeof (prsymaddr_t));
+		syms = dt_zalloc(dtp, depth * sizeof (char *));
+		if (psa == NULL || syms == NULL) {
+			err = -1;
+			goto out;
+		}
+
+		for (n = 0; n < depth && pc[n] != 0; n++)
+			psa[n].psa_addr = pc[n];
+
+		if (dtp->dt_options[DTRACEOPT_NORESOLVE] != DTRACEOPT_UNSET)
+			(void) dt_Plookup_by_addrs(dtp, pid, psa, n);
+		else
+			(void) dt_uaddrs2sym(dtp, pid, psa, syms, n);
+	}
+
 	for (i = 0; i < depth && pc[i] != 0; i++) {
 		const prmap_t *map;
 
@@ -1158,38 +1167,26 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 			break;
 		if (dtp->dt_options[DTRACEOPT_NORESOLVE] != DTRACEOPT_UNSET
 		    && pid >= 0) {
-			if (dt_Pobjname(dtp, pid, pc[i], objname,
-			    sizeof(objname)) != NULL) {
-				const prmap_t *pmap = NULL;
+			if (psa[i].psa_object != NULL) {
+				const prmap_t *pmap = psa[i].psa_map;
 				uint64_t offset = pc[i];
 
-				pmap = dt_Paddr_to_map(dtp, pid, pc[i]);
-
 				if (pmap)
 					offset = pc[i] - pmap->pr_vaddr;
 
 				(void) snprintf(c, sizeof(c), "%s:0x%llx",
-				    dt_basename(objname), (u_longlong_t)offset);
+				    dt_basename((char *)psa[i].psa_object),
+				    (u_longlong_t)offset);
 
 			} else
 				(void) snprintf(c, sizeof(c), "0x%llx",
 				    (u_longlong_t)pc[i]);
 
-		} else if (pid >= 0 && dt_Plookup_by_addr(dtp, pid, pc[i],
-		    name, sizeof (name), &sym) == 0) {
-			(void) dt_Pobjname(dtp, pid, pc[i], objname, sizeof (objname));
-
-			if (pc[i] > sym.st_value) {
-				(void) snprintf(c, sizeof (c),
-				    "%s`%s+0x%llx", dt_basename(objname), name,
-				    (u_longlong_t)(pc[i] - sym.st_value));
-			} else {
-				(void) snprintf(c, sizeof (c),
-				    "%s`%s", dt_basename(objname), name);
-			}
+		} else if (pid >= 0 && syms[i] != NULL) {
+			(void) snprintf(c, sizeof (c), "%s", syms[i]);
 		} else if (str != NULL && str[0] != '\0' && str[0] != '@' &&
 		    (pid >= 0 &&
-			((map = dt_Paddr_to_map(dtp, pid, pc[i])) == NULL ||
+			((map = psa[i].psa_map) == NULL ||
 			    (map->pr_mflags & MA_WRITE)))) {
 			/*
 			 * If the current string pointer in the string table
@@ -1206,10 +1203,10 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 			 */
 			(void) snprintf(c, sizeof (c), "%s", str);
 		} else {
-			if (pid >= 0 && dt_Pobjname(dtp, pid, pc[i], objname,
-			    sizeof (objname)) != NULL) {
+			if (pid >= 0 && psa[i].psa_object != NULL) {
 				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dt_basename(objname), (u_longlong_t)pc[i]);
+				    dt_basename((char *)psa[i].psa_object),
+				    (u_longlong_t)pc[i]);
 			} else {
 				(void) snprintf(c, sizeof (c), "0x%llx",
 				    (u_longlong_t)pc[i]);
@@ -1248,6 +1245,14 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		}
 	}
 
+out:
+	if (syms != NULL) {
+		for (i = 0; i < depth; i++)
+			free(syms[i]);
+	}
+	dt_free(dtp, syms);
+	dt_free(dtp, psa);
+
 	if (pid >= 0)
 		dt_proc_release_unlock(dtp, pid);
 
@@ -1538,38 +1543,13 @@ dt_clear_agg(const dtrace_aggdata_t *aggdata, void *arg)
 	return (DTRACE_AGGWALK_CLEAR);
 }
 
-typedef struct dt_trunc {
-	dtrace_aggvarid_t dttd_id;
-	uint64_t dttd_remaining;
-} dt_trunc_t;
-
-static int
-dt_trunc_agg(const dtrace_aggdata_t *aggdata, void *arg)
-{
-	dt_trunc_t *trunc = arg;
-	dtrace_aggdesc_t *agg = aggdata->dtada_desc;
-	dtrace_aggvarid_t id = trunc->dttd_id;
-
-	if (agg->dtagd_nrecs == 0)
-		return (DTRACE_AGGWALK_NEXT);
-
-	if (agg->dtagd_varid != id)
-		return (DTRACE_AGGWALK_NEXT);
-
-	if (trunc->dttd_remaining == 0)
-		return (DTRACE_AGGWALK_REMOVE);
-
-	trunc->dttd_remaining--;
-	return (DTRACE_AGGWALK_NEXT);
-}
-
 static int
 dt_trunc(dtrace_hdl_t *dtp, caddr_t base, dtrace_recdesc_t *rec)
 {
-	dt_trunc_t trunc;
+	dtrace_aggvarid_t id;
 	caddr_t addr;
 	int64_t remaining;
-	int (*func)(dtrace_hdl_t *, dtrace_aggregate_f *, void *);
+	int rev = 0;
 
 	/*
 	 * We (should) have two records:  the aggregation ID followed by the
@@ -1582,7 +1562,7 @@ dt_trunc(dtrace_hdl_t *dtp, caddr_t base, dtrace_recdesc_t *rec)
 		return (dt_set_errno(dtp, EDT_BADTRUNC));
 
 	/* LINTED - alignment */
-	trunc.dttd_id = *((dtrace_aggvarid_t *)addr);
+	id = *((dtrace_aggvarid_t *)addr);
 	rec++;
 
 	if (rec->dtrd_action != DTRACEACT_LIBACT)
@@ -1614,16 +1594,16 @@ dt_trunc(dtrace_hdl_t *dtp, caddr_t base, dtrace_recdesc_t *rec)
 	}
 
 	if (remaining < 0) {
-		func = dtrace_aggregate_walk_valsorted;
+		rev = 1;
 		remaining = -remaining;
-	} else {
-		func = dtrace_aggregate_walk_valrevsorted;
 	}
 
 	assert(remaining >= 0);
-	trunc.dttd_remaining = remaining;
 
-	(void) func(dtp, dt_trunc_agg, &trunc);
+	/*
+	 * Only the entries to keep need to be found; nothing is sorted.
+	 */
+	(void) dt_aggregate_trunc(dtp, id, (uint64_t)remaining, rev);
 
 	return (0);
 }
@@ -1842,6 +1822,161 @@ dt_setopt(dtrace_hdl_t *dtp, const dtrace_probedata_t *data,
 	return (rval);
 }
 
+/*
+ * Note how full a principal buffer snapshot was.  Only the fullest buffer in
+ * each round matters for predicting the next wakeup; -xswitchrate=auto also
+ * keeps track of fill and drops by CPU.  This must be called before the
+ * snapshot is consumed, since consuming it zeroes the drops.
+ */
+static void
+dt_consume_fill(dtrace_hdl_t *dtp, const dtrace_bufdesc_t *buf)
+{
+	dt_bufstat_t *bs;
+
+	if (buf->dtbd_size > dtp->dt_fillmax)
+		dtp->dt_fillmax = buf->dtbd_size;
+
+	if (dtp->dt_bufstats == NULL ||
+	    buf->dtbd_cpu >= dtp->dt_conf.dtc_maxbufs)
+		return;
+
+	bs = &dtp->dt_bufstats[buf->dtbd_cpu];
+	if (buf->dtbd_size > bs->dtbs_fill)
+		bs->dtbs_fill = buf->dtbd_size;
+	bs->dtbs_drops += buf->dtbd_drops;
+	bs->dtbs_total += buf->dtbd_drops;
+}
+
+/*
+ * With -xswitchrate=auto, adjust the switchrate at the end of each round:
+ * halve it if any buffer dropped or was more than DT_AUTOSWITCH_HIWAT percent
+ * full, double it if every buffer was less than DT_AUTOSWITCH_LOWAT percent
+ * full.  Drops also mean the buffer is too small for any switchrate we are
+ * willing to use, so a larger bufsize is suggested for the next run.  Each
+ * decision is logged, along with the observations that prompted it.
+ */
+static int
+dt_consume_autoswitch(dtrace_hdl_t *dtp)
+{
+	dtrace_optval_t bufsize = dtp->dt_options[DTRACEOPT_BUFSIZE];
+	dtrace_optval_t rate = dtp->dt_options[DTRACEOPT_SWITCHRATE];
+	dtrace_optval_t nrate = rate;
+	processorid_t cpu, fcpu = 0, dcpu = 0;
+	uint64_t fill = 0, drops = 0, pct;
+	dt_bufstat_t *bs;
+	char msg[128];
+
+	for (cpu = 0; cpu < dtp->dt_conf.dtc_maxbufs; cpu++) {
+		bs = &dtp->dt_bufstats[cpu];
+
+		if (bs->dtbs_fill > fill) {
+			fill = bs->dtbs_fill;
+			fcpu = cpu;
+		}
+
+		if (bs->dtbs_drops > drops) {
+			drops = bs->dtbs_drops;
+			dcpu = cpu;
+		}
+
+		bs->dtbs_fill = 0;
+		bs->dtbs_drops = 0;
+	}
+
+	if (bufsize <= 0 || rate <= 0)
+		return (0);
+
+	pct = fill * 100 / bufsize;
+
+	if (drops != 0 || pct > DT_AUTOSWITCH_HIWAT)
+		nrate = rate / 2;
+	else if (pct < DT_AUTOSWITCH_LOWAT)
+		nrate = rate * 2;
+
+	if (nrate < DT_AUTOSWITCH_MIN)
+		nrate = DT_AUTOSWITCH_MIN;
+	if (nrate > DT_AUTOSWITCH_MAX)
+		nrate = DT_AUTOSWITCH_MAX;
+
+	if (nrate != rate) {
+		dtp->dt_options[DTRACEOPT_SWITCHRATE] = nrate;
+
+		(void) snprintf(msg, sizeof (msg), "switchrate %lluns -> "
+		    "%lluns (CPU %d %llu%% full, %llu drops)\n",
+		    (unsigned long long)rate, (unsigned long long)nrate,
+		    drops != 0 ? dcpu : fcpu, (unsigned long long)pct,
+		    (unsigned long long)drops);
+
+		if (dt_handle_autoswitch(dtp, drops != 0 ? dcpu : fcpu,
+		    drops, msg) != 0)
+			return (-1); /* errno is set for us */
+	}
+
+	if (drops == 0 || dtp->dt_autobufsize >= (uint64_t)bufsize * 2)
+		return (0);
+
+	dtp->dt_autobufsize = (uint64_t)bufsize * 2;
+
+	(void) snprintf(msg, sizeof (msg), "suggest -x bufsize=%llu "
+	    "(%llu drops on CPU %d, %llu in all)\n",
+	    (unsigned long long)dtp->dt_autobufsize,
+	    (unsigned long long)drops, dcpu,
+	    (unsigned long long)dtp->dt_bufstats[dcpu].dtbs_total);
+
+	return (dt_handle_autoswitch(dtp, dcpu, drops, msg));
+}
+
+/*
+ * Once a round of consumption is complete, predict when the fullest buffer
+ * will next be DT_WAKEFILL percent full if it keeps filling at the rate seen
+ * since the previous round.  A consumer waiting on dtrace_wakeup_fd() is
+ * woken then, so a bursty buffer is drained before it drops rather than a
+ * full switchrate later.  Without a rate to go on, the next look is taken
+ * shortly after the first round and then twice as far out after each idle
+ * one, so an idle consumer soon sleeps for the whole switchrate.
+ */
+static void
+dt_consume_predict(dtrace_hdl_t *dtp, hrtime_t now)
+{
+	uint64_t thresh = dtp->dt_options[DTRACEOPT_BUFSIZE] * DT_WAKEFILL / 100;
+	hrtime_t last = dtp->dt_filllast;
+	uint64_t fill = dtp->dt_fillmax;
+	hrtime_t wait;
+
+	dtp->dt_wakefill = 0;
+	dtp->dt_fillmax = 0;
+	dtp->dt_filllast = now;
+
+	if (dtp->dt_wakefd == -1)
+		return;
+
+	if (last == 0 || now <= last)
+		wait = DT_WAKEFILL_FIRST;
+	else if (fill == 0)
+		wait = 2 * (now - last);
+	else
+		wait = (hrtime_t)((double)(now - last) * thresh / fill);
+
+	if (wait < DT_WAKEFILL_MIN)
+		wait = DT_WAKEFILL_MIN;
+
+	dtp->dt_wakefill = now + wait;
+}
+
+/*
+ * Called once a round of consumption has completed without error.
+ */
+static int
+dt_consume_done(dtrace_hdl_t *dtp, hrtime_t now)
+{
+	dt_consume_predict(dtp, now);
+
+	if (dtp->dt_bufstats == NULL || dtp->dt_stopped)
+		return (0);
+
+	return (dt_consume_autoswitch(dtp));
+}
+
 static int
 dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, int cpu, dtrace_bufdesc_t *buf,
     dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc, void *arg)
@@ -2473,6 +2608,549 @@ dt_consume_begin(dtrace_hdl_t *dtp, FILE *fp, dtrace_bufdesc_t *buf,
 	return (rval);
 }
 
+/*
+ * Temporal ordering.  With -xtemporal, every clause that records data also
+ * records the time at which it fired (see dt_action_timestamp() in dt_cc.c).
+ * Each pass through dtrace_consume() snapshots every CPU's buffer, walks each
+ * CPU's records with a cursor, and merges the cursors through a binary
+ * min-heap keyed on the timestamps, so that records are delivered in time
+ * order regardless of the CPU they were recorded on.
+ *
+ * The buffers are not all snapshotted at the same time, so a CPU snapshotted
+ * early may still record events older than the newest records of a CPU
+ * snapshotted late.  The kernel stamps every snapshot with the time of the
+ * buffer switch, and records newer than the earliest of these stamps are held
+ * back, in dt_temphold, until the next pass puts them in front of that CPU's
+ * new records.  Only the pass after tracing has stopped delivers everything.
+ *
+ * Records older than the last record delivered by a previous pass can no
+ * longer be put in order: they are delivered at once and counted as late, and
+ * the count is reported through the drop handler.  Records without a
+ * timestamp (those of committing clauses) are not ordered: they are delivered
+ * as soon as their CPU's cursor reaches them.  The records of BEGIN and END
+ * always sort first and last, respectively.
+ */
+typedef struct dt_tcursor {
+	dtrace_bufdesc_t dttc_buf;	/* held records, then the snapshot */
+	size_t dttc_offs;		/* offset of the current record */
+	dtrace_eprobedesc_t *dttc_epd;	/* description of current record */
+	int dttc_order;			/* -1 for BEGIN, 1 for END, else 0 */
+	int dttc_timed;			/* boolean: record has a timestamp */
+	hrtime_t dttc_ts;		/* timestamp of current record */
+	uint64_t dttc_late;		/* number of records out of order */
+} dt_tcursor_t;
+
+/*
+ * Append the bytes of 'src' in [offs, end) to the buffer at 'dst', which holds
+ * 'len' bytes, first padding it with DTRACE_EPIDNONE so that the records keep
+ * the alignment they have in 'src'.  Returns the new length.
+ */
+static size_t
+dt_temporal_append(caddr_t dst, size_t len, caddr_t src, size_t offs,
+    size_t end)
+{
+	for (; (len & (sizeof (uint64_t) - 1)) !=
+	    (offs & (sizeof (uint64_t) - 1)); len += sizeof (dtrace_epid_t))
+		/* LINTED - alignment */
+		*(dtrace_epid_t *)(dst + len) = DTRACE_EPIDNONE;
+
+	memcpy(dst + len, src + offs, end - offs);
+
+	return (len + end - offs);
+}
+
+/*
+ * Move the cursor to the first record at or after its current offset, and
+ * compute its sort key.  Returns 1 if there is such a record, 0 if the buffer
+ * is exhausted, and -1 on error.
+ */
+static int
+dt_temporal_next(dtrace_hdl_t *dtp, dt_tcursor_t *cur, hrtime_t horizon)
+{
+	dtrace_bufdesc_t *buf = &cur->dttc_buf;
+	dtrace_probedesc_t *pd;
+	dtrace_epid_t id;
+	caddr_t base;
+	int i;
+
+	for (;;) {
+		if (cur->dttc_offs >= buf->dtbd_size)
+			return (0);
+
+		id = *(uint32_t *)((uintptr_t)buf->dtbd_data + cur->dttc_offs);
+
+		if (id != DTRACE_EPIDNONE)
+			break;
+
+		cur->dttc_offs += sizeof (id);
+	}
+
+	if (dt_epid_lookup(dtp, id, &cur->dttc_epd, &pd) != 0)
+		return (-1);
+
+	cur->dttc_order = 0;
+	if (strcmp(pd->dtpd_provider, "dtrace") == 0) {
+		if (strcmp(pd->dtpd_name, "BEGIN") == 0)
+			cur->dttc_order = -1;
+		else if (strcmp(pd->dtpd_name, "END") == 0)
+			cur->dttc_order = 1;
+	}
+
+	cur->dttc_timed = 0;
+	cur->dttc_ts = 0;
+
+	base = buf->dtbd_data + cur->dttc_offs;
+	for (i = 0; i < cur->dttc_epd->dtepd_nrecs; i++) {
+		dtrace_recdesc_t *rec = &cur->dttc_epd->dtepd_rec[i];
+
+		if (rec->dtrd_action == DTRACEACT_LIBACT &&
+		    rec->dtrd_arg == DT_ACT_TIMESTAMP) {
+			/* LINTED - alignment */
+			cur->dttc_ts = *((hrtime_t *)(base +
+			    rec->dtrd_offset));
+			cur->dttc_timed = 1;
+			break;
+		}
+	}
+
+	if (cur->dttc_timed && cur->dttc_order == 0 && cur->dttc_ts < horizon) {
+		cur->dttc_late++;
+		cur->dttc_ts = horizon;
+	}
+
+	return (1);
+}
+
+static int
+dt_temporal_cmp(const dt_tcursor_t *a, const dt_tcursor_t *b)
+{
+	if (a->dttc_order != b->dttc_order)
+		return (a->dttc_order < b->dttc_order ? -1 : 1);
+
+	if (a->dttc_ts != b->dttc_ts)
+		return (a->dttc_ts < b->dttc_ts ? -1 : 1);
+
+	/*
+	 * Break ties by CPU, so that the output is deterministic.
+	 */
+	if (a->dttc_buf.dtbd_cpu != b->dttc_buf.dtbd_cpu)
+		return (a->dttc_buf.dtbd_cpu < b->dttc_buf.dtbd_cpu ? -1 : 1);
+
+	return (0);
+}
+
+static void
+dt_temporal_siftdown(dt_tcursor_t **heap, int n, int i)
+{
+	dt_tcursor_t *tmp;
+	int l, r, min;
+
+	for (;;) {
+		l = 2 * i + 1;
+		r = l + 1;
+		min = i;
+
+		if (l < n && dt_temporal_cmp(heap[l], heap[min]) < 0)
+			min = l;
+		if (r < n && dt_temporal_cmp(heap[r], heap[min]) < 0)
+			min = r;
+
+		if (min == i)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/*
+ * Hold back the records of a cursor from its current offset on, for the next
+ * pass.
+ */
+static int
+dt_temporal_hold(dtrace_hdl_t *dtp, dt_tcursor_t *cur)
+{
+	dtrace_bufdesc_t *held = &dtp->dt_temphold[cur->dttc_buf.dtbd_cpu];
+	size_t len = cur->dttc_buf.dtbd_size - cur->dttc_offs;
+
+	if ((held->dtbd_data = dt_alloc(dtp, len + sizeof (uint64_t))) == NULL)
+		return (-1); /* errno is set for us */
+
+	held->dtbd_size = dt_temporal_append(held->dtbd_data, 0,
+	    cur->dttc_buf.dtbd_data, cur->dttc_offs, cur->dttc_buf.dtbd_size);
+
+	return (0);
+}
+
+static int
+dt_consume_temporal(dtrace_hdl_t *dtp, FILE *fp, int max_ncpus,
+    dtrace_consume_probe_f *pf, dtrace_consume_rec_f *rf, void *arg)
+{
+	dtrace_bufdesc_t *buf = &dtp->dt_buf;
+	dtrace_bufdesc_t one, *held;
+	dt_tcursor_t *curs, *cur, **heap;
+	hrtime_t horizon = dtp->dt_templast;
+	hrtime_t watermark = INT64_MAX;
+	int i, n = 0, ncurs = 0, rval = 0;
+	size_t size;
+
+	if (dtp->dt_temphold == NULL) {
+		if ((dtp->dt_temphold = dt_zalloc(dtp,
+		    max_ncpus * sizeof (dtrace_bufdesc_t))) == NULL)
+			return (-1); /* errno is set for us */
+
+		dtp->dt_ntemphold = max_ncpus;
+	}
+
+	curs = dt_zalloc(dtp, max_ncpus * sizeof (dt_tcursor_t));
+	heap = dt_zalloc(dtp, max_ncpus * sizeof (dt_tcursor_t *));
+	if (curs == NULL || heap == NULL) {
+		rval = -1; /* errno is set for us */
+		goto out;
+	}
+
+	for (i = 0; i < max_ncpus && i < dtp->dt_ntemphold; i++) {
+		held = &dtp->dt_temphold[i];
+		buf->dtbd_cpu = i;
+		buf->dtbd_size = 0;
+		buf->dtbd_drops = 0;
+		buf->dtbd_oldest = 0;
+
+		if (dt_ioctl(dtp, DTRACEIOC_BUFSNAP, buf) == -1) {
+			/*
+			 * If we failed with ENOENT, it may be because the
+			 * CPU was unconfigured -- this is okay, and there
+			 * may still be records held back for it.  Any other
+			 * error, however, is unexpected.
+			 */
+			if (errno != ENOENT) {
+				rval = dt_set_errno(dtp, errno);
+				goto out;
+			}
+
+			buf->dtbd_size = 0;
+			buf->dtbd_drops = 0;
+		} else {
+			dt_consume_fill(dtp, buf);
+
+			if (buf->dtbd_timestamp < watermark)
+				watermark = buf->dtbd_timestamp;
+		}
+
+		if (held->dtbd_size == 0 && buf->dtbd_size == 0 &&
+		    buf->dtbd_drops == 0)
+			continue;
+
+		/*
+		 * The cursor walks the records held back for this CPU, then
+		 * the snapshot, whose records start at the oldest one if the
+		 * buffer is a ring.
+		 */
+		cur = &curs[ncurs];
+		cur->dttc_buf = *buf;
+		cur->dttc_buf.dtbd_oldest = 0;
+		size = held->dtbd_size + buf->dtbd_size + 3 * sizeof (uint64_t);
+
+		if ((cur->dttc_buf.dtbd_data = dt_alloc(dtp, size)) == NULL) {
+			rval = -1; /* errno is set for us */
+			goto out;
+		}
+
+		ncurs++;
+		size = dt_temporal_append(cur->dttc_buf.dtbd_data, 0,
+		    held->dtbd_data, 0, held->dtbd_size);
+		size = dt_temporal_append(cur->dttc_buf.dtbd_data, size,
+		    buf->dtbd_data, buf->dtbd_oldest, buf->dtbd_size);
+		size = dt_temporal_append(cur->dttc_buf.dtbd_data, size,
+		    buf->dtbd_data, 0, buf->dtbd_oldest);
+		cur->dttc_buf.dtbd_size = size;
+
+		dt_free(dtp, held->dtbd_data);
+		held->dtbd_data = NULL;
+		held->dtbd_size = 0;
+
+		if ((rval = dt_temporal_next(dtp, cur, horizon)) < 0)
+			goto out;
+
+		if (rval > 0)
+			heap[n++] = cur;
+	}
+
+	/*
+	 * Once tracing has stopped, no record can come in that is older than
+	 * those already snapshotted.
+	 */
+	if (dtp->dt_stopped)
+		watermark = INT64_MAX;
+
+	rval = 0;
+	for (i = n / 2 - 1; i >= 0; i--)
+		dt_temporal_siftdown(heap, n, i);
+
+	while (n > 0) {
+		cur = heap[0];
+
+		/*
+		 * Every other cursor is at a record that sorts after this one,
+		 * so if this one is held back, they all are.
+		 */
+		if (cur->dttc_timed && cur->dttc_order >= 0 &&
+		    cur->dttc_ts > watermark)
+			break;
+
+		/*
+		 * Hand dt_consume_cpu() a buffer holding just this record.
+		 */
+		one = cur->dttc_buf;
+		one.dtbd_data = cur->dttc_buf.dtbd_data + cur->dttc_offs;
+		one.dtbd_size = cur->dttc_epd->dtepd_size;
+		one.dtbd_oldest = 0;
+		one.dtbd_drops = 0;
+
+		if ((rval = dt_consume_cpu(dtp, fp, cur->dttc_buf.dtbd_cpu,
+		    &one, pf, rf, arg)) != 0)
+			goto out;
+
+		if (cur->dttc_timed && cur->dttc_order == 0)
+			dtp->dt_templast = cur->dttc_ts;
+
+		cur->dttc_offs += cur->dttc_epd->dtepd_size;
+
+		if ((rval = dt_temporal_next(dtp, cur, horizon)) < 0)
+			goto out;
+
+		if (rval == 0)
+			heap[0] = heap[--n];
+
+		dt_temporal_siftdown(heap, n, 0);
+	}
+
+	for (i = 0; i < n; i++) {
+		if ((rval = dt_temporal_hold(dtp, heap[i])) != 0)
+			goto out;
+	}
+
+	rval = 0;
+	for (i = 0; i < ncurs; i++) {
+		cur = &curs[i];
+
+		if (cur->dttc_buf.dtbd_drops != 0 &&
+		    (rval = dt_handle_cpudrop(dtp, cur->dttc_buf.dtbd_cpu,
+		    DTRACEDROP_PRINCIPAL, cur->dttc_buf.dtbd_drops)) != 0)
+			break;
+
+		if (cur->dttc_late != 0 &&
+		    (rval = dt_handle_cpudrop(dtp, cur->dttc_buf.dtbd_cpu,
+		    DTRACEDROP_LATE, cur->dttc_late)) != 0)
+			break;
+	}
+
+out:
+	if (curs != NULL) {
+		for (i = 0; i < ncurs; i++)
+			dt_free(dtp, curs[i].dttc_buf.dtbd_data);
+	}
+	dt_free(dtp, curs);
+	dt_free(dtp, heap);
+
+	return (rval);
+}
+
+/*
+ * Parallel buffer snapshotting.  When -xconsumethreads is set, a pool of
+ * worker threads issues DTRACEIOC_BUFSNAP for successive CPUs into a ring of
+ * private buffers, while the calling thread consumes the snapshots strictly
+ * in CPU order.  Only the snapshots run concurrently: record processing calls
+ * back into the consumer and touches handle state, so it stays serialized in
+ * the calling thread, and the output is identical to that of the serial loop.
+ * The ring holds two buffers per worker, which bounds memory use to a small
+ * multiple of the bufsize no matter how many CPUs there are.
+ */
+#define	DT_CSLOT_FREE	0	/* slot may be claimed by a worker */
+#define	DT_CSLOT_BUSY	1	/* worker is snapshotting into this slot */
+#define	DT_CSLOT_READY	2	/* snapshot is ready for consumption */
+
+typedef struct dt_cslot {
+	dtrace_bufdesc_t dtcs_buf;	/* private snapshot buffer */
+	processorid_t dtcs_cpu;		/* CPU held in this slot */
+	int dtcs_state;			/* slot state (see above) */
+	int dtcs_err;			/* errno from snapshot, if any */
+} dt_cslot_t;
+
+typedef struct dt_cpool {
+	dtrace_hdl_t *dtcp_hdl;		/* DTrace handle */
+	pthread_mutex_t dtcp_lock;	/* protects all fields below */
+	pthread_cond_t dtcp_cv;		/* signalled on any slot change */
+	dt_cslot_t *dtcp_slots;		/* ring of snapshot slots */
+	int dtcp_nslots;		/* number of slots in ring */
+	processorid_t dtcp_next;	/* next CPU to hand to a worker */
+	processorid_t dtcp_max;		/* one past the last CPU */
+	processorid_t dtcp_skip;	/* CPU not to snapshot, or -1 */
+	int dtcp_abort;			/* boolean: stop handing out CPUs */
+} dt_cpool_t;
+
+static void *
+dt_consume_snap_worker(void *arg)
+{
+	dt_cpool_t *pool = arg;
+	dt_cslot_t *slot;
+	processorid_t cpu;
+	int err;
+
+	pthread_mutex_lock(&pool->dtcp_lock);
+	for (;;) {
+		while (!pool->dtcp_abort && pool->dtcp_next < pool->dtcp_max &&
+		    pool->dtcp_slots[pool->dtcp_next % pool->dtcp_nslots]
+		    .dtcs_state != DT_CSLOT_FREE)
+			pthread_cond_wait(&pool->dtcp_cv, &pool->dtcp_lock);
+
+		if (pool->dtcp_abort || pool->dtcp_next >= pool->dtcp_max)
+			break;
+
+		cpu = pool->dtcp_next++;
+		slot = &pool->dtcp_slots[cpu % pool->dtcp_nslots];
+		slot->dtcs_state = DT_CSLOT_BUSY;
+		slot->dtcs_cpu = cpu;
+		pthread_mutex_unlock(&pool->dtcp_lock);
+
+		/*
+		 * The CPU being skipped is reported as unconfigured, which the
+		 * consuming side already knows to pass over.  Either way, the
+		 * slot must not keep the size of the CPU it held before.
+		 */
+		err = 0;
+		slot->dtcs_buf.dtbd_size = 0;
+		slot->dtcs_buf.dtbd_drops = 0;
+		if (cpu == pool->dtcp_skip)
+			err = ENOENT;
+		else {
+			slot->dtcs_buf.dtbd_cpu = cpu;
+			if (dt_ioctl(pool->dtcp_hdl, DTRACEIOC_BUFSNAP,
+			    &slot->dtcs_buf) == -1)
+				err = errno;
+		}
+
+		pthread_mutex_lock(&pool->dtcp_lock);
+		slot->dtcs_err = err;
+		slot->dtcs_state = DT_CSLOT_READY;
+		pthread_cond_broadcast(&pool->dtcp_cv);
+	}
+	pthread_mutex_unlock(&pool->dtcp_lock);
+
+	return (NULL);
+}
+
+/*
+ * Consume the buffers of CPUs [0, max_ncpus), skipping 'skip', snapshotting
+ * them in parallel with 'nthreads' worker threads.
+ */
+static int
+dt_consume_parallel(dtrace_hdl_t *dtp, FILE *fp, int max_ncpus,
+    processorid_t skip, int nthreads, dtrace_consume_probe_f *pf,
+    dtrace_consume_rec_f *rf, void *arg)
+{
+	dt_cpool_t pool;
+	dt_cslot_t *slot;
+	pthread_t *workers;
+	dtrace_optval_t size;
+	processorid_t cpu;
+	int nworkers = 0;
+	int i, rval = 0;
+
+	if (nthreads > max_ncpus)
+		nthreads = max_ncpus;
+
+	memset(&pool, 0, sizeof (dt_cpool_t));
+	pool.dtcp_hdl = dtp;
+	pool.dtcp_nslots = nthreads * 2;
+	pool.dtcp_max = max_ncpus;
+	pool.dtcp_skip = skip;
+
+	workers = dt_zalloc(dtp, nthreads * sizeof (pthread_t));
+	pool.dtcp_slots = dt_zalloc(dtp,
+	    pool.dtcp_nslots * sizeof (dt_cslot_t));
+	if (workers == NULL || pool.dtcp_slots == NULL) {
+		dt_free(dtp, workers);
+		dt_free(dtp, pool.dtcp_slots);
+		return (-1); /* errno is set for us */
+	}
+
+	(void) dtrace_getopt(dtp, "bufsize", &size);
+	for (i = 0; i < pool.dtcp_nslots; i++) {
+		if ((pool.dtcp_slots[i].dtcs_buf.dtbd_data =
+		    malloc(size)) == NULL) {
+			rval = dt_set_errno(dtp, EDT_NOMEM);
+			goto out;
+		}
+	}
+
+	pthread_mutex_init(&pool.dtcp_lock, NULL);
+	pthread_cond_init(&pool.dtcp_cv, NULL);
+
+	for (; nworkers < nthreads; nworkers++) {
+		if (pthread_create(&workers[nworkers], NULL,
+		    dt_consume_snap_worker, &pool) != 0)
+			break;
+	}
+
+	/*
+	 * If no worker could be started at all, we cannot make progress;
+	 * fewer workers than requested is fine.
+	 */
+	if (nworkers == 0) {
+		rval = dt_set_errno(dtp, EAGAIN);
+		goto fini;
+	}
+
+	for (cpu = 0; cpu < max_ncpus; cpu++) {
+		slot = &pool.dtcp_slots[cpu % pool.dtcp_nslots];
+
+		pthread_mutex_lock(&pool.dtcp_lock);
+		while (slot->dtcs_state != DT_CSLOT_READY ||
+		    slot->dtcs_cpu != cpu)
+			pthread_cond_wait(&pool.dtcp_cv, &pool.dtcp_lock);
+		pthread_mutex_unlock(&pool.dtcp_lock);
+
+		if (slot->dtcs_err == 0) {
+			dt_consume_fill(dtp, &slot->dtcs_buf);
+			rval = dt_consume_cpu(dtp, fp, cpu, &slot->dtcs_buf,
+			    pf, rf, arg);
+		} else if (slot->dtcs_err != ENOENT)
+			rval = dt_set_errno(dtp, slot->dtcs_err);
+
+		pthread_mutex_lock(&pool.dtcp_lock);
+		slot->dtcs_state = DT_CSLOT_FREE;
+		if (rval != 0)
+			pool.dtcp_abort = 1;
+		pthread_cond_broadcast(&pool.dtcp_cv);
+		pthread_mutex_unlock(&pool.dtcp_lock);
+
+		if (rval != 0)
+			break;
+	}
+
+fini:
+	pthread_mutex_lock(&pool.dtcp_lock);
+	pool.dtcp_abort = 1;
+	pthread_cond_broadcast(&pool.dtcp_cv);
+	pthread_mutex_unlock(&pool.dtcp_lock);
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+
+	pthread_cond_destroy(&pool.dtcp_cv);
+	pthread_mutex_destroy(&pool.dtcp_lock);
+out:
+	for (i = 0; i < pool.dtcp_nslots; i++)
+		free(pool.dtcp_slots[i].dtcs_buf.dtbd_data);
+	dt_free(dtp, pool.dtcp_slots);
+	dt_free(dtp, workers);
+
+	return (rval);
+}
+
 int
 dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
     dtrace_consume_probe_f *pf, dtrace_consume_rec_f *rf, void *arg)
@@ -2485,10 +3163,12 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 	hrtime_t now = gethrtime();
 
 	if (dtp->dt_lastswitch != 0) {
-		if (now - dtp->dt_lastswitch < interval)
+		if (now - dtp->dt_lastswitch >= interval)
+			dtp->dt_lastswitch += interval;
+		else if (dtp->dt_wakefill != 0 && now >= dtp->dt_wakefill)
+			dtp->dt_lastswitch = now;
+		else
 			return (0);
-
-		dtp->dt_lastswitch += interval;
 	} else {
 		dtp->dt_lastswitch = now;
 	}
@@ -2513,6 +3193,23 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 		buf->dtbd_size = size;
 	}
 
+	if (dtp->dt_autoswitch && dtp->dt_bufstats == NULL &&
+	    (dtp->dt_bufstats = dt_zalloc(dtp, max_ncpus *
+	    sizeof (dt_bufstat_t))) == NULL)
+		return (-1); /* errno is set for us */
+
+	/*
+	 * When merging by time, BEGIN and END are ordered by the merge itself.
+	 */
+	if (dtp->dt_temporal) {
+		dtp->dt_beganon = -1;
+		if ((rval = dt_consume_temporal(dtp, fp, max_ncpus,
+		    pf, rf, arg)) != 0)
+			return (rval);
+
+		return (dt_consume_done(dtp, now));
+	}
+
 	/*
 	 * If we have just begun, we want to first process the CPU that
 	 * executed the BEGIN probe (if any).
@@ -2523,14 +3220,22 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 			return (rval);
 	}
 
+	/*
+	 * If we have stopped, we want to process the CPU on which the END
+	 * probe was processed only _after_ we have processed everything else.
+	 */
+	if (dtp->dt_consumethreads > 1) {
+		if ((rval = dt_consume_parallel(dtp, fp, max_ncpus,
+		    dtp->dt_stopped ? dtp->dt_endedon : -1,
+		    dtp->dt_consumethreads, pf, rf, arg)) != 0)
+			return (rval);
+
+		goto end;
+	}
+
 	for (i = 0; i < max_ncpus; i++) {
 		buf->dtbd_cpu = i;
 
-		/*
-		 * If we have stopped, we want to process the CPU on which the
-		 * END probe was processed only _after_ we have processed
-		 * everything else.
-		 */
 		if (dtp->dt_stopped && (i == dtp->dt_endedon))
 			continue;
 
@@ -2546,12 +3251,15 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 			return (dt_set_errno(dtp, errno));
 		}
 
+		dt_consume_fill(dtp, buf);
+
 		if ((rval = dt_consume_cpu(dtp, fp, i, buf, pf, rf, arg)) != 0)
 			return (rval);
 	}
 
+end:
 	if (!dtp->dt_stopped)
-		return (0);
+		return (dt_consume_done(dtp, now));
 
 	buf->dtbd_cpu = dtp->dt_endedon;
 
@@ -2571,5 +3279,7 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 		return (dt_set_errno(dtp, errno));
 	}
 
+	dt_consume_fill(dtp, buf);
+
 	return (dt_consume_cpu(dtp, fp, dtp->dt_endedon, buf, pf, rf, arg));
 }
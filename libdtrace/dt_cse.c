@@ -0,0 +1,941 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Common Subexpression Elimination Across Clauses
+ *
+ * Every clause is compiled into an ECB of its own, so when several clauses
+ * enable the same probe, each of them recomputes on every firing whatever it
+ * has in common with the others: the same pointer chase from curthread, the
+ * same copyinstr(arg0), the same translator member.  With -xcse, dt_cse() is
+ * run over the parse tree before any clause is compiled, and looks at each
+ * group of clauses that have one and the same probe description:
+ *
+ * - Subexpressions that appear in two or more clauses of the group are found
+ *   by comparing their cooked parse trees.  Only expressions without side
+ *   effects whose value cannot change during a firing are considered: builtin
+ *   variables other than the timestamps and epid, operators other than the
+ *   assignments and ++/--, loads, casts, translators and string subroutines.
+ *   The result must be an integer, a pointer or a string.
+ *
+ * - An expression is hoisted only if the program evaluates it on every
+ *   firing (in a predicate, or outside ?:, && and || in a clause without one)
+ *   so that computing it up front cannot fault where the program did not,
+ *   and only if computing it once saves more than it costs.  It is only
+ *   replaced in the clauses that evaluate it whenever they run (outside ?:,
+ *   && and ||), since those are the clauses that can be skipped if it
+ *   faults; a clause that only evaluates it conditionally keeps its own copy.
+ *
+ * - copyinstr() is not hoisted at all if any clause of the program, whatever
+ *   its probe description, calls copyout() or copyoutstr(): that clause may
+ *   fire for the same probe, and change the string between the hoisted
+ *   copyinstr() and its use.
+ *
+ * - A clause added before the group assigns each hoisted expression to a
+ *   hidden clause-local variable, which keeps its value across the ECBs of a
+ *   firing, and the occurrences become reads of those variables.  The added
+ *   clause clears a hidden flag first and sets it last, and the clauses that
+ *   read the variables test the flag in their predicate: if a hoisted
+ *   expression faults, they are skipped instead of using stale values.
+ *
+ * The DIF instructions saved are counted by compiling the affected parse
+ * trees before and after, and reported with -S.
+ */
+
+#include <sys/types.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <dt_impl.h>
+#include <dt_program.h>
+#include <dt_grammar.h>
+#include <dt_parser.h>
+
+#define	DT_CSE_PRED	UINT_MAX	/* occurrence unit for a predicate */
+
+typedef struct dt_cseunit {
+	dt_node_t **dcu_slot;		/* expression compiled into a DIFO */
+	uint_t dcu_clause;		/* index of its clause in the group */
+	int dcu_uncond;			/* evaluated whenever the clause is */
+	int dcu_touched;		/* measured before it was rewritten */
+} dt_cseunit_t;
+
+typedef struct dt_cseocc {
+	dt_node_t **dco_slot;		/* link to the subexpression */
+	uint_t dco_clause;		/* index of its clause in the group */
+	uint_t dco_unit;		/* index of its unit, or DT_CSE_PRED */
+	int dco_uncond;			/* evaluated on every firing */
+	int dco_always;			/* evaluated whenever clause is */
+	int dco_match;			/* equal to the current candidate */
+} dt_cseocc_t;
+
+typedef struct dt_cse {
+	dt_pcb_t *dc_pcb;		/* compiler state */
+	dt_node_t **dc_clauses;		/* clauses of the group, in order */
+	int *dc_reads;			/* clauses reading hoisted values */
+	int *dc_always;			/* clauses always evaluating it */
+	uint_t dc_nclauses;		/* number of clauses in the group */
+	dt_cseunit_t *dc_units;		/* action expressions of the group */
+	uint_t dc_nunits;		/* number of units */
+	uint_t dc_maxunits;		/* allocated size of dc_units */
+	dt_cseocc_t *dc_occs;		/* candidate subexpressions */
+	uint_t dc_nocc;			/* number of candidates */
+	uint_t dc_maxocc;		/* allocated size of dc_occs */
+	dt_node_t *dc_asgn;		/* assignments to hoisted variables */
+	uint_t dc_nexprs;		/* number of hoisted expressions */
+	int dc_before;			/* DIF length of rewritten trees */
+	int dc_copyin;			/* copyinstr() may be hoisted */
+	char dc_flag[16];		/* name of the group's flag variable */
+} dt_cse_t;
+
+/*
+ * Allocate a node that dt_node_link_free() releases with the rest of the
+ * parse tree, as dt_node_alloc() does.
+ */
+static dt_node_t *
+dt_cse_node(dt_pcb_t *pcb, int kind)
+{
+	dt_node_t *dnp = dt_node_xalloc(pcb->pcb_hdl, kind);
+
+	if (dnp == NULL)
+		longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
+
+	dnp->dn_line = yylineno;
+	dnp->dn_link = pcb->pcb_list;
+	pcb->pcb_list = dnp;
+
+	return (dnp);
+}
+
+/*
+ * Return an uncooked reference to the hidden variable this-><name>.
+ */
+static dt_node_t *
+dt_cse_ref(const char *name)
+{
+	return (dt_node_op2(DT_TOK_PTR,
+	    dt_node_ident(strdup("this")), dt_node_ident(strdup(name))));
+}
+
+static int
+dt_cse_modifies(uint_t op)
+{
+	switch (op) {
+	case DT_TOK_ASGN:
+	case DT_TOK_ADD_EQ:
+	case DT_TOK_SUB_EQ:
+	case DT_TOK_MUL_EQ:
+	case DT_TOK_DIV_EQ:
+	case DT_TOK_MOD_EQ:
+	case DT_TOK_AND_EQ:
+	case DT_TOK_XOR_EQ:
+	case DT_TOK_OR_EQ:
+	case DT_TOK_LSH_EQ:
+	case DT_TOK_RSH_EQ:
+	case DT_TOK_ADDADD:
+	case DT_TOK_SUBSUB:
+	case DT_TOK_PREINC:
+	case DT_TOK_POSTINC:
+	case DT_TOK_PREDEC:
+	case DT_TOK_POSTDEC:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Subroutines whose result depends only on their arguments and on memory
+ * that the program cannot modify.  copyinstr() qualifies only if 'copyin' is
+ * set: the program cannot modify user memory unless it calls copyout().
+ */
+static int
+dt_cse_subr(uint_t subr, int copyin)
+{
+	switch (subr) {
+	case DIF_SUBR_COPYINSTR:
+		return (copyin);
+	case DIF_SUBR_BASENAME:
+	case DIF_SUBR_CLEANPATH:
+	case DIF_SUBR_D_PATH:
+	case DIF_SUBR_DIRNAME:
+	case DIF_SUBR_GETMAJOR:
+	case DIF_SUBR_GETMINOR:
+	case DIF_SUBR_HTONL:
+	case DIF_SUBR_HTONLL:
+	case DIF_SUBR_HTONS:
+	case DIF_SUBR_INDEX:
+	case DIF_SUBR_INET_NTOA:
+	case DIF_SUBR_INET_NTOA6:
+	case DIF_SUBR_INET_NTOP:
+	case DIF_SUBR_LLTOSTR:
+	case DIF_SUBR_NTOHL:
+	case DIF_SUBR_NTOHLL:
+	case DIF_SUBR_NTOHS:
+	case DIF_SUBR_PROGENYOF:
+	case DIF_SUBR_RINDEX:
+	case DIF_SUBR_STRCHR:
+	case DIF_SUBR_STRJOIN:
+	case DIF_SUBR_STRLEN:
+	case DIF_SUBR_STRRCHR:
+	case DIF_SUBR_STRSTR:
+	case DIF_SUBR_SUBSTR:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return non-zero if evaluating the cooked expression 'dnp' has no side
+ * effects, and gives the same result anywhere in a probe firing.
+ */
+static int
+dt_cse_pure(const dt_node_t *dnp, int copyin)
+{
+	const dt_ident_t *idp;
+	const dt_node_t *arg;
+
+	switch (dnp->dn_kind) {
+	case DT_NODE_INT:
+	case DT_NODE_STRING:
+	case DT_NODE_IDENT:
+	case DT_NODE_TYPE:
+	case DT_NODE_SYM:
+		return (1);
+	}
+
+	if (!(dnp->dn_flags & DT_NF_COOKED))
+		return (0);
+
+	switch (dnp->dn_kind) {
+	case DT_NODE_VAR:
+		idp = dnp->dn_ident;
+
+		if (idp->di_flags & DT_IDFLG_INLINE) {
+			const dt_idnode_t *inp = idp->di_iarg;
+
+			if (idp->di_kind != DT_IDENT_SCALAR ||
+			    inp->din_root == NULL ||
+			    !dt_cse_pure(inp->din_root, copyin))
+				return (0);
+			break;
+		}
+
+		if ((idp->di_flags & (DT_IDFLG_LOCAL | DT_IDFLG_TLS)) ||
+		    idp->di_id >= DIF_VAR_OTHER_UBASE)
+			return (0); /* user variable */
+
+		switch (idp->di_id) {
+		case DIF_VAR_EPID:
+		case DIF_VAR_TIMESTAMP:
+		case DIF_VAR_VTIMESTAMP:
+		case DIF_VAR_WALLTIMESTAMP:
+			return (0);
+		}
+		break;
+
+	case DT_NODE_FUNC:
+		if (dnp->dn_ident->di_kind != DT_IDENT_FUNC ||
+		    !dt_cse_subr(dnp->dn_ident->di_id, copyin))
+			return (0);
+		break;
+
+	case DT_NODE_OP1:
+		return (!dt_cse_modifies(dnp->dn_op) &&
+		    dt_cse_pure(dnp->dn_child, copyin));
+
+	case DT_NODE_OP2:
+		return (!dt_cse_modifies(dnp->dn_op) &&
+		    dt_cse_pure(dnp->dn_left, copyin) &&
+		    dt_cse_pure(dnp->dn_right, copyin));
+
+	case DT_NODE_OP3:
+		return (dt_cse_pure(dnp->dn_expr, copyin) &&
+		    dt_cse_pure(dnp->dn_left, copyin) &&
+		    dt_cse_pure(dnp->dn_right, copyin));
+
+	default:
+		return (0);
+	}
+
+	for (arg = dnp->dn_args; arg != NULL; arg = arg->dn_list) {
+		if (!dt_cse_pure(arg, copyin))
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Return non-zero if 'dnp' could be replaced by a clause-local variable.
+ */
+static int
+dt_cse_candidate(const dt_node_t *dnp, int copyin)
+{
+	switch (dnp->dn_kind) {
+	case DT_NODE_VAR:
+		if (!(dnp->dn_ident->di_flags & DT_IDFLG_INLINE) &&
+		    dnp->dn_args == NULL)
+			return (0); /* plain variables are loaded directly */
+		break;
+	case DT_NODE_FUNC:
+	case DT_NODE_OP1:
+	case DT_NODE_OP2:
+	case DT_NODE_OP3:
+		break;
+	default:
+		return (0);
+	}
+
+	if (!(dnp->dn_flags & DT_NF_COOKED) ||
+	    (dnp->dn_flags & (DT_NF_BITFIELD | DT_NF_USERLAND)))
+		return (0);
+
+	if (dt_node_is_dynamic(dnp) ||
+	    dt_node_resolve(dnp, DT_IDENT_XLSOU) != NULL ||
+	    dt_node_resolve(dnp, DT_IDENT_XLPTR) != NULL)
+		return (0);
+
+	if (!dt_node_is_string(dnp) &&
+	    (!dt_node_is_scalar(dnp) || (dnp->dn_flags & DT_NF_REF)))
+		return (0);
+
+	return (dt_cse_pure(dnp, copyin));
+}
+
+static int
+dt_cse_equal(const dt_node_t *a, const dt_node_t *b)
+{
+	if (a->dn_kind != b->dn_kind || a->dn_op != b->dn_op ||
+	    a->dn_flags != b->dn_flags ||
+	    a->dn_ctfp != b->dn_ctfp || a->dn_type != b->dn_type)
+		return (0);
+
+	switch (a->dn_kind) {
+	case DT_NODE_INT:
+		return (a->dn_value == b->dn_value);
+	case DT_NODE_STRING:
+	case DT_NODE_IDENT:
+		return (strcmp(a->dn_string, b->dn_string) == 0);
+	case DT_NODE_TYPE:
+		return (1);
+	case DT_NODE_SYM:
+		return (a->dn_ident == b->dn_ident);
+	case DT_NODE_VAR:
+	case DT_NODE_FUNC:
+		if (a->dn_ident != b->dn_ident)
+			return (0);
+
+		for (a = a->dn_args, b = b->dn_args; a != NULL && b != NULL;
+		    a = a->dn_list, b = b->dn_list) {
+			if (!dt_cse_equal(a, b))
+				return (0);
+		}
+		return (a == NULL && b == NULL);
+	case DT_NODE_OP1:
+		return (dt_cse_equal(a->dn_child, b->dn_child));
+	case DT_NODE_OP2:
+		return (dt_cse_equal(a->dn_left, b->dn_left) &&
+		    dt_cse_equal(a->dn_right, b->dn_right));
+	case DT_NODE_OP3:
+		return (dt_cse_equal(a->dn_expr, b->dn_expr) &&
+		    dt_cse_equal(a->dn_left, b->dn_left) &&
+		    dt_cse_equal(a->dn_right, b->dn_right));
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Return non-zero if 'dnp' writes to user memory, which a copyinstr() hoisted
+ * past it could read.
+ */
+static int
+dt_cse_copyout(const dt_node_t *dnp)
+{
+	const dt_node_t *arg;
+
+	if (dnp == NULL)
+		return (0);
+
+	switch (dnp->dn_kind) {
+	case DT_NODE_FUNC:
+		if (dnp->dn_ident->di_kind == DT_IDENT_FUNC &&
+		    (dnp->dn_ident->di_id == DIF_SUBR_COPYOUT ||
+		    dnp->dn_ident->di_id == DIF_SUBR_COPYOUTSTR))
+			return (1);
+		/*FALLTHRU*/
+	case DT_NODE_VAR:
+		for (arg = dnp->dn_args; arg != NULL; arg = arg->dn_list) {
+			if (dt_cse_copyout(arg))
+				return (1);
+		}
+		return (0);
+	case DT_NODE_OP1:
+		return (dt_cse_copyout(dnp->dn_child));
+	case DT_NODE_OP3:
+		if (dt_cse_copyout(dnp->dn_expr))
+			return (1);
+		/*FALLTHRU*/
+	case DT_NODE_OP2:
+		return (dt_cse_copyout(dnp->dn_left) ||
+		    dt_cse_copyout(dnp->dn_right));
+	case DT_NODE_DEXPR:
+	case DT_NODE_DFUNC:
+		return (dt_cse_copyout(dnp->dn_expr));
+	case DT_NODE_AGG:
+		for (arg = dnp->dn_aggtup; arg != NULL; arg = arg->dn_list) {
+			if (dt_cse_copyout(arg))
+				return (1);
+		}
+		return (dt_cse_copyout(dnp->dn_aggfun));
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Compile 'dnp' on its own and return the length of the resulting DIFO.
+ */
+static int
+dt_cse_measure(dt_pcb_t *pcb, dt_node_t *dnp)
+{
+	dtrace_difo_t *dp;
+	int len;
+
+	dt_cg(pcb, dnp);
+	dp = dt_as(pcb);
+	len = dp->dtdo_len;
+	dt_difo_free(pcb->pcb_hdl, dp);
+
+	return (len);
+}
+
+static void
+dt_cse_unit(dt_cse_t *dcp, dt_node_t **slot, uint_t clause, int uncond)
+{
+	dt_cseunit_t *dcu;
+
+	if (dcp->dc_nunits == dcp->dc_maxunits) {
+		uint_t n = dcp->dc_maxunits ? dcp->dc_maxunits * 2 : 16;
+
+		if ((dcu = realloc(dcp->dc_units, n * sizeof (*dcu))) == NULL)
+			longjmp(dcp->dc_pcb->pcb_jmpbuf, EDT_NOMEM);
+
+		memset(dcu + dcp->dc_maxunits, 0,
+		    (n - dcp->dc_maxunits) * sizeof (*dcu));
+		dcp->dc_units = dcu;
+		dcp->dc_maxunits = n;
+	}
+
+	dcu = &dcp->dc_units[dcp->dc_nunits++];
+	dcu->dcu_slot = slot;
+	dcu->dcu_clause = clause;
+	dcu->dcu_uncond = uncond;
+}
+
+/*
+ * Enumerate the expressions in the actions of the group that are compiled
+ * into DIFOs of their own.  List links move as expressions are replaced, so
+ * the units are enumerated again each time; their order never changes, and
+ * dcu_touched stays with the index.
+ */
+static void
+dt_cse_units(dt_cse_t *dcp)
+{
+	dt_node_t *cnp, *dnp, *anp, **argp;
+	uint_t i;
+
+	dcp->dc_nunits = 0;
+
+	for (i = 0; i < dcp->dc_nclauses; i++) {
+		cnp = dcp->dc_clauses[i];
+
+		for (dnp = cnp->dn_acts; dnp != NULL; dnp = dnp->dn_list) {
+			anp = dnp->dn_kind == DT_NODE_AGG ? dnp : dnp->dn_expr;
+
+			if (anp->dn_kind == DT_NODE_AGG) {
+				for (argp = &anp->dn_aggtup; *argp != NULL;
+				    argp = &(*argp)->dn_list) {
+					dt_cse_unit(dcp, argp, i,
+					    cnp->dn_pred == NULL);
+				}
+
+				if (anp->dn_aggfun != NULL &&
+				    anp->dn_aggfun->dn_args != NULL) {
+					dt_cse_unit(dcp,
+					    &anp->dn_aggfun->dn_args, i,
+					    cnp->dn_pred == NULL);
+				}
+			} else if (dnp->dn_kind == DT_NODE_DFUNC) {
+				for (argp = &anp->dn_args; *argp != NULL;
+				    argp = &(*argp)->dn_list) {
+					dt_cse_unit(dcp, argp, i,
+					    cnp->dn_pred == NULL);
+				}
+			} else {
+				dt_cse_unit(dcp, &dnp->dn_expr, i,
+				    cnp->dn_pred == NULL);
+			}
+		}
+	}
+}
+
+/*
+ * Record the candidates in the expression at 'slot', outermost first.  The
+ * operand of & and ++/--, and the left-hand side of an assignment, must
+ * remain l-values; the operand of sizeof is not evaluated at all.  'uncond'
+ * is set if the expression is evaluated on every firing, and 'always' if it
+ * is evaluated whenever its clause is.
+ */
+static void
+dt_cse_walk(dt_cse_t *dcp, dt_node_t **slot, uint_t clause, uint_t unit,
+    int uncond, int always, int lvalue)
+{
+	dt_node_t *dnp = *slot, **argp;
+	dt_cseocc_t *dco;
+	int cond;
+
+	if (!lvalue && dt_cse_candidate(dnp, dcp->dc_copyin)) {
+		if (dcp->dc_nocc == dcp->dc_maxocc) {
+			uint_t n = dcp->dc_maxocc ? dcp->dc_maxocc * 2 : 64;
+
+			if ((dco = realloc(dcp->dc_occs,
+			    n * sizeof (*dco))) == NULL)
+				longjmp(dcp->dc_pcb->pcb_jmpbuf, EDT_NOMEM);
+
+			dcp->dc_occs = dco;
+			dcp->dc_maxocc = n;
+		}
+
+		dco = &dcp->dc_occs[dcp->dc_nocc++];
+		dco->dco_slot = slot;
+		dco->dco_clause = clause;
+		dco->dco_unit = unit;
+		dco->dco_uncond = uncond;
+		dco->dco_always = always;
+		dco->dco_match = 0;
+	}
+
+	switch (dnp->dn_kind) {
+	case DT_NODE_VAR:
+	case DT_NODE_FUNC:
+		for (argp = &dnp->dn_args; *argp != NULL;
+		    argp = &(*argp)->dn_list)
+			dt_cse_walk(dcp, argp, clause, unit, uncond, always, 0);
+		break;
+
+	case DT_NODE_OP1:
+		if (dnp->dn_op != DT_TOK_SIZEOF) {
+			dt_cse_walk(dcp, &dnp->dn_child, clause, unit, uncond,
+			    always, dnp->dn_op == DT_TOK_ADDROF ||
+			    dt_cse_modifies(dnp->dn_op));
+		}
+		break;
+
+	case DT_NODE_OP2:
+		cond = dnp->dn_op == DT_TOK_LAND || dnp->dn_op == DT_TOK_LOR;
+
+		dt_cse_walk(dcp, &dnp->dn_left, clause, unit, uncond, always,
+		    dt_cse_modifies(dnp->dn_op));
+		dt_cse_walk(dcp, &dnp->dn_right, clause, unit, uncond && !cond,
+		    always && !cond, 0);
+		break;
+
+	case DT_NODE_OP3:
+		dt_cse_walk(dcp, &dnp->dn_expr, clause, unit, uncond, always,
+		    0);
+		dt_cse_walk(dcp, &dnp->dn_left, clause, unit, 0, 0, 0);
+		dt_cse_walk(dcp, &dnp->dn_right, clause, unit, 0, 0, 0);
+		break;
+	}
+}
+
+/*
+ * Remember the DIF length of a tree before it is first rewritten.
+ */
+static void
+dt_cse_touch(dt_cse_t *dcp, const dt_cseocc_t *dco)
+{
+	dt_node_t *cnp = dcp->dc_clauses[dco->dco_clause];
+	dt_cseunit_t *dcu;
+
+	if (!dcp->dc_reads[dco->dco_clause]) {
+		dcp->dc_reads[dco->dco_clause] = 1;
+
+		if (cnp->dn_pred != NULL) {
+			dcp->dc_before += dt_cse_measure(dcp->dc_pcb,
+			    cnp->dn_pred);
+		}
+	}
+
+	if (dco->dco_unit == DT_CSE_PRED)
+		return;
+
+	dcu = &dcp->dc_units[dco->dco_unit];
+
+	if (!dcu->dcu_touched) {
+		dcu->dcu_touched = 1;
+		dcp->dc_before += dt_cse_measure(dcp->dc_pcb, *dcu->dcu_slot);
+	}
+}
+
+/*
+ * Find the first candidate worth hoisting, replace all its occurrences with
+ * a new hidden variable, and return non-zero; or return zero if none is left.
+ */
+static int
+dt_cse_hoist(dt_cse_t *dcp)
+{
+	dt_pcb_t *pcb = dcp->dc_pcb;
+	dt_node_t *cnp, *dnp, *ref, *asgn;
+	dt_cseocc_t *dco;
+	uint_t i, j, k, n, first = 0;
+	int other, uncond, cost;
+	char name[32];
+
+	dt_cse_units(dcp);
+	dcp->dc_nocc = 0;
+
+	for (i = 0; i < dcp->dc_nclauses; i++) {
+		cnp = dcp->dc_clauses[i];
+
+		if (cnp->dn_pred != NULL)
+			dt_cse_walk(dcp, &cnp->dn_pred, i, DT_CSE_PRED,
+			    1, 1, 0);
+	}
+
+	for (i = 0; i < dcp->dc_nunits; i++) {
+		dt_cse_walk(dcp, dcp->dc_units[i].dcu_slot,
+		    dcp->dc_units[i].dcu_clause, i,
+		    dcp->dc_units[i].dcu_uncond, 1, 0);
+	}
+
+	for (i = 0; i < dcp->dc_nocc; i++) {
+		dnp = *dcp->dc_occs[i].dco_slot;
+		uncond = other = 0;
+
+		for (j = 0; j < i; j++) {
+			if (dt_cse_equal(dnp, *dcp->dc_occs[j].dco_slot))
+				break;
+		}
+
+		if (j < i)
+			continue; /* already turned down */
+
+		memset(dcp->dc_always, 0, dcp->dc_nclauses * sizeof (int));
+
+		for (; j < dcp->dc_nocc; j++) {
+			dco = &dcp->dc_occs[j];
+			dco->dco_match = j == i ||
+			    dt_cse_equal(dnp, *dco->dco_slot);
+
+			if (dco->dco_match && dco->dco_always)
+				dcp->dc_always[dco->dco_clause] = 1;
+		}
+
+		/*
+		 * Leave the occurrences alone in clauses that only evaluate
+		 * the expression under ?:, && or ||: they would not be run at
+		 * all if computing it up front faulted.
+		 */
+		for (j = i, k = 0, dnp = NULL; j < dcp->dc_nocc; j++) {
+			dco = &dcp->dc_occs[j];
+
+			if (dco->dco_match && !dcp->dc_always[dco->dco_clause])
+				dco->dco_match = 0;
+
+			if (!dco->dco_match)
+				continue;
+
+			if (dnp == NULL) {
+				dnp = *dco->dco_slot;
+				first = dco->dco_clause;
+			}
+
+			k++;
+			uncond |= dco->dco_uncond;
+			other |= dco->dco_clause != first;
+		}
+
+		if (!other || !uncond)
+			continue;
+
+		/*
+		 * Each occurrence becomes a load, and the added clause computes
+		 * the expression once and stores it.
+		 */
+		cost = dt_cse_measure(pcb, dnp) - 1;
+		if ((int)(k - 1) * cost <= (int)k + 1)
+			continue;
+
+		n = ++dcp->dc_nexprs;
+		(void) snprintf(name, sizeof (name), "%s.%u", dcp->dc_flag, n);
+
+		/*
+		 * Work backwards, so that an occurrence in a list is replaced
+		 * before the one preceding it, through whose link it is found.
+		 */
+		for (j = dcp->dc_nocc; j-- > i; ) {
+			dco = &dcp->dc_occs[j];
+
+			if (!dco->dco_match)
+				continue;
+
+			dt_cse_touch(dcp, dco);
+
+			ref = dt_cse_ref(name);
+			ref->dn_line = (*dco->dco_slot)->dn_line;
+			ref->dn_list = (*dco->dco_slot)->dn_list;
+			*dco->dco_slot = ref;
+		}
+
+		dnp->dn_list = NULL;
+		asgn = dt_node_op2(DT_TOK_ASGN, dt_cse_ref(name), dnp);
+
+		if (dcp->dc_asgn != NULL)
+			asgn = dt_node_op2(DT_TOK_COMMA, dcp->dc_asgn, asgn);
+
+		dcp->dc_asgn = asgn;
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Hoist the common subexpressions of a group of clauses, and return the
+ * clause that computes them or NULL if there are none.
+ */
+static dt_node_t *
+dt_cse_group(dt_cse_t *dcp, uint_t group)
+{
+	dt_pcb_t *pcb = dcp->dc_pcb;
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dt_node_t *pnp = dcp->dc_clauses[0]->dn_pdescs;
+	dt_node_t *cnp, *scp, *expr;
+	int after;
+	uint_t i;
+
+	yylineno = pnp->dn_line;
+	dt_setcontext(dtp, pnp->dn_desc);
+
+	(void) snprintf(dcp->dc_flag, sizeof (dcp->dc_flag), "%%cse%u", group);
+
+	while (dt_cse_hoist(dcp))
+		continue;
+
+	if (dcp->dc_nexprs == 0) {
+		dt_endcontext(dtp);
+		return (NULL);
+	}
+
+	expr = dt_node_op2(DT_TOK_ASGN,
+	    dt_cse_ref(dcp->dc_flag), dt_node_int(0));
+	expr = dt_node_op2(DT_TOK_COMMA, expr, dcp->dc_asgn);
+	expr = dt_node_op2(DT_TOK_COMMA, expr,
+	    dt_node_op2(DT_TOK_ASGN, dt_cse_ref(dcp->dc_flag), dt_node_int(1)));
+
+	scp = dt_cse_node(pcb, DT_NODE_CLAUSE);
+	scp->dn_pdescs = dt_cse_node(pcb, DT_NODE_PDESC);
+	scp->dn_acts = dt_node_statement(expr);
+
+	if ((scp->dn_pdescs->dn_desc =
+	    malloc(sizeof (dtrace_probedesc_t))) == NULL)
+		longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
+
+	memcpy(scp->dn_pdescs->dn_desc, pnp->dn_desc,
+	    sizeof (dtrace_probedesc_t));
+
+	for (i = 0; i < dcp->dc_nclauses; i++) {
+		cnp = dcp->dc_clauses[i];
+
+		if (!dcp->dc_reads[i])
+			continue;
+
+		if (cnp->dn_pred != NULL) {
+			cnp->dn_pred = dt_node_op2(DT_TOK_LAND,
+			    dt_cse_ref(dcp->dc_flag), cnp->dn_pred);
+		} else
+			cnp->dn_pred = dt_cse_ref(dcp->dc_flag);
+	}
+
+	/*
+	 * Cook the new clause first, which declares the hidden variables, and
+	 * compile everything that changed again.
+	 */
+	(void) dt_node_cook(scp, DT_IDFLG_REF);
+	after = dt_cse_measure(pcb, scp->dn_acts->dn_expr);
+
+	for (i = 0; i < dcp->dc_nclauses; i++) {
+		cnp = dt_node_cook(dcp->dc_clauses[i], DT_IDFLG_REF);
+
+		if (dcp->dc_reads[i])
+			after += dt_cse_measure(pcb, cnp->dn_pred);
+	}
+
+	dt_cse_units(dcp);
+
+	for (i = 0; i < dcp->dc_nunits; i++) {
+		dt_cseunit_t *dcu = &dcp->dc_units[i];
+
+		if (dcu->dcu_touched)
+			after += dt_cse_measure(pcb, *dcu->dcu_slot);
+	}
+
+	dt_endcontext(dtp);
+
+	dt_dprintf("hoisted %u expressions from %u clauses for %s:%s:%s:%s, "
+	    "%d DIF instructions became %d\n", dcp->dc_nexprs,
+	    dcp->dc_nclauses, pnp->dn_desc->dtpd_provider,
+	    pnp->dn_desc->dtpd_mod, pnp->dn_desc->dtpd_func,
+	    pnp->dn_desc->dtpd_name, dcp->dc_before, after);
+
+	pcb->pcb_prog->dp_cseexprs += dcp->dc_nexprs;
+	pcb->pcb_prog->dp_csesaved += dcp->dc_before - after;
+
+	return (scp);
+}
+
+static int
+dt_cse_samedesc(const dtrace_probedesc_t *a, const dtrace_probedesc_t *b)
+{
+	return (a->dtpd_id == b->dtpd_id &&
+	    strcmp(a->dtpd_provider, b->dtpd_provider) == 0 &&
+	    strcmp(a->dtpd_mod, b->dtpd_mod) == 0 &&
+	    strcmp(a->dtpd_func, b->dtpd_func) == 0 &&
+	    strcmp(a->dtpd_name, b->dtpd_name) == 0);
+}
+
+static void
+dt_cse_free(dt_cse_t *dcp)
+{
+	free(dcp->dc_clauses);
+	free(dcp->dc_reads);
+	free(dcp->dc_always);
+	free(dcp->dc_units);
+	free(dcp->dc_occs);
+	memset(dcp, 0, sizeof (dt_cse_t));
+}
+
+/*
+ * Group the clauses of the program by probe description, and add a clause
+ * computing the common subexpressions of each group before its first clause.
+ * A clause with several probe descriptions is compiled once for each, and is
+ * left alone.
+ */
+void
+dt_cse(dt_pcb_t *pcb)
+{
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dt_node_t **cpp, *cnp, *scp, *dnp, **pp;
+	uint_t i, j, n = 0, group = 0;
+	int err, copyin = 1;
+	jmp_buf ojb;
+	dt_cse_t dc;
+
+	for (cnp = pcb->pcb_root->dn_list; cnp != NULL; cnp = cnp->dn_list) {
+		if (cnp->dn_kind == DT_NODE_PROVIDER)
+			return;
+
+		if (cnp->dn_kind == DT_NODE_CLAUSE &&
+		    cnp->dn_pdescs->dn_list == NULL)
+			n++;
+	}
+
+	if (n < 2)
+		return;
+
+	/*
+	 * Cook every clause in program order first, as dt_compile() would:
+	 * a clause may use variables that are declared by assignment in the
+	 * clauses before it.  Any clause, whatever its probe descriptions,
+	 * may fire along with a group, so a copyout() anywhere in the program
+	 * keeps copyinstr() from being hoisted.
+	 */
+	for (cnp = pcb->pcb_root->dn_list; cnp != NULL; cnp = cnp->dn_list) {
+		if (cnp->dn_kind != DT_NODE_CLAUSE)
+			continue;
+
+		yylineno = cnp->dn_pdescs->dn_line;
+		dt_setcontext(dtp, cnp->dn_pdescs->dn_desc);
+		(void) dt_node_cook(cnp, DT_IDFLG_REF);
+		dt_endcontext(dtp);
+
+		if (dt_cse_copyout(cnp->dn_pred))
+			copyin = 0;
+
+		for (dnp = cnp->dn_acts; dnp != NULL; dnp = dnp->dn_list) {
+			if (dt_cse_copyout(dnp))
+				copyin = 0;
+		}
+	}
+
+	if ((cpp = malloc(n * sizeof (dt_node_t *))) == NULL)
+		longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
+
+	for (cnp = pcb->pcb_root->dn_list, n = 0; cnp != NULL;
+	    cnp = cnp->dn_list) {
+		if (cnp->dn_kind == DT_NODE_CLAUSE &&
+		    cnp->dn_pdescs->dn_list == NULL)
+			cpp[n++] = cnp;
+	}
+
+	memset(&dc, 0, sizeof (dc));
+	memcpy(ojb, pcb->pcb_jmpbuf, sizeof (jmp_buf));
+
+	if ((err = setjmp(pcb->pcb_jmpbuf)) != 0) {
+		memcpy(pcb->pcb_jmpbuf, ojb, sizeof (jmp_buf));
+		dt_cse_free(&dc);
+		free(cpp);
+		longjmp(pcb->pcb_jmpbuf, err);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (cpp[i] == NULL)
+			continue;
+
+		dc.dc_pcb = pcb;
+		dc.dc_copyin = copyin;
+		dc.dc_clauses = malloc(n * sizeof (dt_node_t *));
+		dc.dc_reads = calloc(n, sizeof (int));
+		dc.dc_always = calloc(n, sizeof (int));
+
+		if (dc.dc_clauses == NULL || dc.dc_reads == NULL ||
+		    dc.dc_always == NULL)
+			longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
+
+		for (j = i; j < n; j++) {
+			if (cpp[j] != NULL && (j == i || dt_cse_samedesc(
+			    cpp[i]->dn_pdescs->dn_desc,
+			    cpp[j]->dn_pdescs->dn_desc))) {
+				dc.dc_clauses[dc.dc_nclauses++] = cpp[j];
+				cpp[j] = NULL;
+			}
+		}
+
+		if (dc.dc_nclauses > 1 &&
+		    (scp = dt_cse_group(&dc, group)) != NULL) {
+			for (pp = &pcb->pcb_root->dn_list;
+			    *pp != dc.dc_clauses[0]; pp = &(*pp)->dn_list)
+				continue;
+
+			scp->dn_list = *pp;
+			*pp = scp;
+			group++;
+		}
+
+		dt_cse_free(&dc);
+	}
+
+	memcpy(pcb->pcb_jmpbuf, ojb, sizeof (jmp_buf));
+	free(cpp);
+}
@@ -0,0 +1,754 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * DIF Optimizer
+ *
+ * dt_cg() generates code for one parse tree node at a time, with no idea of
+ * what the surrounding nodes computed: the same constant is loaded again for
+ * every use, a variable read twice is loaded twice, and the logical and
+ * comparison operators branch to labels which only branch again.  Every DIF
+ * instruction is executed in probe context on every firing, so this pass
+ * tidies up the IR list between dt_cg() and dt_as().  Each round is made of:
+ *
+ * - Branch threading: branches to an unconditional branch are retargeted to
+ *   its destination, branches to the next instruction are deleted, and so is
+ *   code that cannot be reached.
+ *
+ * - Local value numbering, within each extended basic block: uses of a
+ *   register are renamed to the oldest register known to hold the same value
+ *   (%r0 for zero), and a constant or user variable already held in some
+ *   register is copied from it rather than loaded again.  Conditional
+ *   branches whose outcome is known from the operands compared are resolved.
+ *
+ * - Dead code elimination, using register liveness: instructions without side
+ *   effects whose results are never used are deleted.
+ *
+ * Rounds are repeated until nothing changes.  The pass only ever deletes or
+ * rewrites instructions in place, using the same DIF_INSTR_* encodings as
+ * dt_cg(), and never makes a branch go backwards, so its output is subject to
+ * the same kernel DIF validation as the input.  Anything that can fault,
+ * stores to memory or variables, or carries a relocation is left alone, and
+ * if the list contains anything the pass does not understand it is left
+ * untouched.  It can be disabled with -xnodifopt.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dt_impl.h>
+#include <dt_as.h>
+
+#define	DT_DIFOPT_ROUNDS	8	/* maximum number of rounds */
+#define	DT_DIFOPT_CC	(1U << DIF_DIR_NREGS)	/* condition codes bit */
+
+typedef struct dt_difinfo {
+	uint_t ddi_use;			/* registers read */
+	uint_t ddi_def;			/* registers written */
+	uint_t ddi_rename;		/* DT_IRREG_* fields to rename */
+	int ddi_pure;			/* deletable if ddi_def is unused */
+} dt_difinfo_t;
+
+typedef struct dt_difval {
+	uint_t dv_vn;			/* value number */
+	uint_t dv_op;			/* opcode that loaded it, or zero */
+	uint_t dv_id;			/* integer, string or variable id */
+	uint_t dv_age;			/* when the register got the value */
+} dt_difval_t;
+
+typedef struct dt_difopt {
+	dt_irlist_t *dop_dlp;		/* instruction list being optimized */
+	const dt_inttab_t *dop_inttab;	/* integer table used by SETX */
+	dt_irnode_t **dop_ins;		/* instructions, without labels */
+	uint_t dop_len;			/* number of entries in dop_ins[] */
+	uint_t *dop_labels;		/* index in dop_ins[] of each label */
+	uint_t *dop_refs;		/* number of branches to each label */
+	uchar_t *dop_target;		/* instruction is a branch target */
+	uchar_t *dop_dead;		/* instruction is to be deleted */
+	uchar_t *dop_reach;		/* instruction is reachable */
+	uint_t *dop_live;		/* registers live into instruction */
+} dt_difopt_t;
+
+#define	DT_OP_ISBRANCH(op) ((op) >= DIF_OP_BA && (op) <= DIF_OP_BLEU)
+
+/*
+ * Describe what an instruction reads and writes.  Returns -1 for opcodes the
+ * optimizer does not know about, and for register numbers out of range.
+ */
+static int
+dt_difopt_info(const dt_irnode_t *dip, dt_difinfo_t *dii)
+{
+	dif_instr_t instr = dip->di_instr;
+	uint_t r1 = DIF_INSTR_R1(instr);
+	uint_t r2 = DIF_INSTR_R2(instr);
+	uint_t rd = DIF_INSTR_RD(instr);
+	int regs = dt_irnode_regs(dip);
+
+	if (regs == -1 ||
+	    ((regs & DT_IRREG_R1) && r1 >= DIF_DIR_NREGS) ||
+	    ((regs & DT_IRREG_R2) && r2 >= DIF_DIR_NREGS) ||
+	    ((regs & (DT_IRREG_RD | DT_IRREG_DEF)) && rd >= DIF_DIR_NREGS))
+		return (-1);
+
+	dii->ddi_use = (regs & DT_IRREG_USECC) ? DT_DIFOPT_CC : 0;
+	dii->ddi_def = (regs & DT_IRREG_DEFCC) ? DT_DIFOPT_CC : 0;
+
+	if (regs & DT_IRREG_R1)
+		dii->ddi_use |= 1U << r1;
+	if (regs & DT_IRREG_R2)
+		dii->ddi_use |= 1U << r2;
+	if (regs & DT_IRREG_RD)
+		dii->ddi_use |= 1U << rd;
+	if (regs & DT_IRREG_DEF)
+		dii->ddi_def |= 1U << rd;
+
+	/*
+	 * %r0 always reads as zero.  A register that is both read and written
+	 * through the rd field cannot be renamed.
+	 */
+	dii->ddi_use &= ~1U;
+	dii->ddi_def &= ~1U;
+	dii->ddi_rename = regs & (DT_IRREG_R1 | DT_IRREG_R2 | DT_IRREG_RD);
+	if (regs & DT_IRREG_DEF)
+		dii->ddi_rename &= ~DT_IRREG_RD;
+	dii->ddi_pure = (regs & DT_IRREG_PURE) != 0;
+
+	return (0);
+}
+
+static uint_t
+dt_difopt_label(const dt_difopt_t *dop, uint_t i)
+{
+	return (dop->dop_labels[DIF_INSTR_LABEL(dop->dop_ins[i]->di_instr)]);
+}
+
+/*
+ * Index the instructions in the list and the labels that precede them, and
+ * note which instructions are branch targets.  Returns -1 if the list is not something
+ * the optimizer can deal with: an unknown opcode, or a branch that does not
+ * go forward to a label in the list.
+ */
+static int
+dt_difopt_scan(dt_difopt_t *dop)
+{
+	dt_irlist_t *dlp = dop->dop_dlp;
+	dt_irnode_t *dip;
+	dt_difinfo_t dii;
+	uint_t i, lbl;
+
+	memset(dop->dop_labels, 0xff, sizeof (uint_t) * dlp->dl_label);
+
+	for (i = 0, dip = dlp->dl_list; dip != NULL; dip = dip->di_next) {
+		if (dip->di_label != DT_LBL_NONE) {
+			if (dip->di_label >= dlp->dl_label)
+				return (-1);
+			dop->dop_labels[dip->di_label] = i;
+		}
+
+		if (dip->di_label != DT_LBL_NONE &&
+		    dip->di_instr == DIF_INSTR_NOP)
+			continue; /* label declaration */
+
+		if (i == dlp->dl_len || dt_difopt_info(dip, &dii) != 0)
+			return (-1);
+
+		dop->dop_ins[i++] = dip;
+	}
+
+	if (i == 0 || i != dlp->dl_len ||
+	    DIF_INSTR_OP(dop->dop_ins[i - 1]->di_instr) != DIF_OP_RET)
+		return (-1);
+
+	dop->dop_len = i;
+	memset(dop->dop_target, 0, dop->dop_len);
+	memset(dop->dop_dead, 0, dop->dop_len);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dif_instr_t instr = dop->dop_ins[i]->di_instr;
+
+		if (!DT_OP_ISBRANCH(DIF_INSTR_OP(instr)))
+			continue;
+
+		lbl = DIF_INSTR_LABEL(instr);
+
+		if (lbl >= dlp->dl_label || dop->dop_labels[lbl] <= i ||
+		    dop->dop_labels[lbl] >= dop->dop_len)
+			return (-1);
+
+		dop->dop_target[dop->dop_labels[lbl]] = 1;
+	}
+
+	return (0);
+}
+
+static uint_t
+dt_difopt_next(const dt_difopt_t *dop, uint_t i)
+{
+	while (++i < dop->dop_len && dop->dop_dead[i])
+		continue;
+
+	return (i);
+}
+
+/*
+ * A deleted instruction is only a label for whatever follows it.
+ */
+static uint_t
+dt_difopt_skip(const dt_difopt_t *dop, uint_t i)
+{
+	return (dop->dop_dead[i] ? dt_difopt_next(dop, i) : i);
+}
+
+/*
+ * Return whether anything branches to the instruction at j, or to any of the
+ * deleted instructions between i and j.
+ */
+static int
+dt_difopt_istarget(const dt_difopt_t *dop, uint_t i, uint_t j)
+{
+	while (++i <= j) {
+		if (dop->dop_target[i])
+			return (1);
+	}
+
+	return (0);
+}
+
+static uint_t
+dt_difopt_invert(uint_t op)
+{
+	switch (op) {
+	case DIF_OP_BE:
+		return (DIF_OP_BNE);
+	case DIF_OP_BNE:
+		return (DIF_OP_BE);
+	case DIF_OP_BG:
+		return (DIF_OP_BLE);
+	case DIF_OP_BLE:
+		return (DIF_OP_BG);
+	case DIF_OP_BGU:
+		return (DIF_OP_BLEU);
+	case DIF_OP_BLEU:
+		return (DIF_OP_BGU);
+	case DIF_OP_BGE:
+		return (DIF_OP_BL);
+	case DIF_OP_BL:
+		return (DIF_OP_BGE);
+	case DIF_OP_BGEU:
+		return (DIF_OP_BLU);
+	case DIF_OP_BLU:
+	default:
+		return (DIF_OP_BGEU);
+	}
+}
+
+/*
+ * Thread branches through unconditional branches (and through conditional
+ * branches on the same condition, since branches leave the condition codes
+ * alone), delete branches to the next instruction, turn a conditional branch
+ * around an unconditional one into a single inverted conditional branch, and
+ * delete unreachable code.  Branches are only ever retargeted to existing
+ * targets, so dop_target[] remains a superset of them.
+ */
+static int
+dt_difopt_branches(dt_difopt_t *dop)
+{
+	dif_instr_t instr;
+	uint_t i, j, t, op, top, lbl;
+	int changed = 0;
+
+	for (i = 0; i < dop->dop_len; i++) {
+		instr = dop->dop_ins[i]->di_instr;
+		op = DIF_INSTR_OP(instr);
+
+		if (dop->dop_dead[i] || !DT_OP_ISBRANCH(op))
+			continue;
+
+		lbl = DIF_INSTR_LABEL(instr);
+		t = dt_difopt_skip(dop, dop->dop_labels[lbl]);
+
+		while ((top = DIF_INSTR_OP(dop->dop_ins[t]->di_instr)) ==
+		    DIF_OP_BA || (op != DIF_OP_BA && top == op)) {
+			lbl = DIF_INSTR_LABEL(dop->dop_ins[t]->di_instr);
+			t = dt_difopt_skip(dop, dop->dop_labels[lbl]);
+		}
+
+		j = dt_difopt_next(dop, i);
+
+		if (t == j) {
+			dop->dop_dead[i] = 1;
+			changed = 1;
+			continue;
+		}
+
+		/*
+		 * bCC 1f; ba 2f; 1: ... => bNCC 2f; 1: ...
+		 */
+		if (op != DIF_OP_BA &&
+		    DIF_INSTR_OP(dop->dop_ins[j]->di_instr) == DIF_OP_BA &&
+		    !dt_difopt_istarget(dop, i, j) &&
+		    t == dt_difopt_next(dop, j)) {
+			op = dt_difopt_invert(op);
+			lbl = DIF_INSTR_LABEL(dop->dop_ins[j]->di_instr);
+			dop->dop_dead[j] = 1;
+		}
+
+		if (DIF_INSTR_BRANCH(op, lbl) != instr) {
+			dop->dop_ins[i]->di_instr = DIF_INSTR_BRANCH(op, lbl);
+			changed = 1;
+		}
+	}
+
+	/*
+	 * All branches go forward, so one pass finds everything reachable.
+	 * Deleted instructions pass reachability on to what follows them.  The
+	 * final RET is always kept.
+	 */
+	memset(dop->dop_reach, 0, dop->dop_len);
+	dop->dop_reach[0] = 1;
+
+	for (i = 0; i < dop->dop_len; i++) {
+		if (!dop->dop_reach[i] && i != dop->dop_len - 1) {
+			if (!dop->dop_dead[i])
+				changed = 1;
+			dop->dop_dead[i] = 1;
+			continue;
+		}
+
+		op = DIF_INSTR_OP(dop->dop_ins[i]->di_instr);
+
+		if (dop->dop_dead[i]) {
+			dop->dop_reach[i + 1] = 1;
+			continue;
+		}
+
+		if (DT_OP_ISBRANCH(op))
+			dop->dop_reach[dt_difopt_label(dop, i)] = 1;
+
+		if (op != DIF_OP_BA && op != DIF_OP_RET)
+			dop->dop_reach[i + 1] = 1;
+	}
+
+	return (changed);
+}
+
+/*
+ * Return whether SETX of the given integer table index sets a register to 0.
+ */
+static int
+dt_difopt_iszero(const dt_inttab_t *ip, uint_t index)
+{
+	const dt_inthash_t *hp;
+
+	for (hp = ip->int_head; hp != NULL; hp = hp->inh_next) {
+		if (hp->inh_index == index)
+			return (hp->inh_value == 0);
+	}
+
+	return (0);
+}
+
+static void
+dt_difopt_reset(dt_difval_t *regs, uint_t *vnp)
+{
+	uint_t r;
+
+	memset(regs, 0, sizeof (dt_difval_t) * DIF_DIR_NREGS);
+
+	for (r = 1; r < DIF_DIR_NREGS; r++)
+		regs[r].dv_vn = (*vnp)++;
+}
+
+/*
+ * Return the oldest register holding value number vn: %r0 for zero.
+ */
+static uint_t
+dt_difopt_holder(const dt_difval_t *regs, uint_t vn)
+{
+	uint_t r, s = 0;
+
+	if (vn == 0)
+		return (0);
+
+	for (r = 1; r < DIF_DIR_NREGS; r++) {
+		if (regs[r].dv_vn == vn &&
+		    (s == 0 || regs[r].dv_age < regs[s].dv_age))
+			s = r;
+	}
+
+	return (s);
+}
+
+/*
+ * Rename the register read through the field at the given bit offset.
+ */
+static dif_instr_t
+dt_difopt_rename(const dt_difval_t *regs, dif_instr_t instr, uint_t shift)
+{
+	uint_t r = (instr >> shift) & 0xff;
+	uint_t s = dt_difopt_holder(regs, regs[r].dv_vn);
+
+	return ((instr & ~(0xffU << shift)) | (s << shift));
+}
+
+/*
+ * Forget which registers hold a loaded variable, because it is stored to
+ * (op and id), or because memory is written (op 0).
+ */
+static void
+dt_difopt_forget(dt_difval_t *regs, uint_t op, uint_t id)
+{
+	uint_t r;
+
+	for (r = 1; r < DIF_DIR_NREGS; r++) {
+		if (regs[r].dv_op == DIF_OP_SETX ||
+		    regs[r].dv_op == DIF_OP_SETS)
+			continue;
+
+		if (op == 0 || (regs[r].dv_op == op && regs[r].dv_id == id))
+			regs[r].dv_op = 0;
+	}
+}
+
+/*
+ * Local value numbering over extended basic blocks: state flows through
+ * conditional branches into the next instruction, and is reset wherever a
+ * branch may land.
+ */
+static int
+dt_difopt_values(dt_difopt_t *dop)
+{
+	dt_difval_t regs[DIF_DIR_NREGS];
+	dt_difinfo_t dii;
+	dif_instr_t instr;
+	uint_t i, r, s, op, id, vn = 1;
+	int cczero = 0, reset = 1, changed = 0;
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ins[i];
+
+		reset |= dop->dop_target[i];
+
+		if (dop->dop_dead[i])
+			continue;
+
+		if (reset) {
+			dt_difopt_reset(regs, &vn);
+			cczero = reset = 0;
+		}
+
+		(void) dt_difopt_info(dip, &dii);
+		instr = dip->di_instr;
+
+		/*
+		 * Rename the registers read to the oldest holding their value.
+		 */
+		if (dii.ddi_rename & DT_IRREG_R1)
+			instr = dt_difopt_rename(regs, instr, 16);
+		if (dii.ddi_rename & DT_IRREG_R2)
+			instr = dt_difopt_rename(regs, instr, 8);
+		if (dii.ddi_rename & DT_IRREG_RD)
+			instr = dt_difopt_rename(regs, instr, 0);
+
+		if (instr != dip->di_instr) {
+			dip->di_instr = instr;
+			changed = 1;
+		}
+
+		op = DIF_INSTR_OP(instr);
+		r = DIF_INSTR_RD(instr);
+		id = DIF_INSTR_VAR(instr);
+
+		switch (op) {
+		case DIF_OP_MOV:
+			if (r == 0)
+				break;
+
+			s = DIF_INSTR_R1(instr);
+
+			if (regs[r].dv_vn == regs[s].dv_vn) {
+				dop->dop_dead[i] = 1;
+				changed = 1;
+			} else {
+				regs[r] = regs[s];
+				regs[r].dv_age = i + 1;
+			}
+			continue;
+
+		case DIF_OP_SETX:
+		case DIF_OP_SETS:
+		case DIF_OP_LDGS:
+		case DIF_OP_LDTS:
+		case DIF_OP_LDLS:
+			if (!dii.ddi_pure || r == 0)
+				break;
+
+			/*
+			 * Find a register already holding the same constant or
+			 * variable, and copy it from there.
+			 */
+			if (op == DIF_OP_SETX &&
+			    dt_difopt_iszero(dop->dop_inttab, id))
+				s = 0;
+			else {
+				for (s = 1; s < DIF_DIR_NREGS; s++) {
+					if (regs[s].dv_op == op &&
+					    regs[s].dv_id == id)
+						break;
+				}
+			}
+
+			if (s == DIF_DIR_NREGS) {
+				regs[r].dv_vn = vn++;
+				regs[r].dv_op = op;
+				regs[r].dv_id = id;
+				regs[r].dv_age = i + 1;
+				continue;
+			}
+
+			if (regs[r].dv_vn == regs[s].dv_vn) {
+				dop->dop_dead[i] = 1;
+				changed = 1;
+				continue;
+			}
+
+			s = dt_difopt_holder(regs, regs[s].dv_vn);
+			dip->di_instr = DIF_INSTR_MOV(s, r);
+			changed = 1;
+
+			regs[r] = regs[s];
+			regs[r].dv_age = i + 1;
+			continue;
+
+		case DIF_OP_TST:
+			cczero = regs[DIF_INSTR_R1(instr)].dv_vn == 0;
+			continue;
+
+		case DIF_OP_CMP:
+		case DIF_OP_SCMP:
+			cczero = regs[DIF_INSTR_R1(instr)].dv_vn ==
+			    regs[DIF_INSTR_R2(instr)].dv_vn;
+			continue;
+
+		/*
+		 * Testing zero or comparing a value with itself leaves only
+		 * the Z flag set.
+		 */
+		case DIF_OP_BE:
+		case DIF_OP_BGE:
+		case DIF_OP_BGEU:
+		case DIF_OP_BLE:
+		case DIF_OP_BLEU:
+			if (cczero) {
+				dip->di_instr = DIF_INSTR_BRANCH(DIF_OP_BA,
+				    DIF_INSTR_LABEL(instr));
+				changed = 1;
+				reset = 1;
+			}
+			continue;
+
+		case DIF_OP_BNE:
+		case DIF_OP_BG:
+		case DIF_OP_BGU:
+		case DIF_OP_BL:
+		case DIF_OP_BLU:
+			if (cczero) {
+				dop->dop_dead[i] = 1;
+				changed = 1;
+			}
+			continue;
+
+		case DIF_OP_BA:
+		case DIF_OP_RET:
+			reset = 1;
+			continue;
+
+		case DIF_OP_STGS:
+			dt_difopt_forget(regs, DIF_OP_LDGS, id);
+			break;
+		case DIF_OP_STTS:
+			dt_difopt_forget(regs, DIF_OP_LDTS, id);
+			break;
+		case DIF_OP_STLS:
+			dt_difopt_forget(regs, DIF_OP_LDLS, id);
+			break;
+
+		case DIF_OP_STGAA:
+		case DIF_OP_STTAA:
+		case DIF_OP_STB:
+		case DIF_OP_STH:
+		case DIF_OP_STW:
+		case DIF_OP_STX:
+		case DIF_OP_COPYS:
+		case DIF_OP_CALL:
+		case DIF_OP_XLATE:
+		case DIF_OP_XLARG:
+			dt_difopt_forget(regs, 0, 0);
+			break;
+		}
+
+		if (dii.ddi_def & DT_DIFOPT_CC)
+			cczero = 0;
+
+		if (dii.ddi_def & ((1U << DIF_DIR_NREGS) - 1)) {
+			regs[r].dv_vn = vn++;
+			regs[r].dv_op = 0;
+			regs[r].dv_age = i + 1;
+		}
+	}
+
+	return (changed);
+}
+
+/*
+ * Dead code elimination.  All branches go forward, so a single backward pass
+ * computes exact register liveness.
+ */
+static int
+dt_difopt_live(dt_difopt_t *dop)
+{
+	uint_t *live = dop->dop_live;
+	dt_difinfo_t dii;
+	uint_t i, op, out;
+	int changed = 0;
+
+	live[dop->dop_len] = 0;
+
+	for (i = dop->dop_len; i-- > 0; ) {
+		if (dop->dop_dead[i]) {
+			live[i] = live[i + 1];
+			continue;
+		}
+
+		(void) dt_difopt_info(dop->dop_ins[i], &dii);
+		op = DIF_INSTR_OP(dop->dop_ins[i]->di_instr);
+
+		if (op == DIF_OP_RET)
+			out = 0;
+		else if (op == DIF_OP_BA)
+			out = live[dt_difopt_label(dop, i)];
+		else if (DT_OP_ISBRANCH(op))
+			out = live[dt_difopt_label(dop, i)] | live[i + 1];
+		else
+			out = live[i + 1];
+
+		if (dii.ddi_pure && (dii.ddi_def & out) == 0) {
+			dop->dop_dead[i] = 1;
+			live[i] = out;
+			changed = 1;
+		} else
+			live[i] = (out & ~dii.ddi_def) | dii.ddi_use;
+	}
+
+	return (changed);
+}
+
+/*
+ * Remove deleted instructions from the list, turning those with a label into
+ * label declarations, and drop labels nothing branches to any more.
+ */
+static void
+dt_difopt_compact(dt_difopt_t *dop)
+{
+	dt_irlist_t *dlp = dop->dop_dlp;
+	dt_irnode_t *dip, **pp;
+	uint_t i;
+	int decl;
+
+	memset(dop->dop_refs, 0, sizeof (uint_t) * dlp->dl_label);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dif_instr_t instr = dop->dop_ins[i]->di_instr;
+
+		if (!dop->dop_dead[i] && DT_OP_ISBRANCH(DIF_INSTR_OP(instr)))
+			dop->dop_refs[DIF_INSTR_LABEL(instr)]++;
+	}
+
+	dlp->dl_last = NULL;
+	dlp->dl_len = 0;
+
+	for (i = 0, pp = &dlp->dl_list; (dip = *pp) != NULL; ) {
+		decl = dip->di_label != DT_LBL_NONE &&
+		    dip->di_instr == DIF_INSTR_NOP;
+
+		if (!decl && dop->dop_dead[i++]) {
+			dip->di_instr = DIF_INSTR_NOP;
+			decl = 1;
+		}
+
+		if (dip->di_label != DT_LBL_NONE &&
+		    dop->dop_refs[dip->di_label] == 0)
+			dip->di_label = DT_LBL_NONE;
+
+		if (decl && dip->di_label == DT_LBL_NONE) {
+			*pp = dip->di_next;
+			free(dip);
+			continue;
+		}
+
+		if (!decl)
+			dlp->dl_len++;
+
+		dlp->dl_last = dip;
+		pp = &dip->di_next;
+	}
+}
+
+void
+dt_difopt(dt_pcb_t *pcb)
+{
+	dt_irlist_t *dlp = &pcb->pcb_ir;
+	uint_t len = dlp->dl_len, round;
+	dt_difopt_t dop;
+	int changed;
+
+	memset(&dop, 0, sizeof (dop));
+	dop.dop_dlp = dlp;
+	dop.dop_inttab = pcb->pcb_inttab;
+
+	/*
+	 * Failure to allocate is not an error: the code is simply left as it
+	 * is.
+	 */
+	if ((dop.dop_ins = malloc(sizeof (void *) * len)) == NULL ||
+	    (dop.dop_labels = malloc(sizeof (uint_t) * dlp->dl_label)) == NULL ||
+	    (dop.dop_refs = malloc(sizeof (uint_t) * dlp->dl_label)) == NULL ||
+	    (dop.dop_target = malloc(len + 1)) == NULL ||
+	    (dop.dop_dead = malloc(len + 1)) == NULL ||
+	    (dop.dop_reach = malloc(len + 1)) == NULL ||
+	    (dop.dop_live = malloc(sizeof (uint_t) * (len + 1))) == NULL)
+		goto out;
+
+	for (round = 0; round < DT_DIFOPT_ROUNDS; round++) {
+		if (dt_difopt_scan(&dop) != 0)
+			break;
+
+		changed = dt_difopt_branches(&dop);
+		changed |= dt_difopt_values(&dop);
+		changed |= dt_difopt_live(&dop);
+
+		if (!changed)
+			break;
+
+		dt_difopt_compact(&dop);
+	}
+
+	if (dlp->dl_len != len) {
+		dt_dprintf("DIF optimizer: %u instructions down to %u\n",
+		    len, dlp->dl_len);
+	}
+
+out:
+	free(dop.dop_ins);
+	free(dop.dop_labels);
+	free(dop.dop_refs);
+	free(dop.dop_target);
+	free(dop.dop_dead);
+	free(dop.dop_reach);
+	free(dop.dop_live);
+}
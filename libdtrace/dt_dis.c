@@ -11,6 +11,7 @@
 #include <dt_impl.h>
 #include <dt_ident.h>
 #include <dt_printf.h>
+#include <dt_program.h>
 
 /*ARGSUSED*/
 static void
@@ -641,4 +642,10 @@ dt_dis_program(dtrace_hdl_t *dtp, dtrace_prog_t *pgp, FILE *fp)
 	dt_dis_iter_t data = { fp };
 
 	dtrace_stmt_iter(dtp, pgp, dt_dis_stmts, &data);
+
+	if (pgp->dp_cseexprs != 0) {
+		fprintf(fp, "\n%u common subexpressions hoisted, "
+		    "%d DIF instructions saved\n", pgp->dp_cseexprs,
+		    pgp->dp_csesaved);
+	}
 }
@@ -6,6 +6,7 @@
  */
 
 #include <stddef.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -270,6 +271,9 @@ static const struct {
 	{ DROPTAG(DTRACEDROP_SPECUNAVAIL) },
 	{ DROPTAG(DTRACEDROP_DBLERROR) },
 	{ DROPTAG(DTRACEDROP_STKSTROVERFLOW) },
+	{ DROPTAG(DTRACEDROP_LATE) },
+	{ DROPTAG(DTRACEDROP_AGGSNAP) },
+	{ DROPTAG(DTRACEDROP_AUTOSWITCH) },
 	{ 0, NULL }
 };
 
@@ -286,25 +290,38 @@ dt_droptag(dtrace_dropkind_t kind)
 	return ("DTRACEDROP_UNKNOWN");
 }
 
-int
-dt_handle_cpudrop(dtrace_hdl_t *dtp, processorid_t cpu,
-    dtrace_dropkind_t what, uint64_t howmany)
+/*
+ * Pass a report of kind 'kind' to the drop handler, with a message formatted
+ * from 'format' and prefixed by the drop tag if -xdroptags is set.  Without a
+ * drop handler, drops abort the consumer; the other reports (aggregation
+ * snapshot statistics and -xswitchrate=auto decisions) are discarded.
+ */
+static int
+dt_handle_drop(dtrace_hdl_t *dtp, processorid_t cpu, dtrace_dropkind_t kind,
+    uint64_t total, uint64_t drops, const char *format, ...)
 {
 	dtrace_dropdata_t drop;
-	char str[80], *s;
+	char str[160], *s;
+	va_list ap;
 	int size;
 
-	assert(what == DTRACEDROP_PRINCIPAL || what == DTRACEDROP_AGGREGATION);
+	if (dtp->dt_drophdlr == NULL) {
+		if (kind == DTRACEDROP_AGGSNAP || kind == DTRACEDROP_AUTOSWITCH)
+			return (0);
+
+		return (dt_set_errno(dtp, EDT_DROPABORT));
+	}
 
 	memset(&drop, 0, sizeof (drop));
 	drop.dtdda_handle = dtp;
 	drop.dtdda_cpu = cpu;
-	drop.dtdda_kind = what;
-	drop.dtdda_drops = howmany;
+	drop.dtdda_kind = kind;
+	drop.dtdda_drops = drops;
+	drop.dtdda_total = total;
 	drop.dtdda_msg = str;
 
 	if (dtp->dt_droptags) {
-		(void) snprintf(str, sizeof (str), "[%s] ", dt_droptag(what));
+		(void) snprintf(str, sizeof (str), "[%s] ", dt_droptag(kind));
 		s = &str[strlen(str)];
 		size = sizeof (str) - (s - str);
 	} else {
@@ -312,12 +329,9 @@ dt_handle_cpudrop(dtrace_hdl_t *dtp, processorid_t cpu,
 		size = sizeof (str);
 	}
 
-	(void) snprintf(s, size, "%llu %sdrop%s on CPU %d\n",
-	    (unsigned long long) howmany, what == DTRACEDROP_PRINCIPAL ? "" : "aggregation ",
-	    howmany > 1 ? "s" : "", cpu);
-
-	if (dtp->dt_drophdlr == NULL)
-		return (dt_set_errno(dtp, EDT_DROPABORT));
+	va_start(ap, format);
+	(void) vsnprintf(s, size, format, ap);
+	va_end(ap);
 
 	if ((*dtp->dt_drophdlr)(&drop, dtp->dt_droparg) == DTRACE_HANDLE_ABORT)
 		return (dt_set_errno(dtp, EDT_DROPABORT));
@@ -325,6 +339,55 @@ dt_handle_cpudrop(dtrace_hdl_t *dtp, processorid_t cpu,
 	return (0);
 }
 
+int
+dt_handle_cpudrop(dtrace_hdl_t *dtp, processorid_t cpu,
+    dtrace_dropkind_t what, uint64_t howmany)
+{
+	assert(what == DTRACEDROP_PRINCIPAL || what == DTRACEDROP_AGGREGATION ||
+	    what == DTRACEDROP_LATE);
+
+	if (what == DTRACEDROP_LATE)
+		return (dt_handle_drop(dtp, cpu, what, 0, howmany,
+		    "%llu record%s out of temporal order on CPU %d\n",
+		    (unsigned long long) howmany, howmany > 1 ? "s" : "",
+		    cpu));
+
+	return (dt_handle_drop(dtp, cpu, what, 0, howmany,
+	    "%llu %sdrop%s on CPU %d\n", (unsigned long long) howmany,
+	    what == DTRACEDROP_PRINCIPAL ? "" : "aggregation ",
+	    howmany > 1 ? "s" : "", cpu));
+}
+
+/*
+ * Report how many aggregation records the last snapshot merged through the
+ * per-CPU record cache and how many required a full hash lookup.  These are
+ * not drops; they are only reported when asked for via -xaggstats.
+ */
+int
+dt_handle_aggsnap(dtrace_hdl_t *dtp, uint64_t skipped, uint64_t processed)
+{
+	return (dt_handle_drop(dtp, DTRACE_CPUALL, DTRACEDROP_AGGSNAP,
+	    skipped + processed, skipped,
+	    "%llu aggregation record%s cached, %llu hashed\n",
+	    (unsigned long long) skipped, skipped != 1 ? "s" : "",
+	    (unsigned long long) processed));
+}
+
+/*
+ * Report a decision taken by -xswitchrate=auto, so that a run can be
+ * reproduced from its log; "drops" are those seen on the CPU that prompted
+ * the decision.
+ */
+int
+dt_handle_autoswitch(dtrace_hdl_t *dtp, processorid_t cpu, uint64_t drops,
+    const char *msg)
+{
+	dt_dprintf("switchrate=auto: %s", msg);
+
+	return (dt_handle_drop(dtp, cpu, DTRACEDROP_AUTOSWITCH, drops, drops,
+	    "switchrate=auto: %s", msg));
+}
+
 static const struct {
 	dtrace_dropkind_t dtdrt_kind;
 	uintptr_t dtdrt_offset;
@@ -34,6 +34,7 @@ extern "C" {
 #include <dt_inttab.h>
 #include <dt_strtab.h>
 #include <dt_symtab.h>
+#include <dt_symcache.h>
 #include <dt_ident.h>
 #include <dt_list.h>
 #include <dt_decl.h>
@@ -117,6 +118,7 @@ typedef struct dt_module {
 	ctf_sect_t dm_ctdata;	/* CTF data for module */
 	ctf_sect_t dm_symtab;	/* symbol table */
 	ctf_sect_t dm_strtab;	/* string table */
+	uint64_t dm_ctfstamp;	/* when dm_ctfp last went cold */
 
 	/*
 	 * Kernel modules only.
@@ -136,6 +138,13 @@ typedef struct dt_module {
 	uint_t dm_aslen;	/* number of entries in dm_asmap */
 } dt_module_t;
 
+typedef struct dt_modrange {
+	GElf_Addr dmr_va;	/* first address in range */
+	GElf_Addr dmr_end;	/* first address beyond range */
+	uint_t dmr_prio;	/* module list position, while building */
+	dt_module_t *dmr_mod;	/* module owning the range */
+} dt_modrange_t;
+
 /*
  * The path to an actual kernel module residing on the disk.  Used only for
  * initialization of the corresponding dt_module, since modprobe -l is
@@ -154,6 +163,7 @@ typedef struct dt_kern_path {
 #define DT_DM_SHARED	0x8	/* module is linked into shared_ctf.ko */
 #define DT_DM_CTF_ARCHIVED  0x10 /* module found in a CTF archive */
 #define DT_DM_KERN_UNLOADED 0x20 /* module not loaded into the kernel */
+#define DT_DM_CTF_COLD	0x40	/* CTF only searched so far: may be released */
 
 typedef struct dt_provmod {
 	char *dp_name;				/* name of provider module */
@@ -175,8 +185,34 @@ typedef struct dt_ahash {
 	dt_ahashent_t	**dtah_hash;		/* hash table */
 	dt_ahashent_t	*dtah_all;		/* list of all elements */
 	size_t		dtah_size;		/* size of hash table */
+	size_t		dtah_nelems;		/* number of elements */
+	uint64_t	dtah_gen;		/* bumped on every removal */
 } dt_ahash_t;
 
+typedef struct dt_acent {
+	size_t dtace_offs;			/* offset of record in buffer */
+	dt_ahashent_t *dtace_ent;		/* entry it aggregated into */
+} dt_acent_t;
+
+typedef struct dt_acache {
+	dt_acent_t *dtac_ents;			/* entries, by record index */
+	size_t dtac_nents;			/* number of valid entries */
+	size_t dtac_size;			/* size of dtac_ents */
+	uint64_t dtac_gen;			/* dtah_gen when filled */
+} dt_acache_t;
+
+typedef struct dt_aslab {
+	struct dt_aslab *dtas_next;		/* next slab in arena */
+	size_t dtas_size;			/* size of slab */
+	size_t dtas_used;			/* bytes handed out */
+} dt_aslab_t;
+
+typedef struct dt_afree {
+	struct dt_afree *dtaf_next;		/* next size on free list */
+	size_t dtaf_size;			/* size of blocks */
+	void *dtaf_blocks;			/* chain of free blocks */
+} dt_afree_t;
+
 typedef struct dt_aggregate {
 	dtrace_bufdesc_t dtat_buf; 	/* buf aggregation snapshot */
 	int dtat_flags;			/* aggregate flags */
@@ -185,8 +221,19 @@ typedef struct dt_aggregate {
 	processorid_t dtat_ncpu;	/* size of dtat_cpus array */
 	processorid_t dtat_maxcpu;	/* maximum number of CPUs */
 	dt_ahash_t dtat_hash;		/* aggregate hash table */
+	dt_aslab_t *dtat_slabs;		/* arena for hash entries */
+	dt_afree_t *dtat_free;		/* removed blocks, by size */
+	dt_acache_t *dtat_cache;	/* per-CPU record cache */
+	uint64_t dtat_skipped;		/* records merged from cache */
+	uint64_t dtat_hashed;		/* records looked up in hash */
 } dt_aggregate_t;
 
+typedef struct dt_bufstat {
+	uint64_t dtbs_fill;		/* bytes in fullest snapshot */
+	uint64_t dtbs_drops;		/* drops seen this round */
+	uint64_t dtbs_total;		/* drops seen since tracing began */
+} dt_bufstat_t;
+
 typedef struct dt_dirpath {
 	dt_list_t dir_list;		/* linked-list forward/back pointers */
 	char *dir_path;			/* directory pathname */
@@ -226,11 +273,21 @@ struct dtrace_hdl {
 	dt_module_t **dt_mods;	/* hash table of dt_module_t's */
 	uint_t dt_modbuckets;	/* number of module hash buckets */
 	uint_t dt_nmods;	/* number of modules in hash and list */
+	dt_modrange_t *dt_modranges; /* module address ranges, sorted */
+	size_t dt_nmodranges;	/* number of entries in dt_modranges */
+	dt_strpool_t *dt_kernstrs; /* names of all kernel module symbols */
+	dt_symindex_t *dt_kernsymindex; /* kernel symbols by name, or NULL */
+	char *dt_kernsnap;	/* kernel snapshot directory, or NULL */
+	char *dt_progcache;	/* compiled program cache directory, or NULL */
+	char *dt_libimage;	/* D library image directory, or NULL */
 	Elf *dt_ctf_elf;	/* ELF handle to the special 'ctf' module */
 	ctf_archive_t *dt_ctfa; /* ctf archive for the entire kernel tree */
 	ctf_file_t *dt_shared_ctf; /* Handle to the shared CTF */
 	uint_t dt_ctf_elf_ref;  /* Number of references to this handle */
 	char *dt_ctfa_path;	/* path to vmlinux.ctfa */
+	uint_t dt_nctfcold;	/* number of modules with cold CTF */
+	uint_t dt_ctfcachesize;	/* max cold CTF kept: set via -xctfcache */
+	uint64_t dt_ctfstamp;	/* clock ordering cold CTF by last use */
 	const dt_modops_t *dt_ctf_ops; /* data model's ops vector for CTF module */
 	dt_list_t dt_kernpathlist; /* linked list of dt_kern_path_t's */
 	dt_kern_path_t **dt_kernpaths; /* hash table of dt_kern_path_t's */
@@ -245,6 +302,8 @@ struct dtrace_hdl {
 	uint_t dt_provbuckets;	/* number of provider hash buckets */
 	uint_t dt_nprovs;	/* number of providers in hash and list */
 	dt_proc_hash_t *dt_procs; /* hash table of grabbed process handles */
+	dt_symcache_t *dt_symcache; /* cache of resolved stack addresses */
+	uint_t dt_symcachesize;	/* max cached addresses: set via -xsymcache */
 	dt_intdesc_t dt_ints[6]; /* cached integer type descriptions */
 	ctf_id_t dt_type_func;	/* cached CTF identifier for function type */
 	ctf_id_t dt_type_fptr;	/* cached CTF identifier for function pointer */
@@ -277,6 +336,12 @@ struct dtrace_hdl {
 	char *dt_sysslice;	/* the systemd system slice: set via -xsysslice */
 	uint_t dt_lazyload;	/* boolean:  set via -xlazyload */
 	uint_t dt_droptags;	/* boolean:  set via -xdroptags */
+	uint_t dt_consumethreads; /* buffer snapshot threads: -xconsumethreads */
+	uint_t dt_aggthreads;	/* aggregation snapshot threads: -xaggthreads */
+	uint_t dt_temporal;	/* boolean:  set via -xtemporal */
+	hrtime_t dt_templast;	/* timestamp of last record merged by time */
+	dtrace_bufdesc_t *dt_temphold; /* per-CPU records held back by time */
+	int dt_ntemphold;	/* number of dt_temphold entries */
 	uint_t dt_active;	/* boolean:  set once tracing is active */
 	uint_t dt_stopped;	/* boolean:  set once tracing is stopped */
 	processorid_t dt_beganon; /* CPU that executed BEGIN probe (if any) */
@@ -300,6 +365,9 @@ struct dtrace_hdl {
 	int dt_cdefs_fd;	/* file descriptor for C CTF debugging cache */
 	int dt_ddefs_fd;	/* file descriptor for D CTF debugging cache */
 	int dt_stdout_fd;	/* file descriptor for saved stdout */
+	int dt_wakefd;		/* epoll fd returned by dtrace_wakeup_fd() */
+	int dt_wakeevfd;	/* eventfd signalled by dtrace_wakeup() */
+	int dt_waketimerfd;	/* timerfd armed for the next deadline */
 	dtrace_handle_err_f *dt_errhdlr; /* error handler, if any */
 	void *dt_errarg;	/* error handler argument */
 	dtrace_prog_t *dt_errprog; /* error handler program, if any */
@@ -314,6 +382,12 @@ struct dtrace_hdl {
 	hrtime_t dt_laststatus;	/* last status */
 	hrtime_t dt_lastswitch;	/* last switch of buffer data */
 	hrtime_t dt_lastagg;	/* last snapshot of aggregation data */
+	hrtime_t dt_wakefill;	/* predicted time a buffer nears full */
+	hrtime_t dt_filllast;	/* time of last buffer fill measurement */
+	uint64_t dt_fillmax;	/* fullest buffer snapshot this round */
+	uint_t dt_autoswitch;	/* boolean:  set via -xswitchrate=auto */
+	dt_bufstat_t *dt_bufstats; /* per-CPU principal buffer fill and drops */
+	uint64_t dt_autobufsize; /* bufsize suggested by -xswitchrate=auto */
 	char *dt_sprintf_buf;	/* buffer for dtrace_sprintf() */
 	int dt_sprintf_buflen;	/* length of dtrace_sprintf() buffer */
 	pthread_mutex_t dt_sprintf_lock; /* lock for dtrace_sprintf() buffer */
@@ -448,6 +522,7 @@ struct dtrace_hdl {
 #define	DT_ACT_UADDR		DT_ACT(27)	/* uaddr() action */
 #define	DT_ACT_SETOPT		DT_ACT(28)	/* setopt() action */
 #define	DT_ACT_PCAP		DT_ACT(29)	/* pcap() action */
+#define	DT_ACT_TIMESTAMP	DT_ACT(30)	/* -xtemporal record timestamp */
 
 /*
  * Sentinel to tell freopen() to restore the saved stdout.  This must not
@@ -601,6 +676,8 @@ extern void dt_difo_free(dtrace_hdl_t *, dtrace_difo_t *);
 
 extern int dt_gmatch(const char *, const char *);
 extern char *dt_basename(char *);
+extern int dt_uaddrs2sym(dtrace_hdl_t *, pid_t, prsymaddr_t *, char **,
+    uint_t);
 
 extern ulong_t dt_popc(ulong_t);
 extern ulong_t dt_popcb(const ulong_t *, ulong_t);
@@ -620,13 +697,18 @@ extern void dt_endcontext(dtrace_hdl_t *);
 
 extern void dt_pragma(dt_node_t *);
 extern int dt_reduce(dtrace_hdl_t *, dt_version_t);
+extern void dt_cse(dt_pcb_t *);
 extern void dt_cg(dt_pcb_t *, dt_node_t *);
+extern void dt_regset_assign(dt_pcb_t *);
+extern void dt_difopt(dt_pcb_t *);
 extern dtrace_difo_t *dt_as(dt_pcb_t *);
 extern void dt_dis_program(dtrace_hdl_t *dtp, dtrace_prog_t *pgp, FILE *fp);
 
 extern int dt_aggregate_go(dtrace_hdl_t *);
 extern int dt_aggregate_init(dtrace_hdl_t *);
 extern void dt_aggregate_destroy(dtrace_hdl_t *);
+extern int dt_aggregate_trunc(dtrace_hdl_t *, dtrace_aggvarid_t,
+    uint64_t, int);
 
 extern int dt_epid_lookup(dtrace_hdl_t *, dtrace_epid_t,
     dtrace_eprobedesc_t **, dtrace_probedesc_t **);
@@ -650,12 +732,16 @@ extern int dt_handle_liberr(dtrace_hdl_t *,
     const dtrace_probedata_t *, const char *);
 extern int dt_handle_cpudrop(dtrace_hdl_t *, processorid_t,
     dtrace_dropkind_t, uint64_t);
+extern int dt_handle_aggsnap(dtrace_hdl_t *, uint64_t, uint64_t);
+extern int dt_handle_autoswitch(dtrace_hdl_t *, processorid_t, uint64_t,
+    const char *);
 extern int dt_handle_status(dtrace_hdl_t *,
     dtrace_status_t *, dtrace_status_t *);
 extern int dt_handle_setopt(dtrace_hdl_t *, dtrace_setoptdata_t *);
 
 extern int dt_lib_depend_add(dtrace_hdl_t *, dt_list_t *, const char *);
 extern dt_lib_depend_t *dt_lib_depend_lookup(dt_list_t *, const char *);
+extern void dt_lib_depend_free(dtrace_hdl_t *);
 
 extern int dt_variable_read(caddr_t, size_t, uint64_t *);
 
@@ -683,6 +769,8 @@ extern int _dtrace_intbuckets;		/* number of hash buckets for ints */
 extern uint_t _dtrace_stkindent;	/* default indent for stack/ustack */
 extern uint_t _dtrace_pidbuckets;	/* number of hash buckets for pids */
 extern uint_t _dtrace_pidlrulim;	/* number of proc handles to cache */
+extern uint_t _dtrace_symcachesize;	/* number of addresses to cache */
+extern uint_t _dtrace_ctfcachesize;	/* number of cold CTF modules to keep */
 extern size_t _dtrace_bufsize;		/* default dt_buf_create() size */
 extern int _dtrace_argmax;		/* default maximum probe arguments */
 extern int _dtrace_debug_assert;	/* turn on expensive assertions */
@@ -175,28 +175,41 @@ dt_kern_path_update(dtrace_hdl_t *dtp)
 		return err;
 }
 
+/*
+ * Read modules.dep, unless the kernel module paths are already known.
+ */
+int
+dt_kern_path_init(dtrace_hdl_t *dtp)
+{
+	int dterrno;
+
+	if (dtp->dt_nkernpaths != 0)
+		return 0;
+
+	pthread_mutex_lock(&kern_path_update_lock);
+	dterrno = dt_kern_path_update(dtp);
+	pthread_mutex_unlock(&kern_path_update_lock);
+
+	if (dterrno != 0) {
+		dt_dprintf("Error initializing kernel module paths: "
+		    "%s\n", dtrace_errmsg(dtp, dterrno));
+		return dterrno;
+	}
+
+	dt_dprintf("Initialized %i kernel module paths\n",
+	    dtp->dt_nkernpaths);
+
+	return 0;
+}
+
 dt_kern_path_t *
 dt_kern_path_lookup_by_name(dtrace_hdl_t *dtp, const char *name)
 {
 	uint_t h = dt_strtab_hash(name, NULL) % dtp->dt_kernpathbuckets;
 	dt_kern_path_t *dkpp;
 
-	if (dtp->dt_nkernpaths == 0) {
-		int dterrno;
-
-		pthread_mutex_lock(&kern_path_update_lock);
-		dterrno = dt_kern_path_update(dtp);
-		pthread_mutex_unlock(&kern_path_update_lock);
-
-		if (dterrno != 0) {
-			dt_dprintf("Error initializing kernel module paths: "
-			    "%s\n", dtrace_errmsg(dtp, dterrno));
-			return (NULL);
-		}
-
-		dt_dprintf("Initialized %i kernel module paths\n",
-		    dtp->dt_nkernpaths);
-	}
+	if (dt_kern_path_init(dtp) != 0)
+		return (NULL);
 
 	for (dkpp = dtp->dt_kernpaths[h]; dkpp != NULL; dkpp = dkpp->dkp_next) {
 		if (strcmp(dkpp->dkp_name, name) == 0)
@@ -13,6 +13,7 @@
 extern dt_kern_path_t *dt_kern_path_create(dtrace_hdl_t *dtp, char *name,
     char *path);
 extern int dt_kern_path_update(dtrace_hdl_t *dtp);
+extern int dt_kern_path_init(dtrace_hdl_t *dtp);
 extern dt_kern_path_t *dt_kern_path_lookup_by_name(dtrace_hdl_t *dtp,
     const char *name);
 extern void dt_kern_path_destroy(dtrace_hdl_t *dtp, dt_kern_path_t *dkpp);
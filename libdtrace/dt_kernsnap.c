@@ -0,0 +1,455 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Kernel snapshots.
+ *
+ * Parsing /proc/kallmodsyms and modules.dep is most of the startup time of a
+ * short dtrace run.  When a snapshot directory is set by the
+ * DTRACE_OPT_KERNSNAP environment variable, dtrace_update() saves what it
+ * parsed there, and later updates reload it instead of parsing, as long as
+ * nothing it was derived from has changed.  This is not an option: the first
+ * dtrace_update() is done by dtrace_open(), before any option can be set.
+ *
+ * A snapshot is keyed on the kernel release and version, the boot ID (the
+ * kernel's addresses move on every boot under KASLR), the name, size and
+ * address of every loaded module in /proc/modules, the size and mtime of
+ * modules.dep, and the /proc and module paths in use.  The key is stored in
+ * the snapshot header, and any mismatch causes a full parse, which then
+ * writes a new snapshot.
+ *
+ * The snapshot is mmap()ed and restored by copying its arrays: the symbol
+ * tables are stored exactly as dt_symtab keeps them in memory, so this is
+ * cheap.  Every index in it is still checked: the directory must be writable
+ * only by trusted users, but a damaged snapshot must not crash us.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <dt_impl.h>
+#include <dt_module.h>
+#include <dt_kernel_module.h>
+#include <dt_kernsnap.h>
+#include <port.h>
+
+#define	DT_KERNSNAP_MAGIC	0x534b5444	/* "DTKS" */
+#define	DT_KERNSNAP_VERSION	1
+
+typedef struct dt_kernsnap_hdr {
+	uint32_t dksh_magic;		/* DT_KERNSNAP_MAGIC */
+	uint32_t dksh_version;		/* DT_KERNSNAP_VERSION */
+	dt_kernsnap_key_t dksh_key;	/* what the snapshot was built from */
+	uint32_t dksh_nkernpaths;	/* number of kernel module paths */
+	uint32_t dksh_nmods;		/* number of modules */
+} dt_kernsnap_hdr_t;			/* followed by strpool, paths, modules */
+
+#define	DT_SNAP_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/*
+ * Return a pointer to the next len bytes of a snapshot and move past them, or
+ * NULL if the snapshot is too short.
+ */
+const void *
+dt_snap_get(dt_snap_t *ds, size_t len)
+{
+	const char *p = ds->ds_ptr;
+
+	if (len > (size_t)(ds->ds_end - p) ||
+	    DT_SNAP_ALIGN(len) > (size_t)(ds->ds_end - p)) {
+		ds->ds_ptr = ds->ds_end;
+		return (NULL);
+	}
+
+	ds->ds_ptr += DT_SNAP_ALIGN(len);
+	return (p);
+}
+
+/*
+ * Append len bytes to a snapshot being written, padded to the alignment.
+ */
+int
+dt_snap_put(FILE *fp, const void *buf, size_t len)
+{
+	static const char pad[8];
+
+	if (len > 0 && fwrite(buf, len, 1, fp) != 1)
+		return (-1);
+
+	if (DT_SNAP_ALIGN(len) != len &&
+	    fwrite(pad, DT_SNAP_ALIGN(len) - len, 1, fp) != 1)
+		return (-1);
+
+	return (0);
+}
+
+const char *
+dt_snap_get_str(dt_snap_t *ds)
+{
+	const uint32_t *len;
+	const char *str;
+
+	if ((len = dt_snap_get(ds, sizeof (uint32_t))) == NULL ||
+	    *len == 0 || (str = dt_snap_get(ds, *len)) == NULL ||
+	    str[*len - 1] != '\0')
+		return (NULL);
+
+	return (str);
+}
+
+int
+dt_snap_put_str(FILE *fp, const char *str)
+{
+	uint32_t len = strlen(str) + 1;
+
+	if (dt_snap_put(fp, &len, sizeof (len)) < 0 ||
+	    dt_snap_put(fp, str, len) < 0)
+		return (-1);
+
+	return (0);
+}
+
+uint64_t
+dt_kernsnap_hash(uint64_t h, const char *p, size_t len)
+{
+	while (len-- > 0) {
+		h ^= (unsigned char)*p++;
+		h *= 1099511628211ULL;
+	}
+
+	return (h);
+}
+
+/*
+ * Compute the key describing the kernel as it is now.
+ */
+void
+dt_kernsnap_key(dtrace_hdl_t *dtp, dt_kernsnap_key_t *key)
+{
+	char path[PATH_MAX];
+	char *line = NULL;
+	size_t line_n = 0;
+	struct stat s;
+	FILE *fp;
+
+	memset(key, 0, sizeof (dt_kernsnap_key_t));
+	strlcpy(key->dsk_release, dtp->dt_uts.release,
+	    sizeof (key->dsk_release));
+	strlcpy(key->dsk_version, dtp->dt_uts.version,
+	    sizeof (key->dsk_version));
+
+	snprintf(path, sizeof (path), "%s/sys/kernel/random/boot_id",
+	    Pprocfs_path());
+	if ((fp = fopen(path, "r")) != NULL) {
+		if (fgets(key->dsk_boot_id, sizeof (key->dsk_boot_id),
+		    fp) == NULL)
+			key->dsk_boot_id[0] = '\0';
+		fclose(fp);
+	}
+
+	key->dsk_paths = dt_kernsnap_hash(DT_KERNSNAP_HASHINIT,
+	    Pprocfs_path(), strlen(Pprocfs_path()) + 1);
+	key->dsk_paths = dt_kernsnap_hash(key->dsk_paths,
+	    dtp->dt_module_path, strlen(dtp->dt_module_path) + 1);
+
+	/*
+	 * Module use counts and dependencies change all the time without any
+	 * effect on symbols: only hash names, sizes and load addresses.
+	 */
+	key->dsk_modules = DT_KERNSNAP_HASHINIT;
+	snprintf(path, sizeof (path), "%s/modules", Pprocfs_path());
+	if ((fp = fopen(path, "r")) != NULL) {
+		while (getline(&line, &line_n, fp) > 0) {
+			char *tok, *save = NULL;
+			int i;
+
+			for (i = 0, tok = strtok_r(line, " \n", &save);
+			    tok != NULL;
+			    i++, tok = strtok_r(NULL, " \n", &save)) {
+				if (i == 0 || i == 1 || i == 5)
+					key->dsk_modules = dt_kernsnap_hash(
+					    key->dsk_modules, tok,
+					    strlen(tok) + 1);
+			}
+		}
+		free(line);
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof (path), "%s/modules.dep", dtp->dt_module_path);
+	if (stat(path, &s) == 0) {
+		key->dsk_dep_size = s.st_size;
+		key->dsk_dep_mtime_sec = s.st_mtim.tv_sec;
+		key->dsk_dep_mtime_nsec = s.st_mtim.tv_nsec;
+	}
+}
+
+static int
+dt_kernsnap_path(dtrace_hdl_t *dtp, char *buf, size_t len)
+{
+	if (dtp->dt_kernsnap == NULL || dtp->dt_kernsnap[0] == '\0')
+		return (-1);
+
+	if (snprintf(buf, len, "%s/kernsnap-%s", dtp->dt_kernsnap,
+	    dtp->dt_uts.release) >= len)
+		return (-1);
+
+	return (0);
+}
+
+static int
+dt_kernsnap_restore_ranges(dt_snap_t *ds, dtrace_addr_range_t **rangep,
+    size_t *sizep)
+{
+	const uint32_t *n;
+	const dtrace_addr_range_t *ranges;
+
+	if ((n = dt_snap_get(ds, sizeof (uint32_t))) == NULL ||
+	    (ranges = dt_snap_get(ds, (size_t)*n *
+	    sizeof (dtrace_addr_range_t))) == NULL)
+		return (-1);
+
+	if (*n == 0)
+		return (0);
+
+	if ((*rangep = malloc(*n * sizeof (dtrace_addr_range_t))) == NULL)
+		return (-1);
+
+	memcpy(*rangep, ranges, *n * sizeof (dtrace_addr_range_t));
+	*sizep = *n;
+
+	return (0);
+}
+
+static int
+dt_kernsnap_restore(dtrace_hdl_t *dtp, dt_snap_t *ds,
+    const dt_kernsnap_hdr_t *hdr)
+{
+	int have_paths = dtp->dt_nkernpaths != 0;
+	dt_strpool_t *strs;
+	uint32_t i;
+
+	if ((strs = dt_strpool_read(ds)) == NULL)
+		return (-1);
+
+	dt_strpool_destroy(dtp->dt_kernstrs);
+	dtp->dt_kernstrs = strs;
+
+	/*
+	 * Module paths are only restored if they have not been read yet.
+	 */
+	for (i = 0; i < hdr->dksh_nkernpaths; i++) {
+		const char *name, *path;
+		char *n = NULL, *p = NULL;
+
+		if ((name = dt_snap_get_str(ds)) == NULL ||
+		    (path = dt_snap_get_str(ds)) == NULL)
+			return (-1);
+
+		if (have_paths)
+			continue;
+
+		if ((n = strdup(name)) == NULL || (p = strdup(path)) == NULL ||
+		    dt_kern_path_create(dtp, n, p) == NULL) {
+			free(n);
+			free(p);
+			return (-1);
+		}
+	}
+
+	for (i = 0; i < hdr->dksh_nmods; i++) {
+		const char *name;
+		const uint32_t *has_syms;
+		dt_module_t *dmp;
+
+		if ((name = dt_snap_get_str(ds)) == NULL)
+			return (-1);
+
+		if ((dmp = dt_module_lookup_by_name(dtp, name)) == NULL) {
+			if ((dmp = dt_module_create(dtp, name)) == NULL ||
+			    dt_kern_module_init(dtp, dmp) != 0)
+				return (-1);
+		}
+
+		if (dt_kernsnap_restore_ranges(ds, &dmp->dm_text_addrs,
+		    &dmp->dm_text_addrs_size) < 0 ||
+		    dt_kernsnap_restore_ranges(ds, &dmp->dm_data_addrs,
+		    &dmp->dm_data_addrs_size) < 0 ||
+		    (has_syms = dt_snap_get(ds, sizeof (uint32_t))) == NULL)
+			return (-1);
+
+		if (*has_syms &&
+		    (dmp->dm_kernsyms = dt_symtab_read(strs, ds)) == NULL)
+			return (-1);
+	}
+
+	return (ds->ds_ptr == ds->ds_end ? 0 : -1);
+}
+
+/*
+ * Populate the module list from the snapshot, if there is a current one.
+ * Called by dtrace_update() with all modules unloaded.  On failure, some
+ * modules may have been partially populated: the caller must unload them
+ * again before parsing.
+ */
+int
+dt_kernsnap_load(dtrace_hdl_t *dtp)
+{
+	char path[PATH_MAX];
+	dt_kernsnap_key_t key;
+	const dt_kernsnap_hdr_t *hdr;
+	dt_snap_t ds;
+	size_t size;
+	void *map;
+	int err, have_paths;
+
+	if (dt_kernsnap_path(dtp, path, sizeof (path)) < 0)
+		return (-1);
+
+	if ((map = cachefile_map(path, sizeof (dt_kernsnap_hdr_t),
+	    DT_KERNSNAP_MAGIC, DT_KERNSNAP_VERSION, &size)) == NULL)
+		return (-1);
+
+	ds.ds_ptr = map;
+	ds.ds_end = (const char *)map + size;
+	hdr = dt_snap_get(&ds, sizeof (dt_kernsnap_hdr_t));
+
+	dt_kernsnap_key(dtp, &key);
+	if (memcmp(&hdr->dksh_key, &key, sizeof (key)) != 0) {
+		dt_dprintf("kernel snapshot %s is stale\n", path);
+		munmap(map, size);
+		return (-1);
+	}
+
+	have_paths = dtp->dt_nkernpaths != 0;
+	err = dt_kernsnap_restore(dtp, &ds, hdr);
+	munmap(map, size);
+
+	if (err != 0) {
+		dt_kern_path_t *dkpp;
+
+		/*
+		 * A partial list of module paths would stop modules.dep from
+		 * ever being read: drop it.
+		 */
+		while (!have_paths &&
+		    (dkpp = dt_list_next(&dtp->dt_kernpathlist)) != NULL)
+			dt_kern_path_destroy(dtp, dkpp);
+
+		dt_dprintf("kernel snapshot %s is corrupt\n", path);
+		return (-1);
+	}
+
+	dt_dprintf("loaded kernel snapshot %s\n", path);
+	return (0);
+}
+
+static int
+dt_kernsnap_save_ranges(FILE *fp, const dtrace_addr_range_t *ranges,
+    size_t n)
+{
+	uint32_t n32 = n;
+
+	if (dt_snap_put(fp, &n32, sizeof (n32)) < 0 ||
+	    dt_snap_put(fp, ranges, n * sizeof (dtrace_addr_range_t)) < 0)
+		return (-1);
+
+	return (0);
+}
+
+static int
+dt_kernsnap_save(FILE *fp, void *arg)
+{
+	dtrace_hdl_t *dtp = arg;
+	dt_kernsnap_hdr_t hdr;
+	dt_kern_path_t *dkpp;
+	dt_module_t *dmp;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.dksh_magic = DT_KERNSNAP_MAGIC;
+	hdr.dksh_version = DT_KERNSNAP_VERSION;
+	dt_kernsnap_key(dtp, &hdr.dksh_key);
+	hdr.dksh_nkernpaths = dtp->dt_nkernpaths;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp)) {
+		if ((dmp->dm_flags & DT_DM_KERNEL) &&
+		    !(dmp->dm_flags & DT_DM_KERN_UNLOADED) &&
+		    (dmp->dm_kernsyms != NULL || dmp->dm_text_addrs_size ||
+		    dmp->dm_data_addrs_size))
+			hdr.dksh_nmods++;
+	}
+
+	if (dt_snap_put(fp, &hdr, sizeof (hdr)) < 0 ||
+	    dt_strpool_write(dtp->dt_kernstrs, fp) < 0)
+		return (-1);
+
+	for (dkpp = dt_list_next(&dtp->dt_kernpathlist); dkpp != NULL;
+	    dkpp = dt_list_next(dkpp)) {
+		if (dt_snap_put_str(fp, dkpp->dkp_name) < 0 ||
+		    dt_snap_put_str(fp, dkpp->dkp_path) < 0)
+			return (-1);
+	}
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp)) {
+		uint32_t has_syms = dmp->dm_kernsyms != NULL;
+
+		if (!(dmp->dm_flags & DT_DM_KERNEL) ||
+		    (dmp->dm_flags & DT_DM_KERN_UNLOADED) ||
+		    (dmp->dm_kernsyms == NULL && !dmp->dm_text_addrs_size &&
+		    !dmp->dm_data_addrs_size))
+			continue;
+
+		if (dt_snap_put_str(fp, dmp->dm_name) < 0 ||
+		    dt_kernsnap_save_ranges(fp, dmp->dm_text_addrs,
+		    dmp->dm_text_addrs_size) < 0 ||
+		    dt_kernsnap_save_ranges(fp, dmp->dm_data_addrs,
+		    dmp->dm_data_addrs_size) < 0 ||
+		    dt_snap_put(fp, &has_syms, sizeof (has_syms)) < 0)
+			return (-1);
+
+		if (has_syms && dt_symtab_write(dmp->dm_kernsyms, fp) < 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Save the module list just parsed by dtrace_update() to the snapshot.
+ */
+void
+dt_kernsnap_store(dtrace_hdl_t *dtp)
+{
+	char path[PATH_MAX];
+
+	if (dt_kernsnap_path(dtp, path, sizeof (path)) < 0)
+		return;
+
+	/*
+	 * Module paths are otherwise only read when CTF is first needed: read
+	 * them now so that later runs need not.
+	 */
+	(void) dt_kern_path_init(dtp);
+
+	if (cachefile_write(dtp->dt_kernsnap, path, dt_kernsnap_save,
+	    dtp) < 0) {
+		dt_dprintf("cannot write kernel snapshot %s: %s\n", path,
+		    strerror(errno));
+		return;
+	}
+
+	dt_dprintf("saved kernel snapshot %s\n", path);
+}
@@ -0,0 +1,67 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_KERNSNAP_H
+#define	_DT_KERNSNAP_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <dtrace.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * A snapshot of the kernel module list, the kernel symbol tables and the
+ * kernel module path hash, as built by dtrace_update(), saved so that later
+ * dtrace runs against the same kernel need not parse /proc/kallmodsyms and
+ * modules.dep again.
+ */
+#define	DT_KERNSNAP_STRLEN	80
+#define	DT_KERNSNAP_HASHINIT	14695981039346656037ULL
+
+/*
+ * What a snapshot was built from: a snapshot is only used if the key of the
+ * running kernel is the same.
+ */
+typedef struct dt_kernsnap_key {
+	char dsk_release[DT_KERNSNAP_STRLEN];	/* uname -r */
+	char dsk_version[DT_KERNSNAP_STRLEN];	/* uname -v */
+	char dsk_boot_id[DT_KERNSNAP_STRLEN];	/* random/boot_id */
+	uint64_t dsk_paths;		/* hash of /proc and module paths */
+	uint64_t dsk_modules;		/* hash of /proc/modules */
+	uint64_t dsk_dep_size;		/* size of modules.dep */
+	int64_t dsk_dep_mtime_sec;	/* mtime of modules.dep */
+	int64_t dsk_dep_mtime_nsec;
+} dt_kernsnap_key_t;
+
+/*
+ * A dt_snap_t is a cursor over a mapped snapshot.  Every item in a snapshot
+ * is padded to a multiple of eight bytes, so that items are aligned.
+ */
+typedef struct dt_snap {
+	const char *ds_ptr;		/* next item */
+	const char *ds_end;		/* end of the snapshot */
+} dt_snap_t;
+
+extern const void *dt_snap_get(dt_snap_t *, size_t);
+extern int dt_snap_put(FILE *, const void *, size_t);
+extern const char *dt_snap_get_str(dt_snap_t *);
+extern int dt_snap_put_str(FILE *, const char *);
+
+extern uint64_t dt_kernsnap_hash(uint64_t, const char *, size_t);
+extern void dt_kernsnap_key(dtrace_hdl_t *, dt_kernsnap_key_t *);
+
+extern int dt_kernsnap_load(dtrace_hdl_t *);
+extern void dt_kernsnap_store(dtrace_hdl_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_KERNSNAP_H */
@@ -0,0 +1,763 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * D library images.
+ *
+ * Before the first compilation, dt_load_libs() looks for .d files in every
+ * library directory and in the per-kernel directory for the running kernel,
+ * scans each of them for #pragma D depends_on, sorts them by dependency and
+ * finally compiles them in that order, skipping those whose dependencies are
+ * not met.  When a library image directory is set (by the "libimage" option),
+ * the libraries that were compiled are saved there as one image, in the order
+ * they were compiled in, and later runs compile them straight from the mapped
+ * image: the directories are not read, the dependency pass and the sort are
+ * skipped, and so are libraries that did not load last time.
+ *
+ * Which libraries load depends on the library files, on the kernel (which
+ * per-kernel directory applies, and which modules and providers libraries can
+ * depend on) and on the libdtrace build.  An image is keyed on the name, size
+ * and mtime of every library file, the kernel version and the kernel snapshot
+ * key, and the build, and is only used if all of these are the same.
+ *
+ * Most libraries define translators, inlines and types that refer to kernel
+ * types and to the compiler's own identifiers, so the image holds their source
+ * and they are compiled again, against the kernel CTF as it is now.  Libraries
+ * that do nothing but define integer constant inlines (such as unistd.d and
+ * regs.d) are different: the image holds the inlines as the compiler defined
+ * them, and they are entered in dt_globals without parsing or cooking anything.
+ * An error compiling a library from the image is an error, just as when
+ * compiling it from its file.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <dt_impl.h>
+#include <dt_program.h>
+#include <dt_grammar.h>
+#include <dt_libimage.h>
+#include <port.h>
+
+#define	DT_LIBIMAGE_MAGIC	0x494c5444	/* "DTLI" */
+#define	DT_LIBIMAGE_VERSION	1
+#define	DT_LIBIMAGE_BLANK	" \t\r\f\v"	/* white space within a line */
+
+typedef struct dt_libimage_hdr {
+	uint32_t dlih_magic;		/* DT_LIBIMAGE_MAGIC */
+	uint32_t dlih_version;		/* DT_LIBIMAGE_VERSION */
+	dt_libimage_key_t dlih_key;	/* what the image was built from */
+	uint32_t dlih_nlibs;		/* number of libraries */
+	uint32_t dlih_pad;
+} dt_libimage_hdr_t;			/* followed by each library: path, */
+					/* length, and source or inlines */
+
+/*
+ * Hash the names, sizes and mtimes of the D library files in a library
+ * directory and in its per-kernel subdirectories.  The order in which they are
+ * read does not matter.
+ */
+static uint64_t
+dt_libimage_hashdir(const char *path, int depth)
+{
+	char fname[PATH_MAX];
+	struct dirent *dp;
+	uint64_t sum = 0;
+	const char *p;
+	struct stat s;
+	DIR *dirp;
+
+	if ((dirp = opendir(path)) == NULL)
+		return (0);
+
+	while ((dp = readdir(dirp)) != NULL) {
+		uint64_t h;
+
+		if (dp->d_name[0] == '.')
+			continue;
+
+		(void) snprintf(fname, sizeof (fname), "%s/%s", path,
+		    dp->d_name);
+
+		if (stat(fname, &s) != 0)
+			continue;
+
+		if (S_ISDIR(s.st_mode)) {
+			if (depth == 0)
+				sum += dt_libimage_hashdir(fname, depth + 1);
+			continue;
+		}
+
+		if ((p = strrchr(dp->d_name, '.')) == NULL || strcmp(p, ".d"))
+			continue;
+
+		h = dt_kernsnap_hash(DT_KERNSNAP_HASHINIT, fname,
+		    strlen(fname) + 1);
+		h = dt_kernsnap_hash(h, (const char *)&s.st_size,
+		    sizeof (s.st_size));
+		h = dt_kernsnap_hash(h, (const char *)&s.st_mtim,
+		    sizeof (s.st_mtim));
+		sum += h;
+	}
+
+	(void) closedir(dirp);
+	return (sum);
+}
+
+/*
+ * Hash the library path and the D library files on it.
+ */
+uint64_t
+dt_libimage_hash(dtrace_hdl_t *dtp)
+{
+	dt_dirpath_t *dirp;
+	uint64_t h = 0;
+
+	for (dirp = dt_list_next(&dtp->dt_lib_path); dirp != NULL;
+	    dirp = dt_list_next(dirp)) {
+		h = dt_kernsnap_hash(h, dirp->dir_path,
+		    strlen(dirp->dir_path) + 1);
+		h += dt_libimage_hashdir(dirp->dir_path, 0);
+	}
+
+	return (h);
+}
+
+/*
+ * Return the next library in a mapped image, or -1 if the image is corrupt.
+ * A library of length 0 holds 'ninlines' inlines, which are then the items of
+ * 'inlines': a name and a dt_libimage_inline_t for each.
+ */
+static int
+dt_libimage_next(dt_snap_t *ds, const char **path, const void **src,
+    size_t *len, dt_snap_t *inlines, uint32_t *ninlines)
+{
+	const uint64_t *lenp;
+	const uint32_t *np;
+	uint32_t i;
+
+	if ((*path = dt_snap_get_str(ds)) == NULL ||
+	    (lenp = dt_snap_get(ds, sizeof (uint64_t))) == NULL)
+		return (-1);
+
+	*len = *lenp;
+	*ninlines = 0;
+	inlines->ds_ptr = inlines->ds_end = NULL;
+
+	if (*len != 0)
+		return ((*src = dt_snap_get(ds, *len)) == NULL ? -1 : 0);
+
+	if ((np = dt_snap_get(ds, sizeof (uint32_t))) == NULL || *np == 0)
+		return (-1);
+
+	*inlines = *ds;
+	for (i = 0; i < *np; i++) {
+		if (dt_snap_get_str(ds) == NULL ||
+		    dt_snap_get(ds, sizeof (dt_libimage_inline_t)) == NULL)
+			return (-1);
+	}
+
+	inlines->ds_end = ds->ds_ptr;
+	*ninlines = *np;
+	return (0);
+}
+
+/*
+ * Check that the inlines of a library in a mapped image can be defined: their
+ * types must be in dt_ints[], and their names not defined already.
+ */
+static int
+dt_libimage_check(dtrace_hdl_t *dtp, dt_snap_t ds, uint32_t ninlines)
+{
+	const uint_t nints = sizeof (dtp->dt_ints) / sizeof (dtp->dt_ints[0]);
+	const dt_libimage_inline_t *dlin;
+	const char *name;
+	uint32_t i;
+
+	for (i = 0; i < ninlines; i++) {
+		name = dt_snap_get_str(&ds);
+		dlin = dt_snap_get(&ds, sizeof (dt_libimage_inline_t));
+
+		if (dlin->dlin_type >= nints || dlin->dlin_vtype >= nints ||
+		    dt_idhash_lookup(dtp->dt_globals, name) != NULL)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Define the inlines of a library in a mapped image, which has been checked,
+ * just as dt_node_inline() did when the library was compiled: each is a scalar
+ * inline whose parse tree is a single integer node.
+ */
+static int
+dt_libimage_define(dtrace_hdl_t *dtp, dt_snap_t *ds, uint32_t ninlines)
+{
+	dt_idhash_t *dhp = dtp->dt_globals;
+	void (*defer)(dt_idhash_t *, dt_ident_t *) = dhp->dh_defer;
+	const dt_libimage_inline_t *dlin;
+	const dt_intdesc_t *type, *vtype;
+	const char *name;
+	dt_idnode_t *inp;
+	dt_node_t *dnp;
+	dt_ident_t *idp;
+	uint32_t i;
+
+	/*
+	 * Deferred pragmas belong to a compilation pass, and there is none.
+	 */
+	dhp->dh_defer = NULL;
+
+	for (i = 0; i < ninlines; i++) {
+		name = dt_snap_get_str(ds);
+		dlin = dt_snap_get(ds, sizeof (dt_libimage_inline_t));
+		type = &dtp->dt_ints[dlin->dlin_type];
+		vtype = &dtp->dt_ints[dlin->dlin_vtype];
+
+		if ((inp = malloc(sizeof (dt_idnode_t))) == NULL)
+			goto err;
+
+		if ((dnp = dt_node_xalloc(dtp, DT_NODE_INT)) == NULL) {
+			free(inp);
+			goto err;
+		}
+
+		dnp->dn_op = DT_TOK_INT;
+		dnp->dn_value = dlin->dlin_value;
+		dt_node_type_assign(dnp, vtype->did_ctfp, vtype->did_type);
+		dnp->dn_flags = dlin->dlin_nflags;
+		dnp->dn_attr = dlin->dlin_vattr;
+
+		memset(inp, 0, sizeof (dt_idnode_t));
+		inp->din_list = dnp;
+		inp->din_root = dnp;
+
+		idp = dt_idhash_insert(dhp, name, DT_IDENT_SCALAR,
+		    dlin->dlin_flags, 0, dlin->dlin_attr, dlin->dlin_vers,
+		    &dt_idops_inline, inp, dtp->dt_gen);
+
+		if (idp == NULL) {
+			dt_node_link_free(&inp->din_list);
+			free(inp);
+			goto err;
+		}
+
+		dt_ident_type_assign(idp, type->did_ctfp, type->did_type);
+	}
+
+	dhp->dh_defer = defer;
+	return (0);
+
+err:
+	dhp->dh_defer = defer;
+	return (dt_set_errno(dtp, EDT_NOMEM));
+}
+
+/*
+ * Compile the libraries in a mapped image, which has been checked.  The image
+ * holds libraries in dependency order, so #pragma D depends_on library only
+ * has to find that its library was compiled already: every library is entered
+ * on the dependency lists as it is compiled, just as dt_load_libs_dir() would.
+ */
+static int
+dt_libimage_compile(dtrace_hdl_t *dtp, dt_snap_t *ds, uint32_t nlibs)
+{
+	dt_lib_depend_t *dld;
+	dtrace_prog_t *pgp;
+	const char *path;
+	const void *src;
+	dt_snap_t inlines;
+	uint32_t i, ninlines;
+	size_t len;
+	FILE *fp;
+
+	for (i = 0; i < nlibs; i++) {
+		(void) dt_libimage_next(ds, &path, &src, &len, &inlines,
+		    &ninlines);
+
+		if (dt_lib_depend_add(dtp, &dtp->dt_lib_dep, path) != 0 ||
+		    (dld = dt_zalloc(dtp, sizeof (dt_lib_depend_t))) == NULL)
+			goto err;
+
+		if ((dld->dtld_library = strdup(path)) == NULL) {
+			dt_free(dtp, dld);
+			(void) dt_set_errno(dtp, EDT_NOMEM);
+			goto err;
+		}
+
+		dt_list_append(&dtp->dt_lib_dep_sorted, dld);
+
+		if (ninlines != 0) {
+			if (dt_libimage_define(dtp, &inlines, ninlines) != 0)
+				goto err;
+
+			dt_dprintf("defined %u inlines of library %s\n",
+			    ninlines, path);
+			dld->dtld_loaded = B_TRUE;
+			continue;
+		}
+
+		/*
+		 * A stream over the image, rather than a string, so that
+		 * errors are reported with their line in the library.
+		 */
+		if ((fp = fmemopen((void *)src, len, "r")) == NULL) {
+			(void) dt_set_errno(dtp, errno);
+			goto err;
+		}
+
+		dtp->dt_filetag = path;
+		pgp = dtrace_program_fcompile(dtp, fp, DTRACE_C_EMPTY, 0, NULL);
+		(void) fclose(fp);
+		dtp->dt_filetag = NULL;
+
+		if (pgp == NULL && (dtp->dt_errno != EDT_COMPILER ||
+		    dtp->dt_errtag != dt_errtag(D_PRAGMA_DEPEND)))
+			goto err;
+
+		if (pgp == NULL) {
+			dt_dprintf("skipping library %s: %s\n", path,
+			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+			continue;
+		}
+
+		dld->dtld_loaded = B_TRUE;
+		dt_program_destroy(dtp, pgp);
+	}
+
+	dt_lib_depend_free(dtp);
+	return (0);
+
+err:
+	dt_lib_depend_free(dtp);
+	return (-1); /* preserve dt_errno */
+}
+
+/*
+ * Compile the D libraries from a current image, if there is one, and return 0.
+ * Otherwise, return 1 and fill in 'dli' for dt_libimage_add() to collect the
+ * libraries as they are compiled from source.  If compiling a library from the
+ * image fails, return -1 with dt_errno set.
+ */
+int
+dt_libimage_load(dtrace_hdl_t *dtp, dt_libimage_t *dli)
+{
+	dt_libimage_key_t *key = &dli->dli_key;
+	const dt_libimage_hdr_t *hdr;
+	const char *path;
+	const void *src;
+	dt_snap_t ds, libs, inlines;
+	size_t len, size;
+	uint32_t i, ninlines;
+	void *map;
+	int rv;
+
+	memset(dli, 0, sizeof (dt_libimage_t));
+
+	if (dtp->dt_libimage == NULL || dtp->dt_libimage[0] == '\0')
+		return (1);
+
+	dt_kernsnap_key(dtp, &key->dlk_kernel);
+	key->dlk_build = dt_kernsnap_hash(DT_KERNSNAP_HASHINIT,
+	    _dtrace_version, strlen(_dtrace_version) + 1);
+	key->dlk_build = dt_kernsnap_hash(key->dlk_build,
+	    _libdtrace_vcs_version, strlen(_libdtrace_vcs_version) + 1);
+	key->dlk_libs = dt_libimage_hash(dtp);
+	key->dlk_kernver = dtp->dt_kernver;
+
+	if (snprintf(dli->dli_path, sizeof (dli->dli_path), "%s/libs-%016llx",
+	    dtp->dt_libimage, (unsigned long long)dt_kernsnap_hash(
+	    DT_KERNSNAP_HASHINIT, (const char *)key,
+	    sizeof (dt_libimage_key_t))) >= sizeof (dli->dli_path)) {
+		dli->dli_path[0] = '\0';
+		return (1);
+	}
+
+	if ((map = cachefile_map(dli->dli_path, sizeof (dt_libimage_hdr_t),
+	    DT_LIBIMAGE_MAGIC, DT_LIBIMAGE_VERSION, &size)) == NULL)
+		return (1);
+
+	ds.ds_ptr = map;
+	ds.ds_end = (const char *)map + size;
+	hdr = dt_snap_get(&ds, sizeof (dt_libimage_hdr_t));
+
+	if (memcmp(&hdr->dlih_key, key, sizeof (dt_libimage_key_t)) != 0) {
+		dt_dprintf("library image %s is stale\n", dli->dli_path);
+		munmap(map, size);
+		return (1);
+	}
+
+	/*
+	 * Check the whole image before compiling anything from it: once a
+	 * library has been compiled, there is no going back to the sources.
+	 */
+	libs = ds;
+	for (i = 0; i < hdr->dlih_nlibs; i++) {
+		if (dt_libimage_next(&ds, &path, &src, &len, &inlines,
+		    &ninlines) != 0 ||
+		    dt_libimage_check(dtp, inlines, ninlines) != 0)
+			break;
+	}
+
+	if (i < hdr->dlih_nlibs || ds.ds_ptr != ds.ds_end) {
+		dt_dprintf("library image %s is corrupt\n", dli->dli_path);
+		munmap(map, size);
+		return (1);
+	}
+
+	rv = dt_libimage_compile(dtp, &libs, hdr->dlih_nlibs);
+	munmap(map, size);
+
+	if (rv != 0)
+		return (-1);
+
+	dt_dprintf("loaded library image %s\n", dli->dli_path);
+	dli->dli_path[0] = '\0';
+	return (0);
+}
+
+/*
+ * Open a library to compile it from source.  It is read into memory and
+ * compiled from there, so that the source in the image is the source that was
+ * compiled; 'src' is set to NULL if it cannot be, and the library is compiled
+ * from its file.
+ */
+FILE *
+dt_libimage_open(const char *path, char **srcp, size_t *lenp)
+{
+	struct stat s;
+	char *src;
+	FILE *fp;
+
+	*srcp = NULL;
+	*lenp = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (NULL);
+
+	if (fstat(fileno(fp), &s) < 0 || s.st_size == 0)
+		return (fp);
+
+	if ((src = malloc(s.st_size)) == NULL ||
+	    fread(src, 1, s.st_size, fp) != s.st_size) {
+		free(src);
+		rewind(fp);
+		return (fp);
+	}
+
+	(void) fclose(fp);
+
+	if ((fp = fmemopen(src, s.st_size, "r")) == NULL) {
+		free(src);
+		return (fopen(path, "r"));
+	}
+
+	*srcp = src;
+	*lenp = s.st_size;
+	return (fp);
+}
+
+/*
+ * Return whether a line, or what is left of it, is blank.
+ */
+static int
+dt_libimage_blank(const char *p)
+{
+	return (p[strspn(p, DT_LIBIMAGE_BLANK)] == '\0');
+}
+
+/*
+ * If a library does nothing but define integer constant inlines, one per line,
+ * and set their version with #pragma D binding, return the number of inlines
+ * and their names.  Otherwise, return 0.
+ */
+static uint32_t
+dt_libimage_scan(const char *src, size_t len, char ***namesp)
+{
+	char *buf, *p, *line, *last, **names = NULL, **nnames;
+	uint32_t n = 0;
+	int name, ename, end;
+
+	if (memchr(src, '\0', len) != NULL || (buf = malloc(len + 1)) == NULL)
+		return (0);
+
+	memcpy(buf, src, len);
+	buf[len] = '\0';
+
+	/*
+	 * Blank out comments, but not newlines, so that lines stay lines.
+	 */
+	for (p = buf; *p != '\0'; p++) {
+		if (p[0] == '"') {
+			for (p++; *p != '"'; p++) {
+				if (*p == '\0' || *p == '\n' || *p == '\\')
+					goto out;
+			}
+		} else if (p[0] == '/' && p[1] == '*') {
+			p[0] = p[1] = ' ';
+			for (p += 2; !(p[0] == '*' && p[1] == '/'); p++) {
+				if (*p == '\0')
+					goto out;
+				if (*p != '\n')
+					*p = ' ';
+			}
+			p[0] = p[1] = ' ';
+			p++;
+		} else if (p[0] == '/' && p[1] == '/') {
+			for (; p[1] != '\0' && p[1] != '\n'; p++)
+				*p = ' ';
+			*p = ' ';
+		}
+	}
+
+	for (line = strtok_r(buf, "\n", &last); line != NULL;
+	    line = strtok_r(NULL, "\n", &last)) {
+		if (dt_libimage_blank(line))
+			continue;
+
+		line += strspn(line, DT_LIBIMAGE_BLANK);
+
+		name = ename = end = -1;
+		(void) sscanf(line, "#pragma D binding \"%*[0-9.]\" "
+		    "%*[A-Za-z0-9_]%n", &end);
+
+		if (end > 0 && dt_libimage_blank(line + end))
+			continue;
+
+		end = -1;
+		(void) sscanf(line, "inline int %n%*[A-Za-z0-9_]%n = %*[^;];%n",
+		    &name, &ename, &end);
+
+		if (end < 0 || !dt_libimage_blank(line + end))
+			goto out;
+
+		if ((nnames = realloc(names,
+		    (n + 1) * sizeof (char *))) == NULL)
+			goto out;
+
+		names = nnames;
+		if ((names[n] = strndup(line + name, ename - name)) == NULL)
+			goto out;
+		n++;
+	}
+
+	free(buf);
+	*namesp = names;
+	return (n);
+
+out:
+	while (n > 0)
+		free(names[--n]);
+	free(names);
+	free(buf);
+	return (0);
+}
+
+/*
+ * Return the index in dt_ints[] of an integer type, or -1.
+ */
+static int
+dt_libimage_int(dtrace_hdl_t *dtp, ctf_file_t *ctfp, ctf_id_t type)
+{
+	int i;
+
+	for (i = 0; i < sizeof (dtp->dt_ints) / sizeof (dtp->dt_ints[0]); i++) {
+		if (dtp->dt_ints[i].did_ctfp == ctfp &&
+		    dtp->dt_ints[i].did_type == type)
+			return (i);
+	}
+
+	return (-1);
+}
+
+/*
+ * Keep the inlines of a library that has just been compiled instead of its
+ * source, if it does nothing but define integer constant inlines and each of
+ * them is what dt_libimage_define() would make of it: a scalar inline, defined
+ * by this compilation pass, of an integer type whose value is an integer node.
+ */
+static void
+dt_libimage_inlines(dtrace_hdl_t *dtp, dt_libimage_lib_t *dll)
+{
+	dt_libimage_inline_t *dlin = NULL;
+	char **names = NULL;
+	dt_idnode_t *inp;
+	dt_ident_t *idp;
+	dt_node_t *dnp;
+	int type, vtype;
+	uint32_t i, n;
+
+	if ((n = dt_libimage_scan(dll->dll_src, dll->dll_len, &names)) == 0 ||
+	    (dlin = calloc(n, sizeof (dt_libimage_inline_t))) == NULL)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		idp = dt_idhash_lookup(dtp->dt_globals, names[i]);
+
+		if (idp == NULL || idp->di_gen != dtp->dt_gen ||
+		    idp->di_kind != DT_IDENT_SCALAR ||
+		    idp->di_ops != &dt_idops_inline ||
+		    (inp = idp->di_iarg) == NULL || inp->din_hash != NULL ||
+		    (dnp = inp->din_root) == NULL ||
+		    dnp->dn_kind != DT_NODE_INT ||
+		    (type = dt_libimage_int(dtp, idp->di_ctfp,
+		    idp->di_type)) < 0 ||
+		    (vtype = dt_libimage_int(dtp, dnp->dn_ctfp,
+		    dnp->dn_type)) < 0)
+			goto out;
+
+		dlin[i].dlin_value = dnp->dn_value;
+		dlin[i].dlin_vers = idp->di_vers;
+		dlin[i].dlin_flags = idp->di_flags & ~DT_IDFLG_ORPHAN;
+		dlin[i].dlin_type = type;
+		dlin[i].dlin_vtype = vtype;
+		dlin[i].dlin_attr = idp->di_attr;
+		dlin[i].dlin_vattr = dnp->dn_attr;
+		dlin[i].dlin_nflags = dnp->dn_flags;
+	}
+
+	free(dll->dll_src);
+	dll->dll_src = NULL;
+	dll->dll_len = 0;
+	dll->dll_names = names;
+	dll->dll_inlines = dlin;
+	dll->dll_ninlines = n;
+	return;
+
+out:
+	for (i = 0; names != NULL && i < n; i++)
+		free(names[i]);
+	free(names);
+	free(dlin);
+}
+
+/*
+ * Add a library that has just been compiled from 'src' to the image, which
+ * takes 'src' over.
+ */
+void
+dt_libimage_add(dtrace_hdl_t *dtp, dt_libimage_t *dli, const char *path,
+    char *src, size_t len)
+{
+	dt_libimage_lib_t *dll = NULL;
+
+	if (dli->dli_path[0] == '\0' || dli->dli_err) {
+		free(src);
+		return;
+	}
+
+	if (src == NULL ||
+	    (dll = dt_zalloc(dtp, sizeof (dt_libimage_lib_t))) == NULL ||
+	    (dll->dll_path = strdup(path)) == NULL) {
+		dt_free(dtp, dll);
+		free(src);
+		dli->dli_err = 1;
+		return;
+	}
+
+	dll->dll_src = src;
+	dll->dll_len = len;
+	dt_libimage_inlines(dtp, dll);
+
+	dt_list_append(&dli->dli_libs, dll);
+	dli->dli_nlibs++;
+}
+
+static int
+dt_libimage_save(FILE *fp, void *arg)
+{
+	dt_libimage_t *dli = arg;
+	dt_libimage_hdr_t hdr;
+	dt_libimage_lib_t *dll;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.dlih_magic = DT_LIBIMAGE_MAGIC;
+	hdr.dlih_version = DT_LIBIMAGE_VERSION;
+	hdr.dlih_key = dli->dli_key;
+	hdr.dlih_nlibs = dli->dli_nlibs;
+
+	if (dt_snap_put(fp, &hdr, sizeof (hdr)) < 0)
+		return (-1);
+
+	for (dll = dt_list_next(&dli->dli_libs); dll != NULL;
+	    dll = dt_list_next(dll)) {
+		uint64_t len = dll->dll_len;
+		uint32_t i;
+
+		if (dt_snap_put_str(fp, dll->dll_path) < 0 ||
+		    dt_snap_put(fp, &len, sizeof (len)) < 0)
+			return (-1);
+
+		if (len != 0) {
+			if (dt_snap_put(fp, dll->dll_src, dll->dll_len) < 0)
+				return (-1);
+			continue;
+		}
+
+		if (dt_snap_put(fp, &dll->dll_ninlines,
+		    sizeof (dll->dll_ninlines)) < 0)
+			return (-1);
+
+		for (i = 0; i < dll->dll_ninlines; i++) {
+			if (dt_snap_put_str(fp, dll->dll_names[i]) < 0 ||
+			    dt_snap_put(fp, &dll->dll_inlines[i],
+			    sizeof (dt_libimage_inline_t)) < 0)
+				return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Save the libraries collected by dt_libimage_add().
+ */
+void
+dt_libimage_store(dtrace_hdl_t *dtp, dt_libimage_t *dli)
+{
+	if (dli->dli_path[0] == '\0' || dli->dli_err)
+		return;
+
+	if (cachefile_write(dtp->dt_libimage, dli->dli_path, dt_libimage_save,
+	    dli) < 0) {
+		dt_dprintf("cannot write library image %s: %s\n",
+		    dli->dli_path, strerror(errno));
+		return;
+	}
+
+	dt_dprintf("saved library image %s\n", dli->dli_path);
+}
+
+void
+dt_libimage_fini(dtrace_hdl_t *dtp, dt_libimage_t *dli)
+{
+	dt_libimage_lib_t *dll;
+	uint32_t i;
+
+	while ((dll = dt_list_next(&dli->dli_libs)) != NULL) {
+		dt_list_delete(&dli->dli_libs, dll);
+		free(dll->dll_path);
+		free(dll->dll_src);
+		for (i = 0; i < dll->dll_ninlines; i++)
+			free(dll->dll_names[i]);
+		free(dll->dll_names);
+		free(dll->dll_inlines);
+		dt_free(dtp, dll);
+	}
+
+	dli->dli_nlibs = 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_LIBIMAGE_H
+#define	_DT_LIBIMAGE_H
+
+#include <stdio.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <dtrace.h>
+#include <dt_list.h>
+#include <dt_kernsnap.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * What the set of D libraries to load and their compilation order depend on.
+ */
+typedef struct dt_libimage_key {
+	dt_kernsnap_key_t dlk_kernel;	/* kernel, boot and loaded modules */
+	uint64_t dlk_build;		/* hash of the libdtrace build */
+	uint64_t dlk_libs;		/* hash of the D library files */
+	uint32_t dlk_kernver;		/* kernel version (per-kernel dirs) */
+	uint32_t dlk_pad;
+} dt_libimage_key_t;
+
+/*
+ * An integer constant inline, as the compiler defined it.  Its types are
+ * indices in dt_ints[].
+ */
+typedef struct dt_libimage_inline {
+	uint64_t dlin_value;		/* value of the constant */
+	uint32_t dlin_vers;		/* version binding */
+	uint16_t dlin_flags;		/* identifier flags */
+	uint8_t dlin_type;		/* type of the inline */
+	uint8_t dlin_vtype;		/* type of the value */
+	dtrace_attribute_t dlin_attr;	/* attributes of the inline */
+	dtrace_attribute_t dlin_vattr;	/* attributes of the value */
+	uint8_t dlin_nflags;		/* parse node flags of the value */
+	uint8_t dlin_pad;
+} dt_libimage_inline_t;
+
+/*
+ * A library holds either its source or, if it does nothing but define integer
+ * constant inlines, these inlines.
+ */
+typedef struct dt_libimage_lib {
+	dt_list_t dll_list;		/* list forward/back pointers */
+	char *dll_path;			/* pathname of the library */
+	char *dll_src;			/* source of the library */
+	size_t dll_len;			/* length of dll_src */
+	char **dll_names;		/* names of the inlines */
+	dt_libimage_inline_t *dll_inlines; /* the inlines */
+	uint32_t dll_ninlines;		/* number of dll_inlines */
+} dt_libimage_lib_t;
+
+/*
+ * The libraries loaded by dt_load_libs(), in order, to be stored as a new
+ * image.  dli_path is empty if no image is to be stored.
+ */
+typedef struct dt_libimage {
+	char dli_path[PATH_MAX];	/* image file */
+	dt_libimage_key_t dli_key;	/* key of the image */
+	dt_list_t dli_libs;		/* list of dt_libimage_lib_t */
+	uint32_t dli_nlibs;		/* number of dli_libs */
+	int dli_err;			/* a library could not be added */
+} dt_libimage_t;
+
+extern uint64_t dt_libimage_hash(dtrace_hdl_t *);
+extern int dt_libimage_load(dtrace_hdl_t *, dt_libimage_t *);
+extern FILE *dt_libimage_open(const char *, char **, size_t *);
+extern void dt_libimage_add(dtrace_hdl_t *, dt_libimage_t *, const char *,
+    char *, size_t);
+extern void dt_libimage_store(dtrace_hdl_t *, dt_libimage_t *);
+extern void dt_libimage_fini(dtrace_hdl_t *, dt_libimage_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_LIBIMAGE_H */
@@ -25,12 +25,11 @@
 
 #include <dt_strtab.h>
 #include <dt_kernel_module.h>
+#include <dt_kernsnap.h>
 #include <dt_module.h>
 #include <dt_impl.h>
 #include <dt_string.h>
 
-#define KSYM_NAME_MAX 128		    /* from kernel/scripts/kallsyms.c */
-#define GZCHUNKSIZE (1024*512)		    /* gzip uncompression chunk size */
 
 static void
 dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp);
@@ -38,6 +37,12 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp);
 static void
 dt_module_shuffle_to_start(dtrace_hdl_t *dtp, const char *name);
 
+static void
+dt_module_symindex(dtrace_hdl_t *dtp);
+
+static void
+dt_module_index_free(dtrace_hdl_t *dtp);
+
 static void
 dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp);
 
@@ -111,6 +116,7 @@ dt_module_create(dtrace_hdl_t *dtp, const char *name)
 	memset(dmp, 0, sizeof (dt_module_t));
 	strlcpy(dmp->dm_name, name, sizeof (dmp->dm_name));
 	dt_list_append(&dtp->dt_modlist, dmp);
+	dt_module_index_free(dtp);
 	dmp->dm_next = dtp->dt_mods[h];
 	dtp->dt_mods[h] = dmp;
 	dtp->dt_nmods++;
@@ -261,25 +267,57 @@ dt_module_load_sect(dtrace_hdl_t *dtp, dt_module_t *dmp, ctf_sect_t *ctsp)
 	return (0);
 }
 
+/*
+ * Return the uncompressed size recorded in the trailer of a gzip-compressed
+ * CTF section, or 0 if there is none or it is implausible.  (Deflate cannot
+ * compress by much more than a factor of 1032.)
+ */
+static size_t
+dt_ctf_gzip_size(const ctf_sect_t *ctsp)
+{
+	const unsigned char *p = ctsp->cts_data;
+	size_t len = ctsp->cts_size;
+	size_t isize;
+
+	if (len < 18 || p[0] != 0x1f || p[1] != 0x8b)
+		return (0);
+
+	p += len - 4;
+	isize = (size_t)p[0] | ((size_t)p[1] << 8) | ((size_t)p[2] << 16) |
+	    ((size_t)p[3] << 24);
+
+	if (isize > len * 1032)
+		return (0);
+
+	return (isize);
+}
+
 /*
  * Only used for linked-in modules.  Archived modules are uncompressed
  * automatically.
+ *
+ * gzip records the uncompressed size, so the section is normally inflated
+ * straight into a single allocation of the right size.  Otherwise (or if the
+ * recorded size is wrong) the buffer is doubled as needed.
  */
 static void *dt_ctf_uncompress(dt_module_t *dmp, ctf_sect_t *ctsp)
 {
 	z_stream s;
 	int ret;
-	unsigned char out[GZCHUNKSIZE];
 	char *output = NULL;
-	size_t out_size = 0;
+	size_t out_alloc;
+
+	if ((out_alloc = dt_ctf_gzip_size(ctsp)) == 0)
+		out_alloc = ctsp->cts_size * 4;
 
 	s.opaque = Z_NULL;
 	s.zalloc = Z_NULL;
 	s.zfree = Z_NULL;
 	s.avail_in = ctsp->cts_size;
 	s.next_in = (void *)ctsp->cts_data;
-	s.next_out = out;
-	s.avail_out = GZCHUNKSIZE;
+
+	if ((output = malloc(out_alloc)) == NULL)
+		goto oom;
 
 	switch (inflateInit2(&s, 15 + 32)) {
 	case Z_OK: break;
@@ -287,44 +325,55 @@ static void *dt_ctf_uncompress(dt_module_t *dmp, ctf_sect_t *ctsp)
 	default: goto zerr;
 	}
 
+	s.next_out = (unsigned char *)output;
+	s.avail_out = out_alloc;
+
 	do {
 		char *new_output;
-		ret = inflate(&s, Z_NO_FLUSH);
+		ret = inflate(&s, Z_FINISH);
 		switch (ret) {
 		case Z_STREAM_END:
 			break;
 		case Z_BUF_ERROR:
 		case Z_OK:
-			if (s.avail_out == GZCHUNKSIZE) {
-				s.msg = "no output possible after inflate round";
-				goto zerr;
+			/*
+			 * Input exhausted short of the end of the stream: take
+			 * what we have, as long as there is anything.
+			 */
+			if (s.avail_out != 0) {
+				if (s.total_out == 0) {
+					s.msg = "no output possible after "
+					    "inflate round";
+					goto zerr;
+				}
+				ret = Z_STREAM_END;
+				break;
 			}
+
+			new_output = realloc(output, out_alloc * 2);
+			if (new_output == NULL) {
+				inflateEnd(&s);
+				goto oom;
+			}
+			output = new_output;
+
+			s.next_out = (unsigned char *)output + out_alloc;
+			s.avail_out = out_alloc;
+			out_alloc *= 2;
 			break;
 		case Z_DATA_ERROR:
 			inflateEnd(&s);
 			goto uncompressed;
 		case Z_MEM_ERROR:
+			inflateEnd(&s);
 			goto oom;
 		default:
 			goto zerr;
 		}
-
-		new_output = realloc(output, out_size +
-		    (GZCHUNKSIZE - s.avail_out));
-
-		if (new_output == NULL)
-			goto oom;
-		output = new_output;
-
-		memcpy(output + out_size, out, (GZCHUNKSIZE - s.avail_out));
-		out_size += (GZCHUNKSIZE - s.avail_out);
-		s.next_out = out;
-		s.avail_out = GZCHUNKSIZE;
-
-	} while ((ret != Z_STREAM_END) && (ret != Z_BUF_ERROR));
+	} while (ret != Z_STREAM_END);
 
 	inflateEnd(&s);
-	ctsp->cts_size = out_size;
+	ctsp->cts_size = s.total_out;
 	ctsp->cts_data = output;
 
 	return output;
@@ -528,6 +577,15 @@ dt_module_getctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 		if (dt_module_load(dtp, dmp) != 0)
 			return (NULL);
 
+	/*
+	 * Our caller may hang on to the container: it can no longer be
+	 * released.
+	 */
+	if (dmp->dm_flags & DT_DM_CTF_COLD) {
+		dmp->dm_flags &= ~DT_DM_CTF_COLD;
+		dtp->dt_nctfcold--;
+	}
+
 	if (dmp->dm_ctfp != NULL)
 		return (dmp->dm_ctfp);
 
@@ -624,6 +682,14 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	free(dmp->dm_asmap);
 	dmp->dm_asmap = NULL;
 
+	/*
+	 * The name index refers to every kernel symbol table.
+	 */
+	if (dmp->dm_kernsyms != NULL) {
+		dt_symindex_destroy(dtp->dt_kernsymindex);
+		dtp->dt_kernsymindex = NULL;
+	}
+
 	dt_symtab_destroy(dmp->dm_kernsyms);
 	dmp->dm_kernsyms = NULL;
 
@@ -639,10 +705,16 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	dmp->dm_data_addrs = NULL;
 	dmp->dm_text_addrs_size = 0;
 	dmp->dm_data_addrs_size = 0;
+	dt_module_index_free(dtp);
 
 	dt_idhash_destroy(dmp->dm_extern);
 	dmp->dm_extern = NULL;
 
+	if (dmp->dm_flags & DT_DM_CTF_COLD) {
+		dmp->dm_flags &= ~DT_DM_CTF_COLD;
+		dtp->dt_nctfcold--;
+	}
+
 	/*
 	 * Built-in modules may be sharing their libelf handle with other
 	 * modules, so should not close it until its refcount falls to zero.
@@ -795,6 +867,246 @@ dtrace_addr_range_grow(dt_module_t *dmp, int is_text)
 	return final_range;
 }
 
+/*
+ * The address index: every text and data range of every module, flattened
+ * into one sorted array of disjoint ranges so that an address can be mapped
+ * to its module with a single binary search.  Where ranges overlap, the
+ * address belongs to whichever module a walk of dt_modlist would have found
+ * first, checking each module's text ranges before its data ranges.  The
+ * index is discarded whenever modules or their ranges change, and rebuilt by
+ * dtrace_update() or on the next lookup.
+ */
+static void
+dt_module_index_free(dtrace_hdl_t *dtp)
+{
+	free(dtp->dt_modranges);
+	dtp->dt_modranges = NULL;
+	dtp->dt_nmodranges = 0;
+}
+
+static int
+dt_module_index_vacmp(const void *lp, const void *rp)
+{
+	const dt_modrange_t *lhs = lp;
+	const dt_modrange_t *rhs = rp;
+
+	if (lhs->dmr_va < rhs->dmr_va)
+		return (-1);
+
+	if (lhs->dmr_va > rhs->dmr_va)
+		return (1);
+
+	return (0);
+}
+
+static int
+dt_module_index_addrcmp(const void *lp, const void *rp)
+{
+	const GElf_Addr *lhs = lp;
+	const GElf_Addr *rhs = rp;
+
+	if (*lhs < *rhs)
+		return (-1);
+
+	if (*lhs > *rhs)
+		return (1);
+
+	return (0);
+}
+
+static int
+dt_module_index_rangecmp(const void *addr_, const void *range_)
+{
+	const GElf_Addr *addr = addr_;
+	const dt_modrange_t *range = range_;
+
+	if (*addr < range->dmr_va)
+		return (-1);
+
+	if (*addr >= range->dmr_end)
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Sift the last element of a heap of ranges ordered by priority up, or the
+ * first one down.
+ */
+static void
+dt_module_index_siftup(dt_modrange_t **heap, size_t n)
+{
+	size_t i = n - 1;
+
+	while (i > 0 && heap[(i - 1) / 2]->dmr_prio > heap[i]->dmr_prio) {
+		dt_modrange_t *tmp = heap[i];
+
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+static void
+dt_module_index_siftdown(dt_modrange_t **heap, size_t n)
+{
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < n) {
+		dt_modrange_t *tmp;
+
+		if (c + 1 < n && heap[c + 1]->dmr_prio < heap[c]->dmr_prio)
+			c++;
+
+		if (heap[i]->dmr_prio <= heap[c]->dmr_prio)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+		i = c;
+	}
+}
+
+static size_t
+dt_module_index_add(dt_modrange_t *src, const dtrace_addr_range_t *range,
+    size_t n, dt_module_t *dmp, uint_t prio)
+{
+	size_t i, nsrc = 0;
+
+	for (i = 0; i < n; i++) {
+		if (range[i].dar_size == 0)
+			continue;
+
+		src[nsrc].dmr_va = range[i].dar_va;
+		src[nsrc].dmr_end = range[i].dar_va + range[i].dar_size;
+		if (src[nsrc].dmr_end < src[nsrc].dmr_va)
+			src[nsrc].dmr_end = (GElf_Addr)-1;
+		src[nsrc].dmr_prio = prio;
+		src[nsrc].dmr_mod = dmp;
+		nsrc++;
+	}
+
+	return (nsrc);
+}
+
+/*
+ * Build the address index.  The ranges are sorted by start address and swept
+ * over every range boundary in turn, keeping the ranges that cover the
+ * current boundary on a heap ordered by priority: the range at the top of the
+ * heap owns everything up to the next boundary.  Ranges that have ended are
+ * only removed once they reach the top.
+ */
+static int
+dt_module_index(dtrace_hdl_t *dtp)
+{
+	dt_modrange_t *src, *idx, **heap;
+	size_t nsrc = 0, nbnd, nidx = 0, nheap = 0, i, j;
+	GElf_Addr *bnd;
+	dt_module_t *dmp;
+	uint_t prio = 0;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp))
+		nsrc += dmp->dm_text_addrs_size + dmp->dm_data_addrs_size;
+
+	src = malloc(sizeof (dt_modrange_t) * (nsrc + 1));
+	idx = malloc(sizeof (dt_modrange_t) * (2 * nsrc + 1));
+	bnd = malloc(sizeof (GElf_Addr) * (2 * nsrc + 1));
+	heap = malloc(sizeof (dt_modrange_t *) * (nsrc + 1));
+
+	if (src == NULL || idx == NULL || bnd == NULL || heap == NULL) {
+		free(src);
+		free(idx);
+		free(bnd);
+		free(heap);
+		return (dt_set_errno(dtp, EDT_NOMEM));
+	}
+
+	nsrc = 0;
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp), prio += 2) {
+		nsrc += dt_module_index_add(&src[nsrc], dmp->dm_text_addrs,
+		    dmp->dm_text_addrs_size, dmp, prio);
+		nsrc += dt_module_index_add(&src[nsrc], dmp->dm_data_addrs,
+		    dmp->dm_data_addrs_size, dmp, prio + 1);
+	}
+
+	qsort(src, nsrc, sizeof (dt_modrange_t), dt_module_index_vacmp);
+
+	for (i = 0; i < nsrc; i++) {
+		bnd[2 * i] = src[i].dmr_va;
+		bnd[2 * i + 1] = src[i].dmr_end;
+	}
+
+	qsort(bnd, 2 * nsrc, sizeof (GElf_Addr), dt_module_index_addrcmp);
+
+	for (i = 0, nbnd = 0; i < 2 * nsrc; i++) {
+		if (nbnd == 0 || bnd[nbnd - 1] != bnd[i])
+			bnd[nbnd++] = bnd[i];
+	}
+
+	for (i = 0, j = 0; i + 1 < nbnd; i++) {
+		while (j < nsrc && src[j].dmr_va <= bnd[i]) {
+			heap[nheap++] = &src[j++];
+			dt_module_index_siftup(heap, nheap);
+		}
+
+		while (nheap > 0 && heap[0]->dmr_end <= bnd[i]) {
+			heap[0] = heap[--nheap];
+			dt_module_index_siftdown(heap, nheap);
+		}
+
+		if (nheap == 0)
+			continue;
+
+		dmp = heap[0]->dmr_mod;
+
+		if (nidx > 0 && idx[nidx - 1].dmr_mod == dmp &&
+		    idx[nidx - 1].dmr_end == bnd[i]) {
+			idx[nidx - 1].dmr_end = bnd[i + 1];
+			continue;
+		}
+
+		idx[nidx].dmr_va = bnd[i];
+		idx[nidx].dmr_end = bnd[i + 1];
+		idx[nidx].dmr_prio = 0;
+		idx[nidx].dmr_mod = dmp;
+		nidx++;
+	}
+
+	free(src);
+	free(bnd);
+	free(heap);
+
+	dt_module_index_free(dtp);
+	dtp->dt_modranges = idx;
+	dtp->dt_nmodranges = nidx;
+
+	dt_dprintf("indexed %zu address ranges for %u modules\n", nidx,
+	    dtp->dt_nmods);
+
+	return (0);
+}
+
+/*
+ * Return the module whose text or data ranges contain the given address, or
+ * NULL if there is none.
+ */
+dt_module_t *
+dt_module_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr)
+{
+	dt_modrange_t *range;
+
+	if (dtp->dt_modranges == NULL && dt_module_index(dtp) == -1)
+		return (NULL);
+
+	range = bsearch(&addr, dtp->dt_modranges, dtp->dt_nmodranges,
+	    sizeof (dt_modrange_t), dt_module_index_rangecmp);
+
+	return (range != NULL ? range->dmr_mod : NULL);
+}
+
 /*
  * Transform an nm(1)-style type field into an ELF info character.  This is the
  * rough inverse of code in nm(1) and kernel/module.c:elf_type().  (Extreme
@@ -842,7 +1154,7 @@ sym_type_to_info(char info)
  * Do all necessary post-creation initialization of a module of type
  * DT_DM_KERNEL.
  */
-static int
+int
 dt_kern_module_init(dtrace_hdl_t *dtp, dt_module_t *dmp)
 {
 	dt_dprintf("initializing module %s\n", dmp->dm_name);
@@ -1058,7 +1370,7 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 }
 
 /*
- * We will use kernel_flag to track which symbols we are reading.
+ * We will use dms_kernel_flag to track which symbols we are reading.
  *
  * /proc/kallmodsyms starts with kernel (and built-in-module) symbols.
  *
@@ -1078,31 +1390,115 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 #define KERNEL_FLAG_KERNEL_END 1
 #define KERNEL_FLAG_LOADABLE 2
 #define KERNEL_FLAG_INIT_SCRATCH 4
+/*
+ * State carried from one /proc/kallmodsyms line to the next.
+ */
+typedef struct dt_modsym_state {
+	uint_t dms_kernel_flag;		/* KERNEL_FLAG_* */
+	dt_module_t *dms_last_dmp;	/* module of the last sized symbol */
+	int dms_last_sym_text;		/* whether it was a text symbol */
+	dt_module_t *dms_prev_dmp;	/* module of the previous line */
+} dt_modsym_state_t;
+
+/*
+ * Parse a hexadecimal number terminated by a space or tab, advancing *pp past
+ * it and the blanks that follow.
+ */
+static int
+dt_modsym_parse_hex(char **pp, uint64_t *valp)
+{
+	char *p = *pp;
+	uint64_t val = 0;
+
+	for (;; p++) {
+		if (*p >= '0' && *p <= '9')
+			val = (val << 4) | (*p - '0');
+		else if (*p >= 'a' && *p <= 'f')
+			val = (val << 4) | (*p - 'a' + 10);
+		else if (*p >= 'A' && *p <= 'F')
+			val = (val << 4) | (*p - 'A' + 10);
+		else
+			break;
+	}
+
+	if (p == *pp || (*p != ' ' && *p != '\t'))
+		return -1;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	*pp = p;
+	*valp = val;
+	return 0;
+}
+
+/*
+ * Split a /proc/kallmodsyms line, of the form
+ *
+ *	address size type name [module]
+ *
+ * in place.  Lines without a module name are for the core kernel.
+ */
+static int
+dt_modsym_parse(char *line, GElf_Addr *addrp, uint64_t *sizep, char *typep,
+    char **namep, char **modp)
+{
+	char *p = line;
+
+	if (dt_modsym_parse_hex(&p, addrp) < 0 ||
+	    dt_modsym_parse_hex(&p, sizep) < 0)
+		return -1;
+
+	if (*p == '\0' || (p[1] != ' ' && p[1] != '\t'))
+		return -1;
+	*typep = *p;
+	for (p++; *p == ' ' || *p == '\t'; p++)
+		continue;
+
+	*namep = p;
+	p += strcspn(p, " \t\n");
+	if (p == *namep)
+		return -1;
+
+	*modp = "vmlinux";
+	if (*p == '\0')
+		return 0;
+	*p++ = '\0';
+
+	p += strspn(p, " \t");
+	if (*p == '[') {
+		char *end = strchr(++p, ']');
+
+		if (end == NULL)
+			return -1;
+		*end = '\0';
+		*modp = p;
+	}
+
+	return 0;
+}
+
 /*
  * Update our module cache.  For each line in /proc/kallmodsyms, create or
  * populate the dt_module_t for this module (if necessary), extend its address
  * ranges as needed, and add the symbol in this line to the module's kernel
- * symbol table.
+ * symbol table.  The line is modified.
  *
  * If we return non-NULL, we might have a changing /proc/kallmodsyms,
  * probably due to module unloading during read.  Perhaps this case should
  * trigger a retry.
  */
 static int
-dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
+dt_modsym_update(dtrace_hdl_t *dtp, char *line, dt_modsym_state_t *dms)
 {
-	static uint_t kernel_flag = 0;
-	static dt_module_t *last_dmp = NULL;
-	static int last_sym_text = -1;
-
 	GElf_Addr sym_addr;
-	long long unsigned sym_size;
+	uint64_t sym_size;
 	char sym_type;
 	int sym_text;
 	dt_module_t *dmp;
 	dtrace_addr_range_t *range = NULL;
-	char sym_name[KSYM_NAME_MAX];
-	char mod_name[PATH_MAX] = "vmlinux]";	/* note trailing ] */
+	char *sym_name;
+	char *mod_name;
 	int skip = 0;
 
 	/*
@@ -1112,16 +1508,14 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	if ((line[0] == '\n') || (line[0] == 0))
 		return 0;
 
-	if (sscanf(line, "%llx %llx %c %s [%s", (long long unsigned *)&sym_addr,
-		(long long unsigned *)&sym_size, &sym_type,
-		sym_name, mod_name) < 4) {
+	if (dt_modsym_parse(line, &sym_addr, &sym_size, &sym_type,
+		&sym_name, &mod_name) < 0) {
 		dt_dprintf("malformed /proc/kallmodsyms line: %s\n", line);
 		return EDT_CORRUPT_KALLSYMS;
 	}
 
 	sym_text = (sym_type == 't') || (sym_type == 'T')
 	     || (sym_type == 'w') || (sym_type == 'W');
-	mod_name[strlen(mod_name)-1] = '\0';	/* chop trailing ] */
 
 	/*
 	 * Symbols of "absolute" type are typically defined per CPU.  Their
@@ -1135,20 +1529,20 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	 * Skip over the .init.scratch section.
 	 */
 	if (strcmp(sym_name, "__init_scratch_begin") == 0) {
-		kernel_flag |= KERNEL_FLAG_INIT_SCRATCH;
+		dms->dms_kernel_flag |= KERNEL_FLAG_INIT_SCRATCH;
 		return 0;
 	} else if (strcmp(sym_name, "__init_scratch_end") == 0) {
-		kernel_flag &= ~ KERNEL_FLAG_INIT_SCRATCH;
+		dms->dms_kernel_flag &= ~ KERNEL_FLAG_INIT_SCRATCH;
 		return 0;
-	} else if (kernel_flag & KERNEL_FLAG_INIT_SCRATCH) {
+	} else if (dms->dms_kernel_flag & KERNEL_FLAG_INIT_SCRATCH) {
 		return 0;
 	}
 
 	if ((strcmp(sym_name, "_end") == 0) ||
 	    (strcmp(sym_name, "__brk_limit") == 0))
-		kernel_flag |= KERNEL_FLAG_KERNEL_END;
-	else if (kernel_flag & KERNEL_FLAG_KERNEL_END)
-		kernel_flag = KERNEL_FLAG_LOADABLE;
+		dms->dms_kernel_flag |= KERNEL_FLAG_KERNEL_END;
+	else if (dms->dms_kernel_flag & KERNEL_FLAG_KERNEL_END)
+		dms->dms_kernel_flag = KERNEL_FLAG_LOADABLE;
 
 	/*
 	 * Special case: rename the 'ctf' module to 'shared_ctf': the
@@ -1158,13 +1552,15 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	 * repository, not ctf.ko's types.
 	 */
 	if (strcmp(mod_name, "ctf") == 0)
-		strcpy(mod_name, "shared_ctf");
+		mod_name = "shared_ctf";
 
 	/*
-	 * Get module.
+	 * Get module.  Consecutive lines are nearly always for the same one.
 	 */
 
-	dmp = dt_module_lookup_by_name(dtp, mod_name);
+	dmp = dms->dms_prev_dmp;
+	if (dmp == NULL || strcmp(dmp->dm_name, mod_name) != 0)
+		dmp = dt_module_lookup_by_name(dtp, mod_name);
 	if (dmp == NULL) {
 		int err;
 
@@ -1176,6 +1572,7 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 		if (err != 0)
 			return err;
 	}
+	dms->dms_prev_dmp = dmp;
 
 	/*
 	 * Add the symbol to the module's kernel symbol table.
@@ -1211,7 +1608,7 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 
 	if (!skip) {
 		if (dmp->dm_kernsyms == NULL)
-			dmp->dm_kernsyms = dt_symtab_create();
+			dmp->dm_kernsyms = dt_symtab_create(dtp->dt_kernstrs);
 
 		if (dmp->dm_kernsyms == NULL)
 			return EDT_NOMEM;
@@ -1230,12 +1627,13 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	if (sym_size == 0)
 		return 0;
 
-	if ((kernel_flag & KERNEL_FLAG_LOADABLE) == 0) {
+	if ((dms->dms_kernel_flag & KERNEL_FLAG_LOADABLE) == 0) {
 		/*
 		 * The kernel and built-in modules are in address order
 		 * in /proc/kallmodsyms.
 		 */
-		if (dmp == last_dmp && sym_text == last_sym_text) {
+		if (dmp == dms->dms_last_dmp &&
+		    sym_text == dms->dms_last_sym_text) {
 			if (sym_text)
 				range = &dmp->dm_text_addrs
 				    [dmp->dm_text_addrs_size - 1];
@@ -1244,8 +1642,8 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 				    [dmp->dm_data_addrs_size - 1];
 			range->dar_size = sym_addr + sym_size - range->dar_va;
 		} else {
-			last_dmp = dmp;
-			last_sym_text = sym_text;
+			dms->dms_last_dmp = dmp;
+			dms->dms_last_sym_text = sym_text;
 		}
 	} else {
 		/*
@@ -1292,25 +1690,54 @@ int
 dtrace_update(dtrace_hdl_t *dtp)
 {
 	dt_module_t *dmp;
+	dt_modsym_state_t dms;
+	char path[PATH_MAX];
 	FILE *fd;
 
 	for (dmp = dt_list_next(&dtp->dt_modlist);
 	    dmp != NULL; dmp = dt_list_next(dmp))
 		dt_module_unload(dtp, dmp);
 
+	/*
+	 * If there is a current kernel snapshot, it already holds everything
+	 * the parse below would produce, sorted.  A snapshot that fails to
+	 * load may have populated some modules: unload them again.
+	 */
+	if (dt_kernsnap_load(dtp) == 0)
+		goto loaded;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist);
+	    dmp != NULL; dmp = dt_list_next(dmp))
+		dt_module_unload(dtp, dmp);
+
+	/*
+	 * All the kernel symbol tables are gone: start a fresh pool for their
+	 * names.
+	 */
+	dt_strpool_destroy(dtp->dt_kernstrs);
+	dtp->dt_kernstrs = dt_strpool_create();
+
 	/*
 	 * Note all the symbols currently loaded into the kernel's address
 	 * space and construct modules with appropriate address ranges from
 	 * each.
 	 */
-	if ((fd = fopen("/proc/kallmodsyms", "r")) != NULL) {
+	snprintf(path, sizeof (path), "%s/kallmodsyms", Pprocfs_path());
+	memset(&dms, 0, sizeof (dms));
+	dms.dms_last_sym_text = -1;
+
+	if ((fd = fopen(path, "r")) != NULL) {
 		char *line = NULL;
 		size_t line_n = 0;
+		int err = 0;
+
+		(void) setvbuf(fd, NULL, _IOFBF, 1024 * 1024);
 		while ((getline(&line, &line_n, fd)) > 0)
-			if (dt_modsym_update(dtp, line) != 0) {
+			if (dt_modsym_update(dtp, line, &dms) != 0) {
 				/* TODO: waiting on a warning infrastructure */
 				dt_dprintf("warning: module CTF loading "
 				    "failed on kallmodsyms line %s\n", line);
+				err = 1;
 				break; /* no hope of (much) CTF */
 			}
 		free(line);
@@ -1328,6 +1755,12 @@ dtrace_update(dtrace_hdl_t *dtp)
 				dt_symtab_pack(dmp->dm_kernsyms);
 			}
 		}
+
+		/*
+		 * Only a complete parse is worth saving.
+		 */
+		if (!err)
+			dt_kernsnap_store(dtp);
 	} else {
 		/* TODO: waiting on a warning infrastructure */
 		dt_dprintf("warning: /proc/kallmodsyms is not "
@@ -1335,6 +1768,7 @@ dtrace_update(dtrace_hdl_t *dtp)
 		dt_dprintf("warning: module CTF loading failed\n");
 	}
 
+loaded:
 	/*
 	 * Look up all the macro identifiers and set di_id to the latest value.
 	 * This code collaborates with dt_lex.l on the use of di_id.  We will
@@ -1372,9 +1806,57 @@ dtrace_update(dtrace_hdl_t *dtp)
 		dt_module_shuffle_to_start(dtp, "vmlinux");
 	}
 
+	/*
+	 * Now that the module list is in its final order, index the address
+	 * ranges.  If this fails, the next lookup by address tries again.
+	 */
+	dt_module_index_free(dtp);
+	(void) dt_module_index(dtp);
+	dt_module_symindex(dtp);
+
+	/*
+	 * Kernel addresses may now resolve differently.
+	 */
+	dt_symcache_flush(dtp);
+
 	return 0;
 }
 
+/*
+ * Index the names of the symbols of all loaded kernel modules, in module list
+ * order, so that dtrace_lookup_by_name() need not search each in turn.  If
+ * this fails, it does.
+ */
+static void
+dt_module_symindex(dtrace_hdl_t *dtp)
+{
+	dt_symindex_t *dsi;
+	dt_module_t *dmp;
+
+	dt_symindex_destroy(dtp->dt_kernsymindex);
+	dtp->dt_kernsymindex = NULL;
+
+	if ((dsi = dt_symindex_create(dtp->dt_kernstrs)) == NULL)
+		return;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp)) {
+		if (!(dmp->dm_flags & DT_DM_KERNEL) ||
+		    (dmp->dm_flags & DT_DM_KERN_UNLOADED) ||
+		    dmp->dm_kernsyms == NULL)
+			continue;
+
+		if (dt_symindex_add(dsi, dmp->dm_kernsyms, dmp) < 0) {
+			dt_dprintf("cannot index kernel symbols of %s\n",
+			    dmp->dm_name);
+			dt_symindex_destroy(dsi);
+			return;
+		}
+	}
+
+	dtp->dt_kernsymindex = dsi;
+}
+
 /*
  * Shuffle one module to the start of the module list.
  */
@@ -1388,6 +1870,7 @@ dt_module_shuffle_to_start(dtrace_hdl_t *dtp, const char *name)
 
 	dt_list_delete(&dtp->dt_modlist, dmp);
 	dt_list_prepend(&dtp->dt_modlist, dmp);
+	dt_module_index_free(dtp);
 }
 
 static dt_module_t *
@@ -1432,6 +1915,9 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 	dt_ident_t *idp;
 	uint_t n;
 	GElf_Sym sym;
+	dt_symindex_t *dsi = NULL;
+	dt_symbol_t *hit = NULL;
+	void *hitmod = NULL;
 
 	uint_t mask = 0; /* mask of dt_module flags to match */
 	uint_t bits = 0; /* flag bits that must be present */
@@ -1454,6 +1940,15 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 
 		dmp = dt_list_next(&dtp->dt_modlist);
 		n = dtp->dt_nmods;
+
+		/*
+		 * Find the first loaded kernel module with this symbol in
+		 * the name index, rather than searching each one.  Other
+		 * modules are still searched in turn.
+		 */
+		if (object != DTRACE_OBJ_UMODS &&
+		    (dsi = dtp->dt_kernsymindex) != NULL)
+			hit = dt_symindex_lookup(dsi, name, NULL, &hitmod);
 	}
 
 	if (symp == NULL)
@@ -1463,8 +1958,27 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 		if ((dmp->dm_flags & mask) != bits)
 			continue; /* failed to match required attributes */
 
-		if (dt_module_load(dtp, dmp) == -1)
+		if (dsi != NULL && (dmp->dm_flags & DT_DM_KERNEL) &&
+		    (!(dmp->dm_flags & DT_DM_KERN_UNLOADED))) {
+			if (!dmp->dm_kernsyms)
+				continue;
+
+			if (dmp != hitmod)
+				goto externs;
+		}
+
+		if (dt_module_load(dtp, dmp) == -1) {
+			/*
+			 * A failed load can unload the module's symbols, and
+			 * with them the index: search the rest in turn.
+			 */
+			if (dsi != NULL && dsi != dtp->dt_kernsymindex)
+				dsi = hitmod = NULL;
+			else if (dsi != NULL && dmp == hitmod)
+				hit = dt_symindex_lookup(dsi, name, dmp,
+				    &hitmod);
 			continue; /* failed to load symbol table */
+		}
 
 		if ((dmp->dm_flags & DT_DM_KERNEL) &&
 		    (!(dmp->dm_flags & DT_DM_KERN_UNLOADED))) {
@@ -1473,7 +1987,11 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 			if (!dmp->dm_kernsyms)
 				continue;
 
-			dt_symp = dt_symbol_by_name(dmp->dm_kernsyms, name);
+			if (dsi != NULL)
+				dt_symp = hit;
+			else
+				dt_symp = dt_symbol_by_name(dmp->dm_kernsyms,
+				    name);
 
 			if (!dt_symp)
 				continue;
@@ -1500,6 +2018,7 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 			}
 		}
 
+externs:
 		if (dmp->dm_extern != NULL &&
 		    (idp = dt_idhash_lookup(dmp->dm_extern, name)) != NULL) {
 			if (symp != &sym) {
@@ -1546,24 +2065,7 @@ dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
 	if (v != NULL)
 		return (v->dtv_lookup_by_addr(dtp->dt_varg, addr, symp, sip));
 
-	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
-	    dmp = dt_list_next(dmp)) {
-		void *i;
-
-		i = bsearch(&addr, dmp->dm_text_addrs, dmp->dm_text_addrs_size,
-		    sizeof (struct dtrace_addr_range), dtrace_addr_range_cmp);
-
-		if (i)
-			break;
-
-		i = bsearch(&addr, dmp->dm_data_addrs, dmp->dm_data_addrs_size,
-		    sizeof (struct dtrace_addr_range), dtrace_addr_range_cmp);
-
-		if (i)
-			break;
-	}
-
-	if (dmp == NULL) {
+	if ((dmp = dt_module_lookup_by_addr(dtp, addr)) == NULL) {
 		dt_dprintf("No module corresponds to %lx\n", addr);
 		return (dt_set_errno(dtp, EDT_NOSYMADDR));
 	}
@@ -1581,6 +2083,19 @@ dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
 		if (!dmp->dm_kernsyms)
 			return (dt_set_errno(dtp, EDT_NOSYMADDR));
 
+		/*
+		 * Only the containing module is wanted: the address need not
+		 * be covered by a symbol.
+		 */
+		if (symp == NULL) {
+			if (sip != NULL) {
+				sip->dts_object = dmp->dm_name;
+				sip->dts_name = NULL;
+				sip->dts_id = 0;
+			}
+			return (0);
+		}
+
 		dt_symp = dt_symbol_by_addr(dmp->dm_kernsyms, addr);
 
 		if (!dt_symp)
@@ -1619,6 +2134,60 @@ dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
 	return (0);
 }
 
+/*
+ * Release the CTF of a module whose CTF has gone cold.  It is reopened from the
+ * archive if it is ever needed again.
+ */
+static void
+dt_module_ctf_release(dtrace_hdl_t *dtp, dt_module_t *dmp)
+{
+	dt_dprintf("releasing cold CTF for module %s\n", dmp->dm_name);
+
+	ctf_close(dmp->dm_ctfp);
+	dmp->dm_ctfp = NULL;
+	dmp->dm_flags &= ~(DT_DM_CTF_COLD | DT_DM_CTF_ARCHIVED | DT_DM_LOADED);
+	dtp->dt_nctfcold--;
+}
+
+/*
+ * Note that a module's CTF was opened only to be searched by a lookup over
+ * every module, and did not yield the answer.  Nothing else refers to it, so
+ * it can be released again: keep at most dt_ctfcachesize such modules, and
+ * release the least recently searched beyond that.
+ *
+ * Only loaded kernel modules whose CTF comes from the archive are released:
+ * everything else about them stays loaded, and their CTF is cheap to reopen.
+ * The kernel proper and the shared CTF are always kept.
+ */
+static void
+dt_module_ctf_cool(dtrace_hdl_t *dtp, dt_module_t *dmp)
+{
+	if ((dmp->dm_flags & (DT_DM_KERNEL | DT_DM_CTF_ARCHIVED |
+	    DT_DM_KERN_UNLOADED)) != (DT_DM_KERNEL | DT_DM_CTF_ARCHIVED) ||
+	    dmp == dtp->dt_exec || dmp->dm_ctfp == dtp->dt_shared_ctf)
+		return;
+
+	dmp->dm_flags |= DT_DM_CTF_COLD;
+	dmp->dm_ctfstamp = ++dtp->dt_ctfstamp;
+	dtp->dt_nctfcold++;
+
+	/*
+	 * The limit is small, so just search for the oldest.
+	 */
+	while (dtp->dt_nctfcold > dtp->dt_ctfcachesize) {
+		dt_module_t *old = NULL;
+
+		for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+		    dmp = dt_list_next(dmp)) {
+			if ((dmp->dm_flags & DT_DM_CTF_COLD) && (old == NULL ||
+			    dmp->dm_ctfstamp < old->dm_ctfstamp))
+				old = dmp;
+		}
+
+		dt_module_ctf_release(dtp, old);
+	}
+}
+
 int
 dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
     dtrace_typeinfo_t *tip)
@@ -1659,9 +2228,18 @@ dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
 		tip = &ti;
 
 	for (; n > 0; n--, dmp = dt_list_next(dmp)) {
+		int cold;
+
 		if ((dmp->dm_flags & mask) != bits)
 			continue; /* failed to match required attributes */
 
+		/*
+		 * A module whose CTF we open here (or opened only in earlier
+		 * searches like this one) is cold unless it has the type.
+		 */
+		cold = !justone && (dmp->dm_ctfp == NULL ||
+		    (dmp->dm_flags & DT_DM_CTF_COLD));
+
 		/*
 		 * If we can't load the CTF container, continue on to the next
 		 * module.  If our search was scoped to only one module then
@@ -1689,7 +2267,8 @@ dtrace_lookup_by_type(dtrace_hdl_t *dtp, const char *object, const char *name,
 				return (0);
 
 			found++;
-		}
+		} else if (cold)
+			dt_module_ctf_cool(dtp, dmp);
 	}
 
 	if (found == 0)
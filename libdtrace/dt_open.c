@@ -656,6 +656,8 @@ uint_t _dtrace_strsize = 256;	/* default size of string intrinsic type */
 uint_t _dtrace_stkindent = 14;	/* default whitespace indent for stack/ustack */
 uint_t _dtrace_pidbuckets = 64; /* default number of pid hash buckets */
 uint_t _dtrace_pidlrulim = 8;	/* default number of pid handles to cache */
+uint_t _dtrace_symcachesize = 16384; /* default number of addresses to cache */
+uint_t _dtrace_ctfcachesize = 32; /* default number of cold CTF modules kept */
 size_t _dtrace_bufsize = 512;	/* default dt_buf_create() size */
 int _dtrace_argmax = 32;	/* default maximum number of probe arguments */
 
@@ -762,6 +764,7 @@ dt_vopen(int version, int flags, int *errp,
 	dt_provmod_t *provmod = NULL;
 	int i, err;
 	char modpath[PATH_MAX];
+	const char *snapdir;
 	struct rlimit rl;
 
 	const dt_intrinsic_t *dinp;
@@ -887,6 +890,9 @@ alloc:
 	dtp->dt_cdefs_fd = -1;
 	dtp->dt_ddefs_fd = -1;
 	dtp->dt_stdout_fd = -1;
+	dtp->dt_wakefd = -1;
+	dtp->dt_wakeevfd = -1;
+	dtp->dt_waketimerfd = -1;
 	dtp->dt_modbuckets = _dtrace_strbuckets;
 	dtp->dt_mods = calloc(dtp->dt_modbuckets, sizeof (dt_module_t *));
 	dtp->dt_kernpathbuckets = _dtrace_strbuckets;
@@ -894,6 +900,8 @@ alloc:
 	dtp->dt_provbuckets = _dtrace_strbuckets;
 	dtp->dt_provs = calloc(dtp->dt_provbuckets, sizeof (dt_provider_t *));
 	dt_proc_hash_create(dtp);
+	dtp->dt_symcachesize = _dtrace_symcachesize;
+	dtp->dt_ctfcachesize = _dtrace_ctfcachesize;
 	dtp->dt_vmax = DT_VERS_LATEST;
 	dtp->dt_cpp_path = strdup(_dtrace_defcpp);
 	dtp->dt_cpp_argv = malloc(sizeof (char *));
@@ -1022,6 +1030,15 @@ alloc:
 			return (set_open_errno(dtp, errp, EDT_NOMEM));
 	}
 
+	/*
+	 * The kernel snapshot directory comes from the environment only:
+	 * options are set once the handle is open, too late for this first
+	 * dtrace_update(), which is the one a snapshot is meant to speed up.
+	 */
+	if ((snapdir = getenv("DTRACE_OPT_KERNSNAP")) != NULL &&
+	    *snapdir != '\0' && (dtp->dt_kernsnap = strdup(snapdir)) == NULL)
+		return (set_open_errno(dtp, errp, EDT_NOMEM));
+
 	/*
 	 * Update the module list and load the values for the macro variable
 	 * definitions according to the current process.
@@ -1328,6 +1345,8 @@ dtrace_close(dtrace_hdl_t *dtp)
 
 	while ((dmp = dt_list_next(&dtp->dt_modlist)) != NULL)
 		dt_module_destroy(dtp, dmp);
+	dt_symindex_destroy(dtp->dt_kernsymindex);
+	dt_strpool_destroy(dtp->dt_kernstrs);
 
 	while ((dkpp = dt_list_next(&dtp->dt_kernpathlist)) != NULL)
 		dt_kern_path_destroy(dtp, dkpp);
@@ -1352,12 +1371,23 @@ dtrace_close(dtrace_hdl_t *dtp)
 		(void) close(dtp->dt_ddefs_fd);
 	if (dtp->dt_stdout_fd != -1)
 		(void) close(dtp->dt_stdout_fd);
+	if (dtp->dt_wakefd != -1)
+		(void) close(dtp->dt_wakefd);
+	if (dtp->dt_wakeevfd != -1)
+		(void) close(dtp->dt_wakeevfd);
+	if (dtp->dt_waketimerfd != -1)
+		(void) close(dtp->dt_waketimerfd);
 
 	dt_epid_destroy(dtp);
 	dt_aggid_destroy(dtp);
 	dt_format_destroy(dtp);
 	dt_buffered_destroy(dtp);
 	dt_aggregate_destroy(dtp);
+	dt_free(dtp, dtp->dt_bufstats);
+	for (i = 0; i < dtp->dt_ntemphold; i++)
+		dt_free(dtp, dtp->dt_temphold[i].dtbd_data);
+	dt_free(dtp, dtp->dt_temphold);
+	dt_symcache_destroy(dtp);
 	free(dtp->dt_buf.dtbd_data);
 	dt_pfdict_destroy(dtp);
 	dt_provmod_destroy(&dtp->dt_provmod);
@@ -1384,6 +1414,9 @@ dtrace_close(dtrace_hdl_t *dtp)
 	elf_end(dtp->dt_ctf_elf);
 	free(dtp->dt_mods);
 	free(dtp->dt_module_path);
+	free(dtp->dt_kernsnap);
+	free(dtp->dt_progcache);
+	free(dtp->dt_libimage);
 	free(dtp->dt_kernpaths);
 	free(dtp->dt_provs);
 	free(dtp);
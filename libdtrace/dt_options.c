@@ -9,6 +9,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 
+#include <stddef.h>
 #include <string.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -36,6 +37,19 @@ dt_opt_agg(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_aggthreads(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	int n;
+
+	if (arg == NULL || (n = atoi(arg)) < 0)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_aggthreads = n;
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_amin(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -98,6 +112,19 @@ dt_opt_core(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (dt_set_errno(dtp, errno));
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_consumethreads(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	int n;
+
+	if (arg == NULL || (n = atoi(arg)) < 0)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_consumethreads = n;
+	return (0);
+}
+
 static int
 dt_opt_cpp_args(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -271,6 +298,31 @@ dt_opt_iregs(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*
+ * Set the directory of a cache: 'option' is the offset of its pathname in the
+ * handle.  An empty directory turns the cache off.
+ */
+static int
+dt_opt_dirpath(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	char **pathp = (char **)((uintptr_t)dtp + option);
+	char *dir;
+
+	if (arg == NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (dtp->dt_pcb != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTCTX));
+
+	if ((dir = strdup(arg)) == NULL)
+		return (dt_set_errno(dtp, EDT_NOMEM));
+
+	free(*pathp);
+	*pathp = dir;
+
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_lazyload(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -475,6 +527,21 @@ dt_opt_stdc(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_symtab_cache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	if (arg == NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (dtp->dt_pcb != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTCTX));
+
+	Pset_symtab_cache_path(arg);
+
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_syslibdir(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -516,6 +583,18 @@ dt_opt_sysslice(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_temporal(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	if (dtp->dt_active)
+		return (dt_set_errno(dtp, EDT_ACTIVE));
+
+	dtp->dt_temporal = 1;
+
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_tree(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -629,6 +708,19 @@ dt_opt_version(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (dt_reduce(dtp, v));
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_wakeup(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (dtrace_wakeup_fd(dtp) == -1)
+		return (-1); /* errno is set for us */
+
+	return (0);
+}
+
 static int
 dt_opt_runtime(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -786,6 +878,16 @@ dt_opt_rate(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 		{ NULL }
 	};
 
+	/*
+	 * A switchrate of "auto" leaves the rate at its default and lets
+	 * dtrace_consume() adjust it to the fill levels it sees.
+	 */
+	if (option == DTRACEOPT_SWITCHRATE) {
+		dtp->dt_autoswitch = (arg != NULL && strcmp(arg, "auto") == 0);
+		if (dtp->dt_autoswitch)
+			return (0);
+	}
+
 	if (arg != NULL) {
 		long long negtest;
 
@@ -1011,6 +1113,36 @@ dt_opt_preallocate(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_symcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	dtrace_optval_t n;
+
+	if (arg == NULL || dt_optval_parse(arg, &n) != 0 || n > UINT_MAX)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dt_symcache_destroy(dtp);
+	dtp->dt_symcachesize = n;
+	return (0);
+}
+
+/*
+ * Shrinking the limit takes effect the next time a module's CTF goes cold.
+ */
+/*ARGSUSED*/
+static int
+dt_opt_ctfcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	dtrace_optval_t n;
+
+	if (arg == NULL || dt_optval_parse(arg, &n) != 0 || n > UINT_MAX)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_ctfcachesize = n;
+	return (0);
+}
+
 typedef struct dt_option {
 	const char *o_name;
 	int (*o_func)(dtrace_hdl_t *, const char *, uintptr_t);
@@ -1022,20 +1154,26 @@ typedef struct dt_option {
  */
 static const dt_option_t _dtrace_ctoptions[] = {
 	{ "aggpercpu", dt_opt_agg, DTRACE_A_PERCPU },
+	{ "aggstats", dt_opt_agg, DTRACE_A_SNAPSTATS },
+	{ "aggthreads", dt_opt_aggthreads },
 	{ "amin", dt_opt_amin },
 	{ "argref", dt_opt_cflags, DTRACE_C_ARGREF },
+	{ "consumethreads", dt_opt_consumethreads },
 	{ "core", dt_opt_core },
 	{ "cpp", dt_opt_cflags, DTRACE_C_CPP },
 	{ "cppargs", dt_opt_cpp_args },
 	{ "cpphdrs", dt_opt_cpp_hdrs },
 	{ "cpppath", dt_opt_cpp_path },
+	{ "cse", dt_opt_cflags, DTRACE_C_CSE },
 	{ "ctypes", dt_opt_ctypes },
+	{ "ctfcache", dt_opt_ctfcache },
 	{ "ctfpath", dt_opt_ctfa_path },
 	{ "defaultargs", dt_opt_cflags, DTRACE_C_DEFARG },
 	{ "dtypes", dt_opt_dtypes },
 	{ "debug", dt_opt_debug },
 	{ "debugassert", dt_opt_debug_assert },
 	{ "define", dt_opt_cpp_opts, (uintptr_t)"-D" },
+	{ "difopt", dt_opt_invcflags, DTRACE_C_NOOPT },
 	{ "droptags", dt_opt_droptags },
 	{ "empty", dt_opt_cflags, DTRACE_C_EMPTY },
 	{ "errtags", dt_opt_cflags, DTRACE_C_ETAGS },
@@ -1048,18 +1186,24 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "lazyload", dt_opt_lazyload },
 	{ "ldpath", dt_opt_ld_path },
 	{ "libdir", dt_opt_libdir },
+	{ "libimage", dt_opt_dirpath, offsetof(dtrace_hdl_t, dt_libimage) },
 	{ "linkmode", dt_opt_linkmode },
 	{ "linktype", dt_opt_linktype },
 	{ "modpath", dt_opt_module_path },
+	{ "nodifopt", dt_opt_cflags, DTRACE_C_NOOPT },
 	{ "nolibs", dt_opt_cflags, DTRACE_C_NOLIBS },
 	{ "pgmax", dt_opt_pgmax },
 	{ "preallocate", dt_opt_preallocate },
 	{ "procfspath", dt_opt_procfs_path },
+	{ "progcache", dt_opt_dirpath, offsetof(dtrace_hdl_t, dt_progcache) },
 	{ "pspec", dt_opt_cflags, DTRACE_C_PSPEC },
 	{ "stdc", dt_opt_stdc },
 	{ "strip", dt_opt_dflags, DTRACE_D_STRIP },
+	{ "symcache", dt_opt_symcache },
+	{ "symtabcache", dt_opt_symtab_cache },
 	{ "syslibdir", dt_opt_syslibdir },
 	{ "sysslice", dt_opt_sysslice },
+	{ "temporal", dt_opt_temporal },
 	{ "tree", dt_opt_tree },
 	{ "tregs", dt_opt_tregs },
 	{ "udefs", dt_opt_invcflags, DTRACE_C_UNODEF },
@@ -1068,6 +1212,7 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "useruid", dt_opt_useruid },
 	{ "verbose", dt_opt_cflags, DTRACE_C_DIFV },
 	{ "version", dt_opt_version },
+	{ "wakeup", dt_opt_wakeup },
 	{ "zdefs", dt_opt_cflags, DTRACE_C_ZDEFS },
 	{ NULL }
 };
@@ -2709,6 +2709,7 @@ dt_xcook_ident(dt_node_t *dnp, dt_idhash_t *dhp, uint_t idkind, int create)
 		if (uref) {
 			idp->di_flags |= DT_IDFLG_USER;
 			dnp->dn_flags |= DT_NF_USERLAND;
+			yypcb->pcb_nocache = 1;
 		}
 
 	} else if (scope == DTRACE_OBJ_EXEC && create == B_TRUE) {
@@ -158,6 +158,7 @@ dt_pcb_pop(dtrace_hdl_t *dtp, int err)
 
 	free(pcb->pcb_filetag);
 	free(pcb->pcb_sflagv);
+	free(pcb->pcb_options);
 
 	dtp->dt_pcb = pcb->pcb_prev;
 	memset(pcb, 0, sizeof (dt_pcb_t));
@@ -74,6 +74,9 @@ typedef struct dt_pcb {
 	int pcb_sou_deref;	/* lexer in struct/union dereference */
 	int pcb_xlator_input;	/* in translator input type */
 	int pcb_array_dimens;	/* in array dimensions */
+	int pcb_nocache;	/* program cannot be kept in the program cache */
+	char *pcb_options;	/* options set by #pragma D option */
+	size_t pcb_optionslen;	/* length of pcb_options */
 } dt_pcb_t;
 
 extern void dt_pcb_push(dtrace_hdl_t *, dt_pcb_t *);
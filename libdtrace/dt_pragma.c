@@ -242,9 +242,8 @@ dt_pragma_depends(const char *prname, dt_node_t *cnp)
 			    dld->dtld_libpath, nnp->dn_string);
 			dld = dt_lib_depend_lookup(&dtp->dt_lib_dep_sorted,
 			    lib);
-			assert(dld != NULL);
 
-			if (!dld->dtld_loaded)
+			if (dld == NULL || !dld->dtld_loaded)
 				xyerror(D_PRAGMA_DEPEND, "program requires "
 				    "library \"%s\" which failed to load",
 				    lib);
@@ -304,7 +303,8 @@ static void
 dt_pragma_option(const char *prname, dt_node_t *dnp)
 {
 	dtrace_hdl_t *dtp = yypcb->pcb_hdl;
-	char *opt, *val;
+	char *opt, *val, *opts;
+	size_t len;
 
 	if (dnp == NULL || dnp->dn_kind != DT_NODE_IDENT) {
 		xyerror(D_PRAGMA_MALFORM,
@@ -333,6 +333,19 @@ dt_pragma_option(const char *prname, dt_node_t *dnp)
 			    opt, val, dtrace_errmsg(dtp, dtrace_errno(dtp)));
 		}
 	}
+
+	/*
+	 * Remember the option for the program cache, which must set it again
+	 * when it returns this program without compiling it.
+	 */
+	len = strlen(dnp->dn_string) + 1;
+	if ((opts = realloc(yypcb->pcb_options,
+	    yypcb->pcb_optionslen + len)) == NULL)
+		longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
+
+	memcpy(opts + yypcb->pcb_optionslen, dnp->dn_string, len);
+	yypcb->pcb_options = opts;
+	yypcb->pcb_optionslen += len;
 }
 
 /*
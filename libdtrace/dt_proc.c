@@ -153,6 +153,8 @@ dt_proc_notify(dtrace_hdl_t *dtp, dt_proc_hash_t *dph, dt_proc_t *dpr,
 			(void) pthread_cond_broadcast(&dph->dph_cv);
 		if (lock)
 			(void) pthread_mutex_unlock(&dph->dph_lock);
+
+		dtrace_wakeup(dtp);
 	}
 }
 
@@ -2127,6 +2129,14 @@ dt_Plookup_by_addr(dtrace_hdl_t *dtp, pid_t pid, uintptr_t addr,
 	return ret;
 }
 
+int
+dt_Plookup_by_addrs(dtrace_hdl_t *dtp, pid_t pid, prsymaddr_t *psa, size_t n)
+{
+	int ret;
+	DEFINE_dt_Pfunction(Plookup_by_addrs, -1, psa, n);
+	return ret;
+}
+
 const prmap_t *
 dt_Paddr_to_map(dtrace_hdl_t *dtp, pid_t pid, uintptr_t addr)
 {
@@ -2221,6 +2231,14 @@ dt_Pread(dtrace_hdl_t *dtp, pid_t pid, void *buf, size_t nbyte,
 	return ret;
 }
 
+uint64_t
+dt_Pmapping_generation(dtrace_hdl_t *dtp, pid_t pid)
+{
+	uint64_t ret;
+	DEFINE_dt_Pfunction(Pmapping_generation, 0);
+	return ret;
+}
+
 void
 dt_proc_hash_create(dtrace_hdl_t *dtp)
 {
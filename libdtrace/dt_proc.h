@@ -155,6 +155,7 @@ extern void dt_proc_enqueue_exits(dtrace_hdl_t *dtp);
  */
 extern int dt_Plookup_by_addr(dtrace_hdl_t *, pid_t, uintptr_t, char *, size_t,
     GElf_Sym *);
+extern int dt_Plookup_by_addrs(dtrace_hdl_t *, pid_t, prsymaddr_t *, size_t);
 extern const prmap_t *dt_Paddr_to_map(dtrace_hdl_t *, pid_t, uintptr_t);
 extern const prmap_t *dt_Plmid_to_map(dtrace_hdl_t *, pid_t, Lmid_t,
     const char *);
@@ -169,6 +170,7 @@ extern int dt_Psymbol_iter_by_addr(dtrace_hdl_t *, pid_t, const char *, int,
     int, proc_sym_f *, void *);
 extern int dt_Pobject_iter(dtrace_hdl_t *, pid_t, proc_map_f *, void *);
 extern ssize_t dt_Pread(dtrace_hdl_t *, pid_t, void *, size_t, uintptr_t);
+extern uint64_t dt_Pmapping_generation(dtrace_hdl_t *, pid_t);
 
 extern void dt_proc_hash_create(dtrace_hdl_t *);
 extern void dt_proc_hash_destroy(dtrace_hdl_t *);
@@ -0,0 +1,688 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Program cache.
+ *
+ * Running the same script again repeats all of dt_compile(): loading the D
+ * libraries, parsing, type resolution, code generation and assembly, for the
+ * same DOF as last time.  When a program cache directory is set (by the
+ * "progcache" option) and a program is compiled with DTRACE_C_CACHE, the DOF
+ * of the compiled program is saved there, and later compilations of the same
+ * program return a program holding that DOF, which dtrace_program_exec()
+ * enables as it is.  The D libraries are not even loaded.
+ *
+ * A cached program is keyed on its source (after preprocessing), its
+ * arguments, the options and flags in effect, the size and mtime of every D
+ * library file, the libdtrace build, and the kernel as described by the kernel
+ * snapshot key (release, version, boot ID and loaded modules) together with
+ * the size and mtime of the kernel CTF archive.  The key selects the file, and
+ * is stored in it along with the whole source and arguments, which must match
+ * exactly.  A program also depends on the values of the macro variables it
+ * references, such as $pid: these are stored too, and any change means the
+ * program is compiled again, which replaces the file.
+ *
+ * The consumer learns what the records of an enabling hold from the kernel,
+ * which gets it from the DOF.  The exception is aggregations, whose records
+ * point back at the compiler's statement: the DOF is stored with statement
+ * numbers instead of these pointers, and a cached program gets one placeholder
+ * statement per statement, holding an aggregation identifier with the name,
+ * variable ID and lquantize() parameters of the original.  The variable IDs
+ * are also compiled into the DIF of printa(), trunc() and the like, so they
+ * are restored as they were, with one identifier for each aggregation however
+ * many statements update it; the program is compiled again if the handle has
+ * already handed out any of these IDs.  Options set by #pragma D option are
+ * stored and set again.
+ *
+ * Programs that create probes while they are compiled (pid and USDT probes),
+ * define providers, or resolve user symbols are never cached, and neither is
+ * anything compiled with -S.  A cached program has no statements: it can only
+ * be enabled, not listed, linked or turned into DOF for anonymous tracing.
+ * Its aggregations and variables are also not shared with other programs
+ * compiled by the same handle.  dtrace(1) therefore only asks for the cache
+ * when it enables a single program.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <dt_impl.h>
+#include <dt_program.h>
+#include <dt_progcache.h>
+#include <dt_libimage.h>
+
+#define	DT_PROGCACHE_MAGIC	0x43505444	/* "DTPC" */
+#define	DT_PROGCACHE_VERSION	1
+
+typedef struct dt_progcache_hdr {
+	uint32_t dpch_magic;		/* DT_PROGCACHE_MAGIC */
+	uint32_t dpch_version;		/* DT_PROGCACHE_VERSION */
+	dt_progcache_key_t dpch_key;	/* what the program was compiled from */
+	uint64_t dpch_srclen;		/* length of the source */
+	uint64_t dpch_doflen;		/* length of the DOF */
+	uint32_t dpch_argc;		/* number of script arguments */
+	uint32_t dpch_nmacros;		/* number of macro variables used */
+	uint32_t dpch_noptions;		/* number of options set by pragmas */
+	uint32_t dpch_nstmts;		/* number of statements */
+	dtrace_proginfo_t dpch_info;	/* program info, without matches */
+} dt_progcache_hdr_t;			/* followed by source, arguments, */
+					/* macros, options, statements, DOF */
+
+typedef struct dt_progcache_macros {
+	FILE *dpm_fp;			/* file to write to, or NULL */
+	uint32_t dpm_count;		/* number of macros referenced */
+	int dpm_err;			/* write error */
+} dt_progcache_macros_t;
+
+typedef struct dt_progcache_save {
+	dtrace_hdl_t *dps_hdl;		/* handle the program was compiled by */
+	dt_progcache_t *dps_dpc;	/* state of the cache lookup */
+	const dt_pcb_t *dps_pcb;	/* compiler state of the program */
+	dtrace_prog_t *dps_prog;	/* program to save */
+	void *dps_dof;			/* DOF of the program */
+	uint64_t *dps_from;		/* statement pointers in the DOF */
+	uint64_t *dps_to;		/* statement numbers to replace them */
+	uint_t dps_nstmts;		/* number of statements */
+} dt_progcache_save_t;
+
+/*
+ * Compute the key of the program in 'dpc', compiled as things are now.
+ */
+static void
+dt_progcache_key(dtrace_hdl_t *dtp, dt_progcache_t *dpc,
+    dtrace_probespec_t pspec, uint_t cflags, int string)
+{
+	dt_progcache_key_t *key = &dpc->dpc_key;
+	dt_ident_t *idp;
+	char path[PATH_MAX];
+	struct stat s;
+	int i;
+
+	memset(key, 0, sizeof (dt_progcache_key_t));
+	dt_kernsnap_key(dtp, &key->dpk_kernel);
+
+	if (dtp->dt_ctfa_path != NULL)
+		strlcpy(path, dtp->dt_ctfa_path, sizeof (path));
+	else
+		snprintf(path, sizeof (path), "%s/kernel/vmlinux.ctfa",
+		    dtp->dt_module_path);
+
+	if (stat(path, &s) == 0) {
+		key->dpk_ctfa_size = s.st_size;
+		key->dpk_ctfa_mtime_sec = s.st_mtim.tv_sec;
+		key->dpk_ctfa_mtime_nsec = s.st_mtim.tv_nsec;
+	}
+
+	key->dpk_build = dt_kernsnap_hash(DT_KERNSNAP_HASHINIT,
+	    _dtrace_version, strlen(_dtrace_version) + 1);
+	key->dpk_build = dt_kernsnap_hash(key->dpk_build,
+	    _libdtrace_vcs_version, strlen(_libdtrace_vcs_version) + 1);
+
+	if (!(dtp->dt_cflags & DTRACE_C_NOLIBS))
+		key->dpk_libs = dt_libimage_hash(dtp);
+
+	key->dpk_source = dt_kernsnap_hash(DT_KERNSNAP_HASHINIT,
+	    dpc->dpc_src, dpc->dpc_srclen);
+	for (i = 0; i < dpc->dpc_argc; i++) {
+		key->dpk_source = dt_kernsnap_hash(key->dpk_source,
+		    dpc->dpc_argv[i], strlen(dpc->dpc_argv[i]) + 1);
+	}
+
+	memcpy(key->dpk_options, dtp->dt_options, sizeof (key->dpk_options));
+	key->dpk_cflags = dtp->dt_cflags | cflags;
+	key->dpk_dflags = dtp->dt_dflags;
+	key->dpk_pspec = pspec;
+	key->dpk_string = string;
+	key->dpk_linkmode = dtp->dt_linkmode;
+	key->dpk_xlatemode = dtp->dt_xlatemode;
+	key->dpk_stdcmode = dtp->dt_stdcmode;
+	key->dpk_model = dtp->dt_conf.dtc_ctfmodel;
+	key->dpk_vmax = dtp->dt_vmax;
+	key->dpk_amin = (dtp->dt_amin.dtat_name << 16) |
+	    (dtp->dt_amin.dtat_data << 8) | dtp->dt_amin.dtat_class;
+
+	/*
+	 * Whether a target process exists decides whether some printf()
+	 * conversions are valid.
+	 */
+	idp = dt_idhash_lookup(dtp->dt_macros, "target");
+	key->dpk_target = idp != NULL && idp->di_id != 0;
+}
+
+/*
+ * Read the source of the program into 'dpc'.  A file is read from its current
+ * position, which is then restored for the compiler: files that cannot seek,
+ * such as pipes, are not cached.
+ */
+static int
+dt_progcache_source(dt_progcache_t *dpc, FILE *fp, const char *s)
+{
+	size_t len = 0, size = BUFSIZ;
+	char *buf, *nbuf;
+	off_t off;
+
+	if (fp == NULL) {
+		if ((dpc->dpc_src = strdup(s)) == NULL)
+			return (-1);
+
+		dpc->dpc_srclen = strlen(s);
+		return (0);
+	}
+
+	if ((off = ftello(fp)) == -1 || (buf = malloc(size)) == NULL)
+		return (-1);
+
+	for (;;) {
+		len += fread(buf + len, 1, size - len, fp);
+		if (len < size)
+			break;
+
+		if ((nbuf = realloc(buf, size * 2)) == NULL) {
+			len = 0;
+			break;
+		}
+
+		buf = nbuf;
+		size *= 2;
+	}
+
+	if (ferror(fp) || fseeko(fp, off, SEEK_SET) == -1 || len == 0) {
+		clearerr(fp);
+		(void) fseeko(fp, off, SEEK_SET);
+		free(buf);
+		return (-1);
+	}
+
+	dpc->dpc_src = buf;
+	dpc->dpc_srclen = len;
+	return (0);
+}
+
+/*
+ * Replace the user argument of every action in 'dof' that is from[i] by to[i].
+ * Fail if the DOF is malformed, or if an action has a non-zero user argument
+ * that is not in from[].
+ */
+static int
+dt_progcache_reloc(void *dof, size_t len, const uint64_t *from,
+    const uint64_t *to, uint_t n)
+{
+	dof_hdr_t *dhp = dof;
+	uint_t i, j, k;
+
+	if (len < sizeof (dof_hdr_t) || dhp->dofh_filesz != len ||
+	    dhp->dofh_secsize != sizeof (dof_sec_t) ||
+	    dhp->dofh_secoff > len || dhp->dofh_secoff % sizeof (uint64_t) ||
+	    dhp->dofh_secnum > (len - dhp->dofh_secoff) / sizeof (dof_sec_t))
+		return (-1);
+
+	for (i = 0; i < dhp->dofh_secnum; i++) {
+		dof_sec_t *sec = (dof_sec_t *)((char *)dof +
+		    dhp->dofh_secoff) + i;
+		dof_actdesc_t *dofa;
+
+		if (sec->dofs_type != DOF_SECT_ACTDESC)
+			continue;
+
+		if (sec->dofs_entsize != sizeof (dof_actdesc_t) ||
+		    sec->dofs_offset > len ||
+		    sec->dofs_size > len - sec->dofs_offset ||
+		    sec->dofs_offset % sizeof (uint64_t))
+			return (-1);
+
+		dofa = (dof_actdesc_t *)((char *)dof + sec->dofs_offset);
+
+		for (j = 0; j < sec->dofs_size / sizeof (dof_actdesc_t); j++) {
+			if (dofa[j].dofa_uarg == 0)
+				continue;
+
+			for (k = 0; k < n && from[k] != dofa[j].dofa_uarg; k++)
+				continue;
+
+			if (k == n)
+				return (-1);
+
+			dofa[j].dofa_uarg = to[k];
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Create the placeholder statement for statement 'n' of a cached program,
+ * which updates aggregation 'id', with an aggregation identifier carrying what
+ * the consumer needs: its name, its ID, and its lquantize() or llquantize()
+ * parameters, if any.  Statements that update the same aggregation share the
+ * identifier of the first.
+ */
+static int
+dt_progcache_agg(dtrace_hdl_t *dtp, dtrace_prog_t *pgp, uint32_t n,
+    const char *name, uint32_t id, uint64_t auxinfo)
+{
+	dt_idhash_t *dhp = dtp->dt_aggs;
+	dtrace_stmtdesc_t *sdp = &pgp->dp_cstmts[n];
+	dt_idsig_t *isp;
+	dt_ident_t *idp;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		idp = pgp->dp_cstmts[i].dtsd_aggdata;
+
+		if (idp == NULL || idp->di_id != id)
+			continue;
+
+		if (strcmp(idp->di_name, name) != 0)
+			return (-1);
+
+		sdp->dtsd_aggdata = idp;
+		return (0);
+	}
+
+	if (id < dhp->dh_nextid || id >= dhp->dh_maxid)
+		return (-1);
+
+	if ((idp = dt_ident_create(name, DT_IDENT_AGG, DT_IDFLG_WRITE, id,
+	    _dtrace_defattr, 0, &dt_idops_assc, NULL, dtp->dt_gen)) == NULL)
+		return (-1);
+
+	sdp->dtsd_aggdata = idp;
+
+	if (auxinfo == 0)
+		return (0);
+
+	if ((isp = calloc(1, sizeof (dt_idsig_t))) == NULL)
+		return (-1);
+
+	isp->dis_varargs = -1;
+	isp->dis_optargs = -1;
+	isp->dis_auxinfo = auxinfo;
+	idp->di_data = isp;
+
+	return (0);
+}
+
+/*
+ * Turn the cached program after the header into a program, or return NULL if
+ * it is stale or corrupt.
+ */
+static dtrace_prog_t *
+dt_progcache_load(dtrace_hdl_t *dtp, dt_progcache_t *dpc, dt_snap_t *ds,
+    const dt_progcache_hdr_t *hdr)
+{
+	const char *src, *str;
+	const uint32_t *val, *agg, *id;
+	const uint64_t *auxinfo;
+	uint_t nextid = dtp->dt_aggs->dh_nextid;
+	uint64_t *from = NULL, *to = NULL;
+	dtrace_prog_t *pgp = NULL;
+	const void *dof;
+	dt_snap_t opts;
+	dt_ident_t *idp;
+	uint32_t i;
+
+	if (hdr->dpch_srclen != dpc->dpc_srclen ||
+	    hdr->dpch_argc != dpc->dpc_argc ||
+	    (src = dt_snap_get(ds, hdr->dpch_srclen)) == NULL ||
+	    memcmp(src, dpc->dpc_src, dpc->dpc_srclen) != 0)
+		return (NULL);
+
+	for (i = 0; i < hdr->dpch_argc; i++) {
+		if ((str = dt_snap_get_str(ds)) == NULL ||
+		    strcmp(str, dpc->dpc_argv[i]) != 0)
+			return (NULL);
+	}
+
+	for (i = 0; i < hdr->dpch_nmacros; i++) {
+		if ((str = dt_snap_get_str(ds)) == NULL ||
+		    (val = dt_snap_get(ds, sizeof (uint32_t))) == NULL)
+			return (NULL);
+
+		if ((idp = dt_idhash_lookup(dtp->dt_macros, str)) == NULL ||
+		    idp->di_id != *val) {
+			dt_dprintf("cached program %s uses $%s\n",
+			    dpc->dpc_path, str);
+			return (NULL);
+		}
+	}
+
+	/*
+	 * Options are only set once the whole program has been read.
+	 */
+	opts = *ds;
+	for (i = 0; i < hdr->dpch_noptions; i++) {
+		if (dt_snap_get_str(ds) == NULL)
+			return (NULL);
+	}
+
+	if (hdr->dpch_nstmts > (size_t)(ds->ds_end - ds->ds_ptr) /
+	    sizeof (uint32_t) || (pgp = dt_program_create(dtp)) == NULL)
+		return (NULL);
+
+	if (hdr->dpch_nstmts != 0 &&
+	    ((pgp->dp_cstmts = dt_zalloc(dtp, hdr->dpch_nstmts *
+	    sizeof (dtrace_stmtdesc_t))) == NULL ||
+	    (from = malloc(hdr->dpch_nstmts * sizeof (uint64_t))) == NULL ||
+	    (to = malloc(hdr->dpch_nstmts * sizeof (uint64_t))) == NULL))
+		goto err;
+
+	pgp->dp_ncstmts = hdr->dpch_nstmts;
+
+	for (i = 0; i < hdr->dpch_nstmts; i++) {
+		if ((agg = dt_snap_get(ds, sizeof (uint32_t))) == NULL)
+			goto err;
+
+		from[i] = i + 1;
+		to[i] = (uintptr_t)&pgp->dp_cstmts[i];
+
+		if (*agg == 0)
+			continue;
+
+		if ((str = dt_snap_get_str(ds)) == NULL ||
+		    (id = dt_snap_get(ds, sizeof (uint32_t))) == NULL ||
+		    (auxinfo = dt_snap_get(ds, sizeof (uint64_t))) == NULL ||
+		    dt_progcache_agg(dtp, pgp, i, str, *id, *auxinfo) != 0)
+			goto err;
+
+		if (*id >= nextid)
+			nextid = *id + 1;
+	}
+
+	if ((dof = dt_snap_get(ds, hdr->dpch_doflen)) == NULL ||
+	    ds->ds_ptr != ds->ds_end ||
+	    (pgp->dp_dof = dt_alloc(dtp, hdr->dpch_doflen)) == NULL)
+		goto err;
+
+	memcpy(pgp->dp_dof, dof, hdr->dpch_doflen);
+	if (dt_progcache_reloc(pgp->dp_dof, hdr->dpch_doflen, from, to,
+	    hdr->dpch_nstmts) != 0)
+		goto err;
+
+	for (i = 0; i < hdr->dpch_noptions; i++) {
+		char *opt, *eq;
+
+		if ((opt = strdup(dt_snap_get_str(&opts))) == NULL)
+			goto err;
+
+		if ((eq = strchr(opt, '=')) != NULL)
+			*eq++ = '\0';
+
+		if (dtrace_setopt(dtp, opt, eq) != 0) {
+			free(opt);
+			goto err;
+		}
+
+		free(opt);
+	}
+
+	/*
+	 * Programs compiled from now on must not reuse the restored IDs.
+	 */
+	dtp->dt_aggs->dh_nextid = nextid;
+	pgp->dp_info = hdr->dpch_info;
+	free(from);
+	free(to);
+	return (pgp);
+
+err:
+	free(from);
+	free(to);
+	dt_program_destroy(dtp, pgp);
+	return (NULL);
+}
+
+/*
+ * Return the cached program for the given source, if there is a current one.
+ * Otherwise, fill in 'dpc' for dt_progcache_store() to save the program once
+ * it is compiled, and return NULL.
+ */
+dtrace_prog_t *
+dt_progcache_lookup(dtrace_hdl_t *dtp, dt_progcache_t *dpc,
+    dtrace_probespec_t pspec, uint_t cflags, int argc, char *const argv[],
+    FILE *fp, const char *s)
+{
+	const dt_progcache_hdr_t *hdr;
+	dtrace_prog_t *pgp;
+	dt_snap_t ds;
+	size_t size;
+	void *map;
+
+	memset(dpc, 0, sizeof (dt_progcache_t));
+
+	if (dtp->dt_progcache == NULL || dtp->dt_progcache[0] == '\0' ||
+	    !(cflags & DTRACE_C_CACHE) ||
+	    ((dtp->dt_cflags | cflags) & (DTRACE_C_DIFV | DTRACE_C_CTL)))
+		return (NULL);
+
+	if (dt_progcache_source(dpc, fp, s) != 0)
+		return (NULL);
+
+	dpc->dpc_argc = argc;
+	dpc->dpc_argv = argv;
+	dt_progcache_key(dtp, dpc, pspec, cflags, fp == NULL);
+
+	if (snprintf(dpc->dpc_path, sizeof (dpc->dpc_path), "%s/prog-%016llx",
+	    dtp->dt_progcache, (unsigned long long)dt_kernsnap_hash(
+	    DT_KERNSNAP_HASHINIT, (const char *)&dpc->dpc_key,
+	    sizeof (dpc->dpc_key))) >= sizeof (dpc->dpc_path)) {
+		dpc->dpc_path[0] = '\0';
+		dt_progcache_fini(dpc);
+		return (NULL);
+	}
+
+	if ((map = cachefile_map(dpc->dpc_path, sizeof (dt_progcache_hdr_t),
+	    DT_PROGCACHE_MAGIC, DT_PROGCACHE_VERSION, &size)) == NULL)
+		return (NULL);
+
+	ds.ds_ptr = map;
+	ds.ds_end = (const char *)map + size;
+	hdr = dt_snap_get(&ds, sizeof (dt_progcache_hdr_t));
+
+	if (memcmp(&hdr->dpch_key, &dpc->dpc_key, sizeof (dpc->dpc_key)) != 0)
+		pgp = NULL;
+	else
+		pgp = dt_progcache_load(dtp, dpc, &ds, hdr);
+
+	munmap(map, size);
+
+	if (pgp == NULL) {
+		dt_dprintf("cached program %s is stale\n", dpc->dpc_path);
+		return (NULL);
+	}
+
+	dt_dprintf("loaded cached program %s\n", dpc->dpc_path);
+	dt_progcache_fini(dpc);
+	return (pgp);
+}
+
+static int
+dt_progcache_macro(dt_idhash_t *dhp, dt_ident_t *idp, void *arg)
+{
+	dt_progcache_macros_t *dpm = arg;
+	uint32_t val = idp->di_id;
+
+	if (!(idp->di_flags & DT_IDFLG_REF))
+		return (0);
+
+	dpm->dpm_count++;
+
+	if (dpm->dpm_fp != NULL &&
+	    (dt_snap_put_str(dpm->dpm_fp, idp->di_name) < 0 ||
+	    dt_snap_put(dpm->dpm_fp, &val, sizeof (val)) < 0))
+		dpm->dpm_err = -1;
+
+	return (0);
+}
+
+static int
+dt_progcache_save(FILE *fp, void *arg)
+{
+	dt_progcache_save_t *dps = arg;
+	dtrace_hdl_t *dtp = dps->dps_hdl;
+	dt_progcache_t *dpc = dps->dps_dpc;
+	const dt_pcb_t *pcb = dps->dps_pcb;
+	dtrace_prog_t *pgp = dps->dps_prog;
+	void *dof = dps->dps_dof;
+	uint64_t *from = dps->dps_from;
+	dt_progcache_macros_t dpm;
+	dt_progcache_hdr_t hdr;
+	dt_stmt_t *stp;
+	const char *opt;
+	uint32_t i;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.dpch_magic = DT_PROGCACHE_MAGIC;
+	hdr.dpch_version = DT_PROGCACHE_VERSION;
+	hdr.dpch_key = dpc->dpc_key;
+	hdr.dpch_srclen = dpc->dpc_srclen;
+	hdr.dpch_doflen = ((dof_hdr_t *)dof)->dofh_filesz;
+	hdr.dpch_argc = dpc->dpc_argc;
+
+	memset(&dpm, 0, sizeof (dpm));
+	(void) dt_idhash_iter(dtp->dt_macros, dt_progcache_macro, &dpm);
+	hdr.dpch_nmacros = dpm.dpm_count;
+
+	for (opt = pcb->pcb_options;
+	    opt < pcb->pcb_options + pcb->pcb_optionslen;
+	    opt += strlen(opt) + 1)
+		hdr.dpch_noptions++;
+
+	for (stp = dt_list_next(&pgp->dp_stmts); stp != NULL;
+	    stp = dt_list_next(stp))
+		hdr.dpch_nstmts++;
+
+	dtrace_program_info(dtp, pgp, &hdr.dpch_info);
+
+	if (dt_snap_put(fp, &hdr, sizeof (hdr)) < 0 ||
+	    dt_snap_put(fp, dpc->dpc_src, dpc->dpc_srclen) < 0)
+		return (-1);
+
+	for (i = 0; i < hdr.dpch_argc; i++) {
+		if (dt_snap_put_str(fp, dpc->dpc_argv[i]) < 0)
+			return (-1);
+	}
+
+	dpm.dpm_fp = fp;
+	dpm.dpm_count = 0;
+	(void) dt_idhash_iter(dtp->dt_macros, dt_progcache_macro, &dpm);
+	if (dpm.dpm_err != 0 || dpm.dpm_count != hdr.dpch_nmacros)
+		return (-1);
+
+	for (opt = pcb->pcb_options;
+	    opt < pcb->pcb_options + pcb->pcb_optionslen;
+	    opt += strlen(opt) + 1) {
+		if (dt_snap_put_str(fp, opt) < 0)
+			return (-1);
+	}
+
+	for (i = 0, stp = dt_list_next(&pgp->dp_stmts); stp != NULL;
+	    i++, stp = dt_list_next(stp)) {
+		dtrace_stmtdesc_t *sdp = stp->ds_desc;
+		dt_ident_t *aid = sdp->dtsd_aggdata;
+		uint32_t agg = aid != NULL, id;
+		uint64_t auxinfo = 0;
+
+		from[i] = (uintptr_t)sdp;
+
+		if (dt_snap_put(fp, &agg, sizeof (agg)) < 0)
+			return (-1);
+
+		if (aid == NULL)
+			continue;
+
+		if (aid->di_data != NULL)
+			auxinfo = ((dt_idsig_t *)aid->di_data)->dis_auxinfo;
+
+		id = aid->di_id;
+
+		if (dt_snap_put_str(fp, aid->di_name) < 0 ||
+		    dt_snap_put(fp, &id, sizeof (id)) < 0 ||
+		    dt_snap_put(fp, &auxinfo, sizeof (auxinfo)) < 0)
+			return (-1);
+	}
+
+	/*
+	 * The statement pointers in the DOF are only known once the statements
+	 * have been written: replace them by statement numbers before the DOF
+	 * itself is written.
+	 */
+	if (dt_progcache_reloc(dof, hdr.dpch_doflen, from, dps->dps_to,
+	    dps->dps_nstmts) < 0 ||
+	    dt_snap_put(fp, dof, hdr.dpch_doflen) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Save a program just compiled after a failed dt_progcache_lookup().
+ */
+void
+dt_progcache_store(dtrace_hdl_t *dtp, dt_progcache_t *dpc,
+    const dt_pcb_t *pcb, dtrace_prog_t *pgp)
+{
+	dt_progcache_save_t dps;
+	dt_stmt_t *stp;
+	uint_t i;
+
+	if (dpc->dpc_path[0] == '\0')
+		return;
+
+	if (pcb->pcb_nocache) {
+		dt_dprintf("program cannot be cached\n");
+		return;
+	}
+
+	memset(&dps, 0, sizeof (dps));
+	dps.dps_hdl = dtp;
+	dps.dps_dpc = dpc;
+	dps.dps_pcb = pcb;
+	dps.dps_prog = pgp;
+
+	if ((dps.dps_dof = dtrace_dof_create(dtp, pgp, DTRACE_D_STRIP)) == NULL)
+		return;
+
+	for (stp = dt_list_next(&pgp->dp_stmts); stp != NULL;
+	    stp = dt_list_next(stp))
+		dps.dps_nstmts++;
+
+	if (dps.dps_nstmts != 0 &&
+	    ((dps.dps_from = malloc(dps.dps_nstmts *
+	    sizeof (uint64_t))) == NULL ||
+	    (dps.dps_to = malloc(dps.dps_nstmts * sizeof (uint64_t))) == NULL))
+		goto out;
+
+	for (i = 0; i < dps.dps_nstmts; i++)
+		dps.dps_to[i] = i + 1;
+
+	if (cachefile_write(dtp->dt_progcache, dpc->dpc_path,
+	    dt_progcache_save, &dps) < 0)
+		dt_dprintf("cannot write cached program %s: %s\n",
+		    dpc->dpc_path, strerror(errno));
+	else
+		dt_dprintf("saved cached program %s\n", dpc->dpc_path);
+
+out:
+	free(dps.dps_from);
+	free(dps.dps_to);
+	dtrace_dof_destroy(dtp, dps.dps_dof);
+}
+
+void
+dt_progcache_fini(dt_progcache_t *dpc)
+{
+	free(dpc->dpc_src);
+	dpc->dpc_src = NULL;
+}
@@ -0,0 +1,74 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_PROGCACHE_H
+#define	_DT_PROGCACHE_H
+
+#include <stdio.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <dtrace.h>
+#include <dt_kernsnap.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Everything a compiled program depends on other than its source and
+ * arguments, and the macro variables it references, which are kept with it.
+ */
+typedef struct dt_progcache_key {
+	dt_kernsnap_key_t dpk_kernel;	/* kernel, boot and loaded modules */
+	uint64_t dpk_ctfa_size;		/* size of the kernel CTF archive */
+	int64_t dpk_ctfa_mtime_sec;	/* mtime of the kernel CTF archive */
+	int64_t dpk_ctfa_mtime_nsec;
+	uint64_t dpk_build;		/* hash of the libdtrace build */
+	uint64_t dpk_libs;		/* hash of the D library files */
+	uint64_t dpk_source;		/* hash of the source and arguments */
+	uint64_t dpk_options[DTRACEOPT_MAX]; /* run-time options */
+	uint32_t dpk_cflags;		/* compile-time flags */
+	uint32_t dpk_dflags;		/* link-time flags */
+	uint32_t dpk_pspec;		/* probe specifier context */
+	uint32_t dpk_string;		/* compiled from a string */
+	uint32_t dpk_linkmode;		/* symbol linking mode */
+	uint32_t dpk_xlatemode;		/* translator linking mode */
+	uint32_t dpk_stdcmode;		/* stdc compatibility mode */
+	uint32_t dpk_model;		/* data model of the kernel */
+	uint32_t dpk_vmax;		/* ceiling on program API binding */
+	uint32_t dpk_amin;		/* floor on program attributes */
+	uint32_t dpk_target;		/* there is a target process */
+	uint32_t dpk_pad;
+} dt_progcache_key_t;
+
+/*
+ * The state of one cache lookup, kept by dt_compile() until the program is
+ * compiled and can be stored.  dpc_path is empty if the program cannot be
+ * cached.
+ */
+typedef struct dt_progcache {
+	char dpc_path[PATH_MAX];	/* cache file for this program */
+	dt_progcache_key_t dpc_key;	/* key of the program */
+	char *dpc_src;			/* source of the program */
+	size_t dpc_srclen;		/* length of dpc_src */
+	int dpc_argc;			/* number of script arguments */
+	char *const *dpc_argv;		/* script arguments */
+} dt_progcache_t;
+
+struct dt_pcb;
+
+extern dtrace_prog_t *dt_progcache_lookup(dtrace_hdl_t *, dt_progcache_t *,
+    dtrace_probespec_t, uint_t, int, char *const [], FILE *, const char *);
+extern void dt_progcache_store(dtrace_hdl_t *, dt_progcache_t *,
+    const struct dt_pcb *, dtrace_prog_t *);
+extern void dt_progcache_fini(dt_progcache_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_PROGCACHE_H */
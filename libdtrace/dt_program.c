@@ -42,7 +42,7 @@ void
 dt_program_destroy(dtrace_hdl_t *dtp, dtrace_prog_t *pgp)
 {
 	dt_stmt_t *stp, *next;
-	uint_t i;
+	uint_t i, j;
 
 	for (stp = dt_list_next(&pgp->dp_stmts); stp != NULL; stp = next) {
 		next = dt_list_next(stp);
@@ -54,6 +54,25 @@ dt_program_destroy(dtrace_hdl_t *dtp, dtrace_prog_t *pgp)
 		dt_free(dtp, pgp->dp_xrefs[i]);
 
 	dt_free(dtp, pgp->dp_xrefs);
+
+	/*
+	 * The placeholder statements of a cached program that update the
+	 * same aggregation share the identifier of the first one.
+	 */
+	for (i = 0; i < pgp->dp_ncstmts; i++) {
+		dt_ident_t *idp = pgp->dp_cstmts[i].dtsd_aggdata;
+
+		for (j = 0; j < i && idp != NULL; j++) {
+			if (pgp->dp_cstmts[j].dtsd_aggdata == idp)
+				idp = NULL;
+		}
+
+		if (idp != NULL)
+			dt_ident_destroy(idp);
+	}
+
+	dt_free(dtp, pgp->dp_cstmts);
+	dt_free(dtp, pgp->dp_dof);
 	dt_list_delete(&dtp->dt_programs, pgp);
 	dt_free(dtp, pgp);
 }
@@ -72,6 +91,11 @@ dtrace_program_info(dtrace_hdl_t *dtp, dtrace_prog_t *pgp,
 
 	memset(pip, 0, sizeof (dtrace_proginfo_t));
 
+	if (pgp->dp_dof != NULL) {
+		*pip = pgp->dp_info;
+		return;
+	}
+
 	if (dt_list_next(&pgp->dp_stmts) != NULL) {
 		pip->dpi_descattr = _dtrace_maxattr;
 		pip->dpi_stmtattr = _dtrace_maxattr;
@@ -135,11 +159,19 @@ dtrace_program_exec(dtrace_hdl_t *dtp, dtrace_prog_t *pgp,
 
 	dtrace_program_info(dtp, pgp, pip);
 
-	if ((dof = dtrace_dof_create(dtp, pgp, DTRACE_D_STRIP)) == NULL)
-		return (-1);
-
-	n = dt_ioctl(dtp, DTRACEIOC_ENABLE, dof);
-	dtrace_dof_destroy(dtp, dof);
+	/*
+	 * A program from the program cache has no statements to create DOF
+	 * from, only the DOF itself.
+	 */
+	if (pgp->dp_dof != NULL)
+		n = dt_ioctl(dtp, DTRACEIOC_ENABLE, pgp->dp_dof);
+	else {
+		if ((dof = dtrace_dof_create(dtp, pgp, DTRACE_D_STRIP)) == NULL)
+			return (-1);
+
+		n = dt_ioctl(dtp, DTRACEIOC_ENABLE, dof);
+		dtrace_dof_destroy(dtp, dof);
+	}
 
 	if (n == -1) {
 		switch (errno) {
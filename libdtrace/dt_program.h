@@ -26,6 +26,12 @@ struct dtrace_prog {
 	ulong_t **dp_xrefs;	/* array of translator reference bitmaps */
 	uint_t dp_xrefslen;	/* length of dp_xrefs array */
 	uint8_t dp_dofversion;	/* DOF version this program requires */
+	uint_t dp_cseexprs;	/* subexpressions hoisted by dt_cse() */
+	int dp_csesaved;	/* DIF instructions saved by dt_cse() */
+	void *dp_dof;		/* DOF of a program from the program cache */
+	dtrace_stmtdesc_t *dp_cstmts; /* placeholder statements for dp_dof */
+	uint_t dp_ncstmts;	/* number of dp_cstmts */
+	dtrace_proginfo_t dp_info; /* program info for dp_dof */
 };
 
 extern dtrace_prog_t *dt_program_create(dtrace_hdl_t *);
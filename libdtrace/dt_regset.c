@@ -10,8 +10,11 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 
+#include <dt_impl.h>
 #include <dt_regset.h>
+#include <dt_as.h>
 
 dt_regset_t *
 dt_regset_create(ulong_t size)
@@ -84,3 +87,599 @@ dt_regset_free(dt_regset_t *drp, int reg)
 	assert(BT_TEST(drp->dr_bitmap, reg) != 0);
 	BT_CLEAR(drp->dr_bitmap, reg);
 }
+
+/*
+ * Register Assignment
+ *
+ * dt_cg() allocates registers from a set of DT_REGSET_VREGS virtual registers,
+ * so that no expression fails to compile for want of registers while its code
+ * is generated.  Once the IR list is complete, dt_regset_assign() maps the
+ * virtual registers onto the dtc_difintregs registers of the DIF machine:
+ *
+ * - The registers live out of each instruction are computed in one backward
+ *   pass over the list: dt_cg() only ever branches forward.
+ *
+ * - Two virtual registers interfere if one is written while the other is
+ *   live, except that the source and destination of a MOV do not.
+ *
+ * - The interference graph is colored by simplification and optimistic
+ *   selection.  Each register is given the color of a register it is moved
+ *   to or from if possible, and the moves that become moves of a register to
+ *   itself are deleted.  Registers live on entry, such as the input of a
+ *   translator member (which the caller passes in %r1), keep their number.
+ *
+ * - If the graph cannot be colored, the top DT_REGSET_SCRATCH registers are
+ *   set aside and the graph is colored again with the others.  Registers
+ *   still left without a color are spilled to hidden clause-local variables:
+ *   each such register is stored after every instruction that writes it, and
+ *   loaded into a scratch register before every instruction that reads it.
+ */
+
+#define	DT_REGSET_NREGS	(DT_REGSET_VREGS + 1)	/* including %r0 */
+#define	DT_REGSET_NWORDS	BT_BITOUL(DT_REGSET_NREGS)
+#define	DT_REGSET_SCRATCH	3	/* kept for spill code */
+
+#define	DT_REGSET_ROW(map, i)	((map) + (size_t)(i) * DT_REGSET_NWORDS)
+
+typedef struct dt_regassign {
+	dt_pcb_t *dra_pcb;		/* compiler state */
+	dt_irnode_t **dra_ins;		/* instructions, without labels */
+	int *dra_regs;			/* dt_irnode_regs() of each one */
+	uint_t dra_len;			/* number of entries in dra_ins[] */
+	uint_t *dra_labels;		/* index in dra_ins[] of each label */
+	ulong_t *dra_in;		/* registers live into each one */
+	ulong_t *dra_out;		/* registers live out of each one */
+	ulong_t dra_used[DT_REGSET_NWORDS]; /* registers referenced */
+	ulong_t dra_adj[DT_REGSET_NREGS][DT_REGSET_NWORDS]; /* interference */
+	uint_t dra_refs[DT_REGSET_NREGS]; /* number of references */
+	int dra_color[DT_REGSET_NREGS];	/* register assigned, or -1 */
+	uchar_t dra_fixed[DT_REGSET_NREGS]; /* register keeps its number */
+	dt_ident_t *dra_spill[DT_REGSET_NREGS]; /* variable if spilled */
+} dt_regassign_t;
+
+/*
+ * Index the instructions in the list and the labels that precede them, and
+ * count the references to each register.
+ */
+static int
+dt_regset_scan(dt_regassign_t *dra)
+{
+	dt_irlist_t *dlp = &dra->dra_pcb->pcb_ir;
+	dt_irnode_t *dip;
+	uint_t i = 0;
+
+	memset(dra->dra_labels, 0xff, sizeof (uint_t) * dlp->dl_label);
+
+	for (dip = dlp->dl_list; dip != NULL; dip = dip->di_next) {
+		dif_instr_t instr = dip->di_instr;
+		int regs;
+
+		if (dip->di_label != DT_LBL_NONE)
+			dra->dra_labels[dip->di_label] = i;
+
+		if (dip->di_label != DT_LBL_NONE && instr == DIF_INSTR_NOP)
+			continue; /* label declaration */
+
+		if (i == dlp->dl_len || (regs = dt_irnode_regs(dip)) == -1)
+			return (-1);
+
+		if (regs & DT_IRREG_R1)
+			dra->dra_refs[DIF_INSTR_R1(instr)]++;
+		if (regs & DT_IRREG_R2)
+			dra->dra_refs[DIF_INSTR_R2(instr)]++;
+		if (regs & (DT_IRREG_RD | DT_IRREG_DEF))
+			dra->dra_refs[DIF_INSTR_RD(instr)]++;
+
+		dra->dra_regs[i] = regs;
+		dra->dra_ins[i++] = dip;
+	}
+
+	dra->dra_len = i;
+
+	for (i = 1; i < DT_REGSET_NREGS; i++) {
+		if (dra->dra_refs[i] != 0)
+			BT_SET(dra->dra_used, i);
+	}
+
+	return (0);
+}
+
+/*
+ * Compute the registers live into and out of each instruction.  The row of
+ * dra_in[] past the last instruction stays empty.
+ */
+static int
+dt_regset_live(dt_regassign_t *dra)
+{
+	size_t size = sizeof (ulong_t) * DT_REGSET_NWORDS;
+	uint_t i, j, w;
+
+	for (i = dra->dra_len; i-- > 0; ) {
+		dif_instr_t instr = dra->dra_ins[i]->di_instr;
+		uint_t op = DIF_INSTR_OP(instr);
+		int regs = dra->dra_regs[i];
+		ulong_t *in = DT_REGSET_ROW(dra->dra_in, i);
+		ulong_t *out = DT_REGSET_ROW(dra->dra_out, i);
+
+		if (op != DIF_OP_BA && op != DIF_OP_RET)
+			memcpy(out, DT_REGSET_ROW(dra->dra_in, i + 1), size);
+		else
+			memset(out, 0, size);
+
+		if (op >= DIF_OP_BA && op <= DIF_OP_BLEU) {
+			uint_t lbl = DIF_INSTR_LABEL(instr);
+
+			if (lbl >= dra->dra_pcb->pcb_ir.dl_label ||
+			    (j = dra->dra_labels[lbl]) <= i || j > dra->dra_len)
+				return (-1);
+
+			for (w = 0; w < DT_REGSET_NWORDS; w++)
+				out[w] |= DT_REGSET_ROW(dra->dra_in, j)[w];
+		}
+
+		memcpy(in, out, size);
+
+		if (regs & DT_IRREG_DEF)
+			BT_CLEAR(in, DIF_INSTR_RD(instr));
+		if (regs & DT_IRREG_R1)
+			BT_SET(in, DIF_INSTR_R1(instr));
+		if (regs & DT_IRREG_R2)
+			BT_SET(in, DIF_INSTR_R2(instr));
+		if (regs & DT_IRREG_RD)
+			BT_SET(in, DIF_INSTR_RD(instr));
+
+		BT_CLEAR(in, 0);
+	}
+
+	return (0);
+}
+
+/*
+ * Make register r interfere with each register in the given set but itself.
+ */
+static void
+dt_regset_edges(dt_regassign_t *dra, uint_t r, const ulong_t *set)
+{
+	uint_t v;
+
+	for (v = 1; v < DT_REGSET_NREGS; v++) {
+		if (v != r && BT_TEST(set, v)) {
+			BT_SET(dra->dra_adj[r], v);
+			BT_SET(dra->dra_adj[v], r);
+		}
+	}
+}
+
+static void
+dt_regset_interfere(dt_regassign_t *dra)
+{
+	ulong_t live[DT_REGSET_NWORDS];
+	const ulong_t *in = DT_REGSET_ROW(dra->dra_in, 0);
+	uint_t i, r;
+
+	for (i = 0; i < dra->dra_len; i++) {
+		dif_instr_t instr = dra->dra_ins[i]->di_instr;
+
+		if (!(dra->dra_regs[i] & DT_IRREG_DEF) ||
+		    (r = DIF_INSTR_RD(instr)) == 0)
+			continue;
+
+		memcpy(live, DT_REGSET_ROW(dra->dra_out, i), sizeof (live));
+
+		if (DIF_INSTR_OP(instr) == DIF_OP_MOV)
+			BT_CLEAR(live, DIF_INSTR_R1(instr));
+
+		dt_regset_edges(dra, r, live);
+	}
+
+	/*
+	 * Registers live on entry all hold their values at once.
+	 */
+	for (r = 1; r < DT_REGSET_NREGS; r++) {
+		if (BT_TEST(in, r))
+			dt_regset_edges(dra, r, in);
+	}
+}
+
+/*
+ * Pick a color for register r from the available set, preferring that of a
+ * register it is moved to or from.
+ */
+static int
+dt_regset_prefer(const dt_regassign_t *dra, uint_t r, const ulong_t *avail)
+{
+	uint_t i, v;
+	int c;
+
+	for (i = 0; i < dra->dra_len; i++) {
+		dif_instr_t instr = dra->dra_ins[i]->di_instr;
+
+		if (DIF_INSTR_OP(instr) != DIF_OP_MOV)
+			continue;
+
+		if (DIF_INSTR_RD(instr) == r)
+			v = DIF_INSTR_R1(instr);
+		else if (DIF_INSTR_R1(instr) == r)
+			v = DIF_INSTR_RD(instr);
+		else
+			continue;
+
+		if (v != 0 && (c = dra->dra_color[v]) > 0 && BT_TEST(avail, c))
+			return (c);
+	}
+
+	if (BT_TEST(avail, r))
+		return (r);
+
+	for (c = 1; !BT_TEST(avail, c); c++)
+		continue;
+
+	return (c);
+}
+
+/*
+ * Color the interference graph with colors 1 to ncolors, and return the
+ * number of registers left without one.
+ */
+static uint_t
+dt_regset_color(dt_regassign_t *dra, uint_t ncolors)
+{
+	ulong_t left[DT_REGSET_NWORDS], avail[DT_REGSET_NWORDS];
+	uint_t stack[DT_REGSET_NREGS], deg[DT_REGSET_NREGS];
+	uint_t sp = 0, nspill = 0, best, c, u, v;
+
+	memset(left, 0, sizeof (left));
+
+	for (v = 1; v < DT_REGSET_NREGS; v++) {
+		if (!BT_TEST(dra->dra_used, v) || dra->dra_fixed[v])
+			continue;
+
+		dra->dra_color[v] = -1;
+		BT_SET(left, v);
+	}
+
+	for (v = 1; v < DT_REGSET_NREGS; v++) {
+		for (deg[v] = 0, u = 1; u < DT_REGSET_NREGS; u++)
+			deg[v] += BT_TEST(dra->dra_adj[v], u);
+	}
+
+	/*
+	 * Remove the registers with fewer neighbors than colors one at a time,
+	 * and when there are none, the one with the most neighbors for its
+	 * number of references: it is the best one to spill, should it not be
+	 * colorable after all.
+	 */
+	for (;;) {
+		for (best = 0, v = 1; v < DT_REGSET_NREGS; v++) {
+			if (!BT_TEST(left, v))
+				continue;
+
+			if (deg[v] < ncolors) {
+				best = v;
+				break;
+			}
+
+			if (best == 0 || deg[v] * dra->dra_refs[best] >
+			    deg[best] * dra->dra_refs[v])
+				best = v;
+		}
+
+		if (best == 0)
+			break;
+
+		BT_CLEAR(left, best);
+		stack[sp++] = best;
+
+		for (u = 1; u < DT_REGSET_NREGS; u++) {
+			if (BT_TEST(dra->dra_adj[best], u))
+				deg[u]--;
+		}
+	}
+
+	while (sp > 0) {
+		v = stack[--sp];
+
+		memset(avail, 0, sizeof (avail));
+		for (c = 1; c <= ncolors; c++)
+			BT_SET(avail, c);
+
+		for (u = 1; u < DT_REGSET_NREGS; u++) {
+			if (BT_TEST(dra->dra_adj[v], u) &&
+			    dra->dra_color[u] > 0)
+				BT_CLEAR(avail, dra->dra_color[u]);
+		}
+
+		for (c = 1; c <= ncolors && !BT_TEST(avail, c); c++)
+			continue;
+
+		if (c > ncolors)
+			nspill++;
+		else
+			dra->dra_color[v] = dt_regset_prefer(dra, v, avail);
+	}
+
+	return (nspill);
+}
+
+/*
+ * Find or create the hidden clause-local variable of each spilled register.
+ */
+static int
+dt_regset_spill(dt_regassign_t *dra)
+{
+	dt_pcb_t *pcb = dra->dra_pcb;
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dt_idhash_t *dhp = pcb->pcb_locals;
+	dtrace_typeinfo_t dtt;
+	char name[16];
+	dt_ident_t *idp;
+	uint_t v, id;
+
+	if (dhp == NULL)
+		return (EDT_NOREG);
+
+	if (dtrace_lookup_by_type(dtp, DTRACE_OBJ_DDEFS, "uint64_t", &dtt) != 0)
+		return (dtrace_errno(dtp));
+
+	for (v = 1; v < DT_REGSET_NREGS; v++) {
+		if (!BT_TEST(dra->dra_used, v) || dra->dra_color[v] != -1)
+			continue;
+
+		(void) snprintf(name, sizeof (name), "%%r%u", v);
+
+		if ((idp = dt_idhash_lookup(dhp, name)) == NULL) {
+			if (dt_idhash_nextid(dhp, &id) == -1)
+				return (EDT_NOREG);
+
+			idp = dt_idhash_insert(dhp, name, DT_IDENT_SCALAR,
+			    DT_IDFLG_LOCAL | DT_IDFLG_WRITE, id,
+			    _dtrace_defattr, 0, &dt_idops_thaw, NULL,
+			    dtp->dt_gen);
+
+			if (idp == NULL)
+				return (EDT_NOMEM);
+
+			dt_ident_type_assign(idp, dtt.dtt_ctfp, dtt.dtt_type);
+		}
+
+		idp->di_flags |= DT_IDFLG_DIFR | DT_IDFLG_DIFW;
+		dra->dra_spill[v] = idp;
+	}
+
+	return (0);
+}
+
+static dt_irnode_t *
+dt_regset_node(dif_instr_t instr)
+{
+	dt_irnode_t *dip = malloc(sizeof (dt_irnode_t));
+
+	if (dip != NULL) {
+		dip->di_label = DT_LBL_NONE;
+		dip->di_instr = instr;
+		dip->di_extern = NULL;
+		dip->di_next = NULL;
+	}
+
+	return (dip);
+}
+
+/*
+ * Rewrite each instruction with the registers assigned, inserting the loads
+ * and stores of spilled registers around it.  The list stays well-formed
+ * even if we run out of memory half-way.
+ */
+static int
+dt_regset_rewrite(dt_regassign_t *dra, uint_t nregs)
+{
+	static const int flds[] = { DT_IRREG_R1, DT_IRREG_R2, DT_IRREG_RD };
+	dt_irlist_t *dlp = &dra->dra_pcb->pcb_ir;
+	dt_irnode_t **dipp = &dlp->dl_list;
+	dt_irnode_t *dip, *nip;
+	int err = 0;
+
+	while ((dip = *dipp) != NULL) {
+		dif_instr_t instr = dip->di_instr;
+		uint_t reg[3], scratch[DT_REGSET_SCRATCH];
+		uint_t nscratch = 0, k, s, v;
+		int regs;
+
+		if (dip->di_label != DT_LBL_NONE && instr == DIF_INSTR_NOP) {
+			dipp = &dip->di_next;
+			continue; /* label declaration */
+		}
+
+		regs = dt_irnode_regs(dip);
+		reg[0] = DIF_INSTR_R1(instr);
+		reg[1] = DIF_INSTR_R2(instr);
+		reg[2] = DIF_INSTR_RD(instr);
+
+		for (k = 0; k < 3 && err == 0; k++) {
+			int def = k == 2 && (regs & DT_IRREG_DEF);
+
+			if (!(regs & flds[k]) && !def)
+				continue;
+
+			if ((v = reg[k]) == 0 || dra->dra_spill[v] == NULL) {
+				reg[k] = v != 0 ? dra->dra_color[v] : 0;
+				continue;
+			}
+
+			for (s = 0; s < nscratch && scratch[s] != v; s++)
+				continue;
+
+			reg[k] = nregs - 1 - s;
+
+			if (s < nscratch)
+				continue; /* already loaded */
+
+			scratch[nscratch++] = v;
+
+			if (!(regs & flds[k]))
+				continue; /* only written */
+
+			nip = dt_regset_node(DIF_INSTR_LDV(DIF_OP_LDLS,
+			    dra->dra_spill[v]->di_id, reg[k]));
+
+			if (nip == NULL) {
+				err = EDT_NOMEM;
+				break;
+			}
+
+			/*
+			 * The load takes over any label of the instruction, so
+			 * that branches to it execute the load first.
+			 */
+			nip->di_label = dip->di_label;
+			dip->di_label = DT_LBL_NONE;
+			nip->di_next = dip;
+			*dipp = nip;
+			dipp = &nip->di_next;
+			dlp->dl_len++;
+		}
+
+		if (err != 0)
+			break;
+
+		if (regs & (DT_IRREG_R1 | DT_IRREG_R2 | DT_IRREG_RD |
+		    DT_IRREG_DEF)) {
+			dip->di_instr = DIF_INSTR_FMT(DIF_INSTR_OP(instr),
+			    reg[0], reg[1], reg[2]);
+		}
+
+		v = DIF_INSTR_RD(instr);
+
+		if ((regs & DT_IRREG_DEF) && dra->dra_spill[v] != NULL) {
+			nip = dt_regset_node(DIF_INSTR_STV(DIF_OP_STLS,
+			    dra->dra_spill[v]->di_id, reg[2]));
+
+			if (nip == NULL) {
+				err = EDT_NOMEM;
+				break;
+			}
+
+			nip->di_next = dip->di_next;
+			dip->di_next = nip;
+			dipp = &nip->di_next;
+			dlp->dl_len++;
+		} else if (DIF_INSTR_OP(instr) == DIF_OP_MOV &&
+		    reg[0] == reg[2]) {
+			/*
+			 * A move of a register to itself is deleted, leaving
+			 * any label it has as a label declaration.
+			 */
+			dlp->dl_len--;
+
+			if (dip->di_label != DT_LBL_NONE) {
+				dip->di_instr = DIF_INSTR_NOP;
+				dipp = &dip->di_next;
+			} else {
+				*dipp = dip->di_next;
+				free(dip);
+			}
+		} else
+			dipp = &dip->di_next;
+	}
+
+	for (dlp->dl_last = NULL, dip = dlp->dl_list; dip != NULL;
+	    dip = dip->di_next)
+		dlp->dl_last = dip;
+
+	return (err);
+}
+
+/*
+ * Map the virtual registers used by the IR list onto the DIF registers.
+ */
+void
+dt_regset_assign(dt_pcb_t *pcb)
+{
+	dt_irlist_t *dlp = &pcb->pcb_ir;
+	uint_t nregs = pcb->pcb_hdl->dt_conf.dtc_difintregs;
+	uint_t ncolors;
+	dt_regassign_t *dra;
+	const ulong_t *in;
+	int err = 0;
+	uint_t v;
+
+	/*
+	 * The "iregs" option only checks that the number is positive: never
+	 * hand out registers the DIF machine does not have, or that would not
+	 * fit in the register sets and instruction fields used here.
+	 */
+	if (nregs > DIF_DIR_NREGS)
+		nregs = DIF_DIR_NREGS;
+	ncolors = nregs - 1;
+
+	if ((dra = calloc(1, sizeof (dt_regassign_t))) == NULL)
+		longjmp(pcb->pcb_jmpbuf, EDT_NOMEM);
+
+	dra->dra_pcb = pcb;
+	dra->dra_ins = malloc(sizeof (dt_irnode_t *) * dlp->dl_len);
+	dra->dra_regs = malloc(sizeof (int) * dlp->dl_len);
+	dra->dra_labels = malloc(sizeof (uint_t) * dlp->dl_label);
+	dra->dra_in = calloc((size_t)dlp->dl_len + 1,
+	    sizeof (ulong_t) * DT_REGSET_NWORDS);
+	dra->dra_out = calloc(dlp->dl_len, sizeof (ulong_t) * DT_REGSET_NWORDS);
+
+	if (dra->dra_ins == NULL || dra->dra_regs == NULL ||
+	    dra->dra_labels == NULL || dra->dra_in == NULL ||
+	    dra->dra_out == NULL) {
+		err = EDT_NOMEM;
+		goto out;
+	}
+
+	/*
+	 * dt_cg() only emits opcodes dt_irnode_regs() knows about, and only
+	 * branches forward.
+	 */
+	if (dt_regset_scan(dra) != 0 || dt_regset_live(dra) != 0) {
+		err = EDT_NOREG;
+		goto out;
+	}
+
+	in = DT_REGSET_ROW(dra->dra_in, 0);
+
+	for (v = 1; v < DT_REGSET_NREGS; v++) {
+		if (BT_TEST(in, v) && v < nregs) {
+			dra->dra_fixed[v] = 1;
+			dra->dra_color[v] = v;
+		}
+	}
+
+	dt_regset_interfere(dra);
+
+	if (dt_regset_color(dra, ncolors) != 0) {
+		if (ncolors <= DT_REGSET_SCRATCH) {
+			err = EDT_NOREG;
+			goto out;
+		}
+
+		ncolors -= DT_REGSET_SCRATCH;
+
+		for (v = 1; v < DT_REGSET_NREGS; v++) {
+			if (dra->dra_fixed[v] && v > ncolors) {
+				err = EDT_NOREG;
+				goto out;
+			}
+		}
+
+		(void) dt_regset_color(dra, ncolors);
+
+		if ((err = dt_regset_spill(dra)) != 0)
+			goto out;
+	}
+
+	err = dt_regset_rewrite(dra, nregs);
+
+out:
+	free(dra->dra_ins);
+	free(dra->dra_regs);
+	free(dra->dra_labels);
+	free(dra->dra_in);
+	free(dra->dra_out);
+	free(dra);
+
+	if (err != 0)
+		longjmp(pcb->pcb_jmpbuf, err);
+}
@@ -15,6 +15,8 @@
 extern "C" {
 #endif
 
+#define	DT_REGSET_VREGS	255	/* virtual registers used by dt_cg() */
+
 typedef struct dt_regset {
 	ulong_t dr_size;		/* number of registers in set */
 	ulong_t *dr_bitmap;		/* bitmap of active registers */
@@ -109,6 +109,7 @@ dtrace_xstr2desc(dtrace_hdl_t *dtp, dtrace_probespec_t spec,
 				if (idp == NULL)
 					return (dt_set_errno(dtp, EDT_BADSPCV));
 
+				idp->di_flags |= DT_IDFLG_REF;
 				v = buf;
 				vlen = snprintf(buf, 32, "%d", idp->di_id);
 
@@ -818,11 +819,23 @@ dtrace_addr2str(dtrace_hdl_t *dtp, uint64_t addr, char *str, int nbytes)
 	GElf_Sym sym;
 
 	size_t n = 20; /* for 0x%llx\0 */
+	const char *cs;
 	char *s;
 	int err;
 
-	if ((err = dtrace_lookup_by_addr(dtp, addr, &sym, &dts)) == 0)
+	if (dt_symcache_lookup(dtp, 0, addr, 0, &cs) == 0)
+		return (dt_string2str((char *)cs, str, nbytes));
+
+	if ((err = dtrace_lookup_by_addr(dtp, addr, &sym, &dts)) == 0) {
 		n += strlen(dts.dts_object) + strlen(dts.dts_name) + 2; /* +` */
+	} else if (dtrace_lookup_by_addr(dtp, addr, NULL, &dts) == 0) {
+		/*
+		 * There is no symbol, but there is a containing module.
+		 */
+		n += strlen(dts.dts_object) + 1; /* for ` */
+	} else {
+		dts.dts_object = NULL;
+	}
 
 	s = alloca(n);
 
@@ -832,30 +845,100 @@ dtrace_addr2str(dtrace_hdl_t *dtp, uint64_t addr, char *str, int nbytes)
 	} else if (err == 0) {
 		(void) snprintf(s, n, "%s`%s",
 		    dts.dts_object, dts.dts_name);
+	} else if (dts.dts_object != NULL) {
+		(void) snprintf(s, n, "%s`0x%llx", dts.dts_object,
+		    (u_longlong_t)addr);
 	} else {
-		/*
-		 * We'll repeat the lookup, but this time we'll specify a NULL
-		 * GElf_Sym -- indicating that we're only interested in the
-		 * containing module.
-		 */
-		if (dtrace_lookup_by_addr(dtp, addr, NULL, &dts) == 0) {
-			(void) snprintf(s, n, "%s`0x%llx", dts.dts_object,
-			    (u_longlong_t)addr);
+		(void) snprintf(s, n, "0x%llx", (u_longlong_t)addr);
+	}
+
+	dt_symcache_insert(dtp, 0, addr, 0, s);
+
+	return (dt_string2str(s, str, nbytes));
+}
+
+/*
+ * Resolve the n user addresses psa[i].psa_addr in the process pid, which the
+ * caller must have grabbed and locked.  Addresses found in the symbolization
+ * cache are not looked up again; all the others are resolved together, in a
+ * single trip through libproc.  On return, syms[i] is the malloc()ed
+ * "object`symbol+offset" string for psa[i].psa_addr, or NULL if there is no
+ * symbol, in which case psa[i] gives the mapping and object containing the
+ * address, if any.  Addresses without a symbol are not cached: what callers
+ * print for them depends on that mapping and object, which only libproc can
+ * supply, so they are looked up again every time.
+ */
+int
+dt_uaddrs2sym(dtrace_hdl_t *dtp, pid_t pid, prsymaddr_t *psa, char **syms,
+    uint_t n)
+{
+	uint64_t gen = dt_Pmapping_generation(dtp, pid);
+	prsymaddr_t *miss;
+	uint_t i, *idx, nmiss = 0;
+	char c[PATH_MAX * 2];
+	const char *cs;
+
+	for (i = 0; i < n; i++) {
+		psa[i].psa_map = NULL;
+		psa[i].psa_object = NULL;
+		psa[i].psa_name = NULL;
+		syms[i] = NULL;
+	}
+
+	if ((miss = dt_alloc(dtp, n * sizeof (prsymaddr_t))) == NULL ||
+	    (idx = dt_alloc(dtp, n * sizeof (uint_t))) == NULL) {
+		dt_free(dtp, miss);
+		return (-1);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (dt_symcache_lookup(dtp, pid, psa[i].psa_addr, gen,
+			&cs) == 0 && (syms[i] = strdup(cs)) != NULL)
+			continue;
+
+		miss[nmiss].psa_addr = psa[i].psa_addr;
+		idx[nmiss++] = i;
+	}
+
+	if (nmiss > 0 && dt_Plookup_by_addrs(dtp, pid, miss, nmiss) != 0)
+		nmiss = 0;
+
+	for (i = 0; i < nmiss; i++) {
+		prsymaddr_t *p = &psa[idx[i]];
+		const char *obj;
+
+		*p = miss[i];
+
+		if (p->psa_name == NULL)
+			continue;
+
+		obj = p->psa_object != NULL ?
+		    dt_basename((char *)p->psa_object) : "";
+
+		if (p->psa_addr > p->psa_sym.st_value) {
+			(void) snprintf(c, sizeof (c), "%s`%s+0x%llx", obj,
+			    p->psa_name,
+			    (u_longlong_t)(p->psa_addr - p->psa_sym.st_value));
 		} else {
-			(void) snprintf(s, n, "0x%llx", (u_longlong_t)addr);
+			(void) snprintf(c, sizeof (c), "%s`%s", obj,
+			    p->psa_name);
 		}
+
+		syms[idx[i]] = strdup(c);
+		dt_symcache_insert(dtp, pid, p->psa_addr, gen, c);
 	}
 
-	return (dt_string2str(s, str, nbytes));
+	dt_free(dtp, idx);
+	dt_free(dtp, miss);
+
+	return (0);
 }
 
 int
 dtrace_uaddr2str(dtrace_hdl_t *dtp, pid_t pid,
     uint64_t addr, char *str, int nbytes)
 {
-	char name[PATH_MAX], objname[PATH_MAX], c[PATH_MAX * 2];
-	GElf_Sym sym;
-	char *obj;
+	char objname[PATH_MAX], c[PATH_MAX * 2];
 
 	if (pid != 0)
 		pid = dt_proc_grab_lock(dtp, pid, DTRACE_PROC_WAITING |
@@ -884,25 +967,24 @@ dtrace_uaddr2str(dtrace_hdl_t *dtp, pid_t pid,
 			(void) snprintf(c, sizeof(c), "0x%llx",
 			    (unsigned long long) addr);
 
-	} else if (dt_Plookup_by_addr(dtp, pid, addr, name, sizeof(name),
-	    &sym) == 0) {
-		(void) dt_Pobjname(dtp, pid, addr, objname, sizeof (objname));
-
-		obj = dt_basename(objname);
-
-		if (addr > sym.st_value) {
-			(void) snprintf(c, sizeof (c), "%s`%s+0x%llx", obj,
-			    name, (u_longlong_t)(addr - sym.st_value));
+	} else {
+		prsymaddr_t psa;
+		char *sym;
+
+		psa.psa_addr = addr;
+
+		if (dt_uaddrs2sym(dtp, pid, &psa, &sym, 1) == 0 &&
+		    sym != NULL) {
+			(void) snprintf(c, sizeof (c), "%s", sym);
+			free(sym);
+		} else if (psa.psa_object != NULL) {
+			(void) snprintf(c, sizeof (c), "%s`0x%llx",
+			    dt_basename((char *)psa.psa_object),
+			    (unsigned long long) addr);
 		} else {
-			(void) snprintf(c, sizeof (c), "%s`%s", obj, name);
+			(void) snprintf(c, sizeof (c), "0x%llx",
+			    (unsigned long long) addr);
 		}
-	} else if (dt_Pobjname(dtp, pid, addr, objname,
-		sizeof (objname)) != NULL) {
-		(void) snprintf(c, sizeof (c), "%s`0x%llx",
-		    dt_basename(objname), (unsigned long long) addr);
-	} else {
-		(void) snprintf(c, sizeof (c), "0x%llx",
-		    (unsigned long long) addr);
 	}
 
 	dt_proc_release_unlock(dtp, pid);
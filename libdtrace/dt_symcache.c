@@ -0,0 +1,193 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <dt_symcache.h>
+#include <dt_impl.h>
+
+static uint_t
+dt_symcache_hash(const dt_symcache_t *dsc, pid_t pid, uint64_t pc)
+{
+	uint64_t h = pc ^ ((uint64_t)pid << 32);
+
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+
+	return ((uint_t)h & (dsc->dsc_hashlen - 1));
+}
+
+/*
+ * Return the handle's cache, creating it on first use.  A cache size of zero
+ * (-xsymcache=0) disables caching altogether.
+ */
+static dt_symcache_t *
+dt_symcache_get(dtrace_hdl_t *dtp)
+{
+	dt_symcache_t *dsc = dtp->dt_symcache;
+	uint_t len = 1;
+
+	if (dsc != NULL || dtp->dt_symcachesize == 0)
+		return (dsc);
+
+	while (len < dtp->dt_symcachesize)
+		len <<= 1;
+
+	if ((dsc = dt_zalloc(dtp, sizeof (dt_symcache_t))) == NULL ||
+	    (dsc->dsc_hash = dt_zalloc(dtp, sizeof (void *) * len)) == NULL) {
+		dt_free(dtp, dsc);
+		return (NULL);
+	}
+
+	dsc->dsc_hdl = dtp;
+	dsc->dsc_hashlen = len;
+	dsc->dsc_maxelems = dtp->dt_symcachesize;
+
+	return (dtp->dt_symcache = dsc);
+}
+
+static void
+dt_symcache_remove(dt_symcache_t *dsc, dt_symcent_t *dsce)
+{
+	uint_t h = dt_symcache_hash(dsc, dsce->dsce_pid, dsce->dsce_pc);
+	dt_symcent_t **pp;
+
+	for (pp = &dsc->dsc_hash[h]; *pp != dsce; pp = &(*pp)->dsce_next)
+		continue;
+
+	*pp = dsce->dsce_next;
+	dt_list_delete(&dsc->dsc_lru, dsce);
+	dsc->dsc_nelems--;
+
+	free(dsce->dsce_str);
+	dt_free(dsc->dsc_hdl, dsce);
+}
+
+/*
+ * Look up the string cached for <pid, pc>.  For user addresses, gen is the
+ * process's current mapping generation: an entry resolved under any other
+ * generation is stale, and is dropped.  On a hit, return 0 and set *strp to
+ * the cached string, which is only valid until the next call into the cache.
+ * On a miss, return -1.
+ */
+int
+dt_symcache_lookup(dtrace_hdl_t *dtp, pid_t pid, uint64_t pc, uint64_t gen,
+    const char **strp)
+{
+	dt_symcache_t *dsc = dt_symcache_get(dtp);
+	dt_symcent_t *dsce;
+
+	if (dsc == NULL)
+		return (-1);
+
+	for (dsce = dsc->dsc_hash[dt_symcache_hash(dsc, pid, pc)];
+	    dsce != NULL; dsce = dsce->dsce_next) {
+		if (dsce->dsce_pid == pid && dsce->dsce_pc == pc)
+			break;
+	}
+
+	if (dsce != NULL && dsce->dsce_gen != gen) {
+		dt_symcache_remove(dsc, dsce);
+		dsce = NULL;
+	}
+
+	if (dsce == NULL) {
+		dsc->dsc_misses++;
+		return (-1);
+	}
+
+	if (dt_list_next(&dsc->dsc_lru) != dsce) {
+		dt_list_delete(&dsc->dsc_lru, dsce);
+		dt_list_prepend(&dsc->dsc_lru, dsce);
+	}
+
+	dsc->dsc_hits++;
+	*strp = dsce->dsce_str;
+	return (0);
+}
+
+/*
+ * Cache the string for <pid, pc>, resolved under mapping generation gen,
+ * replacing any entry already cached for it.  Failure to allocate is not an
+ * error: the address is simply resolved again next time.
+ */
+void
+dt_symcache_insert(dtrace_hdl_t *dtp, pid_t pid, uint64_t pc, uint64_t gen,
+    const char *str)
+{
+	dt_symcache_t *dsc = dt_symcache_get(dtp);
+	dt_symcent_t *dsce;
+	uint_t h;
+
+	if (dsc == NULL)
+		return;
+
+	h = dt_symcache_hash(dsc, pid, pc);
+	for (dsce = dsc->dsc_hash[h]; dsce != NULL; dsce = dsce->dsce_next) {
+		if (dsce->dsce_pid == pid && dsce->dsce_pc == pc) {
+			dt_symcache_remove(dsc, dsce);
+			break;
+		}
+	}
+
+	if (dsc->dsc_nelems >= dsc->dsc_maxelems)
+		dt_symcache_remove(dsc, dt_list_prev(&dsc->dsc_lru));
+
+	if ((dsce = dt_zalloc(dtp, sizeof (dt_symcent_t))) == NULL)
+		return;
+
+	if ((dsce->dsce_str = strdup(str)) == NULL) {
+		dt_free(dtp, dsce);
+		return;
+	}
+
+	dsce->dsce_pid = pid;
+	dsce->dsce_pc = pc;
+	dsce->dsce_gen = gen;
+	dsce->dsce_next = dsc->dsc_hash[h];
+	dsc->dsc_hash[h] = dsce;
+
+	dt_list_prepend(&dsc->dsc_lru, dsce);
+	dsc->dsc_nelems++;
+}
+
+/*
+ * Discard every cached string: called when the kernel's modules have been
+ * reread, and when the cache is resized.
+ */
+void
+dt_symcache_flush(dtrace_hdl_t *dtp)
+{
+	dt_symcache_t *dsc = dtp->dt_symcache;
+	dt_symcent_t *dsce;
+
+	if (dsc == NULL)
+		return;
+
+	dt_dprintf("symbol cache: %llu hits, %llu misses, %u entries "
+	    "flushed\n", (unsigned long long)dsc->dsc_hits,
+	    (unsigned long long)dsc->dsc_misses, dsc->dsc_nelems);
+
+	while ((dsce = dt_list_next(&dsc->dsc_lru)) != NULL)
+		dt_symcache_remove(dsc, dsce);
+}
+
+void
+dt_symcache_destroy(dtrace_hdl_t *dtp)
+{
+	dt_symcache_t *dsc = dtp->dt_symcache;
+
+	if (dsc == NULL)
+		return;
+
+	dt_symcache_flush(dtp);
+	dt_free(dtp, dsc->dsc_hash);
+	dt_free(dtp, dsc);
+	dtp->dt_symcache = NULL;
+}
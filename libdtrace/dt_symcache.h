@@ -0,0 +1,57 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#ifndef	_DT_SYMCACHE_H
+#define	_DT_SYMCACHE_H
+
+#include <sys/types.h>
+#include <dtrace.h>
+#include <dt_list.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The symbolization cache maps a <pid, pc> pair to the string that stack(),
+ * ustack(), sym() and usym() print for it, so that addresses which recur in
+ * trace data are only resolved once.  Kernel addresses use a pid of 0.  User
+ * entries remember the libproc mapping generation they were resolved under
+ * and are discarded once the process's mappings change.
+ */
+typedef struct dt_symcent {
+	dt_list_t dsce_list;		/* LRU linkage, most recent first */
+	struct dt_symcent *dsce_next;	/* next entry in hash chain */
+	pid_t dsce_pid;			/* process ID, or 0 for the kernel */
+	uint64_t dsce_pc;		/* address */
+	uint64_t dsce_gen;		/* mapping generation of dsce_str */
+	char *dsce_str;			/* formatted symbol */
+} dt_symcent_t;
+
+typedef struct dt_symcache {
+	dtrace_hdl_t *dsc_hdl;		/* pointer back to library handle */
+	dt_symcent_t **dsc_hash;	/* array of hash buckets */
+	uint_t dsc_hashlen;		/* size of hash bucket array */
+	uint_t dsc_nelems;		/* number of entries cached */
+	uint_t dsc_maxelems;		/* maximum number of entries */
+	dt_list_t dsc_lru;		/* entries in least-recently-used order */
+	uint64_t dsc_hits;		/* lookups satisfied from the cache */
+	uint64_t dsc_misses;		/* lookups not in the cache */
+} dt_symcache_t;
+
+extern int dt_symcache_lookup(dtrace_hdl_t *, pid_t, uint64_t, uint64_t,
+    const char **);
+extern void dt_symcache_insert(dtrace_hdl_t *, pid_t, uint64_t, uint64_t,
+    const char *);
+extern void dt_symcache_flush(dtrace_hdl_t *);
+extern void dt_symcache_destroy(dtrace_hdl_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_SYMCACHE_H */
@@ -4,8 +4,6 @@
  * We cannot rely on ELF symbol table management at all times: in particular,
  * kernel symbols have no ELF symbol table.  Thus, this module implements a
  * simple, reasonably memory-efficient symbol table manager.
- *
- * TODO: increase efficiency (perhaps Huffman-coding symbol names?)
  */
 
 /*
@@ -16,26 +14,44 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/bitmap.h>
 #include <dt_symtab.h>
 #include <dt_impl.h>
-#include <dt_list.h>
 #include <unistd.h>
 
 #define DT_ST_SORTED 0x01		/* Sorted, ready for searching. */
 #define DT_ST_PACKED 0x02		/* Symbol table packed
 					 * (necessarily sorted too) */
 
+/*
+ * Symbol names live in a string pool shared by all the symbol tables of a
+ * handle, each distinct name stored once: kernel modules have many names in
+ * common.  Symbols refer to their names by 32-bit offset into the pool.  The
+ * pool keeps an open-addressed hash of the offsets of its strings, for
+ * interning.
+ */
+struct dt_strpool {
+	char *dsp_buf;			/* string data */
+	uint32_t dsp_size;		/* bytes of dsp_buf in use */
+	uint32_t dsp_alloc;		/* bytes of dsp_buf allocated */
+	uint32_t *dsp_hash;		/* string offsets + 1, or 0 if free */
+	uint32_t dsp_hashsz;		/* size of dsp_hash (power of 2) */
+	uint32_t dsp_nstrs;		/* number of strings in the pool */
+};
+
+/*
+ * Symbols are stored by value in one array per symbol table, and chained into
+ * the name hash by index, so that a symbol costs a few words and no separate
+ * allocations.  Kernel symbol sizes always fit in 32 bits.
+ */
 struct dt_symbol {
-	dt_list_t dts_list;		/* list forward/back pointers */
-	union {
-		char *str;		/* symbol name */
-		size_t off;		/* symbol offset in strtab */
-	} dts_name;
 	GElf_Addr dts_addr;		/* symbol address */
-	GElf_Xword dts_size;		/* symbol size */
+	uint32_t dts_name;		/* offset of name in string pool */
+	uint32_t dts_size;		/* symbol size */
+	uint32_t dts_next;		/* next in hash chain (index + 1) */
 	unsigned char dts_info;		/* ELF symbol information */
-	struct dt_symbol *dts_next;	/* hash chain pointer */
 };
 
 /*
@@ -51,36 +67,219 @@ struct dt_symbol {
 typedef struct dt_symrange {
 	GElf_Addr dtsr_lo;
 	GElf_Addr dtsr_hi;
-	dt_symbol_t *dtsr_sym;
+	uint_t dtsr_sym;		/* index of symbol in dtst_syms */
 } dt_symrange_t;
 
+/*
+ * A symbol index maps names to symbols across any number of symbol tables
+ * sharing one string pool, so that a name can be looked up in all of them at
+ * once.  It is keyed on the interned offset of the name: finding a name costs
+ * one probe of the pool's hash and one of the index's.  Each entry names a
+ * symbol by its table and its index in that table.  Entries for the same name
+ * are chained in the order their tables were added.
+ */
+typedef struct dt_symindex_ent {
+	uint32_t dsie_tab;		/* index of table in dsi_tabs */
+	uint32_t dsie_sym;		/* index of symbol in the table */
+	uint32_t dsie_next;		/* next in hash chain (index + 1) */
+} dt_symindex_ent_t;
+
+struct dt_symindex {
+	dt_strpool_t *dsi_strs;		/* string pool of all the tables */
+	dt_symtab_t **dsi_tabs;		/* tables, in order of addition */
+	void **dsi_owners;		/*   - owner of each table */
+	uint32_t dsi_ntabs;		/*   - number of tables */
+	uint32_t dsi_tabs_alloc;	/*   - number of tables allocated */
+	dt_symindex_ent_t *dsi_ents;	/* one entry per symbol */
+	uint32_t dsi_nents;		/*   - number of entries */
+	uint32_t dsi_ents_alloc;	/*   - number of entries allocated */
+	uint32_t *dsi_buckets;		/* hash buckets (index + 1), or NULL */
+	uint32_t dsi_shift;		/* 32 - log2(number of buckets) */
+};
+
 struct dt_symtab {
-	dt_list_t dtst_symlist;		/* symbol list */
-	dt_symbol_t **dtst_syms_by_name;/* symbol name->addr hash buckets */
+	dt_strpool_t *dtst_strs;	/* string pool holding symbol names */
+	dt_symbol_t *dtst_syms;		/* symbols, in insertion order */
+	uint_t dtst_num_syms;		/*   - number of symbols */
+	uint_t dtst_num_syms_alloc;	/*   - number of symbols allocated */
+	uint32_t *dtst_syms_by_name;	/* name hash buckets (index + 1) */
 	uint_t dtst_symbuckets;		/* number of buckets */
-	char *dtst_strtab;		/* string table of symbol names */
 	dt_symrange_t *dtst_ranges;	/* range->symbol mapping */
 	uint_t dtst_num_range;		/*   - number of ranges */
-	uint_t dtst_num_range_alloc;	/*   - number of ranges allocated */
 	int dtst_flags;			/* symbol table flags */
 };
 
+dt_strpool_t *
+dt_strpool_create(void)
+{
+	dt_strpool_t *sp = calloc(1, sizeof (dt_strpool_t));
+
+	if (sp == NULL)
+		return NULL;
+
+	sp->dsp_hashsz = 1024;
+	sp->dsp_hash = calloc(sp->dsp_hashsz, sizeof (uint32_t));
+	if (sp->dsp_hash == NULL) {
+		free(sp);
+		return NULL;
+	}
+
+	return sp;
+}
+
+void
+dt_strpool_destroy(dt_strpool_t *sp)
+{
+	if (sp == NULL)
+		return;
+
+	free(sp->dsp_buf);
+	free(sp->dsp_hash);
+	free(sp);
+}
+
 /*
- * Grow the range->symbol mapping.
+ * Return the number of bytes of string data in the pool.
  */
-static dt_symrange_t *
-dt_symtab_grow_ranges(dt_symtab_t *symtab)
+size_t
+dt_strpool_size(const dt_strpool_t *sp)
 {
-	uint_t num_alloc = (symtab->dtst_num_range_alloc + 1) * 2;
-	dt_symrange_t *new_ranges = realloc(symtab->dtst_ranges,
-	    sizeof (dt_symrange_t) * num_alloc);
-	if (new_ranges == NULL)
-		return NULL;
+	return sp->dsp_size;
+}
 
-	symtab->dtst_num_range_alloc = num_alloc;
-	symtab->dtst_ranges = new_ranges;
+/*
+ * FNV-1a: dt_strtab_hash() clusters badly on the similar names common in
+ * symbol tables, which open addressing cannot tolerate.
+ */
+static uint32_t
+dt_strpool_hash(const char *str, size_t *len)
+{
+	const unsigned char *p;
+	uint32_t h = 2166136261U;
+
+	for (p = (const unsigned char *)str; *p != '\0'; p++) {
+		h ^= *p;
+		h *= 16777619U;
+	}
+
+	if (len != NULL)
+		*len = (const char *)p - str;
+
+	return h;
+}
+
+static int
+dt_strpool_rehash(dt_strpool_t *sp)
+{
+	uint32_t hashsz = sp->dsp_hashsz * 2;
+	uint32_t *hash = calloc(hashsz, sizeof (uint32_t));
+	uint32_t i;
+
+	if (hash == NULL)
+		return -1;
+
+	for (i = 0; i < sp->dsp_hashsz; i++) {
+		uint32_t h;
+
+		if (sp->dsp_hash[i] == 0)
+			continue;
+
+		h = dt_strpool_hash(&sp->dsp_buf[sp->dsp_hash[i] - 1], NULL);
+		while (hash[h & (hashsz - 1)] != 0)
+			h++;
+		hash[h & (hashsz - 1)] = sp->dsp_hash[i];
+	}
+
+	free(sp->dsp_hash);
+	sp->dsp_hash = hash;
+	sp->dsp_hashsz = hashsz;
+
+	return 0;
+}
+
+/*
+ * Return the offset of a string in the pool, adding it if it is not already
+ * there, or -1 if out of memory.
+ */
+static ssize_t
+dt_strpool_insert(dt_strpool_t *sp, const char *str)
+{
+	size_t len;
+	uint32_t h = dt_strpool_hash(str, &len);
+	uint32_t *bucket, off;
+
+	for (;; h++) {
+		bucket = &sp->dsp_hash[h & (sp->dsp_hashsz - 1)];
+		if (*bucket == 0)
+			break;
+		if (strcmp(&sp->dsp_buf[*bucket - 1], str) == 0)
+			return *bucket - 1;
+	}
+
+	if ((uint64_t)sp->dsp_size + len + 1 >= UINT32_MAX)
+		return -1;
+
+	if (sp->dsp_size + len + 1 > sp->dsp_alloc) {
+		size_t alloc = sp->dsp_alloc ? sp->dsp_alloc : 65536;
+		char *buf;
+
+		while (alloc < sp->dsp_size + len + 1)
+			alloc *= 2;
+		if (alloc > UINT32_MAX)
+			alloc = UINT32_MAX;
+
+		if ((buf = realloc(sp->dsp_buf, alloc)) == NULL)
+			return -1;
+
+		sp->dsp_buf = buf;
+		sp->dsp_alloc = alloc;
+	}
+
+	/*
+	 * Keep the hash at most half full.  If it cannot grow, it merely gets
+	 * slower, until it is full and interning fails.
+	 */
+	if ((sp->dsp_nstrs + 1) * 2 > sp->dsp_hashsz) {
+		if (dt_strpool_rehash(sp) == 0) {
+			for (bucket = &sp->dsp_hash[h & (sp->dsp_hashsz - 1)];
+			    *bucket != 0;
+			    bucket = &sp->dsp_hash[++h & (sp->dsp_hashsz - 1)])
+				continue;
+		} else if (sp->dsp_nstrs + 1 >= sp->dsp_hashsz)
+			return -1;
+	}
+
+	off = sp->dsp_size;
+	memcpy(&sp->dsp_buf[off], str, len + 1);
+	*bucket = off + 1;
+	sp->dsp_size += len + 1;
+	sp->dsp_nstrs++;
+
+	return off;
+}
+
+/*
+ * Return the offset of a string in the pool, or -1 if it is not there.
+ */
+static ssize_t
+dt_strpool_lookup(const dt_strpool_t *sp, const char *str)
+{
+	uint32_t h = dt_strpool_hash(str, NULL);
+	uint32_t off;
+
+	for (;; h++) {
+		off = sp->dsp_hash[h & (sp->dsp_hashsz - 1)];
+		if (off == 0)
+			return -1;
+		if (strcmp(&sp->dsp_buf[off - 1], str) == 0)
+			return off - 1;
+	}
+}
 
-	return new_ranges;
+static const char *
+dt_symtab_name(const dt_symtab_t *symtab, const dt_symbol_t *dtsp)
+{
+	return &symtab->dtst_strs->dsp_buf[dtsp->dts_name];
 }
 
 /*
@@ -93,10 +292,13 @@ dt_symtab_grow_ranges(dt_symtab_t *symtab)
  * - we demote the name "cleanup_module"
  */
 static int
-dt_symrange_sort_cmp(const void *lp, const void *rp)
+dt_symrange_sort_cmp(const void *lp, const void *rp, void *arg)
 {
-	dt_symbol_t *lhs = ((dt_symrange_t *) lp)->dtsr_sym;
-	dt_symbol_t *rhs = ((dt_symrange_t *) rp)->dtsr_sym;
+	dt_symtab_t *symtab = arg;
+	dt_symbol_t *lhs = &symtab->dtst_syms[((dt_symrange_t *) lp)->dtsr_sym];
+	dt_symbol_t *rhs = &symtab->dtst_syms[((dt_symrange_t *) rp)->dtsr_sym];
+	const char *lname = dt_symtab_name(symtab, lhs);
+	const char *rname = dt_symtab_name(symtab, rhs);
 
 	if (lhs->dts_addr < rhs->dts_addr)
 		return -1;
@@ -116,17 +318,13 @@ dt_symrange_sort_cmp(const void *lp, const void *rp)
 	    (GELF_ST_BIND(rhs->dts_info) == STB_WEAK))
 		return GELF_ST_BIND(lhs->dts_info) == STB_WEAK ? 1 : -1;
 
-	/*
-	 * Note: packed strtabs must already be sorted and can be
-	 * neither changed nor resorted.
-	 */
-	if (strcmp(lhs->dts_name.str, "cleanup_module") &&
-	    strcmp(rhs->dts_name.str, "cleanup_module") == 0)
+	if (strcmp(lname, "cleanup_module") &&
+	    strcmp(rname, "cleanup_module") == 0)
 		return -1;
-	if (strcmp(rhs->dts_name.str, "cleanup_module") &&
-	    strcmp(lhs->dts_name.str, "cleanup_module") == 0)
+	if (strcmp(rname, "cleanup_module") &&
+	    strcmp(lname, "cleanup_module") == 0)
 		return +1;
-	return (strcmp(lhs->dts_name.str, rhs->dts_name.str));
+	return (strcmp(lname, rname));
 }
 
 /*
@@ -145,24 +343,19 @@ static int dt_symbol_search_cmp(const void *lp, const void *rp)
 }
 
 dt_symtab_t *
-dt_symtab_create(void)
+dt_symtab_create(dt_strpool_t *strs)
 {
-	dt_symtab_t *symtab = malloc (sizeof (struct dt_symtab));
+	dt_symtab_t *symtab;
 
+	if (strs == NULL)
+		return NULL;
+
+	symtab = malloc (sizeof (struct dt_symtab));
 	if (symtab == NULL)
 		return NULL;
 
 	memset(symtab, 0, sizeof (struct dt_symtab));
-
-	symtab->dtst_symbuckets = _dtrace_strbuckets;
-	symtab->dtst_syms_by_name = calloc(symtab->dtst_symbuckets,
-	    sizeof (struct dt_symbol *));
-
-	if (symtab->dtst_syms_by_name == NULL) {
-		free(symtab->dtst_syms_by_name);
-		free(symtab);
-		return NULL;
-	}
+	symtab->dtst_strs = strs;
 
 	return symtab;
 }
@@ -170,34 +363,24 @@ dt_symtab_create(void)
 void
 dt_symtab_destroy(dt_symtab_t *symtab)
 {
-	dt_symbol_t *dtsp;
-	dt_symbol_t *last_dtsp = NULL;
-
 	if (!symtab)
 		return;
 
 	free(symtab->dtst_ranges);
 	free(symtab->dtst_syms_by_name);
-	free(symtab->dtst_strtab);
-
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp)) {
-		if (!(symtab->dtst_flags & DT_ST_PACKED))
-			free(dtsp->dts_name.str);
-		free(last_dtsp);
-		last_dtsp = dtsp;
-	}
-	free(last_dtsp);
-
+	free(symtab->dtst_syms);
 	free(symtab);
 }
 
+/*
+ * Add a symbol.  The pointer returned is only valid until the next insertion.
+ */
 dt_symbol_t *
 dt_symbol_insert(dt_symtab_t *symtab, const char *name,
     GElf_Addr addr, GElf_Xword size, unsigned char info)
 {
-	uint_t h;
 	dt_symbol_t *dtsp;
+	ssize_t off;
 
 	/*
 	 * No insertion into packed symtabs.
@@ -205,49 +388,38 @@ dt_symbol_insert(dt_symtab_t *symtab, const char *name,
 	if (symtab->dtst_flags & DT_ST_PACKED)
 		return NULL;
 
-	if ((dtsp = malloc(sizeof (dt_symbol_t))) == NULL)
+	if (size > UINT32_MAX)
 		return NULL;
 
-	if (symtab->dtst_num_range >= symtab->dtst_num_range_alloc)
-		if (dt_symtab_grow_ranges(symtab) == NULL) {
-			free(dtsp);
+	if (symtab->dtst_num_syms >= symtab->dtst_num_syms_alloc) {
+		uint_t num_alloc = (symtab->dtst_num_syms_alloc + 64) * 2;
+		dt_symbol_t *syms = realloc(symtab->dtst_syms,
+		    sizeof (dt_symbol_t) * num_alloc);
+
+		if (syms == NULL)
 			return NULL;
-		}
 
+		symtab->dtst_num_syms_alloc = num_alloc;
+		symtab->dtst_syms = syms;
+	}
+
+	if ((off = dt_strpool_insert(symtab->dtst_strs, name)) < 0)
+		return NULL;
+
+	dtsp = &symtab->dtst_syms[symtab->dtst_num_syms++];
 	memset(dtsp, 0, sizeof (dt_symbol_t));
-	dtsp->dts_name.str = strdup(name);
+	dtsp->dts_name = off;
 	dtsp->dts_addr = addr;
 	dtsp->dts_size = size;
 	dtsp->dts_info = info;
 
-	if (dtsp->dts_name.str == NULL) {
-		free(dtsp->dts_name.str);
-		free(dtsp);
-		return NULL;
-	}
-
 	/*
-	 * Address->symbol mapping.  Zero-size symbols do not
-	 * include any addresses and therefore are not added.
-	 * It is not yet necessary to set the range's addr and size.
+	 * The address->symbol mapping and the name hash are both built when
+	 * the table is sorted.
 	 */
-
-	if (size > 0) {
-		symtab->dtst_ranges[symtab->dtst_num_range].dtsr_sym = dtsp;
-		symtab->dtst_num_range++;
-	}
-
-	/*
-	 * Append to the doubly linked list.
-	 */
-	dt_list_append(&symtab->dtst_symlist, dtsp);
-
-	/*
-	 * Add to lookup-by-name hash table.
-	 */
-	h = dt_strtab_hash(name, NULL) % symtab->dtst_symbuckets;
-	dtsp->dts_next = symtab->dtst_syms_by_name[h];
-	symtab->dtst_syms_by_name[h] = dtsp;
+	free(symtab->dtst_syms_by_name);
+	symtab->dtst_syms_by_name = NULL;
+	symtab->dtst_symbuckets = 0;
 
 	symtab->dtst_flags &= ~DT_ST_SORTED;
 
@@ -257,20 +429,25 @@ dt_symbol_insert(dt_symtab_t *symtab, const char *name,
 dt_symbol_t *
 dt_symbol_by_name(dt_symtab_t *symtab, const char *name)
 {
-	uint_t h = dt_strtab_hash(name, NULL) % symtab->dtst_symbuckets;
-	dt_symbol_t *dtsp;
-	int packed = symtab->dtst_flags & DT_ST_PACKED;
+	uint32_t i;
 
-	for (dtsp = symtab->dtst_syms_by_name[h]; dtsp != NULL;
-	     dtsp = dtsp->dts_next) {
-		if (packed) {
-			if (strcmp(&symtab->dtst_strtab[dtsp->dts_name.off],
-				name) == 0)
+	if (symtab->dtst_syms_by_name == NULL) {
+		for (i = 0; i < symtab->dtst_num_syms; i++) {
+			dt_symbol_t *dtsp = &symtab->dtst_syms[i];
+
+			if (strcmp(dt_symtab_name(symtab, dtsp), name) == 0)
 				return (dtsp);
 		}
-		else
-			if (strcmp(dtsp->dts_name.str, name) == 0)
-				return (dtsp);
+		return NULL;
+	}
+
+	for (i = symtab->dtst_syms_by_name[dt_strtab_hash(name, NULL) %
+	    symtab->dtst_symbuckets]; i != 0;
+	    i = symtab->dtst_syms[i - 1].dts_next) {
+		dt_symbol_t *dtsp = &symtab->dtst_syms[i - 1];
+
+		if (strcmp(dt_symtab_name(symtab, dtsp), name) == 0)
+			return (dtsp);
 	}
 
 	return NULL;
@@ -293,7 +470,7 @@ dt_symbol_by_addr(dt_symtab_t *symtab, GElf_Addr dts_addr)
 	if (sympp == NULL)
 		return NULL;
 
-	return sympp->dtsr_sym;
+	return &symtab->dtst_syms[sympp->dtsr_sym];
 }
 
 static int
@@ -330,7 +507,7 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 	 */
 	dt_symrange_t *old_ranges = symtab->dtst_ranges;
 	dt_symrange_t *new_ranges;
-	uint_t num_alloc = symtab->dtst_num_range_alloc;
+	uint_t num_alloc = symtab->dtst_num_range;
 	uint_t num_range = 0;
 	int i;
 	GElf_Addr lo, hi = 0;
@@ -352,7 +529,8 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 
 		/* guess that the next range will be the next symbol */
 
-		dt_symbol_t *sym = old_ranges[i].dtsr_sym;
+		uint_t symi = old_ranges[i].dtsr_sym;
+		dt_symbol_t *sym = &symtab->dtst_syms[symi];
 
 		/*
 		 * Set the low and high for this range.
@@ -374,7 +552,8 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 		/* check for other candidate symbols for this range */
 
 		for (j = i + 1; j < symtab->dtst_num_range; j++) {
-			dt_symbol_t *sym2 = old_ranges[j].dtsr_sym;
+			uint_t sym2i = old_ranges[j].dtsr_sym;
+			dt_symbol_t *sym2 = &symtab->dtst_syms[sym2i];
 			GElf_Addr hi2;
 
 			/* if sym2 is too high, all others will be as well */
@@ -395,15 +574,17 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 			/* decide whether sym2 should win over sym */
 			if ((sym2->dts_addr > sym->dts_addr) ||
 			    ((sym2->dts_addr == sym->dts_addr) &&
-			    (sym2->dts_size < sym->dts_size)))
+			    (sym2->dts_size < sym->dts_size))) {
 				sym = sym2;
+				symi = sym2i;
+			}
 		}
 
 		/* check if we can coalese the new range to the last one */
 
 		if (num_range > 0 &&
 		    new_ranges[num_range-1].dtsr_hi == lo &&
-		    new_ranges[num_range-1].dtsr_sym == sym)
+		    new_ranges[num_range-1].dtsr_sym == symi)
 			new_ranges[num_range-1].dtsr_hi = hi;
 		else {
 
@@ -425,48 +606,103 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 
 			new_ranges[num_range].dtsr_lo = lo;
 			new_ranges[num_range].dtsr_hi = hi;
-			new_ranges[num_range].dtsr_sym = sym;
+			new_ranges[num_range].dtsr_sym = symi;
 			num_range++;
 		}
 	}
 
 	free(symtab->dtst_ranges);
 	symtab->dtst_num_range = num_range;
-	symtab->dtst_num_range_alloc = num_alloc;
 	symtab->dtst_ranges = new_ranges;
 	return 0;
 }
 
+/*
+ * Build the name-to-symbol hash, sized to the symbol table.
+ */
+static int
+dt_symtab_hash_names(dt_symtab_t *symtab)
+{
+	uint_t nbuckets = symtab->dtst_num_syms / 2 + 1;
+	uint32_t *buckets;
+	uint_t i;
+
+	if (nbuckets < _dtrace_strbuckets)
+		nbuckets = _dtrace_strbuckets;
+
+	if ((buckets = calloc(nbuckets, sizeof (uint32_t))) == NULL)
+		return -1;
+
+	for (i = 0; i < symtab->dtst_num_syms; i++) {
+		dt_symbol_t *dtsp = &symtab->dtst_syms[i];
+		uint_t h = dt_strtab_hash(dt_symtab_name(symtab, dtsp),
+		    NULL) % nbuckets;
+
+		dtsp->dts_next = buckets[h];
+		buckets[h] = i + 1;
+	}
+
+	free(symtab->dtst_syms_by_name);
+	symtab->dtst_syms_by_name = buckets;
+	symtab->dtst_symbuckets = nbuckets;
+
+	return 0;
+}
+
 /*
  * Sort the address-to-name list.
  */
 void
 dt_symtab_sort(dt_symtab_t *symtab)
 {
+	uint_t i, n = 0;
+
 	if (symtab->dtst_flags & DT_ST_SORTED)
 		return;
 
-	qsort(symtab->dtst_ranges, symtab->dtst_num_range,
-	    sizeof (dt_symrange_t), dt_symrange_sort_cmp);
+	/*
+	 * Zero-size symbols do not include any addresses and therefore are not
+	 * added to the address->symbol mapping.
+	 */
+	free(symtab->dtst_ranges);
+	symtab->dtst_ranges = malloc(sizeof (dt_symrange_t) *
+	    (symtab->dtst_num_syms + 1));
+	symtab->dtst_num_range = 0;
+	if (symtab->dtst_ranges == NULL)
+		return;
+
+	for (i = 0; i < symtab->dtst_num_syms; i++) {
+		if (symtab->dtst_syms[i].dts_size > 0)
+			symtab->dtst_ranges[n++].dtsr_sym = i;
+	}
+	symtab->dtst_num_range = n;
+
+	qsort_r(symtab->dtst_ranges, symtab->dtst_num_range,
+	    sizeof (dt_symrange_t), dt_symrange_sort_cmp, symtab);
 
 	if (dt_symtab_form_ranges(symtab))
 		return;
 
+	if (symtab->dtst_syms_by_name == NULL &&
+	    dt_symtab_hash_names(symtab) < 0)
+		return;
+
 	symtab->dtst_flags |= DT_ST_SORTED;
 }
 
 /*
- * Get next item on the linked list, keeping or eliminating the current item.
+ * Get next item on the hash chain, keeping or eliminating the current item.
  */
 static
-dt_symbol_t **
-next_symp(dt_symbol_t **p, int *nelim, int keep) {
+uint32_t *
+next_symp(dt_symtab_t *symtab, uint32_t *p, int *nelim, int keep) {
+	dt_symbol_t *dtsp = &symtab->dtst_syms[*p - 1];
+
 	if (keep)
-		return &((*p)->dts_next);
+		return &dtsp->dts_next;
 	else {
-		dt_symbol_t *tmp = (*p)->dts_next;
-		(*p)->dts_next = NULL;
-		*p = tmp;
+		*p = dtsp->dts_next;
+		dtsp->dts_next = 0;
 		*nelim += 1;
 		return p;
 	}
@@ -484,95 +720,428 @@ dt_symtab_purge(dt_symtab_t *symtab)
 {
 	uint_t i;
 
+	if (symtab->dtst_syms_by_name == NULL &&
+	    dt_symtab_hash_names(symtab) < 0)
+		return;
+
 	/* loop over buckets */
 	for (i = 0; i < symtab->dtst_symbuckets; i++) {
 
-		/* walk the bucket's linked list */
-		dt_symbol_t **p1;
+		/* walk the bucket's chain */
+		uint32_t *p1;
 		for (p1 = &symtab->dtst_syms_by_name[i]; *p1; ) {
 			int nelim = 0;
-			char *myname = (*p1)->dts_name.str;
-			dt_symbol_t **p2;
+			uint32_t myname = symtab->dtst_syms[*p1 - 1].dts_name;
+			uint32_t *p2;
 
 			/*
-			 * Walk from the next item to the end of the list,
+			 * Walk from the next item to the end of the chain,
 			 * keeping only symbols whose names differ from myname.
-			 * (Compare symbol names by looking at dts_name.str,
-			 * since symtab is not packed yet.)
+			 * (Names are interned, so equal names have equal
+			 * offsets.)
 			 */
-			for (p2 = &((*p1)->dts_next); *p2; )
-				p2 = next_symp(p2, &nelim,
-				    strcmp((*p2)->dts_name.str, myname));
+			for (p2 = &symtab->dtst_syms[*p1 - 1].dts_next; *p2; )
+				p2 = next_symp(symtab, p2, &nelim,
+				    symtab->dtst_syms[*p2 - 1].dts_name !=
+				    myname);
 
 			/*
 			 * Advance p1, keeping the current item only if no
 			 * other symbols were eliminated (duplicated p1).
 			 */
-			p1 = next_symp(p1, &nelim, nelim == 0);
+			p1 = next_symp(symtab, p1, &nelim, nelim == 0);
 		}
 	}
 }
 
+/*
+ * Finish a symbol table: sort it and trim its arrays to size.  No symbols can
+ * be added to a packed table.
+ */
 void
 dt_symtab_pack(dt_symtab_t *symtab)
 {
-	dt_symbol_t *dtsp;
-	size_t strsz = 0, offset = 0;
-
-	/*
-	 * For now, merely pack the symbols into a string table.
-	 *
-	 * In future, Huffman-coding the symbols seems sensible: they have many
-	 * identical components (a property which scripts/kallsyms.c also takes
-	 * advantage of).
-	 */
+	dt_symbol_t *syms;
 
 	if (symtab->dtst_flags & DT_ST_PACKED)
 		return;
 
 	dt_symtab_sort(symtab);
 
+	if (symtab->dtst_num_syms > 0 &&
+	    symtab->dtst_num_syms < symtab->dtst_num_syms_alloc &&
+	    (syms = realloc(symtab->dtst_syms,
+	    sizeof (dt_symbol_t) * symtab->dtst_num_syms)) != NULL) {
+		symtab->dtst_syms = syms;
+		symtab->dtst_num_syms_alloc = symtab->dtst_num_syms;
+	}
+
+	symtab->dtst_flags |= DT_ST_PACKED;
+}
+
+/*
+ * Save a string pool to a snapshot.
+ */
+int
+dt_strpool_write(const dt_strpool_t *sp, FILE *fp)
+{
+	uint32_t hdr[3] = { sp->dsp_size, sp->dsp_hashsz, sp->dsp_nstrs };
+
+	if (dt_snap_put(fp, hdr, sizeof (hdr)) < 0 ||
+	    dt_snap_put(fp, sp->dsp_buf, sp->dsp_size) < 0 ||
+	    dt_snap_put(fp, sp->dsp_hash,
+	    sp->dsp_hashsz * sizeof (uint32_t)) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Restore a string pool from a snapshot, checking that it is consistent: a
+ * snapshot is not trusted any more than any other file.
+ */
+dt_strpool_t *
+dt_strpool_read(dt_snap_t *ds)
+{
+	const uint32_t *hdr, *hash;
+	const char *buf;
+	dt_strpool_t *sp;
+	uint32_t i, used;
+
+	if ((hdr = dt_snap_get(ds, 3 * sizeof (uint32_t))) == NULL ||
+	    hdr[1] == 0 || (hdr[1] & (hdr[1] - 1)) != 0 ||
+	    hdr[2] >= hdr[1] || hdr[2] > hdr[0] ||
+	    (buf = dt_snap_get(ds, hdr[0])) == NULL ||
+	    (hdr[0] > 0 && buf[hdr[0] - 1] != '\0') ||
+	    (hash = dt_snap_get(ds, hdr[1] * sizeof (uint32_t))) == NULL)
+		return NULL;
+
+	for (i = 0, used = 0; i < hdr[1]; i++) {
+		if (hash[i] > hdr[0])
+			return NULL;
+		used += hash[i] != 0;
+	}
+	if (used >= hdr[1])
+		return NULL;
+
+	if ((sp = calloc(1, sizeof (dt_strpool_t))) == NULL)
+		return NULL;
+
+	sp->dsp_buf = malloc(hdr[0] ? hdr[0] : 1);
+	sp->dsp_hash = malloc(hdr[1] * sizeof (uint32_t));
+	if (sp->dsp_buf == NULL || sp->dsp_hash == NULL) {
+		dt_strpool_destroy(sp);
+		return NULL;
+	}
+
+	memcpy(sp->dsp_buf, buf, hdr[0]);
+	memcpy(sp->dsp_hash, hash, hdr[1] * sizeof (uint32_t));
+	sp->dsp_size = sp->dsp_alloc = hdr[0];
+	sp->dsp_hashsz = hdr[1];
+	sp->dsp_nstrs = hdr[2];
+
+	return sp;
+}
+
+/*
+ * Save a sorted symbol table to a snapshot.
+ */
+int
+dt_symtab_write(const dt_symtab_t *symtab, FILE *fp)
+{
+	uint32_t hdr[4] = { symtab->dtst_num_syms, symtab->dtst_num_range,
+			    symtab->dtst_symbuckets, symtab->dtst_flags };
+
+	if (!(symtab->dtst_flags & DT_ST_SORTED) ||
+	    symtab->dtst_syms_by_name == NULL)
+		return -1;
+
+	if (dt_snap_put(fp, hdr, sizeof (hdr)) < 0 ||
+	    dt_snap_put(fp, symtab->dtst_syms,
+	    symtab->dtst_num_syms * sizeof (dt_symbol_t)) < 0 ||
+	    dt_snap_put(fp, symtab->dtst_ranges,
+	    symtab->dtst_num_range * sizeof (dt_symrange_t)) < 0 ||
+	    dt_snap_put(fp, symtab->dtst_syms_by_name,
+	    symtab->dtst_symbuckets * sizeof (uint32_t)) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Restore a symbol table from a snapshot, with its names in the given pool
+ * (restored from the same snapshot).  Every index is checked.
+ */
+dt_symtab_t *
+dt_symtab_read(dt_strpool_t *strs, dt_snap_t *ds)
+{
+	const uint32_t *hdr, *buckets;
+	const dt_symbol_t *syms;
+	const dt_symrange_t *ranges;
+	dt_symtab_t *symtab;
+	ulong_t *seen;
+	uint32_t i, j;
+
+	if ((hdr = dt_snap_get(ds, 4 * sizeof (uint32_t))) == NULL ||
+	    hdr[2] == 0 || !(hdr[3] & DT_ST_SORTED) ||
+	    (syms = dt_snap_get(ds, (size_t)hdr[0] *
+	    sizeof (dt_symbol_t))) == NULL ||
+	    (ranges = dt_snap_get(ds, (size_t)hdr[1] *
+	    sizeof (dt_symrange_t))) == NULL ||
+	    (buckets = dt_snap_get(ds, (size_t)hdr[2] *
+	    sizeof (uint32_t))) == NULL)
+		return NULL;
+
+	for (i = 0; i < hdr[0]; i++) {
+		if (syms[i].dts_name >= strs->dsp_size ||
+		    syms[i].dts_next > hdr[0])
+			return NULL;
+	}
+	for (i = 0; i < hdr[1]; i++) {
+		if (ranges[i].dtsr_sym >= hdr[0])
+			return NULL;
+	}
+	for (i = 0; i < hdr[2]; i++) {
+		if (buckets[i] > hdr[0])
+			return NULL;
+	}
+
 	/*
-	 * Size and allocate the string table: give up if we can't.
+	 * Each symbol may be reached at most once from all the hash chains
+	 * together: otherwise a chain loops, or two chains merge, and lookups
+	 * could go round forever.
 	 */
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp))
-		strsz += strlen(dtsp->dts_name.str) + 1;
+	if ((seen = calloc(1, BT_SIZEOFMAP((size_t)hdr[0] + 1))) == NULL)
+		return NULL;
+
+	for (i = 0; i < hdr[2]; i++) {
+		for (j = buckets[i]; j != 0; j = syms[j - 1].dts_next) {
+			if (BT_TEST(seen, j - 1)) {
+				free(seen);
+				return NULL;
+			}
+			BT_SET(seen, j - 1);
+		}
+	}
+	free(seen);
 
-	symtab->dtst_strtab = malloc(strsz);
-	if (symtab->dtst_strtab == NULL)
+	if ((symtab = dt_symtab_create(strs)) == NULL)
+		return NULL;
+
+	symtab->dtst_syms = malloc(sizeof (dt_symbol_t) * (hdr[0] + 1));
+	symtab->dtst_ranges = malloc(sizeof (dt_symrange_t) * (hdr[1] + 1));
+	symtab->dtst_syms_by_name = malloc(sizeof (uint32_t) * hdr[2]);
+	if (symtab->dtst_syms == NULL || symtab->dtst_ranges == NULL ||
+	    symtab->dtst_syms_by_name == NULL) {
+		dt_symtab_destroy(symtab);
+		return NULL;
+	}
+
+	memcpy(symtab->dtst_syms, syms, sizeof (dt_symbol_t) * hdr[0]);
+	memcpy(symtab->dtst_ranges, ranges, sizeof (dt_symrange_t) * hdr[1]);
+	memcpy(symtab->dtst_syms_by_name, buckets, sizeof (uint32_t) * hdr[2]);
+	symtab->dtst_num_syms = symtab->dtst_num_syms_alloc = hdr[0];
+	symtab->dtst_num_range = hdr[1];
+	symtab->dtst_symbuckets = hdr[2];
+	symtab->dtst_flags = hdr[3] & (DT_ST_SORTED | DT_ST_PACKED);
+
+	return symtab;
+}
+
+dt_symindex_t *
+dt_symindex_create(dt_strpool_t *strs)
+{
+	dt_symindex_t *dsi = calloc(1, sizeof (dt_symindex_t));
+
+	if (dsi == NULL)
+		return NULL;
+
+	dsi->dsi_strs = strs;
+	return dsi;
+}
+
+void
+dt_symindex_destroy(dt_symindex_t *dsi)
+{
+	if (dsi == NULL)
 		return;
 
-	/*
-	 * Fill it out.
-	 */
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp)) {
-		size_t len = strlen(dtsp->dts_name.str) + 1;
-
-		memcpy(&symtab->dtst_strtab[offset], dtsp->dts_name.str, len);
-		free(dtsp->dts_name.str);
-		dtsp->dts_name.off = offset;
-		offset += len;
+	free(dsi->dsi_tabs);
+	free(dsi->dsi_owners);
+	free(dsi->dsi_ents);
+	free(dsi->dsi_buckets);
+	free(dsi);
+}
+
+/*
+ * Add every symbol reachable by name in a sorted symbol table to the index,
+ * on behalf of an owner, which lookups return.  Lookups find symbols in tables
+ * added earlier first.  The table must not change while it is in the index.
+ */
+int
+dt_symindex_add(dt_symindex_t *dsi, dt_symtab_t *symtab, void *owner)
+{
+	uint32_t i, j, n = 0;
+
+	if (symtab->dtst_syms_by_name == NULL ||
+	    symtab->dtst_strs != dsi->dsi_strs)
+		return -1;
+
+	if (dsi->dsi_ntabs == dsi->dsi_tabs_alloc) {
+		uint32_t alloc = dsi->dsi_tabs_alloc ? dsi->dsi_tabs_alloc * 2
+		    : 64;
+		dt_symtab_t **tabs;
+		void **owners;
+
+		if ((tabs = realloc(dsi->dsi_tabs,
+		    alloc * sizeof (dt_symtab_t *))) == NULL)
+			return -1;
+		dsi->dsi_tabs = tabs;
+
+		if ((owners = realloc(dsi->dsi_owners,
+		    alloc * sizeof (void *))) == NULL)
+			return -1;
+		dsi->dsi_owners = owners;
+		dsi->dsi_tabs_alloc = alloc;
 	}
 
-	symtab->dtst_flags |= DT_ST_PACKED;
+	for (i = 0; i < symtab->dtst_symbuckets; i++) {
+		for (j = symtab->dtst_syms_by_name[i]; j != 0;
+		    j = symtab->dtst_syms[j - 1].dts_next)
+			n++;
+	}
+
+	if ((uint64_t)dsi->dsi_nents + n >= UINT32_MAX)
+		return -1;
+
+	if (dsi->dsi_nents + n > dsi->dsi_ents_alloc) {
+		uint64_t alloc = dsi->dsi_ents_alloc ? dsi->dsi_ents_alloc
+		    : 4096;
+		dt_symindex_ent_t *ents;
+
+		while (alloc < dsi->dsi_nents + n)
+			alloc *= 2;
+		if (alloc >= UINT32_MAX)
+			alloc = UINT32_MAX - 1;
+
+		if ((ents = realloc(dsi->dsi_ents,
+		    alloc * sizeof (dt_symindex_ent_t))) == NULL)
+			return -1;
+		dsi->dsi_ents = ents;
+		dsi->dsi_ents_alloc = alloc;
+	}
+
+	for (i = 0; i < symtab->dtst_symbuckets; i++) {
+		for (j = symtab->dtst_syms_by_name[i]; j != 0;
+		    j = symtab->dtst_syms[j - 1].dts_next) {
+			dt_symindex_ent_t *dsie;
+
+			dsie = &dsi->dsi_ents[dsi->dsi_nents++];
+			dsie->dsie_tab = dsi->dsi_ntabs;
+			dsie->dsie_sym = j - 1;
+			dsie->dsie_next = 0;
+		}
+	}
+
+	dsi->dsi_tabs[dsi->dsi_ntabs] = symtab;
+	dsi->dsi_owners[dsi->dsi_ntabs++] = owner;
+
+	free(dsi->dsi_buckets);
+	dsi->dsi_buckets = NULL;
+
+	return 0;
+}
+
+static uint32_t
+dt_symindex_hash(const dt_symindex_t *dsi, uint32_t name)
+{
+	return (uint32_t)((name + 1) * 2654435761U) >> dsi->dsi_shift;
+}
+
+static dt_symbol_t *
+dt_symindex_sym(const dt_symindex_t *dsi, const dt_symindex_ent_t *dsie)
+{
+	return &dsi->dsi_tabs[dsie->dsie_tab]->dtst_syms[dsie->dsie_sym];
 }
 
 /*
- * Return the name of a symbol.  Currently redundant, this will become useful
- * when dt_symtab_pack() starts compressing symbol names.  TODO: we must retain
- * ownership of the expanded string, even in this case: it is part of the
- * libdtrace API.  This is distinctly tricky: it may be simpler to change the
- * API to require caller-frees semantics.
+ * Hash the entries, at most two to a bucket.  Entries are pushed onto their
+ * chains last first, so that each chain ends up in order of addition.
+ */
+static int
+dt_symindex_hash_names(dt_symindex_t *dsi)
+{
+	uint32_t bits = 1, i;
+
+	while (bits < 31 && (1U << bits) < dsi->dsi_nents / 2)
+		bits++;
+
+	if ((dsi->dsi_buckets = calloc(1U << bits,
+	    sizeof (uint32_t))) == NULL)
+		return -1;
+	dsi->dsi_shift = 32 - bits;
+
+	for (i = dsi->dsi_nents; i > 0; i--) {
+		dt_symindex_ent_t *dsie = &dsi->dsi_ents[i - 1];
+		uint32_t h = dt_symindex_hash(dsi,
+		    dt_symindex_sym(dsi, dsie)->dts_name);
+
+		dsie->dsie_next = dsi->dsi_buckets[h];
+		dsi->dsi_buckets[h] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * Look up a name in the index.  Return the first symbol with that name in a
+ * table added after the table of the given owner (or the first of all, if
+ * after is NULL), and set *ownerp to its owner; or return NULL if there is
+ * none.
+ */
+dt_symbol_t *
+dt_symindex_lookup(dt_symindex_t *dsi, const char *name, const void *after,
+    void **ownerp)
+{
+	ssize_t off;
+	uint32_t i;
+	int skip = after != NULL;
+
+	if (dsi->dsi_buckets == NULL && dt_symindex_hash_names(dsi) < 0)
+		return NULL;
+
+	if ((off = dt_strpool_lookup(dsi->dsi_strs, name)) < 0)
+		return NULL;
+
+	for (i = dsi->dsi_buckets[dt_symindex_hash(dsi, off)]; i != 0;
+	    i = dsi->dsi_ents[i - 1].dsie_next) {
+		dt_symindex_ent_t *dsie = &dsi->dsi_ents[i - 1];
+		dt_symbol_t *dtsp = dt_symindex_sym(dsi, dsie);
+
+		if (dtsp->dts_name != off)
+			continue;
+
+		if (skip) {
+			skip = dsi->dsi_owners[dsie->dsie_tab] != after;
+			continue;
+		}
+
+		*ownerp = dsi->dsi_owners[dsie->dsie_tab];
+		return dtsp;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the name of a symbol.  It remains valid as long as the string pool
+ * does not grow: that is, until symbols are next inserted into any table
+ * sharing the pool.
  */
 const char *
-dt_symbol_name(dt_symtab_t *symtab _dt_unused_, dt_symbol_t *symbol)
+dt_symbol_name(dt_symtab_t *symtab, dt_symbol_t *symbol)
 {
-	if (symtab->dtst_flags & DT_ST_PACKED)
-		return &symtab->dtst_strtab[symbol->dts_name.off];
-	else
-		return symbol->dts_name.str;
+	return dt_symtab_name(symtab, symbol);
 }
 
 void
@@ -12,8 +12,10 @@
 #ifndef	_DT_SYMTAB_H
 #define	_DT_SYMTAB_H
 
+#include <stdio.h>
 #include <gelf.h>
 #include <dtrace.h>
+#include <dt_kernsnap.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -27,12 +29,22 @@ extern "C" {
  * can also be packed, which increases efficiency further but forbids further
  * modification.  (We do not define whether the 'more efficient' form increases
  * space- or time-efficiency.)
+ *
+ * Symbol names are interned in a string pool, which any number of symbol
+ * tables may share.  A symbol index looks names up in many such tables at
+ * once.
  */
 
+typedef struct dt_strpool dt_strpool_t;
 typedef struct dt_symbol dt_symbol_t;
 typedef struct dt_symtab dt_symtab_t;
+typedef struct dt_symindex dt_symindex_t;
 
-extern dt_symtab_t *dt_symtab_create(void);
+extern dt_strpool_t *dt_strpool_create(void);
+extern void dt_strpool_destroy(dt_strpool_t *sp);
+extern size_t dt_strpool_size(const dt_strpool_t *sp);
+
+extern dt_symtab_t *dt_symtab_create(dt_strpool_t *strs);
 extern void dt_symtab_destroy(dt_symtab_t *symtab);
 extern dt_symbol_t *dt_symbol_insert(dt_symtab_t *symtab, const char *name,
     GElf_Addr addr, GElf_Xword size, unsigned char info);
@@ -43,6 +55,18 @@ extern void dt_symtab_sort(dt_symtab_t *symtab);
 extern void dt_symtab_purge(dt_symtab_t *symtab);
 extern void dt_symtab_pack(dt_symtab_t *symtab);
 
+extern dt_symindex_t *dt_symindex_create(dt_strpool_t *strs);
+extern void dt_symindex_destroy(dt_symindex_t *dsi);
+extern int dt_symindex_add(dt_symindex_t *dsi, dt_symtab_t *symtab,
+    void *owner);
+extern dt_symbol_t *dt_symindex_lookup(dt_symindex_t *dsi, const char *name,
+    const void *after, void **ownerp);
+
+extern int dt_strpool_write(const dt_strpool_t *sp, FILE *fp);
+extern dt_strpool_t *dt_strpool_read(dt_snap_t *ds);
+extern int dt_symtab_write(const dt_symtab_t *symtab, FILE *fp);
+extern dt_symtab_t *dt_symtab_read(dt_strpool_t *strs, dt_snap_t *ds);
+
 extern const char *dt_symbol_name(dt_symtab_t *symtab, dt_symbol_t *symbol);
 extern void dt_symbol_to_elfsym(dtrace_hdl_t *dtp, dt_symbol_t *symbol,
     GElf_Sym *elf_symp);
@@ -10,6 +10,10 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <libproc.h>
 #include <port.h>
 
@@ -23,15 +27,16 @@ static const struct {
 	{ DTRACEOPT_MAX, 0 }
 };
 
-void
-dtrace_sleep(dtrace_hdl_t *dtp)
+/*
+ * Return the time at which dtrace_work() next has something to do: the
+ * earliest of the status, aggregation and switch deadlines, or the time at
+ * which dtrace_consume() predicts a principal buffer will near full.
+ */
+static hrtime_t
+dt_work_deadline(dtrace_hdl_t *dtp)
 {
-	dt_proc_hash_t *dph = dtp->dt_procs;
 	dtrace_optval_t policy = dtp->dt_options[DTRACEOPT_BUFPOLICY];
-	dt_proc_notify_t *dprn;
-
 	hrtime_t earliest = INT64_MAX;
-	struct timespec tv;
 	int i;
 
 	for (i = 0; _dtrace_sleeptab[i].dtslt_option < DTRACEOPT_MAX; i++) {
@@ -52,19 +57,164 @@ dtrace_sleep(dtrace_hdl_t *dtp)
 			earliest = *((hrtime_t *)a) + interval;
 	}
 
-	(void) pthread_mutex_lock(&dph->dph_lock);
+	if (policy == DTRACEOPT_BUFPOLICY_SWITCH && dtp->dt_wakefill != 0 &&
+	    dtp->dt_wakefill < earliest)
+		earliest = dtp->dt_wakefill;
+
+	return (earliest);
+}
+
+/*
+ * Arm the wakeup timer for the next deadline.  Setting the timer also
+ * discards any expiry that has not been read, so this is done each time the
+ * work that the timer was asking for has been done.  Until tracing is active
+ * there are no deadlines, so the timer is left disarmed.
+ */
+static void
+dt_work_arm(dtrace_hdl_t *dtp)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	hrtime_t earliest;
+
+	if (dtp->dt_wakefd == -1)
+		return;
+
+	if (dtp->dt_active) {
+		earliest = dt_work_deadline(dtp);
+
+		/*
+		 * A zero it_value disarms the timer, so a deadline that has
+		 * already passed is nudged forward to fire at once.
+		 */
+		if (earliest <= 0)
+			earliest = 1;
+
+		its.it_value.tv_sec = earliest / NANOSEC;
+		its.it_value.tv_nsec = earliest % NANOSEC;
+	}
+
+	(void) timerfd_settime(dtp->dt_waketimerfd, TFD_TIMER_ABSTIME,
+	    &its, NULL);
+}
+
+/*
+ * Return a file descriptor that becomes readable when the consumer has work
+ * to do: a status, aggregation or switch deadline has arrived, a principal
+ * buffer is predicted to be nearing full, a process being traced has changed
+ * state, or dtrace_wakeup() has been called.  The descriptor is an epoll
+ * instance and can be added to the caller's own epoll set.  Once it is
+ * readable, dtrace_sleep() returns without blocking and dtrace_work() does
+ * whatever is due and re-arms the descriptor.  Once this has been called,
+ * dtrace_sleep() waits on the descriptor too.
+ */
+int
+dtrace_wakeup_fd(dtrace_hdl_t *dtp)
+{
+	struct epoll_event ev;
+	int oerrno;
+
+	if (dtp->dt_wakefd != -1)
+		return (dtp->dt_wakefd);
+
+	if ((dtp->dt_wakeevfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		goto err;
+
+	if ((dtp->dt_waketimerfd = timerfd_create(CLOCK_REALTIME,
+	    TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+		goto err;
+
+	if ((dtp->dt_wakefd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		goto err;
+
+	memset(&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = dtp->dt_wakeevfd;
+	if (epoll_ctl(dtp->dt_wakefd, EPOLL_CTL_ADD, dtp->dt_wakeevfd,
+	    &ev) == -1)
+		goto err;
 
-	tv.tv_sec = earliest / NANOSEC;
-	tv.tv_nsec = earliest % NANOSEC;
+	ev.data.fd = dtp->dt_waketimerfd;
+	if (epoll_ctl(dtp->dt_wakefd, EPOLL_CTL_ADD, dtp->dt_waketimerfd,
+	    &ev) == -1)
+		goto err;
+
+	dt_work_arm(dtp);
+	return (dtp->dt_wakefd);
+
+err:
+	oerrno = errno;
+
+	if (dtp->dt_wakefd != -1)
+		(void) close(dtp->dt_wakefd);
+	if (dtp->dt_wakeevfd != -1)
+		(void) close(dtp->dt_wakeevfd);
+	if (dtp->dt_waketimerfd != -1)
+		(void) close(dtp->dt_waketimerfd);
+
+	dtp->dt_wakefd = dtp->dt_wakeevfd = dtp->dt_waketimerfd = -1;
+
+	return (dt_set_errno(dtp, oerrno));
+}
+
+/*
+ * Make the descriptor returned by dtrace_wakeup_fd() readable.  This is safe
+ * to call from any thread, and is a no-op if there is no such descriptor.
+ * Process state changes are delivered this way; callers with their own
+ * notion of a buffer nearing full can use it to the same end.
+ */
+void
+dtrace_wakeup(dtrace_hdl_t *dtp)
+{
+	uint64_t one = 1;
+
+	if (dtp->dt_wakeevfd != -1)
+		(void) write(dtp->dt_wakeevfd, &one, sizeof (one));
+}
+
+void
+dtrace_sleep(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_proc_notify_t *dprn;
+
+	hrtime_t earliest = dt_work_deadline(dtp);
+	struct timespec tv;
+
+	if (dtp->dt_wakefd != -1 && dtp->dt_active) {
+		struct epoll_event ev;
+		uint64_t val;
+
+		/*
+		 * Wait on the wakeup descriptor instead of the condition
+		 * variable.  Process notifications are queued before the
+		 * descriptor is signalled, so any that arrive after it has
+		 * been drained leave it readable for the next call.
+		 */
+		dt_work_arm(dtp);
+		(void) epoll_wait(dtp->dt_wakefd, &ev, 1, -1);
+		(void) read(dtp->dt_wakeevfd, &val, sizeof (val));
+
+		(void) pthread_mutex_lock(&dph->dph_lock);
+	} else {
+		(void) pthread_mutex_lock(&dph->dph_lock);
+
+		tv.tv_sec = earliest / NANOSEC;
+		tv.tv_nsec = earliest % NANOSEC;
+
+		/*
+		 * Wait until the time specified by "earliest" has arrived, or
+		 * until we receive notification that a process is in an
+		 * interesting state.
+		 */
+		(void) pthread_cond_timedwait(&dph->dph_cv, &dph->dph_lock,
+		    &tv);
+	}
 
 	/*
-	 * Wait until the time specified by "earliest" has arrived, or until we
-	 * receive notification that a process is in an interesting state; also
-	 * make sure that any synchronous notifications of process exit are
+	 * Make sure that any synchronous notifications of process exit are
 	 * received.  Regardless of why we awaken, iterate over any pending
 	 * notifications and process them.
 	 */
-	(void) pthread_cond_timedwait(&dph->dph_cv, &dph->dph_lock, &tv);
 	(void) dt_proc_enqueue_exits(dtp);
 
 	while ((dprn = dph->dph_notify) != NULL) {
@@ -281,6 +431,7 @@ dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
 		 * return.
 		 */
 		assert(rval == DTRACE_WORKSTATUS_OKAY);
+		dt_work_arm(dtp);
 		return (rval);
 	}
 
@@ -290,5 +441,6 @@ dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
 	if (dtrace_consume(dtp, fp, pfunc, rfunc, arg) == -1)
 		return (DTRACE_WORKSTATUS_ERROR);
 
+	dt_work_arm(dtp);
 	return (rval);
 }
@@ -48,6 +48,8 @@ extern dtrace_hdl_t *dtrace_vopen(int version, int flags, int *errp,
 extern int dtrace_go(dtrace_hdl_t *dtp);
 extern int dtrace_stop(dtrace_hdl_t *dtp);
 extern void dtrace_sleep(dtrace_hdl_t *dtp);
+extern int dtrace_wakeup_fd(dtrace_hdl_t *dtp);
+extern void dtrace_wakeup(dtrace_hdl_t *dtp);
 extern void dtrace_close(dtrace_hdl_t *dtp);
 
 extern int dtrace_errno(dtrace_hdl_t *dtp);
@@ -99,10 +101,13 @@ typedef struct dtrace_proginfo {
 #define	DTRACE_C_PSPEC  0x0080	/* Interpret ambiguous specifiers as probes */
 #define	DTRACE_C_ETAGS	0x0100	/* Prefix error messages with error tags */
 #define	DTRACE_C_ARGREF	0x0200	/* Do not require all macro args to be used */
+#define	DTRACE_C_NOOPT	0x0400	/* Do not optimize compiled DIF */
 #define	DTRACE_C_DEFARG	0x0800	/* Use 0/"" as value for unspecified args */
 #define	DTRACE_C_NOLIBS	0x1000	/* Do not process D system libraries */
 #define	DTRACE_C_CTL	0x2000	/* Only process control directives */
-#define	DTRACE_C_MASK	0x3bff	/* mask of all valid flags to dtrace_*compile */
+#define	DTRACE_C_CSE	0x4000	/* Share common subexpressions of clauses */
+#define	DTRACE_C_CACHE	0x8000	/* Use the program cache (exec only) */
+#define	DTRACE_C_MASK	0xffff	/* mask of all valid flags to dtrace_*compile */
 
 extern dtrace_prog_t *dtrace_program_strcompile(dtrace_hdl_t *dtp, const char *s,
     dtrace_probespec_t spec, uint_t cflags, int argc, char *const argv[]);
@@ -287,7 +292,10 @@ typedef enum {
 	DTRACEDROP_SPECBUSY,			/* spec drop due to busy */
 	DTRACEDROP_SPECUNAVAIL,			/* spec drop due to unavail */
 	DTRACEDROP_STKSTROVERFLOW,		/* stack string tab overflow */
-	DTRACEDROP_DBLERROR			/* error in ERROR probe */
+	DTRACEDROP_DBLERROR,			/* error in ERROR probe */
+	DTRACEDROP_LATE,			/* record too late to order */
+	DTRACEDROP_AGGSNAP,			/* aggregation snapshot stats */
+	DTRACEDROP_AUTOSWITCH			/* switchrate=auto decision */
 } dtrace_dropkind_t;
 
 typedef struct dtrace_dropdata {
@@ -344,6 +352,7 @@ extern int dtrace_handle_setopt(dtrace_hdl_t *dtp,
 #define	DTRACE_A_PERCPU		0x0001
 #define	DTRACE_A_KEEPDELTA	0x0002
 #define	DTRACE_A_ANONYMOUS	0x0004
+#define	DTRACE_A_SNAPSTATS	0x0008
 
 #define	DTRACE_AGGWALK_ERROR		-1	/* error while processing */
 #define	DTRACE_AGGWALK_NEXT		0	/* proceed to next element */
@@ -0,0 +1,116 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Cache files: the kernel snapshot, the program cache, the D library image and
+ * the symbol table index cache.
+ *
+ * Every cache file starts with a 32-bit magic number and a 32-bit version.
+ * A cache file is only read if it is owned by the current user or by root,
+ * and is written under a temporary name and renamed into place, so that
+ * concurrent dtrace runs never see a partial one.  Failure to read or write a
+ * cache file is never an error to callers: they just do the work it would
+ * have saved.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <port.h>
+
+/*
+ * Map the cache file 'path', if it is trusted, at least 'hdrsize' bytes long,
+ * and starts with the given magic number and version.  Return the mapping and
+ * set '*sizep' to its size, or return NULL.
+ */
+void *
+cachefile_map(const char *path, size_t hdrsize, uint32_t magic,
+    uint32_t version, size_t *sizep)
+{
+	const uint32_t *hdr;
+	struct stat s;
+	void *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return (NULL);
+
+	if (fstat(fd, &s) < 0 || (s.st_uid != geteuid() && s.st_uid != 0) ||
+	    s.st_size < (off_t)hdrsize ||
+	    s.st_size < (off_t)(2 * sizeof (uint32_t)) ||
+	    (map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd,
+	    0)) == MAP_FAILED) {
+		close(fd);
+		return (NULL);
+	}
+	close(fd);
+
+	hdr = map;
+	if (hdr[0] != magic || hdr[1] != version) {
+		munmap(map, s.st_size);
+		return (NULL);
+	}
+
+	*sizep = s.st_size;
+	return (map);
+}
+
+/*
+ * Write the cache file 'path' in the directory 'dir', which is created if need
+ * be, by calling 'func' on a stream open on a temporary file.  Return 0 on
+ * success, or -1 with errno set if either the file or 'func' fails.
+ */
+int
+cachefile_write(const char *dir, const char *path,
+    int (*func)(FILE *, void *), void *arg)
+{
+	char tmp[PATH_MAX + 8];
+	FILE *fp;
+	int fd, err;
+
+	(void) mkdir(dir, 0755);
+
+	if (snprintf(tmp, sizeof (tmp), "%s.XXXXXX", path) >= sizeof (tmp)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	if ((fd = mkstemp(tmp)) < 0)
+		return (-1);
+
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		err = errno;
+		close(fd);
+		goto err;
+	}
+
+	if (func(fp, arg) < 0 || fchmod(fd, 0644) < 0) {
+		err = errno;
+		fclose(fp);
+		goto err;
+	}
+
+	if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+		err = errno;
+		goto err;
+	}
+
+	return (0);
+
+err:
+	unlink(tmp);
+	errno = err;
+	return (-1);
+}
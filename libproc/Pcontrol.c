@@ -126,6 +126,7 @@ Pcreate(
 	}
 
 	memset(P, 0, sizeof (*P));
+	Pmapping_changed(P);
 	P->bkpts = calloc(BKPT_HASH_BUCKETS, sizeof (struct bkpt_t *));
 	if (!P->bkpts) {
 		_dprintf("Out of memory initializing breakpoint hash\n");
@@ -295,6 +296,7 @@ Pgrab(pid_t pid, int noninvasiveness, int already_ptraced, void *wrap_arg,
 		return (NULL);
         }
 	memset(P, 0, sizeof (*P));
+	Pmapping_changed(P);
 	P->state = already_ptraced ? PS_TRACESTOP : PS_RUN;
 	P->pid = pid;
 	P->detach = 1;
@@ -943,6 +945,7 @@ Pwait_handle_waitpid(struct ps_prochandle *P, int status)
 		P->bkpt_consume = 0;
 		P->r_debug_addr = 0;
 		P->info_valid = 0;
+		Pmapping_changed(P);
 		P->group_stopped = 0;
 		P->listening = 0;
 		if ((P->ptrace_count == 0) && ptrace_lock_hook)
@@ -1480,6 +1483,7 @@ Puntrace(struct ps_prochandle *P, int leave_stopped)
 			P->state = PS_DEAD;
 		P->ptrace_halted = FALSE;
 		P->info_valid = 0;
+		Pmapping_changed(P);
 	}
 
 	if (P->ptrace_count == 0 && ptrace_lock_hook)
@@ -2609,6 +2613,15 @@ Pset_procfs_path(const char *path)
 	strcpy(procfs_path, path);
 }
 
+/*
+ * Get the path to /proc.
+ */
+const char *
+Pprocfs_path(void)
+{
+	return procfs_path;
+}
+
 /*
  * Set a function returning a pointer to a jmp_buf we should use to throw
  * exceptions.
@@ -18,6 +18,7 @@
 #include <rtld_db.h>
 #include <libproc.h>
 #include <limits.h>
+#include <time.h>
 #include <dtrace.h>
 #include <dt_list.h>
 #include <setjmp.h>
@@ -68,8 +69,20 @@ typedef struct sym_tbl {	/* symbol table */
 	uint_t	*sym_byname;	/* symbols sorted by name */
 	uint_t	*sym_byaddr;	/* symbols sorted by addr */
 	size_t	sym_count;	/* number of symbols in each sorted list */
+	void	*sym_idxmap;	/* mmap()ed index cache holding both lists */
+	size_t	sym_idxmapsz;	/* size of sym_idxmap */
 } sym_tbl_t;
 
+/*
+ * Identity of an ELF file in the on-disk symbol table index cache: see
+ * Psymcache.c.
+ */
+typedef struct symtab_key {
+	char	sk_buildid[129]; /* hex ELF build-id, or "" if none */
+	off_t	sk_size;	/* file size */
+	struct timespec sk_mtime; /* file modification time */
+} symtab_key_t;
+
 /*
  * This structure persists even across shared library loads and unloads: it is
  * reference-counted by file_ref and deallocated only when this reaches zero.
@@ -233,6 +246,7 @@ struct ps_prochandle {
 	int	memfd;		/* /proc/<pid>/mem filedescriptor */
 	int	mapfilefd;	/* /proc/<pid>/map_files directory fd */
 	int	info_valid;	/* if zero, map and file info need updating */
+	uint64_t map_gen;	/* see Pmapping_generation() */
 	int	lmids_valid;	/* 0 if we haven't yet scanned the link map */
 	int	elf64;		/* if nonzero, this is a 64-bit process */
 	int	elf_machine;	/* the e_machine of this process */
@@ -270,6 +284,12 @@ extern  uintptr_t Pget_bkpt_ip(struct ps_prochandle *P, int expect_esrch);
 extern  long	Preset_bkpt_ip(struct ps_prochandle *P, uintptr_t addr);
 extern	char *	Pget_proc_status(pid_t pid, const char *field);
 extern	int	Pmapfilefd(struct ps_prochandle *P);
+extern	void	Pmapping_changed(struct ps_prochandle *P);
+extern	int	Psymtab_cache_load(sym_tbl_t *, const symtab_key_t *,
+    const char *);
+extern	void	Psymtab_cache_store(const sym_tbl_t *, const symtab_key_t *,
+    const char *);
+extern	void	Psymtab_index_free(sym_tbl_t *);
 
 #ifdef NEED_SOFTWARE_SINGLESTEP
 extern	uintptr_t	Pget_next_ip(struct ps_prochandle *P);
@@ -277,6 +297,7 @@ extern	uintptr_t	Pget_next_ip(struct ps_prochandle *P);
 
 extern	uintptr_t r_debug(struct ps_prochandle *P);
 extern	char	procfs_path[PATH_MAX];
+extern	char	symtab_cache_path[PATH_MAX];
 
 /*
  * The wrapper functions are somewhat inconsistently named, because we can
@@ -0,0 +1,221 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * On-disk cache of sorted symbol table indexes.
+ *
+ * Sorting a big symbol table by address and by name is the dominant cost of
+ * Pbuild_file_symtab(), yet libc, libjvm and the like are the same in every
+ * process and every run.  When a cache directory is set, the two sorted index
+ * arrays of each table are written there the first time they are computed,
+ * in a file named after the ELF build-id and the table, and are mmap()ed back
+ * on later use instead of being recomputed.  The symbols and strings
+ * themselves are not cached: they are already mmap()ed from the ELF file.
+ *
+ * A cache file records the size and modification time of the ELF file it was
+ * computed from, and the size of its symbol and string tables, and is ignored
+ * unless all of them match.  Every index is also checked to be in range, so a
+ * corrupt or malicious cache file cannot cause lookups to stray out of the
+ * symbol table.  Failure to read or write the cache is never an error: the
+ * indexes are simply computed as they would be without it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <port.h>
+
+#include "libproc.h"
+#include "Pcontrol.h"
+
+#define	SYMCACHE_MAGIC		0x43535444	/* "DTSC" */
+#define	SYMCACHE_VERSION	1
+
+typedef struct symcache_hdr {
+	uint32_t sch_magic;		/* SYMCACHE_MAGIC */
+	uint32_t sch_version;		/* SYMCACHE_VERSION */
+	uint64_t sch_size;		/* size of the ELF file */
+	int64_t	sch_mtime_sec;		/* mtime of the ELF file */
+	int64_t	sch_mtime_nsec;
+	uint64_t sch_symn;		/* entries in the symbol table */
+	uint64_t sch_strsz;		/* size of the string table */
+	uint64_t sch_count;		/* entries in each index */
+} symcache_hdr_t;			/* followed by byaddr[], byname[] */
+
+char	symtab_cache_path[PATH_MAX] = "";
+
+/*
+ * Set the directory holding the symbol table index cache.  NULL or "" turns
+ * the cache off (the default).
+ */
+void
+Pset_symtab_cache_path(const char *path)
+{
+	if (path == NULL)
+		path = "";
+
+	strlcpy(symtab_cache_path, path, sizeof (symtab_cache_path));
+}
+
+static int
+symcache_name(char *buf, size_t len, const symtab_key_t *key,
+    const char *which)
+{
+	if (symtab_cache_path[0] == '\0' || key->sk_buildid[0] == '\0')
+		return (-1);
+
+	if (snprintf(buf, len, "%s/%s.%s", symtab_cache_path,
+		key->sk_buildid, which) >= len)
+		return (-1);
+
+	return (0);
+}
+
+static int
+symcache_hdr_matches(const symcache_hdr_t *hdr, const sym_tbl_t *symtab,
+    const symtab_key_t *key)
+{
+	return (hdr->sch_size == key->sk_size &&
+	    hdr->sch_mtime_sec == key->sk_mtime.tv_sec &&
+	    hdr->sch_mtime_nsec == key->sk_mtime.tv_nsec &&
+	    hdr->sch_symn == symtab->sym_symn &&
+	    hdr->sch_strsz == symtab->sym_strsz);
+}
+
+/*
+ * Try to fill in the sorted indexes of a symbol table from the cache.
+ * Returns 0 on success, -1 if the indexes must be computed.
+ */
+int
+Psymtab_cache_load(sym_tbl_t *symtab, const symtab_key_t *key,
+    const char *which)
+{
+	char name[PATH_MAX];
+	const symcache_hdr_t *hdr;
+	uint_t *idx;
+	void *map;
+	size_t i, size;
+
+	if (symtab->sym_data_pri == NULL || symtab->sym_byaddr != NULL ||
+	    symcache_name(name, sizeof (name), key, which) < 0)
+		return (-1);
+
+	if ((map = cachefile_map(name, sizeof (symcache_hdr_t), SYMCACHE_MAGIC,
+	    SYMCACHE_VERSION, &size)) == NULL)
+		return (-1);
+
+	hdr = map;
+	if (!symcache_hdr_matches(hdr, symtab, key) ||
+	    hdr->sch_count > size / (2 * sizeof (uint_t)) ||
+	    size != sizeof (symcache_hdr_t) +
+	    2 * hdr->sch_count * sizeof (uint_t))
+		goto stale;
+
+	idx = (uint_t *)(hdr + 1);
+	for (i = 0; i < 2 * hdr->sch_count; i++) {
+		if (idx[i] >= symtab->sym_symn)
+			goto stale;
+	}
+
+	symtab->sym_idxmap = map;
+	symtab->sym_idxmapsz = size;
+	symtab->sym_count = hdr->sch_count;
+	symtab->sym_byaddr = idx;
+	symtab->sym_byname = idx + hdr->sch_count;
+
+	_dprintf("%s: %zi %s indexes from cache\n", key->sk_buildid,
+	    symtab->sym_count, which);
+	return (0);
+
+stale:
+	_dprintf("%s: stale %s index cache %s\n", key->sk_buildid, which,
+	    name);
+	munmap(map, size);
+	return (-1);
+}
+
+typedef struct symcache_save {
+	const sym_tbl_t *scs_symtab;	/* table whose indexes are saved */
+	const symtab_key_t *scs_key;	/* ELF file the table comes from */
+} symcache_save_t;
+
+static int
+symcache_save(FILE *fp, void *arg)
+{
+	symcache_save_t *scs = arg;
+	const sym_tbl_t *symtab = scs->scs_symtab;
+	const symtab_key_t *key = scs->scs_key;
+	symcache_hdr_t hdr;
+	size_t n = symtab->sym_count;
+
+	memset(&hdr, 0, sizeof (hdr));
+	hdr.sch_magic = SYMCACHE_MAGIC;
+	hdr.sch_version = SYMCACHE_VERSION;
+	hdr.sch_size = key->sk_size;
+	hdr.sch_mtime_sec = key->sk_mtime.tv_sec;
+	hdr.sch_mtime_nsec = key->sk_mtime.tv_nsec;
+	hdr.sch_symn = symtab->sym_symn;
+	hdr.sch_strsz = symtab->sym_strsz;
+	hdr.sch_count = n;
+
+	if (fwrite(&hdr, sizeof (hdr), 1, fp) != 1 ||
+	    fwrite(symtab->sym_byaddr, sizeof (uint_t), n, fp) != n ||
+	    fwrite(symtab->sym_byname, sizeof (uint_t), n, fp) != n)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Write the freshly-computed sorted indexes of a symbol table to the cache.
+ */
+void
+Psymtab_cache_store(const sym_tbl_t *symtab, const symtab_key_t *key,
+    const char *which)
+{
+	char name[PATH_MAX];
+	symcache_save_t scs;
+
+	if (symtab->sym_byaddr == NULL || symtab->sym_idxmap != NULL ||
+	    symcache_name(name, sizeof (name), key, which) < 0)
+		return;
+
+	scs.scs_symtab = symtab;
+	scs.scs_key = key;
+
+	if (cachefile_write(symtab_cache_path, name, symcache_save, &scs) < 0)
+		_dprintf("cannot write %s index cache %s: %s\n", which, name,
+		    strerror(errno));
+}
+
+/*
+ * Free the sorted indexes of a symbol table, whether computed or cached.
+ */
+void
+Psymtab_index_free(sym_tbl_t *symtab)
+{
+	if (symtab->sym_idxmap != NULL)
+		munmap(symtab->sym_idxmap, symtab->sym_idxmapsz);
+	else {
+		free(symtab->sym_byname);
+		free(symtab->sym_byaddr);
+	}
+
+	symtab->sym_idxmap = NULL;
+	symtab->sym_idxmapsz = 0;
+	symtab->sym_byname = NULL;
+	symtab->sym_byaddr = NULL;
+	symtab->sym_count = 0;
+}
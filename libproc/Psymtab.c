@@ -25,6 +25,7 @@
 #include <sys/ptrace.h>
 #include <port.h>
 #include <setjmp.h>
+#include <pthread.h>
 
 #include <mutex.h>
 
@@ -106,11 +107,8 @@ file_info_del(struct ps_prochandle *P, file_info_t *fptr)
 	    fptr->file_pname);
 
 	dt_list_delete(&P->file_list, fptr);
-	free(fptr->file_symtab.sym_byname);
-	free(fptr->file_symtab.sym_byaddr);
-
-	free(fptr->file_dynsym.sym_byname);
-	free(fptr->file_dynsym.sym_byaddr);
+	Psymtab_index_free(&fptr->file_symtab);
+	Psymtab_index_free(&fptr->file_dynsym);
 
 	if (fptr->file_lo)
 		free(fptr->file_lo->rl_scope);
@@ -437,6 +435,175 @@ Pupdate_symsearch(struct ps_prochandle *P, struct file_info *fptr)
 	*jmp_pad = old_exec_jmp;
 }
 
+/*
+ * Release one mapping that has gone away (or changed) since the last
+ * Pupdate_maps().  Its prmap_file_t is tidied up by mapping_reindex().
+ */
+static void
+mapping_drop(map_info_t *mptr)
+{
+	if (mptr->map_file != NULL)
+		mptr->map_file->file_ref--;
+
+	free(mptr->map_pmap->pr_mapaddrname);
+	free(mptr->map_pmap);
+	mptr->map_pmap = NULL;
+	mptr->map_file = NULL;
+}
+
+/*
+ * Return nonzero if a mapping is identical to one just read from
+ * /proc/$pid/maps, and can therefore be kept as it is.
+ */
+static int
+mapping_unchanged(const prmap_t *pmptr, uintptr_t laddr, uintptr_t haddr,
+    int mflags, dev_t dev, ino_t inode, const char *fn)
+{
+	return (pmptr->pr_vaddr == laddr &&
+	    pmptr->pr_size == haddr - laddr &&
+	    pmptr->pr_mflags == mflags &&
+	    pmptr->pr_dev == dev &&
+	    pmptr->pr_inum == inode &&
+	    strcmp(pmptr->pr_file->prf_mapname, fn) == 0);
+}
+
+/*
+ * Recompute everything that depends on the position of mappings in the
+ * (address-sorted) mappings array: the per-name lists of mappings, the
+ * primary text and first segment of each name, the index of each file's
+ * primary mapping, and the executable and dynamic linker mappings.  Names
+ * no longer mapped at all are freed.
+ *
+ * This is cheap next to reading and parsing the maps file, and much simpler
+ * than patching up every index as mappings come and go.
+ */
+static int
+mapping_reindex(struct ps_prochandle *P, const char *exefile)
+{
+	file_info_t *fptr;
+	size_t i;
+
+	for (i = 0; i < MAP_HASH_BUCKETS; i++) {
+		prmap_file_t *prf;
+
+		for (prf = P->map_files[i]; prf != NULL; prf = prf->prf_next) {
+			prf->prf_num_mappings = 0;
+			prf->prf_text_map = NULL;
+			prf->first_segment = NULL;
+		}
+	}
+
+	for (i = 0, fptr = dt_list_next(&P->file_list);
+	     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
+		fptr->file_map = -1;
+		if (fptr->file_symsearch) {
+			free(fptr->file_symsearch);
+			fptr->file_symsearch = NULL;
+			fptr->file_nsymsearch = 0;
+		}
+	}
+
+	P->map_exec = -1;
+	P->map_ldso = -1;
+
+	for (i = 0; i < P->num_mappings; i++) {
+		map_info_t *mptr = &P->mappings[i];
+		prmap_t *pmptr = mptr->map_pmap;
+		prmap_file_t *prf = pmptr->pr_file;
+		struct prmap **new_prf_mappings;
+
+		new_prf_mappings = realloc(prf->prf_mappings,
+		    (prf->prf_num_mappings + 1) * sizeof (struct prmap_t *));
+
+		if (new_prf_mappings == NULL)
+			return (-1);
+
+		prf->prf_mappings = new_prf_mappings;
+		prf->prf_mappings[prf->prf_num_mappings] = pmptr;
+		prf->prf_num_mappings++;
+
+		/*
+		 * Note down the first mapping encountered: this is the base for
+		 * segment/offset calculations.  Also note the mapping that
+		 * likely corresponds to the place code will be executed out of.
+		 */
+		if (prf->first_segment == NULL)
+			prf->first_segment = pmptr;
+
+		if (pmptr->pr_mflags & MA_EXEC) {
+			char *basename = strrchr(prf->prf_mapname, '/');
+			char *suffix = strrchr(prf->prf_mapname, '.');
+
+			/*
+			 * The primary text mapping must correspond to an
+			 * on-disk mapping somewhere (since we cannot mmap()
+			 * nor create a file_info for anonymous mappings).
+			 * This is universally true in any case.
+			 */
+			if ((prf->prf_text_map == NULL) &&
+			    (prf->prf_mapname[0] == '/'))
+				prf->prf_text_map = pmptr;
+
+			/*
+			 * Heuristic to recognize the dynamic linker.  Works
+			 * for /lib, /lib64, and Debian multiarch as well as
+			 * conventional /lib/ld-2.13.so style systems.	(All
+			 * versions of glibc 2.x name their dynamic linker
+			 * something like ld-*.so.)
+			 *
+			 * If this heuristic fails, object_name_to_map() can use
+			 * the AT_BASE auxv entry to come up with another guess
+			 * (though this is likely to be stymied by dynamic
+			 * linker relocation for non-statically-linked
+			 * programs).
+			 */
+
+			if (basename && suffix && P->map_ldso == -1 &&
+			    !P->no_dyn &&
+			    (strncmp(prf->prf_mapname, "/lib", 4) == 0) &&
+			    (strncmp(basename, "/ld-", 4) == 0) &&
+			    (strcmp(suffix, ".so") == 0))
+				P->map_ldso = i;
+
+			/*
+			 * Recognize the executable mapping.
+			 */
+
+			if (exefile[0] != '\0' && P->map_exec == -1 &&
+			    (strcmp(prf->prf_mapname, exefile) == 0))
+				P->map_exec = i;
+		}
+
+		if (mptr->map_file &&
+		    mptr->map_file->file_map == -1 &&
+		    prf->prf_text_map == pmptr)
+			mptr->map_file->file_map = i;
+	}
+
+	/*
+	 * Free names with no mappings left.
+	 */
+	for (i = 0; i < MAP_HASH_BUCKETS; i++) {
+		prmap_file_t **prfp = &P->map_files[i];
+
+		while (*prfp != NULL) {
+			prmap_file_t *prf = *prfp;
+
+			if (prf->prf_num_mappings > 0) {
+				prfp = &prf->prf_next;
+				continue;
+			}
+
+			*prfp = prf->prf_next;
+			free(prf->prf_mappings);
+			free(prf->prf_mapname);
+			free(prf);
+		}
+	}
+
+	return (0);
+}
+
 /*
  * Go through all the address space mappings, validating or updating
  * the information already gathered, or gathering new information.
@@ -452,7 +619,10 @@ Pupdate_maps(struct ps_prochandle *P)
 	char exefile[PATH_MAX + 10] = "";	/* strlen(" (deleted)") */
 	FILE *fp;
 
-	size_t old_num_mappings = P->num_mappings;
+	map_info_t *old_mappings;
+	size_t old_num_mappings;
+	size_t old_i = 0, kept = 0;
+	size_t mappings_size = 0;
 	size_t i = 0;
 	char *fn = NULL;
 	char *mapaddrname = NULL;
@@ -466,22 +636,23 @@ Pupdate_maps(struct ps_prochandle *P)
 		return;
 
 	_dprintf("Updating mappings for PID %i\n", P->pid);
+	Pmapping_changed(P);
 
 	/*
-	 * For now, just throw away and reconstruct all the mappings from
-	 * scratch.  This is theoretically inefficient, as a dlopen() or
-	 * dlclose() will normally change only a few mappings: but it is much
-	 * simpler to implement than the alternatives, and it ends up being
-	 * cheaper than expected because we can avoid having to resort any of
-	 * the mappings arrays (since /proc/$pid/maps is always sorted by
-	 * address).  We are left with allocator overhead and nothing else.
+	 * A dlopen() or dlclose() will normally change only a few mappings,
+	 * but a process may have very many of them, so rather than throwing
+	 * away and reconstructing all the mappings, merge the new maps file
+	 * into the old mappings array.  Both are sorted by address, so this is
+	 * a single pass over each: mappings identical to the old ones are
+	 * kept, together with their file_info_t and symbol tables, and only
+	 * the ranges that have changed are freed or allocated.  Everything
+	 * that depends on the position of mappings in the array is then
+	 * recomputed by mapping_reindex().
 	 *
-	 * Because it is much more expensive to recompute the file_info_t, we
-	 * preserve them (with zero reference count) and reuse them where
-	 * possible.
+	 * file_info_t's of dropped mappings are preserved (with zero reference
+	 * count) until the end, so that a new mapping of an already-known file
+	 * can reuse it.
 	 */
-	mapping_purge(P);
-
 	(void) snprintf(mapfile, sizeof (mapfile), "%s/%d/maps",
 	    procfs_path, (int)P->pid);
 	if ((fp = fopen(mapfile, "r")) == NULL) {
@@ -494,6 +665,11 @@ Pupdate_maps(struct ps_prochandle *P)
 	if ((len = readlink(exefilesym, exefile, sizeof (exefile))) > 0)
 		exefile[len] = '\0';
 
+	old_mappings = P->mappings;
+	old_num_mappings = P->num_mappings;
+	P->mappings = NULL;
+	P->num_mappings = 0;
+
 	while (getline(&line, &len, fp) >= 0) {
 		unsigned long laddr, haddr, offset;
 		ino_t	inode;
@@ -504,7 +680,7 @@ Pupdate_maps(struct ps_prochandle *P)
 		map_info_t *mptr;
 		prmap_file_t *prf;
 		prmap_t *pmptr;
-		struct prmap **new_prf_mappings;
+		int mflags = 0;
 
 		/*
 		 * gcc complains:
@@ -526,25 +702,60 @@ Pupdate_maps(struct ps_prochandle *P)
 		if ((fn == NULL) || (mapaddrname == NULL) || (fn[0] == '[')) {
 			free(fn);
 			free(mapaddrname);
+			fn = NULL;
+			mapaddrname = NULL;
 			continue;
 		}
 
+		if (perms[0] == 'r')
+			mflags |= MA_READ;
+		if (perms[1] == 'w')
+			mflags |= MA_WRITE;
+		if (perms[2] == 'x')
+			mflags |= MA_EXEC;
+
 		/*
-		 * Allocate a new map_info, and see if we need to allocate a new
-		 * map_file.  Expand the map_info region only if necessary.
-		 * (This makes multiple sequential unmaps cheaper, though
-		 * nothing we can do can make multiple sequential maps cheap.)
+		 * Expand the mappings array geometrically, since it is now
+		 * always built afresh.
 		 */
-
-		if (P->num_mappings >= old_num_mappings) {
+		if (P->num_mappings >= mappings_size) {
+			size_t new_size = mappings_size ? mappings_size * 2 :
+			    old_num_mappings + 16;
 			map_info_t *mappings = realloc(P->mappings,
-			    sizeof (struct map_info) * (P->num_mappings + 1));
+			    sizeof (struct map_info) * new_size);
 			if (!mappings)
 				goto err;
 			P->mappings = mappings;
+			mappings_size = new_size;
 		}
 
 		mptr = &P->mappings[P->num_mappings];
+
+		/*
+		 * Old mappings below this one have gone away.  If the next old
+		 * mapping is identical to this one, keep it.
+		 */
+		while (old_i < old_num_mappings &&
+		    old_mappings[old_i].map_pmap->pr_vaddr < laddr)
+			mapping_drop(&old_mappings[old_i++]);
+
+		if (old_i < old_num_mappings &&
+		    mapping_unchanged(old_mappings[old_i].map_pmap, laddr,
+			haddr, mflags, makedev(major, minor), inode, fn)) {
+			*mptr = old_mappings[old_i++];
+			free(fn);
+			free(mapaddrname);
+			fn = NULL;
+			mapaddrname = NULL;
+			P->num_mappings++;
+			kept++;
+			continue;
+		}
+
+		/*
+		 * A new mapping: allocate a new prmap, and see if we need to
+		 * allocate a new map_file.
+		 */
 		memset(mptr, 0, sizeof (struct map_info));
 
 		mptr->map_pmap = malloc(sizeof (struct prmap));
@@ -566,87 +777,18 @@ Pupdate_maps(struct ps_prochandle *P)
 			prf->prf_next = P->map_files[h];
 			P->map_files[h] = prf;
 		}
-		else {
+		else
 			free(fn);
-			fn = NULL;
-		}
-
-		new_prf_mappings = realloc(prf->prf_mappings,
-		    (prf->prf_num_mappings + 1) * sizeof (struct prmap_t *));
-
-		if (new_prf_mappings == NULL) {
-			free(mptr->map_pmap);
-			goto err;
-		}
-
-		prf->prf_mappings = new_prf_mappings;
-		prf->prf_mappings[prf->prf_num_mappings] = pmptr;
-		prf->prf_num_mappings++;
+		fn = NULL;
 
 		pmptr->pr_vaddr = laddr;
 		pmptr->pr_size = haddr - laddr;
 		pmptr->pr_mapaddrname = mapaddrname;
-
-		/*
-		 * Note down the first mapping encountered: this is the base for
-		 * segment/offset calculations.  Also note the mapping that
-		 * likely corresponds to the place code will be executed out of.
-		 */
-                if (prf->first_segment == NULL)
-			prf->first_segment = pmptr;
-		if (perms[0] == 'r')
-			pmptr->pr_mflags |= MA_READ;
-		if (perms[1] == 'w') {
-			pmptr->pr_mflags |= MA_WRITE;
-		}
-		if (perms[2] == 'x') {
-			char *basename = strrchr(prf->prf_mapname, '/');
-			char *suffix = strrchr(prf->prf_mapname, '.');
-
-			pmptr->pr_mflags |= MA_EXEC;
-
-			/*
-			 * The primary text mapping must correspond to an
-			 * on-disk mapping somewhere (since we cannot mmap()
-			 * nor create a file_info for anonymous mappings).
-			 * This is universally true in any case.
-			 */
-			if ((prf->prf_text_map == NULL) &&
-			    (prf->prf_mapname[0] == '/'))
-				prf->prf_text_map = pmptr;
-
-			/*
-			 * Heuristic to recognize the dynamic linker.  Works
-			 * for /lib, /lib64, and Debian multiarch as well as
-			 * conventional /lib/ld-2.13.so style systems.	(All
-			 * versions of glibc 2.x name their dynamic linker
-			 * something like ld-*.so.)
-			 *
-			 * If this heuristic fails, object_name_to_map() can use
-			 * the AT_BASE auxv entry to come up with another guess
-			 * (though this is likely to be stymied by dynamic
-			 * linker relocation for non-statically-linked
-			 * programs).
-			 */
-
-			if (basename && suffix && P->map_ldso == -1 &&
-			    !P->no_dyn &&
-			    (strncmp(prf->prf_mapname, "/lib", 4) == 0) &&
-			    (strncmp(basename, "/ld-", 4) == 0) &&
-			    (strcmp(suffix, ".so") == 0))
-				P->map_ldso = P->num_mappings;
-
-			/*
-			 * Recognize the executable mapping.
-			 */
-
-			if (exefile[0] != '\0' && P->map_exec == -1 &&
-			    (strcmp(prf->prf_mapname, exefile) == 0))
-				P->map_exec = P->num_mappings;
-		}
+		pmptr->pr_mflags = mflags;
 		pmptr->pr_dev = makedev(major, minor);
 		pmptr->pr_inum = inode;
 		pmptr->pr_file = prf;
+		mapaddrname = NULL;
 
 		/*
 		 * We try to merge any file information we may have for existing
@@ -687,11 +829,6 @@ Pupdate_maps(struct ps_prochandle *P)
 				 * mappings.
 				 */
 			}
-
-			if (mptr->map_file &&
-			    mptr->map_file->file_map == -1 &&
-			    mptr->map_pmap->pr_file->prf_text_map == mptr->map_pmap)
-				mptr->map_file->file_map = P->num_mappings;
 		}
 
 		_dprintf("Added mapping for %s: %lx(%lx)\n", prf->prf_mapname,
@@ -699,6 +836,17 @@ Pupdate_maps(struct ps_prochandle *P)
 		P->num_mappings++;
 	}
 
+	while (old_i < old_num_mappings)
+		mapping_drop(&old_mappings[old_i++]);
+	free(old_mappings);
+	old_mappings = NULL;
+
+	_dprintf("Kept %zu of %zu mappings for PID %i, now %zu\n", kept,
+	    old_num_mappings, P->pid, P->num_mappings);
+
+	if (mapping_reindex(P, exefile) < 0)
+		goto err;
+
 	/*
 	 * Drop file_info_t's corresponding to closed mappings, which will still
 	 * have a zero refcount.
@@ -727,6 +875,14 @@ Pupdate_maps(struct ps_prochandle *P)
 	return;
 
 err:
+	/*
+	 * Drop any old mappings not yet merged: Preset_maps() frees the rest.
+	 */
+	if (old_mappings != NULL) {
+		while (old_i < old_num_mappings)
+			mapping_drop(&old_mappings[old_i++]);
+		free(old_mappings);
+	}
 	fclose(fp);
 	free(fn);
 	free(mapaddrname);
@@ -856,11 +1012,22 @@ Pname_to_map(struct ps_prochandle *P, const char *name)
 }
 
 /*
- * We wouldn't need these if qsort(3C) took an argument for the callback...
+ * Context for the symbol index comparators, passed through qsort_r(3), so that
+ * any number of symbol tables can be sorted at the same time.
+ */
+typedef struct symsort {
+	GElf_Sym *ss_syms;		/* copy of the symbols being sorted */
+	char *ss_strs;			/* their string table */
+	uint_t *ss_index;		/* index array to sort */
+	size_t ss_count;		/* number of entries in ss_index */
+	int (*ss_cmp)(const void *, const void *, void *);
+} symsort_t;
+
+/*
+ * Symbol tables with at least this many entries have their by-name index
+ * sorted on a separate thread, concurrently with the by-address index.
  */
-static mutex_t sort_mtx = DEFAULTMUTEX;
-static char *sort_strs;
-static GElf_Sym *sort_syms;
+#define	SYMSORT_PARALLEL_MIN	16384
 
 static int
 byaddr_cmp_common(GElf_Sym *a, char *aname, GElf_Sym *b, char *bname)
@@ -927,27 +1094,38 @@ byaddr_cmp_common(GElf_Sym *a, char *aname, GElf_Sym *b, char *bname)
 }
 
 static int
-byaddr_cmp(const void *aa, const void *bb)
+byaddr_cmp(const void *aa, const void *bb, void *arg)
 {
-	GElf_Sym *a = &sort_syms[*(uint_t *)aa];
-	GElf_Sym *b = &sort_syms[*(uint_t *)bb];
-	char *aname = sort_strs + a->st_name;
-	char *bname = sort_strs + b->st_name;
+	symsort_t *ss = arg;
+	GElf_Sym *a = &ss->ss_syms[*(uint_t *)aa];
+	GElf_Sym *b = &ss->ss_syms[*(uint_t *)bb];
+	char *aname = ss->ss_strs + a->st_name;
+	char *bname = ss->ss_strs + b->st_name;
 
 	return (byaddr_cmp_common(a, aname, b, bname));
 }
 
 static int
-byname_cmp(const void *aa, const void *bb)
+byname_cmp(const void *aa, const void *bb, void *arg)
 {
-	GElf_Sym *a = &sort_syms[*(uint_t *)aa];
-	GElf_Sym *b = &sort_syms[*(uint_t *)bb];
-	char *aname = sort_strs + a->st_name;
-	char *bname = sort_strs + b->st_name;
+	symsort_t *ss = arg;
+	GElf_Sym *a = &ss->ss_syms[*(uint_t *)aa];
+	GElf_Sym *b = &ss->ss_syms[*(uint_t *)bb];
+	char *aname = ss->ss_strs + a->st_name;
+	char *bname = ss->ss_strs + b->st_name;
 
 	return (strcmp(aname, bname));
 }
 
+static void *
+symsort_thread(void *arg)
+{
+	symsort_t *ss = arg;
+
+	qsort_r(ss->ss_index, ss->ss_count, sizeof (uint_t), ss->ss_cmp, ss);
+	return (NULL);
+}
+
 /*
  * Given a symbol index, look up the corresponding symbol from the
  * given symbol table.
@@ -1003,6 +1181,8 @@ optimize_symtab(sym_tbl_t *symtab)
 	GElf_Sym *symp, *syms;
 	uint_t i, *indexa, *indexb;
 	size_t symn, strsz, count;
+	symsort_t byaddr, byname;
+	pthread_t tid;
 
 	if (symtab == NULL || symtab->sym_data_pri == NULL ||
 	    symtab->sym_byaddr != NULL)
@@ -1055,20 +1235,70 @@ optimize_symtab(sym_tbl_t *symtab)
 	}
 
 	/*
-	 * Sort the two tables according to the appropriate criteria.
+	 * Sort the two tables according to the appropriate criteria.  The
+	 * sorts are independent, so for big tables the by-name sort runs on a
+	 * thread of its own while this one sorts by address.  If the thread
+	 * cannot be created, both sorts simply happen here.
 	 */
-	(void) mutex_lock(&sort_mtx);
-	sort_strs = symtab->sym_strs;
-	sort_syms = syms;
+	byaddr.ss_syms = byname.ss_syms = syms;
+	byaddr.ss_strs = byname.ss_strs = symtab->sym_strs;
+	byaddr.ss_count = byname.ss_count = count;
+	byaddr.ss_index = symtab->sym_byaddr;
+	byaddr.ss_cmp = byaddr_cmp;
+	byname.ss_index = symtab->sym_byname;
+	byname.ss_cmp = byname_cmp;
+
+	if (count >= SYMSORT_PARALLEL_MIN &&
+	    pthread_create(&tid, NULL, symsort_thread, &byname) == 0) {
+		symsort_thread(&byaddr);
+		pthread_join(tid, NULL);
+	} else {
+		symsort_thread(&byaddr);
+		symsort_thread(&byname);
+	}
+
+	free(syms);
+}
 
-	qsort(symtab->sym_byaddr, count, sizeof (uint_t), byaddr_cmp);
-	qsort(symtab->sym_byname, count, sizeof (uint_t), byname_cmp);
+/*
+ * Sort a symbol table for lookups, or fetch its sorted indexes from the
+ * on-disk cache if possible.
+ */
+static void
+index_symtab(sym_tbl_t *symtab, const symtab_key_t *key, const char *which)
+{
+	if (Psymtab_cache_load(symtab, key, which) == 0)
+		return;
 
-	sort_strs = NULL;
-	sort_syms = NULL;
-	(void) mutex_unlock(&sort_mtx);
+	optimize_symtab(symtab);
+	Psymtab_cache_store(symtab, key, which);
+}
 
-	free(syms);
+/*
+ * Extract the GNU build-id, if any, from a note section, as a hex string.
+ */
+static void
+note_buildid(Elf_Data *data, symtab_key_t *key)
+{
+	GElf_Nhdr nhdr;
+	size_t off = 0, name_off, desc_off;
+
+	while ((off = gelf_getnote(data, off, &nhdr, &name_off,
+		    &desc_off)) > 0) {
+		const unsigned char *desc;
+		size_t i;
+
+		if (nhdr.n_type != NT_GNU_BUILD_ID || nhdr.n_namesz != 4 ||
+		    memcmp((char *)data->d_buf + name_off, "GNU", 4) != 0 ||
+		    nhdr.n_descsz == 0 ||
+		    nhdr.n_descsz * 2 >= sizeof (key->sk_buildid))
+			continue;
+
+		desc = (const unsigned char *)data->d_buf + desc_off;
+		for (i = 0; i < nhdr.n_descsz; i++)
+			snprintf(&key->sk_buildid[i * 2], 3, "%02x", desc[i]);
+		return;
+	}
 }
 
 /*
@@ -1089,6 +1319,8 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	size_t nshdrs, shstrndx;
 	int mapfilefd;
 	int err;
+	symtab_key_t key;
+	struct stat s;
 	jmp_buf * volatile old_exec_jmp;
 	jmp_buf **jmp_pad, this_exec_jmp;
 
@@ -1249,7 +1481,18 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 		goto bad;
 	}
 	velf = elf;
+
+	/*
+	 * Identify the file for the symbol table index cache.  The build-id
+	 * is filled in from the notes below.
+	 */
+	memset(&key, 0, sizeof (key));
+	if (fstat(fd, &s) == 0) {
+		key.sk_size = s.st_size;
+		key.sk_mtime = s.st_mtim;
+	}
 	close(fd);
+
 	if ((cache = malloc(nshdrs * sizeof (*cache))) == NULL) {
 		_dprintf("failed to malloc section cache for mapping of %s\n",
 		    fptr->file_pname);
@@ -1295,6 +1538,9 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	for (i = 1, cp = cache + 1; i < nshdrs; i++, cp++) {
 		GElf_Shdr *shp = &cp->c_shdr;
 
+		if (shp->sh_type == SHT_NOTE && key.sk_buildid[0] == '\0')
+			note_buildid(cp->c_data, &key);
+
 		if (shp->sh_type == SHT_SYMTAB || shp->sh_type == SHT_DYNSYM) {
 			sym_tbl_t *symp = shp->sh_type == SHT_SYMTAB ?
 			    &fptr->file_symtab : &fptr->file_dynsym;
@@ -1348,8 +1594,8 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	 * was included in the core file. Before we perform any lookups, we
 	 * create sorted versions to optimize for lookups.
 	 */
-	optimize_symtab(&fptr->file_symtab);
-	optimize_symtab(&fptr->file_dynsym);
+	index_symtab(&fptr->file_symtab, &key, "symtab");
+	index_symtab(&fptr->file_dynsym, &key, "dynsym");
 
 	free(cache);
 
@@ -1836,6 +2082,50 @@ sym_search_next(struct ps_prochandle *P, file_info_t *fptr,
 	return NULL;
 }
 
+/*
+ * Search the symbol tables of one object for the symbol containing addr,
+ * returning it (relocated to the object's load address) and its name.
+ */
+static int
+file_sym_by_addr(file_info_t *fptr, uintptr_t addr, GElf_Sym *symbolp,
+    char **namep)
+{
+	GElf_Sym	*symp;
+	GElf_Sym	sym1, *sym1p = NULL;
+	GElf_Sym	sym2, *sym2p = NULL;
+	char		*name1 = NULL;
+	char		*name2 = NULL;
+	uint_t		i1;
+	uint_t		i2;
+
+	/*
+	 * Adjust the address by the load object base address in case the
+	 * address turns out to be in a shared library.  (This will likely fail
+	 * or work only erratically for noninvasive grabs, since we cannot
+	 * determine the runtime value of file_dyn_base in that case.)
+	 */
+	addr -= fptr->file_dyn_base;
+
+	/*
+	 * Search both symbol tables, symtab first, then dynsym.
+	 */
+	if ((sym1p = sym_by_addr(&fptr->file_symtab, addr, &sym1, &i1)) != NULL)
+		name1 = fptr->file_symtab.sym_strs + sym1.st_name;
+	if ((sym2p = sym_by_addr(&fptr->file_dynsym, addr, &sym2, &i2)) != NULL)
+		name2 = fptr->file_dynsym.sym_strs + sym2.st_name;
+
+	if ((symp = sym_prefer(sym1p, name1, sym2p, name2)) == NULL)
+		return (-1);
+
+	*namep = (symp == sym1p) ? name1 : name2;
+	*symbolp = *symp;
+
+	if (GELF_ST_TYPE(symbolp->st_info) != STT_TLS)
+		symbolp->st_value += fptr->file_dyn_base;
+
+	return (0);
+}
+
 /*
  * Search the process symbol tables looking for a symbol whose
  * value to value+size contain the address specified by addr.
@@ -1848,14 +2138,7 @@ int
 Plookup_by_addr(struct ps_prochandle *P, uintptr_t addr, char *sym_name_buffer,
     size_t bufsize, GElf_Sym *symbolp)
 {
-	GElf_Sym	*symp;
 	char		*name;
-	GElf_Sym	sym1, *sym1p = NULL;
-	GElf_Sym	sym2, *sym2p = NULL;
-	char		*name1 = NULL;
-	char		*name2 = NULL;
-	uint_t		i1;
-	uint_t		i2;
 	map_info_t	*mptr;
 	file_info_t	*fptr;
 
@@ -1875,35 +2158,137 @@ Plookup_by_addr(struct ps_prochandle *P, uintptr_t addr, char *sym_name_buffer,
 	if (fptr->file_elf == NULL)			/* not an ELF file */
 		return (-1);
 
-	/*
-	 * Adjust the address by the load object base address in case the
-	 * address turns out to be in a shared library.  (This will likely fail
-	 * or work only erratically for noninvasive grabs, since we cannot
-	 * determine the runtime value of file_dyn_base in that case.)
-	 */
-	addr -= fptr->file_dyn_base;
-
-	/*
-	 * Search both symbol tables, symtab first, then dynsym.
-	 */
-	if ((sym1p = sym_by_addr(&fptr->file_symtab, addr, &sym1, &i1)) != NULL)
-		name1 = fptr->file_symtab.sym_strs + sym1.st_name;
-	if ((sym2p = sym_by_addr(&fptr->file_dynsym, addr, &sym2, &i2)) != NULL)
-		name2 = fptr->file_dynsym.sym_strs + sym2.st_name;
-
-	if ((symp = sym_prefer(sym1p, name1, sym2p, name2)) == NULL)
+	if (file_sym_by_addr(fptr, addr, symbolp, &name) < 0)
 		return (-1);
 
-	name = (symp == sym1p) ? name1 : name2;
 	if (bufsize > 0) {
 		(void) strncpy(sym_name_buffer, name, bufsize);
 		sym_name_buffer[bufsize - 1] = '\0';
 	}
 
-	*symbolp = *symp;
+	return (0);
+}
 
-	if (GELF_ST_TYPE(symbolp->st_info) != STT_TLS)
-		symbolp->st_value += fptr->file_dyn_base;
+static int
+psa_addr_cmp(const void *a, const void *b)
+{
+	const prsymaddr_t *lhs = *(const prsymaddr_t **)a;
+	const prsymaddr_t *rhs = *(const prsymaddr_t **)b;
+
+	if (lhs->psa_addr < rhs->psa_addr)
+		return (-1);
+	if (lhs->psa_addr > rhs->psa_addr)
+		return (1);
+	return (0);
+}
+
+/*
+ * Look up many addresses at once, filling in the mapping, object name and
+ * symbol (if any) of each element of psa[].  The addresses are visited in
+ * sorted order, so that the mappings are walked once, in step with them,
+ * rather than searched afresh for every address, and each object's symbol
+ * table is built or checked once for the whole run of addresses within it.
+ * Repeated addresses are resolved only once.
+ *
+ * The strings and mappings returned are only valid until the mappings next
+ * change.  Returns 0 on success (even if some addresses were not resolved),
+ * -1 on failure.
+ */
+int
+Plookup_by_addrs(struct ps_prochandle *P, prsymaddr_t *psa, size_t n)
+{
+	prsymaddr_t ** volatile sorted;
+	file_info_t *last = NULL;
+	size_t i, mpidx = 0;
+	jmp_buf * volatile old_exec_jmp;
+	jmp_buf **jmp_pad, this_exec_jmp;
+
+	if (P->state == PS_DEAD)
+		return (-1);
+
+	if (n == 0)
+		return (0);
+
+	Pupdate_maps(P);
+	Pupdate_lmids(P);
+
+	if ((sorted = malloc(n * sizeof (prsymaddr_t *))) == NULL)
+		return (-1);
+
+	for (i = 0; i < n; i++) {
+		psa[i].psa_map = NULL;
+		psa[i].psa_object = NULL;
+		psa[i].psa_name = NULL;
+		sorted[i] = &psa[i];
+	}
+
+	qsort(sorted, n, sizeof (prsymaddr_t *), psa_addr_cmp);
+
+	/*
+	 * If we spot an exec() while building a symbol table, free everything
+	 * and rethrow.
+	 */
+	jmp_pad = libproc_unwinder_pad(P);
+	old_exec_jmp = *jmp_pad;
+	if (setjmp(this_exec_jmp)) {
+		free(sorted);
+
+		if (old_exec_jmp)
+			longjmp(*old_exec_jmp, 1);
+		*jmp_pad = old_exec_jmp;
+
+		return (-1);
+	}
+	*jmp_pad = &this_exec_jmp;
+
+	for (i = 0; i < n; i++) {
+		prsymaddr_t *p = sorted[i];
+		const prmap_t *pmap;
+		file_info_t *fptr;
+		char *name;
+
+		if (i > 0 && p->psa_addr == sorted[i - 1]->psa_addr) {
+			*p = *sorted[i - 1];
+			continue;
+		}
+
+		while (mpidx < P->num_mappings &&
+		    P->mappings[mpidx].map_pmap->pr_vaddr +
+		    P->mappings[mpidx].map_pmap->pr_size <= p->psa_addr)
+			mpidx++;
+
+		if (mpidx == P->num_mappings)
+			break;
+
+		pmap = P->mappings[mpidx].map_pmap;
+		if (p->psa_addr < pmap->pr_vaddr)
+			continue;			/* in a hole */
+
+		p->psa_map = pmap;
+
+		if ((fptr = P->mappings[mpidx].map_file) == NULL)
+			continue;
+
+		if (fptr->file_lname != NULL)
+			p->psa_object = fptr->file_lname;
+		else
+			p->psa_object = fptr->file_pname;
+
+		if (fptr != last) {
+			Pbuild_file_symtab(P, fptr);
+			last = fptr;
+		}
+
+		if (fptr->file_elf == NULL)		/* not an ELF file */
+			continue;
+
+		if (file_sym_by_addr(fptr, p->psa_addr, &p->psa_sym,
+			&name) == 0)
+			p->psa_name = name;
+	}
+
+	*jmp_pad = old_exec_jmp;
+	free(sorted);
 
 	return (0);
 }
@@ -2336,4 +2721,29 @@ Preset_maps(struct ps_prochandle *P)
 	file_info_purge(P);
 
 	P->info_valid = 0;
+	Pmapping_changed(P);
+}
+
+/*
+ * Note that the mappings may have changed, by moving the process on to a new
+ * mapping generation.
+ */
+void
+Pmapping_changed(struct ps_prochandle *P)
+{
+	static mutex_t map_gen_lock = DEFAULTMUTEX;
+	static uint64_t map_gen;
+
+	mutex_lock(&map_gen_lock);
+	P->map_gen = ++map_gen;
+	mutex_unlock(&map_gen_lock);
+}
+
+uint64_t
+Pmapping_generation(struct ps_prochandle *P)
+{
+	if (P->state != PS_DEAD)
+		Pupdate_maps(P);
+
+	return (P->map_gen);
 }
@@ -96,6 +96,8 @@ extern 	ssize_t	Pread_scalar_quietly(struct ps_prochandle *P, void *buf,
     size_t nbyte, size_t nscalar, uintptr_t address, int quietly);
 extern	int	Phasfds(struct ps_prochandle *);
 extern	void	Pset_procfs_path(const char *);
+extern	const char *Pprocfs_path(void);
+extern	void	Pset_symtab_cache_path(const char *);
 extern	int	Pdynamically_linked(struct ps_prochandle *);
 extern	int	Ptraceable(struct ps_prochandle *);
 extern	int	Pelf64(struct ps_prochandle *);
@@ -223,6 +225,22 @@ extern 	uintptr_t Pbkpt_addr(struct ps_prochandle *P);
 extern int Plookup_by_addr(struct ps_prochandle *,
     uintptr_t, char *, size_t, GElf_Sym *);
 
+/*
+ * Resolve many addresses in one call: much cheaper than a Plookup_by_addr(),
+ * Pobjname() and Paddr_to_map() per address.  Only psa_addr is read: the
+ * other fields are filled in.  The strings and mapping returned are only
+ * valid until the mappings next change.
+ */
+typedef struct prsymaddr {
+	uintptr_t	psa_addr;		/* address to look up */
+	const prmap_t	*psa_map;		/* containing mapping, or NULL */
+	const char	*psa_object;		/* object name, or NULL */
+	const char	*psa_name;		/* symbol name, or NULL */
+	GElf_Sym	psa_sym;		/* symbol, if psa_name is set */
+} prsymaddr_t;
+
+extern int Plookup_by_addrs(struct ps_prochandle *, prsymaddr_t *, size_t);
+
 typedef struct prsyminfo {
 	const char	*prs_object;		/* object name */
 	const char	*prs_name;		/* symbol name */
@@ -299,6 +317,14 @@ extern void Pupdate_syms(struct ps_prochandle *);
  */
 extern void Preset_maps(struct ps_prochandle *);
 
+/*
+ * Return a number that changes whenever the victim's address space mappings
+ * may have changed (after dlopen(), dlclose() or exec(), say).  Generations
+ * are unique across all process handles, so a client caching results by pid
+ * can use them to detect a different process with the same pid.
+ */
+extern uint64_t Pmapping_generation(struct ps_prochandle *);
+
 /*
  * Return 1 if this address is within a valid mapping, file-backed mapping, or
  * writable mapping, respectively.
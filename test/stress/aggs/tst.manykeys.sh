@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# Benchmark the aggregation snapshot path: drive a few million distinct
+# keys through a single aggregation and report how long the consumer took
+# to snapshot, merge and print them.  The keys differ only in the order of
+# their bytes, which is the worst case for a poor hash function.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.manykeys.$$
+
+start=$(date +%s%N)
+
+$dtrace $dt_flags -q -x aggsize=512m -x aggrate=10ms -o $tmpfile \
+    -c 'dd if=/dev/zero of=/dev/null bs=1 count=2000000' -n '
+syscall::read:entry,
+syscall::write:entry
+/pid == $target/
+{
+	this->n = n++;
+	@[(this->n & 0xff) << 24 | (this->n >> 8 & 0xff) << 16 |
+	    (this->n >> 16 & 0xff) << 8 | (this->n >> 24 & 0xff)] = count();
+}' 2> /dev/null
+
+status=$?
+end=$(date +%s%N)
+
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	rm -f $tmpfile
+	exit $status
+fi
+
+nkeys=$(grep -c '[0-9]' $tmpfile)
+rm -f $tmpfile
+
+echo "$nkeys keys in $(( (end - start) / 1000000 )) ms"
+
+if [ "$nkeys" -lt 1000000 ]; then
+	echo "$0: expected at least 1000000 keys, got $nkeys"
+	exit 1
+fi
+
+exit 0
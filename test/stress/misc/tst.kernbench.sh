@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# Benchmark the kernel module and symbol tables: symbol lookup by address and
+# by name, and rebuilding the tables by parsing /proc/kallmodsyms and from a
+# kernel snapshot.  Each benchmark also checks its results.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+utils="$(dirname $_test)/../../utils"
+snapdir=$tmpdir/kernbench.$$
+status=0
+
+mkdir -p $snapdir
+
+$utils/kernbench addr 4000000 || status=1
+$utils/kernbench update 20 || status=1
+$utils/kernbench update 20 $snapdir || status=1
+$utils/kernbench name 4000 || status=1
+
+rm -rf $snapdir
+exit $status
@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+##
+#
+# ASSERTION:
+# With -xaggstats, every aggregation snapshot reports how many records were
+# merged through the per-CPU record cache and how many were hashed, and the
+# cache does not change the aggregated values.
+#
+# SECTION: Aggregations/Aggregations
+#
+##
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.aggstats.$$
+
+$dtrace $dt_flags -q -x aggstats -x aggrate=10ms -n '
+tick-1ms
+{
+	@[i++ % 10] = count();
+}
+
+tick-1ms
+/i == 500/
+{
+	exit(0);
+}
+
+END
+{
+	printa("%d %@d\n", @);
+}' 2> $tmpfile > $tmpfile.out
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	cat $tmpfile
+	rm -f $tmpfile $tmpfile.out
+	exit $status
+fi
+
+if ! grep -q 'aggregation records\{0,1\} cached, [0-9]* hashed' $tmpfile; then
+	echo "$0: no aggregation snapshot statistics reported"
+	cat $tmpfile
+	rm -f $tmpfile $tmpfile.out
+	exit 1
+fi
+
+total=$(awk '/^[0-9]+ [0-9]+$/ { n += $2 } END { print n }' $tmpfile.out)
+rm -f $tmpfile $tmpfile.out
+
+if [ "$total" != 500 ]; then
+	echo "$0: expected 500 aggregated events, got $total"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,6 @@
+0 20 950
+1 20 970
+2 20 990
+3 20 1010
+4 20 1030
+
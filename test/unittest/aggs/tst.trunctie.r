@@ -0,0 +1,9 @@
+a 195 1
+a 196 1
+a 197 1
+a 198 1
+a 199 1
+b 1 66
+b 2 66
+b 0 67
+
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# @@timeout: 15
+
+#
+# With -xswitchrate=auto, a principal buffer that fills up within the default
+# switchrate makes the consumer shorten the switchrate, and the decision is
+# logged.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.switchrate-auto.$$
+
+$dtrace $dt_flags -q -x switchrate=auto -x bufsize=16k -o /dev/null -n '
+tick-1ms
+{
+	printf("%d %d\n", i++, timestamp);
+}
+
+tick-1sec
+/++n == 4/
+{
+	exit(0);
+}' 2> $tmpfile
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	cat $tmpfile
+	rm -f $tmpfile
+	exit $status
+fi
+
+if ! grep -q 'switchrate=auto: switchrate [0-9]*ns -> [0-9]*ns' $tmpfile; then
+	echo "$0: no switchrate decision logged"
+	cat $tmpfile
+	rm -f $tmpfile
+	exit 1
+fi
+
+rm -f $tmpfile
+exit 0
@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# @@timeout: 12
+
+#
+# With -xtemporal, a clause that only calls trace() records data, and its
+# records come out in timestamp order like those of printf().
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.temporal-trace.$$
+
+$dtrace $dt_flags -x temporal -o $tmpfile -s /dev/stdin <<EOF
+profile-997
+{
+	trace(timestamp);
+}
+
+tick-1sec
+/i++ == 2/
+{
+	exit(0);
+}
+EOF
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	rm -f $tmpfile
+	exit $status
+fi
+
+awk '$3 ~ /:profile-997$/ { print $4 }' $tmpfile > $tmpfile.ts
+
+if [ ! -s $tmpfile.ts ]; then
+	echo "$0: no trace() records"
+	rm -f $tmpfile $tmpfile.ts
+	exit 1
+fi
+
+sort -n -c $tmpfile.ts
+status=$?
+
+rm -f $tmpfile $tmpfile.ts
+exit $status
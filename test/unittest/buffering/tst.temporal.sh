@@ -0,0 +1,78 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# @@timeout: 12
+
+#
+# With -xtemporal, records from all CPUs come out in timestamp order, with
+# BEGIN first and END last.  Clauses that only aggregate do not disturb this,
+# and records are held back until they can be ordered, so none comes late.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.temporal.$$
+
+$dtrace $dt_flags -x temporal -q -o $tmpfile -s /dev/stdin 2> $tmpfile.err <<EOF
+BEGIN
+{
+	printf("begin\n");
+}
+
+profile-997
+{
+	printf("%d\n", timestamp);
+}
+
+profile-997
+{
+	@n = count();
+}
+
+tick-1sec
+/i++ == 2/
+{
+	exit(0);
+}
+
+END
+{
+	printa("end %@d\n", @n);
+}
+EOF
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	cat $tmpfile.err
+	rm -f $tmpfile $tmpfile.err
+	exit $status
+fi
+
+if grep -q 'out of temporal order' $tmpfile.err; then
+	echo "$0: records delivered out of order"
+	cat $tmpfile.err
+	rm -f $tmpfile $tmpfile.err
+	exit 1
+fi
+
+if [ "$(grep -v '^$' $tmpfile | head -1)" != "begin" ] ||
+   ! grep -v '^$' $tmpfile | tail -1 | grep -q '^end [0-9]'; then
+	echo "$0: BEGIN or END record out of place"
+	rm -f $tmpfile $tmpfile.err
+	exit 1
+fi
+
+grep '^[0-9]' $tmpfile | sort -n -c
+status=$?
+
+rm -f $tmpfile $tmpfile.err
+exit $status
@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# @@timeout: 12
+
+#
+# With -xwakeup, the consumer is woken when a principal buffer is predicted
+# to be nearing full, so a buffer far too small to last a whole switchrate
+# is still drained without drops.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+tmpfile=$tmpdir/tst.wakeup.$$
+
+$dtrace $dt_flags -q -x wakeup -x switchrate=30sec -x bufsize=16k \
+    -o $tmpfile -n '
+tick-1ms
+/i < 2000/
+{
+	printf("%d\n", i++);
+}
+
+tick-1ms
+/i == 2000/
+{
+	exit(0);
+}' 2> $tmpfile.err
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo "$0: dtrace failed with status $status"
+	cat $tmpfile.err
+	rm -f $tmpfile $tmpfile.err
+	exit $status
+fi
+
+if grep -q 'drop' $tmpfile.err; then
+	echo "$0: buffer drops despite wakeup"
+	cat $tmpfile.err
+	rm -f $tmpfile $tmpfile.err
+	exit 1
+fi
+
+n=$(grep -c '^[0-9]' $tmpfile)
+rm -f $tmpfile $tmpfile.err
+
+if [ "$n" != 2000 ]; then
+	echo "$0: expected 2000 records, got $n"
+	exit 1
+fi
+
+exit 0
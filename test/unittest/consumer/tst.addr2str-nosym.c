@@ -0,0 +1,95 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Verify that dtrace_addr2str() of a kernel address that lies in a module but
+ * not in any symbol (such as the padding after a function) yields the whole
+ * "module`0xaddr" string, however long the module name.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <dtrace.h>
+
+static GElf_Addr nosym;
+
+/*
+ * Walk the text of each kernel module from symbol to symbol, looking for the
+ * first address past the end of a symbol that no other symbol covers.
+ */
+static int
+find_nosym(dtrace_hdl_t *dtp, const dtrace_objinfo_t *dto, void *arg)
+{
+	size_t i;
+
+	if (!(dto->dto_flags & DTRACE_OBJ_F_KERNEL))
+		return (0);
+
+	for (i = 0; i < dto->dto_text_addrs_size; i++) {
+		GElf_Addr addr = dto->dto_text_addrs[i].dar_va;
+		GElf_Addr end = addr + dto->dto_text_addrs[i].dar_size;
+		GElf_Sym sym;
+		int n;
+
+		for (n = 0; addr < end && n < 10000; n++) {
+			if (dtrace_lookup_by_addr(dtp, addr, &sym, NULL) != 0) {
+				nosym = addr;
+				return (1);
+			}
+
+			if (sym.st_value + sym.st_size <= addr)
+				break;
+
+			addr = sym.st_value + sym.st_size;
+		}
+	}
+
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	dtrace_syminfo_t dts;
+	char s[256], exp[256];
+	dtrace_hdl_t *dtp;
+	int err;
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open %d |%s|\n",
+		    err, dtrace_errmsg(NULL, err));
+		return (1);
+	}
+
+	if (dtrace_object_iter(dtp, find_nosym, NULL) == 0) {
+		printf("ERROR: no kernel text address without a symbol\n");
+		dtrace_close(dtp);
+		return (1);
+	}
+
+	if (dtrace_lookup_by_addr(dtp, nosym, NULL, &dts) != 0) {
+		printf("ERROR: no module for 0x%llx\n",
+		    (unsigned long long)nosym);
+		dtrace_close(dtp);
+		return (1);
+	}
+
+	snprintf(exp, sizeof (exp), "%s`0x%llx", dts.dts_object,
+	    (unsigned long long)nosym);
+
+	dtrace_addr2str(dtp, nosym, s, sizeof (s));
+	printf("|%s|\n", s);
+
+	dtrace_close(dtp);
+
+	if (strcmp(s, exp) != 0) {
+		printf("ERROR: expected |%s|\n", exp);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+# ASSERTION:
+#
+# With -xcse, subexpressions shared by clauses for the same probe are
+# computed once, which -S reports, and the program prints the same as
+# without it, including in a clause that only uses them under &&.
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+cat > $tmpdir/cse.d <<'EOT'
+BEGIN
+{
+	printf("%d %s\n", strlen(strjoin(execname, "-cse")) + pid,
+	    strjoin(execname, "-cse"));
+}
+
+BEGIN
+/strlen(strjoin(execname, "-cse")) + pid > 0/
+{
+	printf("%s\n", substr(strjoin(execname, "-cse"), 1));
+}
+
+BEGIN
+/strlen(strjoin(execname, "-cse")) + pid < 0/
+{
+	printf("not reached\n");
+}
+
+BEGIN
+{
+	printf("%d\n", pid > 0 && strlen(strjoin(execname, "-cse")) > 0);
+}
+
+BEGIN
+{
+	@[strjoin(execname, "-cse")] = count();
+	exit(0);
+}
+EOT
+
+expected="$($dtrace $dt_flags -qs $tmpdir/cse.d 2>&1)"
+out="$($dtrace $dt_flags -xcse -qs $tmpdir/cse.d 2>&1)"
+
+if [ "$out" != "$expected" ]; then
+	echo "got '$out', expected '$expected'"
+	exit 1
+fi
+
+if ! $dtrace $dt_flags -xcse -Se -s $tmpdir/cse.d 2>&1 |
+    grep -q 'common subexpressions hoisted'; then
+	echo "no subexpressions hoisted"
+	exit 1
+fi
+
+exit 0
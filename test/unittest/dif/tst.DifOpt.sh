@@ -0,0 +1,86 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+# ASSERTION:
+#
+# The DIF optimizer never makes a program longer, makes the corpus below
+# shorter overall, and does not change what any of it does: each program
+# prints the same with and without -xnodifopt.
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+# Count the DIF instructions disassembled by -S.
+count()
+{
+	$dtrace $dt_flags "$@" -Se -s $tmpdir/difopt.d 2>&1 |
+	    grep -cE '^[0-9]+ [0-9]+: [0-9a-f]{8} '
+}
+
+corpus=(
+'BEGIN { x = 1; y = 1; z = 1; printf("%d %d %d\n", x, y, z); }'
+'BEGIN { x = 0; y = x + 0; printf("%d %d\n", x, y); }'
+'BEGIN { x = 7; printf("%d %d %d\n", x * x, x + x, x - x); }'
+'BEGIN { self->a = 3; printf("%d\n", self->a + self->a * self->a); }'
+'BEGIN { this->s = "abc"; printf("%s %s\n", this->s, this->s); }'
+'BEGIN { x = 5; y = 6; printf("%d\n", x < y && y < 10 && x != y); }'
+'BEGIN { x = 5; printf("%d %d\n", x > 3 || x < 0, !(x == 5)); }'
+'BEGIN { x = 2; printf("%d\n", x == 2 ? (x > 1 ? 10 : 20) : 30); }'
+'BEGIN { x = 9; x = x + 1; x = x + 1; printf("%d\n", x); }'
+'BEGIN { a = 1; b = a; c = b; printf("%d %d %d\n", a, b, c); }'
+'BEGIN { x = 4; y = x ^^ 0; printf("%d %d\n", y, x ^^ x); }'
+'BEGIN { n = 3; printf("%d\n", n > 0 ? n > 1 ? n > 2 ? 3 : 2 : 1 : 0); }'
+'BEGIN { s = "x"; t = "x"; printf("%d %d\n", s == t, s == s); }'
+'BEGIN { x = 10; self->y = x; self->y = self->y + x; printf("%d\n", self->y); }'
+'BEGIN { x = 1; printf("%d\n", (x & 1) + (x | 2) + (x << 3) + (x >> 1)); }'
+)
+
+before=0
+after=0
+
+for prog in "${corpus[@]}"; do
+	echo "$prog" > $tmpdir/difopt.d
+
+	noopt="$(count -xnodifopt)"
+	opt="$(count)"
+
+	if [ -z "$noopt" ] || [ "$noopt" -eq 0 ]; then
+		echo "cannot disassemble: $prog"
+		exit 1
+	fi
+
+	if [ "$opt" -gt "$noopt" ]; then
+		echo "$noopt instructions became $opt: $prog"
+		exit 1
+	fi
+
+	before=$((before + noopt))
+	after=$((after + opt))
+
+	expected="$($dtrace $dt_flags -xnodifopt -qs $tmpdir/difopt.d \
+	    -n 'BEGIN { exit(0); }' 2>&1)"
+	out="$($dtrace $dt_flags -qs $tmpdir/difopt.d \
+	    -n 'BEGIN { exit(0); }' 2>&1)"
+
+	if [ "$out" != "$expected" ]; then
+		echo "got '$out', expected '$expected': $prog"
+		exit 1
+	fi
+done
+
+echo "$before DIF instructions optimized to $after"
+
+if [ $after -ge $before ]; then
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,4 @@
+41
+59
+abcdefghi
+
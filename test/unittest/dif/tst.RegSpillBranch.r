@@ -0,0 +1,5 @@
+50
+39
+136
+236
+
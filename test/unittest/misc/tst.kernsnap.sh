@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+#
+# Kernel symbols resolve the same way whether the kernel's modules and
+# symbols are parsed (first run, which saves a snapshot) or restored from the
+# snapshot (second run).  The debug output of each run must show that the
+# snapshot was indeed saved, and then loaded.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+snap=$tmpdir/kernsnap.$$
+err=$tmpdir/err.$$
+
+rm -rf $snap $err
+
+for run in 1 2; do
+	DTRACE_OPT_KERNSNAP=$snap $dtrace $dt_flags -x debug \
+	    -o $tmpdir/out.$run -qn 'BEGIN
+	{
+		printf("%a %a\n", (uintptr_t)&`jiffies,
+		    (uintptr_t)&`vfs_read + 1);
+		exit(0);
+	}' 2>$err
+
+	status=$?
+	if [ "$status" -ne 0 ]; then
+		echo $tst: dtrace failed in run $run
+		grep -v 'DEBUG' $err
+		rm -rf $snap $err
+		exit $status
+	fi
+
+	if [ $run -eq 1 ]; then
+		msg='saved kernel snapshot'
+	else
+		msg='loaded kernel snapshot'
+	fi
+
+	if ! grep -q "$msg" $err; then
+		echo "$tst: no '$msg' in run $run"
+		rm -rf $snap $err
+		exit 1
+	fi
+done
+
+if ! cmp -s $tmpdir/out.1 $tmpdir/out.2; then
+	echo $tst: symbols resolve differently from the snapshot
+	diff $tmpdir/out.1 $tmpdir/out.2
+	status=1
+fi
+
+rm -rf $snap $err $tmpdir/out.1 $tmpdir/out.2
+
+exit $status
@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+#
+# A script run with -xprogcache is saved on the first run and loaded from the
+# cache on the second, and prints the same both times as without the cache,
+# including its aggregations and the options it sets with #pragma.  @a is
+# updated by two clauses and must stay one aggregation, and printa() must find
+# @a and @b by the aggregation IDs compiled into it.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+cache=$tmpdir/progcache.$$
+
+cat > $tmpdir/progcache.d <<EOF
+#pragma D option quiet
+#pragma D option aggsortkey
+
+BEGIN
+{
+	printf("%s %d\n", \$\$1, \$2);
+	@a["x"] = count();
+	@a["y"] = count();
+	@q = lquantize(\$2, 0, 10, 2);
+	@s = sum(\$2 * 3);
+}
+
+BEGIN
+{
+	@a["z"] = count();
+	@b = sum(5);
+	exit(0);
+}
+
+END
+{
+	printa("b %@d\n", @b);
+	printa("a %s %@d\n", @a);
+}
+EOF
+
+script()
+{
+	$dtrace $dt_flags "$@" -s $tmpdir/progcache.d hello 7
+}
+
+expected="$(script)" || exit 1
+
+for run in save load; do
+	out="$(script -xprogcache=$cache -xdebug 2>$tmpdir/progcache.err)"
+	status=$?
+	if [ "$status" -ne 0 ]; then
+		echo "$run run failed"
+		cat $tmpdir/progcache.err
+		exit $status
+	fi
+	if [ "$out" != "$expected" ]; then
+		echo "$run run: got '$out', expected '$expected'"
+		exit 1
+	fi
+done
+
+if ! grep -q 'loaded cached program' $tmpdir/progcache.err; then
+	echo "program not loaded from the cache"
+	exit 1
+fi
+
+if [ $(ls $cache | grep -c '^prog-') -ne 1 ]; then
+	echo "expected one cached program in $cache"
+	exit 1
+fi
+
+rm -rf $cache
+exit 0
@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+#
+# With -xlibimage, the D libraries are saved as an image on the first run and
+# compiled from it on the second, and their inlines and translators work the
+# same both times as without the image.  The integer constants of unistd.d are
+# defined from the image without compiling unistd.d.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+image=$tmpdir/libimage.$$
+
+script()
+{
+	$dtrace $dt_flags "$@" -qn '
+	BEGIN
+	{
+		printf("%d %d %d %d\n", curpsinfo->pr_pid == pid,
+		    xlate <psinfo_t *>(curthread)->pr_ppid == ppid,
+		    PR_MODEL_LP64, DTRACEFLT_BADSTACK);
+		exit(0);
+	}'
+}
+
+expected="$(script)" || exit 1
+
+for run in save load; do
+	out="$(script -xlibimage=$image -xdebug 2>$tmpdir/libimage.err)"
+	status=$?
+	if [ "$status" -ne 0 ]; then
+		echo "$run run failed"
+		cat $tmpdir/libimage.err
+		exit $status
+	fi
+	if [ "$out" != "$expected" ]; then
+		echo "$run run: got '$out', expected '$expected'"
+		exit 1
+	fi
+done
+
+if ! grep -q 'loaded library image' $tmpdir/libimage.err; then
+	echo "libraries not compiled from the image"
+	exit 1
+fi
+
+if ! grep -q 'inlines of library .*/unistd.d' $tmpdir/libimage.err; then
+	echo "inlines of unistd.d not defined from the image"
+	exit 1
+fi
+
+rm -rf $image
+exit 0
@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+#
+# Types still resolve correctly when the CTF of modules searched in vain is
+# released straight away, and then searched again.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+script()
+{
+	$dtrace $dt_flags -x ctfcache=$1 -qs /dev/stdin <<EOF
+	struct ctfcache_nosuch_1 *p;
+	struct ctfcache_nosuch_2 *q;
+
+	BEGIN
+	{
+		printf("%d %d %d\n", sizeof (struct task_struct),
+		    offsetof(struct file, f_pos), sizeof (p) + sizeof (q));
+		exit(0);
+	}
+EOF
+}
+
+expected="$(script 32)" || exit 1
+
+for n in 0 1; do
+	out="$(script $n)"
+	status=$?
+	if [ "$status" -ne 0 ]; then
+		echo "dtrace -xctfcache=$n failed"
+		exit $status
+	fi
+	if [ "$out" != "$expected" ]; then
+		echo "-xctfcache=$n: got '$out', expected '$expected'"
+		exit 1
+	fi
+done
+
+exit 0
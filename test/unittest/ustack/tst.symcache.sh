@@ -0,0 +1,81 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# @@tags: unstable
+
+#
+# Stacks printed with a symbolization cache far too small for the working set
+# (so that entries are constantly evicted and re-resolved) still resolve every
+# frame.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+file=$tmpdir/out.$$
+dtrace=$1
+
+rm -f $file
+
+$dtrace $dt_flags -x symcache=2 -o $file -c test/triggers/ustack-tst-spin \
+    -s /dev/stdin <<EOF
+
+	#pragma D option quiet
+	#pragma D option destructive
+	#pragma D option evaltime=main
+
+	profile-1999
+	/pid == \$target && n++ > 100 && n <= 600/
+	{
+		printf("START");
+		ustack(4);
+	}
+
+	profile-1999
+	/pid == \$target && n > 600/
+	{
+		raise(SIGINT);
+		exit(0);
+	}
+
+	tick-1s
+	/++secs > 10/
+	{
+		trace("test timed out");
+		exit(1);
+	}
+EOF
+
+status=$?
+if [ "$status" -ne 0 ]; then
+	echo $tst: dtrace failed
+	rm -f $file
+	exit $status
+fi
+
+perl /dev/stdin $file <<EOF
+	while (<>) {
+		chomp;
+		next unless /^START/;
+		\$count++;
+
+		foreach \$fn ("baz", "bar", "foo", "main") {
+			\$_ = <>;
+			chomp;
+			die "expected \$fn at \$.: \$_\n" unless /\`\$fn\+?/;
+		}
+	}
+
+	die "too few samples (\$count)\n" unless \$count >= 500;
+EOF
+
+status=$?
+rm -f $file
+
+exit $status
@@ -0,0 +1,105 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+# @@tags: unstable
+
+#
+# Stacks resolve the same way whether the symbol table indexes are computed
+# (first run, which populates the on-disk cache) or read back from the cache
+# (second run).  The debug output of the second run must show that indexes
+# were indeed read back from the cache.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+file=$tmpdir/out.$$
+err=$tmpdir/err.$$
+cache=$tmpdir/symtabcache.$$
+dtrace=$1
+
+rm -rf $file $err $cache
+
+for run in 1 2; do
+	$dtrace $dt_flags -x symtabcache=$cache -x debug -o $file 2>$err \
+	    -c test/triggers/ustack-tst-spin -s /dev/stdin <<EOF
+
+	#pragma D option quiet
+	#pragma D option destructive
+	#pragma D option evaltime=main
+
+	profile-1999
+	/pid == \$target && n++ > 100 && n <= 200/
+	{
+		printf("START");
+		ustack(4);
+	}
+
+	profile-1999
+	/pid == \$target && n > 200/
+	{
+		raise(SIGINT);
+		exit(0);
+	}
+
+	tick-1s
+	/++secs > 10/
+	{
+		trace("test timed out");
+		exit(1);
+	}
+EOF
+
+	status=$?
+	if [ "$status" -ne 0 ]; then
+		echo $tst: dtrace failed in run $run
+		grep -v 'DEBUG' $err
+		rm -rf $file $err $cache
+		exit $status
+	fi
+
+	if [ -z "$(ls $cache 2>/dev/null)" ]; then
+		echo $tst: no cache files written in run $run
+		rm -rf $file $err $cache
+		exit 1
+	fi
+
+	if [ $run -eq 2 ] && ! grep -q 'indexes from cache' $err; then
+		echo $tst: symbol table indexes not read from the cache
+		rm -rf $file $err $cache
+		exit 1
+	fi
+
+	perl /dev/stdin $file <<EOF
+	while (<>) {
+		chomp;
+		next unless /^START/;
+		\$count++;
+
+		foreach \$fn ("baz", "bar", "foo", "main") {
+			\$_ = <>;
+			chomp;
+			die "expected \$fn at \$.: \$_\n" unless /\`\$fn\+?/;
+		}
+	}
+
+	die "too few samples (\$count)\n" unless \$count >= 90;
+EOF
+
+	status=$?
+	rm -f $file $err
+	if [ "$status" -ne 0 ]; then
+		rm -rf $cache
+		exit $status
+	fi
+done
+
+rm -rf $cache
+
+exit 0
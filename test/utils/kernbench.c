@@ -0,0 +1,557 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2019, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Benchmark and check the kernel module and symbol tables.
+ *
+ *   kernbench addr [n]
+ *	Resolve n random kernel text addresses with dtrace_lookup_by_addr(),
+ *	and check the first few thousand results against a linear search of
+ *	every module's address ranges.
+ *
+ *   kernbench update [n [snapdir]]
+ *	Rebuild the tables n times with dtrace_update(), from the kernel
+ *	snapshot in snapdir if one is given, and report the heap in use.
+ *	Then check that a sample of addresses resolves as it does in a handle
+ *	opened without a snapshot.
+ *
+ *   kernbench name [n]
+ *	Look up n typed kernel data symbols from /proc/kallsyms across all
+ *	modules with dtrace_lookup_by_name(), and compile a program that
+ *	references all of them.  Check each result against a lookup in each
+ *	module in turn.
+ *
+ * Random addresses are drawn from a fixed seed, so runs on the same kernel
+ * use the same addresses.  The exit status is nonzero if any check fails.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <dtrace.h>
+
+typedef struct kb_range {
+	GElf_Addr kbr_va;		/* start address */
+	GElf_Addr kbr_end;		/* end address */
+	int kbr_kernel;			/* boolean: text of a kernel module */
+	char *kbr_name;			/* module name */
+} kb_range_t;
+
+typedef struct kb_ranges {
+	kb_range_t *kbr_ranges;		/* in module order, text first */
+	size_t kbr_n;
+	size_t kbr_size;
+	size_t kbr_ntext;		/* number of kernel text ranges */
+} kb_ranges_t;
+
+#define	KB_SAMPLE	1000		/* addresses in a sample */
+#define	KB_SYMLEN	512		/* longest resolution checked */
+
+static int nerrors;
+
+void
+fatal(char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+
+	fprintf(stderr, "%s: ", "kernbench");
+	vfprintf(stderr, fmt, ap);
+
+	if (fmt[strlen(fmt) - 1] != '\n')
+		fprintf(stderr, ": %s\n", strerror(errno));
+
+	exit(1);
+}
+
+static void
+error(char *fmt, ...)
+{
+	va_list ap;
+
+	if (nerrors++ >= 10)
+		return;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "%s: ", "kernbench");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static long long
+elapsed(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1000000000LL +
+	    (end.tv_nsec - start->tv_nsec);
+}
+
+static size_t
+heap_in_use(void)
+{
+#if __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+
+	return (mi.uordblks + mi.hblkhd);
+}
+
+static dtrace_hdl_t *
+kb_open(void)
+{
+	dtrace_hdl_t *dtp;
+	int err;
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL)
+		fatal("cannot open dtrace library: %s\n",
+		    dtrace_errmsg(NULL, err));
+
+	return (dtp);
+}
+
+static void
+kb_add(kb_ranges_t *kbr, const dtrace_addr_range_t *r, size_t n,
+    const dtrace_objinfo_t *dto, int text)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		kb_range_t *k;
+
+		if (r[i].dar_size == 0)
+			continue;
+
+		if (kbr->kbr_n == kbr->kbr_size) {
+			kbr->kbr_size = kbr->kbr_size ? kbr->kbr_size * 2 : 64;
+			kbr->kbr_ranges = realloc(kbr->kbr_ranges,
+			    kbr->kbr_size * sizeof (kb_range_t));
+			if (kbr->kbr_ranges == NULL)
+				fatal("cannot allocate ranges");
+		}
+
+		k = &kbr->kbr_ranges[kbr->kbr_n++];
+		k->kbr_va = r[i].dar_va;
+		k->kbr_end = r[i].dar_va + r[i].dar_size;
+		k->kbr_kernel = text && (dto->dto_flags & DTRACE_OBJ_F_KERNEL);
+		if ((k->kbr_name = strdup(dto->dto_name)) == NULL)
+			fatal("cannot allocate ranges");
+
+		kbr->kbr_ntext += k->kbr_kernel;
+	}
+}
+
+static int
+kb_collect(dtrace_hdl_t *dtp, const dtrace_objinfo_t *dto, void *arg)
+{
+	kb_add(arg, dto->dto_text_addrs, dto->dto_text_addrs_size, dto, 1);
+	kb_add(arg, dto->dto_data_addrs, dto->dto_data_addrs_size, dto, 0);
+
+	return (0);
+}
+
+static void
+kb_ranges(dtrace_hdl_t *dtp, kb_ranges_t *kbr)
+{
+	memset(kbr, 0, sizeof (kb_ranges_t));
+
+	if (dtrace_object_iter(dtp, kb_collect, kbr) != 0)
+		fatal("cannot iterate over modules: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+
+	if (kbr->kbr_ntext == 0)
+		fatal("no kernel text ranges found\n");
+}
+
+static void
+kb_ranges_free(kb_ranges_t *kbr)
+{
+	size_t i;
+
+	for (i = 0; i < kbr->kbr_n; i++)
+		free(kbr->kbr_ranges[i].kbr_name);
+	free(kbr->kbr_ranges);
+}
+
+/*
+ * Draw n random addresses from the kernel text ranges.
+ */
+static GElf_Addr *
+kb_addrs(const kb_ranges_t *kbr, unsigned long n)
+{
+	const kb_range_t **text;
+	GElf_Addr *addrs;
+	unsigned long i, j;
+
+	addrs = malloc(n * sizeof (GElf_Addr));
+	text = malloc(kbr->kbr_ntext * sizeof (kb_range_t *));
+	if (addrs == NULL || text == NULL)
+		fatal("cannot allocate addresses");
+
+	for (i = 0, j = 0; i < kbr->kbr_n; i++) {
+		if (kbr->kbr_ranges[i].kbr_kernel)
+			text[j++] = &kbr->kbr_ranges[i];
+	}
+
+	srandom(1);
+	for (i = 0; i < n; i++) {
+		const kb_range_t *r = text[random() % kbr->kbr_ntext];
+
+		addrs[i] = r->kbr_va + random() % (r->kbr_end - r->kbr_va);
+	}
+
+	free(text);
+	return (addrs);
+}
+
+/*
+ * The module that owns an address is the first, in module order, with a text
+ * range or else a data range covering it.
+ */
+static const char *
+kb_owner(const kb_ranges_t *kbr, GElf_Addr addr)
+{
+	size_t i;
+
+	for (i = 0; i < kbr->kbr_n; i++) {
+		const kb_range_t *r = &kbr->kbr_ranges[i];
+
+		if (addr >= r->kbr_va && addr < r->kbr_end)
+			return (r->kbr_name);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Format the resolution of an address as "module`symbol+offset", "module" if
+ * no symbol covers it, or "" if no module does.
+ */
+static void
+kb_resolve(dtrace_hdl_t *dtp, GElf_Addr addr, char *buf, size_t len)
+{
+	dtrace_syminfo_t dts;
+	GElf_Sym sym;
+
+	if (dtrace_lookup_by_addr(dtp, addr, &sym, &dts) == 0)
+		snprintf(buf, len, "%s`%s+0x%llx", dts.dts_object,
+		    dts.dts_name, (unsigned long long)(addr - sym.st_value));
+	else if (dtrace_lookup_by_addr(dtp, addr, NULL, &dts) == 0)
+		snprintf(buf, len, "%s", dts.dts_object);
+	else
+		buf[0] = '\0';
+}
+
+static void
+bench_addr(unsigned long n)
+{
+	unsigned long i, hits = 0;
+	struct timespec start;
+	dtrace_syminfo_t dts;
+	kb_ranges_t kbr;
+	GElf_Addr *addrs;
+	dtrace_hdl_t *dtp;
+	GElf_Sym sym;
+	long long ns;
+
+	dtp = kb_open();
+	kb_ranges(dtp, &kbr);
+	addrs = kb_addrs(&kbr, n);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n; i++) {
+		if (dtrace_lookup_by_addr(dtp, addrs[i], &sym, NULL) == 0)
+			hits++;
+	}
+
+	ns = elapsed(&start);
+	printf("%lu lookups in %zu ranges, %lu resolved, %lld ns/lookup\n",
+	    n, kbr.kbr_n, hits, n ? ns / (long long)n : 0);
+
+	if (n > 0 && hits == 0)
+		error("no address resolved\n");
+
+	/*
+	 * The reference search is linear, so only check a sample.
+	 */
+	for (i = 0; i < n && i < 10 * KB_SAMPLE; i++) {
+		const char *owner = kb_owner(&kbr, addrs[i]);
+		GElf_Addr addr = addrs[i];
+
+		if (dtrace_lookup_by_addr(dtp, addr, &sym, &dts) == 0) {
+			if (owner == NULL || strcmp(dts.dts_object, owner) != 0)
+				error("0x%llx: %s`%s, expected module %s\n",
+				    (unsigned long long)addr, dts.dts_object,
+				    dts.dts_name, owner ? owner : "none");
+			else if (addr < sym.st_value || (sym.st_size != 0 &&
+			    addr >= sym.st_value + sym.st_size))
+				error("0x%llx: %s`%s does not cover it\n",
+				    (unsigned long long)addr, dts.dts_object,
+				    dts.dts_name);
+		} else if (dtrace_lookup_by_addr(dtp, addr, NULL, &dts) == 0) {
+			if (owner == NULL || strcmp(dts.dts_object, owner) != 0)
+				error("0x%llx: module %s, expected %s\n",
+				    (unsigned long long)addr, dts.dts_object,
+				    owner ? owner : "none");
+		} else if (owner != NULL) {
+			error("0x%llx: no module, expected %s\n",
+			    (unsigned long long)addr, owner);
+		}
+	}
+
+	free(addrs);
+	kb_ranges_free(&kbr);
+	dtrace_close(dtp);
+}
+
+static void
+bench_update(unsigned long n, const char *snapdir)
+{
+	unsigned long i;
+	struct timespec start;
+	kb_ranges_t kbr;
+	GElf_Addr *addrs;
+	dtrace_hdl_t *dtp;
+	char (*ref)[KB_SYMLEN];
+	char buf[KB_SYMLEN];
+	long long ns;
+
+	/*
+	 * Resolve the sample in a handle that parsed the tables itself.
+	 */
+	unsetenv("DTRACE_OPT_KERNSNAP");
+	dtp = kb_open();
+	kb_ranges(dtp, &kbr);
+	addrs = kb_addrs(&kbr, KB_SAMPLE);
+
+	if ((ref = malloc(KB_SAMPLE * KB_SYMLEN)) == NULL)
+		fatal("cannot allocate sample");
+
+	for (i = 0; i < KB_SAMPLE; i++)
+		kb_resolve(dtp, addrs[i], ref[i], KB_SYMLEN);
+
+	kb_ranges_free(&kbr);
+	dtrace_close(dtp);
+
+	/*
+	 * The first handle saves the snapshot, the second loads it.
+	 */
+	if (snapdir != NULL) {
+		setenv("DTRACE_OPT_KERNSNAP", snapdir, 1);
+		dtrace_close(kb_open());
+	}
+
+	dtp = kb_open();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n; i++) {
+		if (dtrace_update(dtp) != 0)
+			fatal("cannot update modules: %s\n",
+			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+	}
+
+	ns = elapsed(&start);
+	printf("%lu updates%s, %lld us/update, %zu KiB heap in use\n",
+	    n, snapdir ? " from a snapshot" : "",
+	    n ? ns / (long long)n / 1000 : 0, heap_in_use() / 1024);
+
+	for (i = 0; i < KB_SAMPLE; i++) {
+		kb_resolve(dtp, addrs[i], buf, sizeof (buf));
+
+		if (strcmp(buf, ref[i]) != 0)
+			error("0x%llx: %s, expected %s\n",
+			    (unsigned long long)addrs[i], buf, ref[i]);
+	}
+
+	free(ref);
+	free(addrs);
+	dtrace_close(dtp);
+}
+
+/*
+ * Only data symbols with a type can be referenced from D.
+ */
+static int
+usable(dtrace_hdl_t *dtp, const char *name)
+{
+	dtrace_syminfo_t dts;
+	dtrace_typeinfo_t dtt;
+	GElf_Sym sym;
+
+	return (dtrace_lookup_by_name(dtp, DTRACE_OBJ_KMODS, name, &sym,
+	    &dts) == 0 && dtrace_symbol_type(dtp, &sym, &dts, &dtt) == 0);
+}
+
+typedef struct kb_byname {
+	const char *kbn_name;		/* symbol to look up */
+	GElf_Sym kbn_sym;		/* first match */
+	char kbn_object[KB_SYMLEN];	/* module of the first match */
+	int kbn_found;			/* boolean: a module has it */
+} kb_byname_t;
+
+static int
+kb_byname(dtrace_hdl_t *dtp, const dtrace_objinfo_t *dto, void *arg)
+{
+	kb_byname_t *kbn = arg;
+
+	if (!(dto->dto_flags & DTRACE_OBJ_F_KERNEL) ||
+	    dtrace_lookup_by_name(dtp, dto->dto_name, kbn->kbn_name,
+	    &kbn->kbn_sym, NULL) != 0)
+		return (0);
+
+	snprintf(kbn->kbn_object, sizeof (kbn->kbn_object), "%s",
+	    dto->dto_name);
+	kbn->kbn_found = 1;
+
+	return (1);
+}
+
+static void
+bench_name(unsigned long n)
+{
+	unsigned long i, rounds = 100, nnames = 0;
+	char **names;
+	char *line = NULL, *prog, *p;
+	size_t line_n = 0, len;
+	struct timespec start;
+	dtrace_syminfo_t dts;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *pgp;
+	kb_byname_t kbn;
+	GElf_Sym sym;
+	long long ns;
+	FILE *fp;
+
+	dtp = kb_open();
+
+	if ((names = calloc(n, sizeof (char *))) == NULL)
+		fatal("cannot allocate names");
+
+	if ((fp = fopen("/proc/kallsyms", "r")) == NULL)
+		fatal("cannot open /proc/kallsyms");
+
+	while (nnames < n && getline(&line, &line_n, fp) > 0) {
+		char type, name[256];
+
+		if (sscanf(line, "%*s %c %255s", &type, name) != 2 ||
+		    strchr("DdBb", type) == NULL || strchr(name, '.') != NULL ||
+		    !usable(dtp, name))
+			continue;
+
+		if ((names[nnames++] = strdup(name)) == NULL)
+			fatal("cannot allocate names");
+	}
+	free(line);
+	fclose(fp);
+
+	if (nnames == 0)
+		fatal("no typed kernel data symbols found\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nnames * rounds; i++) {
+		if (dtrace_lookup_by_name(dtp, DTRACE_OBJ_KMODS,
+		    names[i % nnames], NULL, NULL) != 0)
+			fatal("cannot look up %s\n", names[i % nnames]);
+	}
+
+	ns = elapsed(&start);
+	printf("%lu lookups of %lu symbols, %lld ns/lookup\n",
+	    nnames * rounds, nnames, ns / (long long)(nnames * rounds));
+
+	for (i = 0; i < nnames; i++) {
+		memset(&kbn, 0, sizeof (kbn));
+		kbn.kbn_name = names[i];
+		(void) dtrace_object_iter(dtp, kb_byname, &kbn);
+
+		if (dtrace_lookup_by_name(dtp, DTRACE_OBJ_KMODS, names[i],
+		    &sym, &dts) != 0)
+			error("%s: not found\n", names[i]);
+		else if (!kbn.kbn_found)
+			error("%s: found in %s, but in no module\n", names[i],
+			    dts.dts_object);
+		else if (strcmp(dts.dts_object, kbn.kbn_object) != 0 ||
+		    sym.st_value != kbn.kbn_sym.st_value)
+			error("%s: found in %s at 0x%llx, expected %s "
+			    "at 0x%llx\n", names[i], dts.dts_object,
+			    (unsigned long long)sym.st_value, kbn.kbn_object,
+			    (unsigned long long)kbn.kbn_sym.st_value);
+	}
+
+	/*
+	 * One statement per symbol: x = (uint64_t)&`name;
+	 */
+	for (i = 0, len = 32; i < nnames; i++)
+		len += strlen(names[i]) + 24;
+
+	if ((prog = malloc(len)) == NULL)
+		fatal("cannot allocate program");
+
+	p = prog + sprintf(prog, "BEGIN\n{\n");
+	for (i = 0; i < nnames; i++)
+		p += sprintf(p, "\tx = (uint64_t)&`%s;\n", names[i]);
+	sprintf(p, "}\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if ((pgp = dtrace_program_strcompile(dtp, prog,
+	    DTRACE_PROBESPEC_NAME, 0, 0, NULL)) == NULL)
+		fatal("cannot compile program: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+
+	ns = elapsed(&start);
+	printf("compiled %lu symbol references in %lld us\n", nnames,
+	    ns / 1000);
+
+	for (i = 0; i < nnames; i++)
+		free(names[i]);
+	free(names);
+	free(prog);
+	dtrace_close(dtp);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long n = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: kernbench addr [n]\n"
+		    "       kernbench update [n [snapdir]]\n"
+		    "       kernbench name [n]\n");
+		return (2);
+	}
+
+	if (argc > 2)
+		n = strtoul(argv[2], NULL, 0);
+
+	if (strcmp(argv[1], "addr") == 0)
+		bench_addr(argc > 2 ? n : 1000000);
+	else if (strcmp(argv[1], "update") == 0)
+		bench_update(argc > 2 ? n : 10, argc > 3 ? argv[3] : NULL);
+	else if (strcmp(argv[1], "name") == 0)
+		bench_name(argc > 2 ? n : 2000);
+	else
+		fatal("unknown benchmark %s\n", argv[1]);
+
+	if (nerrors > 0)
+		fprintf(stderr, "%s: %d errors\n", "kernbench", nerrors);
+
+	return (nerrors != 0);
+}